@@ -0,0 +1,78 @@
+#include "Benchmark.h"
+#include "Profiler.h"
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+static void WriteJSONString(std::ostream& out, const char* s) {
+    out << '"';
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') out << '\\';
+        if (static_cast<unsigned char>(*s) >= 0x20) out << *s;
+    }
+    out << '"';
+}
+
+static void WritePercentiles(std::ostream& out, const FramePercentiles& pct) {
+    char buf[192];
+    snprintf(buf, sizeof(buf), "\"count\":%llu,\"p50_ms\":%.4f,\"p95_ms\":%.4f,\"p99_ms\":%.4f,\"max_ms\":%.4f",
+        pct.count, pct.p50, pct.p95, pct.p99, pct.max);
+    out << buf;
+}
+
+bool WriteBenchmarkJSON(const std::filesystem::path& fn, const BenchmarkRun& run) {
+    std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    char buf[128];
+
+    out << "{\n  \"path\": ";
+    WriteJSONString(out, run.path.empty() ? "flythrough" : run.path.c_str());
+    snprintf(buf, sizeof(buf), ",\n  \"frames\": %llu,\n  \"dt_s\": %.6f,\n  \"wall_s\": %.3f,\n", run.numFrames, run.dt, run.sWall);
+    out << buf;
+
+    out << "  \"frame\": {\n";
+    const struct { const char* name; const FramePercentiles& pct; } frames[] = {
+        { "cpu", run.frames.cpu }, { "gpu", run.frames.gpu }, { "present", run.frames.present } };
+    for (size_t i = 0; i < 3; ++i) {
+        out << "    \"" << frames[i].name << "\": {";
+        WritePercentiles(out, frames[i].pct);
+        out << (i + 1 < 3 ? "},\n" : "}\n");
+    }
+    out << "  },\n";
+
+    // scopes by track, parents before children, as Profiler::Report prints them
+    std::vector<ProfileSummary> phases;
+    Profiler::Get().GetSummary(phases);
+    out << "  \"phases\": [";
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const ProfileSummary& ph = phases[i];
+        out << (i ? ",\n" : "\n") << "    {\"track\":";
+        WriteJSONString(out, ph.track.c_str());
+        out << ",\"name\":";
+        WriteJSONString(out, ph.name);
+        snprintf(buf, sizeof(buf), ",\"depth\":%u,\"avg_ms\":%.4f,", ph.depth, ph.msAvg);
+        out << buf;
+        WritePercentiles(out, ph.ms);
+        out << '}';
+    }
+    out << (phases.empty() ? "],\n" : "\n  ],\n");
+
+    // a per-frame counter as its total and its average per frame, a gauge as its peak
+    const CounterRegistry& counters = CounterRegistry::Get();
+    const unsigned int numCounters = run.pCounters ? static_cast<unsigned int>(run.pCounters->totals.size()) : 0;
+    const double numFrames = run.pCounters && run.pCounters->frame ? static_cast<double>(run.pCounters->frame) : 1.0;
+    out << "  \"counters\": [";
+    for (unsigned int i = 0; i < numCounters; ++i) {
+        const Counter& c = counters.GetCounter(i);
+        out << (i ? ",\n" : "\n") << "    {\"name\":";
+        WriteJSONString(out, c.GetName());
+        out << ",\"unit\":";
+        WriteJSONString(out, c.GetUnit());
+        const long long total = run.pCounters->totals[i];
+        if (c.GetKind() == COUNTER_PER_FRAME) snprintf(buf, sizeof(buf), ",\"total\":%lld,\"per_frame\":%.3f}", total, total / numFrames);
+        else snprintf(buf, sizeof(buf), ",\"peak\":%lld}", total);
+        out << buf;
+    }
+    out << (numCounters ? "\n  ]\n}\n" : "]\n}\n");
+    return static_cast<bool>(out);
+}
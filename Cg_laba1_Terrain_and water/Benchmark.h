@@ -0,0 +1,19 @@
+#pragma once
+#include "Counters.h"
+#include "FrameHistogram.h"
+#include <filesystem>
+#include <string>
+
+// What a benchmark run was and how its frames went; the per-phase times come from Profiler::Get().
+struct BenchmarkRun {
+    std::string         path;               // camera path file; empty for the built-in flythrough
+    unsigned long long  numFrames = 0;
+    double              dt = 0.0;           // simulated seconds per frame
+    double              sWall = 0.0;
+    FrameWindow         frames;             // CPU, GPU and present percentiles of the whole run
+    const CounterSnapshot* pCounters = nullptr; // the last snapshot; its totals cover the run
+};
+
+// The run, every profiler scope with count, average and percentiles, and the counters' totals and
+// per-frame averages, as one JSON object. Two runs of the same path are compared key by key.
+bool WriteBenchmarkJSON(const std::filesystem::path& fn, const BenchmarkRun& run);
@@ -0,0 +1,490 @@
+#include "BlockCompress.h"
+#include "Graphics.h"
+#include "TextureCache.h"
+#include "JobSystem.h"
+#include <DirectXTex.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
+namespace {
+    const unsigned int MIN_BLOCK_ROWS_PER_TASK = 8;
+
+    typedef unsigned char Block[16][4];
+
+    // 4x4 texels starting at (bx*4, by*4); edges repeat the last row/column for levels smaller than a block
+    void FetchBlock(const unsigned char* src, unsigned int w, unsigned int h, unsigned int bx, unsigned int by,
+        Block px) {
+        for (unsigned int y = 0; y < 4; ++y) {
+            const unsigned int sy = (std::min)(by * 4 + y, h - 1);
+            for (unsigned int x = 0; x < 4; ++x) {
+                const unsigned int sx = (std::min)(bx * 4 + x, w - 1);
+                std::memcpy(px[y * 4 + x], src + (size_t(sy) * w + sx) * 4, 4);
+            }
+        }
+    }
+
+    // ---- BC1 colour block ----
+
+    inline uint16_t To565(const float c[3]) {
+        int r = (int)(c[0] * (31.0f / 255.0f) + 0.5f);
+        int g = (int)(c[1] * (63.0f / 255.0f) + 0.5f);
+        int b = (int)(c[2] * (31.0f / 255.0f) + 0.5f);
+        r = (std::min)((std::max)(r, 0), 31);
+        g = (std::min)((std::max)(g, 0), 63);
+        b = (std::min)((std::max)(b, 0), 31);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    inline void From565(uint16_t v, int c[3]) {
+        int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+        c[0] = (r << 3) | (r >> 2);
+        c[1] = (g << 2) | (g >> 4);
+        c[2] = (b << 3) | (b >> 2);
+    }
+
+    // 4-colour palette (c0 > c1 ordering is fixed up by the caller)
+    void ColorPalette(uint16_t c0, uint16_t c1, int pal[4][3]) {
+        From565(c0, pal[0]);
+        From565(c1, pal[1]);
+        for (int k = 0; k < 3; ++k) {
+            pal[2][k] = (2 * pal[0][k] + pal[1][k]) / 3;
+            pal[3][k] = (pal[0][k] + 2 * pal[1][k]) / 3;
+        }
+    }
+
+    uint32_t PickColorIndices(const Block px, const int pal[4][3], int& err) {
+        uint32_t bits = 0;
+        err = 0;
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestErr = INT32_MAX;
+            for (int k = 0; k < 4; ++k) {
+                int dr = px[i][0] - pal[k][0], dg = px[i][1] - pal[k][1], db = px[i][2] - pal[k][2];
+                int e = dr * dr + dg * dg + db * db;
+                if (e < bestErr) { bestErr = e; best = k; }
+            }
+            bits |= uint32_t(best) << (2 * i);
+            err += bestErr;
+        }
+        return bits;
+    }
+
+    // Least-squares endpoints for fixed indices; false when the system is degenerate.
+    bool RefitColor(const Block px, uint32_t bits, float e0[3], float e1[3]) {
+        static const float W0[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float a = 0.0f, b = 0.0f, c = 0.0f, x[3] = {}, y[3] = {};
+        for (int i = 0; i < 16; ++i) {
+            float w0 = W0[(bits >> (2 * i)) & 3], w1 = 1.0f - w0;
+            a += w0 * w0; b += w0 * w1; c += w1 * w1;
+            for (int k = 0; k < 3; ++k) {
+                x[k] += w0 * px[i][k];
+                y[k] += w1 * px[i][k];
+            }
+        }
+        float det = a * c - b * b;
+        if (std::fabs(det) < 1e-6f) return false;
+        for (int k = 0; k < 3; ++k) {
+            e0[k] = (c * x[k] - b * y[k]) / det;
+            e1[k] = (a * y[k] - b * x[k]) / det;
+        }
+        return true;
+    }
+
+    void EncodeColor(const Block px, unsigned char* out) {
+        float mean[3] = {}, mn[3] = { 255, 255, 255 }, mx[3] = {};
+        for (int i = 0; i < 16; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                mean[k] += px[i][k];
+                mn[k] = (std::min)(mn[k], (float)px[i][k]);
+                mx[k] = (std::max)(mx[k], (float)px[i][k]);
+            }
+        }
+        for (int k = 0; k < 3; ++k) mean[k] /= 16.0f;
+
+        // principal axis of the colour cloud by power iteration, seeded with the bounding box diagonal
+        float cov[6] = {};
+        for (int i = 0; i < 16; ++i) {
+            float d[3] = { px[i][0] - mean[0], px[i][1] - mean[1], px[i][2] - mean[2] };
+            cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+            cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+        }
+        float axis[3] = { mx[0] - mn[0], mx[1] - mn[1], mx[2] - mn[2] };
+        for (int it = 0; it < 4; ++it) {
+            float v[3] = {
+                cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+            float len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+            if (len < 1e-6f) break;
+            for (int k = 0; k < 3; ++k) axis[k] = v[k] / len;
+        }
+        float lenAxis = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+
+        float e0[3], e1[3];
+        if (lenAxis < 1e-6f) {
+            for (int k = 0; k < 3; ++k) e0[k] = e1[k] = mean[k];
+        }
+        else {
+            for (int k = 0; k < 3; ++k) axis[k] /= lenAxis;
+            float tMin = FLT_MAX, tMax = -FLT_MAX;
+            for (int i = 0; i < 16; ++i) {
+                float t = (px[i][0] - mean[0]) * axis[0] + (px[i][1] - mean[1]) * axis[1] + (px[i][2] - mean[2]) * axis[2];
+                tMin = (std::min)(tMin, t);
+                tMax = (std::max)(tMax, t);
+            }
+            // inset by 1/16 of the range: the extremes are rarely worth a palette entry each
+            float inset = (tMax - tMin) / 16.0f;
+            tMax -= inset;
+            tMin += inset;
+            for (int k = 0; k < 3; ++k) {
+                e0[k] = mean[k] + axis[k] * tMax;
+                e1[k] = mean[k] + axis[k] * tMin;
+            }
+        }
+
+        uint16_t c0 = To565(e0), c1 = To565(e1);
+        int pal[4][3], err;
+        ColorPalette(c0, c1, pal);
+        uint32_t bits = PickColorIndices(px, pal, err);
+
+        float r0[3], r1[3];
+        if (err > 0 && RefitColor(px, bits, r0, r1)) {
+            uint16_t d0 = To565(r0), d1 = To565(r1);
+            int palRefit[4][3], errRefit;
+            ColorPalette(d0, d1, palRefit);
+            uint32_t bitsRefit = PickColorIndices(px, palRefit, errRefit);
+            if (errRefit < err) { c0 = d0; c1 = d1; bits = bitsRefit; }
+        }
+
+        // 4-colour mode requires c0 > c1: swapping the endpoints swaps index pairs 0<->1 and 2<->3
+        if (c0 < c1) {
+            std::swap(c0, c1);
+            bits ^= 0x55555555u;
+        }
+        else if (c0 == c1) {
+            bits = 0;
+        }
+
+        out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+        out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+        std::memcpy(out + 4, &bits, 4);
+    }
+
+    void DecodeColor(const unsigned char* in, bool isBC1, Block px) {
+        uint16_t c0 = uint16_t(in[0] | (in[1] << 8)), c1 = uint16_t(in[2] | (in[3] << 8));
+        uint32_t bits;
+        std::memcpy(&bits, in + 4, 4);
+
+        int pal[4][4];
+        From565(c0, pal[0]);
+        From565(c1, pal[1]);
+        pal[0][3] = pal[1][3] = pal[2][3] = pal[3][3] = 255;
+        if (c0 > c1 || !isBC1) {
+            for (int k = 0; k < 3; ++k) {
+                pal[2][k] = (2 * pal[0][k] + pal[1][k]) / 3;
+                pal[3][k] = (pal[0][k] + 2 * pal[1][k]) / 3;
+            }
+        }
+        else {
+            for (int k = 0; k < 3; ++k) {
+                pal[2][k] = (pal[0][k] + pal[1][k]) / 2;
+                pal[3][k] = 0;
+            }
+            pal[3][3] = 0;
+        }
+        for (int i = 0; i < 16; ++i) {
+            const int* c = pal[(bits >> (2 * i)) & 3];
+            for (int k = 0; k < 3; ++k) px[i][k] = (unsigned char)c[k];
+            if (isBC1) px[i][3] = (unsigned char)c[3];
+        }
+    }
+
+    // ---- BC4 single-channel block (BC3 alpha, BC5 red/green) ----
+
+    void EncodeChannel(const Block px, int ch, unsigned char* out) {
+        int a0 = 0, a1 = 255;
+        for (int i = 0; i < 16; ++i) {
+            a0 = (std::max)(a0, (int)px[i][ch]);
+            a1 = (std::min)(a1, (int)px[i][ch]);
+        }
+        out[0] = (unsigned char)a0;
+        out[1] = (unsigned char)a1;
+
+        // 8-value mode: index 0 = a0, 1 = a1, 2..7 step from a0 towards a1
+        uint64_t bits = 0;
+        if (a0 > a1) {
+            const int range = a0 - a1;
+            for (int i = 0; i < 16; ++i) {
+                int p = ((px[i][ch] - a1) * 14 + range) / (2 * range);   // round((v - a1) * 7 / range)
+                int idx = p == 7 ? 0 : (p == 0 ? 1 : 8 - p);
+                bits |= uint64_t(idx) << (3 * i);
+            }
+        }
+        for (int b = 0; b < 6; ++b) out[2 + b] = (unsigned char)(bits >> (8 * b));
+    }
+
+    void DecodeChannel(const unsigned char* in, int ch, Block px) {
+        int a0 = in[0], a1 = in[1], pal[8];
+        pal[0] = a0;
+        pal[1] = a1;
+        if (a0 > a1) {
+            for (int i = 2; i < 8; ++i) pal[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+        }
+        else {
+            for (int i = 2; i < 6; ++i) pal[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+            pal[6] = 0;
+            pal[7] = 255;
+        }
+        uint64_t bits = 0;
+        for (int b = 0; b < 6; ++b) bits |= uint64_t(in[2 + b]) << (8 * b);
+        for (int i = 0; i < 16; ++i) px[i][ch] = (unsigned char)pal[(bits >> (3 * i)) & 7];
+    }
+
+    void EncodeBlock(BCFormat format, const Block px, unsigned char* out) {
+        switch (format) {
+        case BC_FORMAT_BC1:
+            EncodeColor(px, out);
+            break;
+        case BC_FORMAT_BC3:
+            EncodeChannel(px, 3, out);
+            EncodeColor(px, out + 8);
+            break;
+        case BC_FORMAT_BC5:
+            EncodeChannel(px, 0, out);
+            EncodeChannel(px, 1, out + 8);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void DecodeBlock(BCFormat format, const unsigned char* in, Block px) {
+        std::memset(px, 0, sizeof(Block));
+        switch (format) {
+        case BC_FORMAT_BC1:
+            DecodeColor(in, true, px);
+            break;
+        case BC_FORMAT_BC3:
+            DecodeChannel(in, 3, px);
+            DecodeColor(in + 8, false, px);
+            break;
+        case BC_FORMAT_BC5:
+            DecodeChannel(in, 0, px);
+            DecodeChannel(in + 8, 1, px);
+            for (int i = 0; i < 16; ++i) px[i][3] = 255;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // BC7 has no built-in encoder: the block rectangle is handed to DirectXTex as a sub-image
+    void EncodeBC7(const unsigned char* src, unsigned int w, unsigned int h, unsigned char* dst, unsigned int pitch,
+        unsigned int bx0, unsigned int by0, unsigned int bx1, unsigned int by1) {
+        const unsigned int x0 = bx0 * 4, y0 = by0 * 4;
+        const unsigned int x1 = (std::min)(bx1 * 4, w), y1 = (std::min)(by1 * 4, h);
+
+        DirectX::Image img = {};
+        img.width = x1 - x0;
+        img.height = y1 - y0;
+        img.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        img.rowPitch = size_t(w) * 4;
+        img.slicePitch = img.rowPitch * img.height;
+        img.pixels = const_cast<uint8_t*>(src + (size_t(y0) * w + x0) * 4);
+
+        DirectX::ScratchImage bc;
+        HRESULT hr = DirectX::Compress(img, DXGI_FORMAT_BC7_UNORM,
+            DirectX::TEX_COMPRESS_BC7_QUICK | DirectX::TEX_COMPRESS_PARALLEL, DirectX::TEX_THRESHOLD_DEFAULT, bc);
+        if (FAILED(hr)) throw graphics::GFX_Exception("BCChain::Encode: BC7 Compress failed.");
+
+        const DirectX::Image* out = bc.GetImage(0, 0, 0);
+        for (unsigned int r = 0; r < by1 - by0; ++r) {
+            std::memcpy(dst + size_t(by0 + r) * pitch + size_t(bx0) * 16, out->pixels + r * out->rowPitch,
+                size_t(bx1 - bx0) * 16);
+        }
+    }
+}
+
+BCChain::~BCChain() {
+    Release();
+}
+
+const char* BCChain::FormatName(BCFormat format) {
+    switch (format) {
+    case BC_FORMAT_BC1: return "BC1";
+    case BC_FORMAT_BC3: return "BC3";
+    case BC_FORMAT_BC5: return "BC5";
+    case BC_FORMAT_BC7: return "BC7";
+    }
+    return "?";
+}
+
+void BCChain::Release() {
+    if (m_view) TextureCache::ReleaseView(m_view);
+    m_view = nullptr;
+    m_pData = nullptr;
+    m_buf.clear();
+    m_buf.shrink_to_fit();
+    m_listLevels.clear();
+    m_size = 0;
+    m_psnr = 0.0f;
+}
+
+void BCChain::Layout(BCFormat format, unsigned int w, unsigned int h) {
+    m_format = format;
+    m_listLevels.clear();
+    m_size = 0;
+
+    const unsigned int n = MipChain::CountLevels(w, h);
+    for (unsigned int i = 0; i < n; ++i) {
+        m_listLevels.push_back({ (size_t)m_size, w, h });
+        m_size += uint64_t(GetRowPitch(i)) * GetRowCount(i);
+        w = (std::max)(1u, w / 2);
+        h = (std::max)(1u, h / 2);
+    }
+}
+
+bool BCChain::Load(uint64_t key) {
+    Release();
+    if (!key) return false;
+
+    TextureCacheEntry entry;
+    if (!TextureCache::Get().Load(key, entry)) return false;
+
+    const BCFormat format = static_cast<BCFormat>(entry.format);
+    if (format == BC_FORMAT_BC1 || format == BC_FORMAT_BC3 || format == BC_FORMAT_BC5 || format == BC_FORMAT_BC7) {
+        Layout(format, entry.w, entry.h);
+        if (entry.mips == GetLevelCount() && entry.size == m_size) {
+            m_view = entry.view;
+            m_pData = entry.data;
+            m_psnr = entry.psnr;
+            return true;
+        }
+    }
+    TextureCache::ReleaseView(entry.view);
+    m_listLevels.clear();
+    m_size = 0;
+    return false;
+}
+
+void BCChain::Encode(const MipChain& mips, BCFormat format, uint64_t key) {
+    Release();
+    Layout(format, mips.GetWidth(0), mips.GetHeight(0));
+    m_buf.resize((size_t)m_size);
+    m_pData = m_buf.data();
+
+    for (unsigned int i = 0; i < GetLevelCount(); ++i) {
+        EncodeLevel(mips, i, 0, 0, (GetWidth(i) + 3) / 4, GetRowCount(i));
+    }
+    m_psnr = ComputePSNR(mips.GetLevel(0));
+
+    if (key) {
+        TextureCache::Get().Store(key, m_pData, m_size, GetWidth(0), GetHeight(0), format, GetLevelCount(), m_psnr);
+    }
+}
+
+void BCChain::Update(const MipChain& mips, const std::vector<MipRect>& dirty) {
+    const unsigned int n = (std::min)(GetLevelCount(), static_cast<unsigned int>(dirty.size()));
+    for (unsigned int i = 0; i < n; ++i) {
+        const MipRect& r = dirty[i];
+        if (r.x0 >= r.x1 || r.y0 >= r.y1) continue;
+        EncodeLevel(mips, i, r.x0 / 4, r.y0 / 4, (r.x1 + 3) / 4, (r.y1 + 3) / 4);
+    }
+}
+
+void BCChain::EncodeLevel(const MipChain& mips, unsigned int i,
+    unsigned int bx0, unsigned int by0, unsigned int bx1, unsigned int by1) {
+    const unsigned char* src = mips.GetLevel(i);
+    const unsigned int w = GetWidth(i), h = GetHeight(i);
+    const unsigned int pitch = GetRowPitch(i);
+    const unsigned int sizeBlock = BlockBytes(m_format);
+    unsigned char* dst = m_pData + m_listLevels[i].offset;
+
+    if (m_format == BC_FORMAT_BC7) {
+        EncodeBC7(src, w, h, dst, pitch, bx0, by0, bx1, by1);
+        return;
+    }
+
+    const BCFormat format = m_format;
+    JobSystem::Shared().ParallelFor(by0, by1, MIN_BLOCK_ROWS_PER_TASK, [=](unsigned int a, unsigned int b) {
+        Block px;
+        for (unsigned int by = a; by < b; ++by) {
+            unsigned char* row = dst + size_t(by) * pitch;
+            for (unsigned int bx = bx0; bx < bx1; ++bx) {
+                FetchBlock(src, w, h, bx, by, px);
+                EncodeBlock(format, px, row + size_t(bx) * sizeBlock);
+            }
+        }
+    });
+}
+
+float BCChain::ComputePSNR(const unsigned char* src) const {
+    const unsigned int w = GetWidth(0), h = GetHeight(0);
+    const int channels = m_format == BC_FORMAT_BC1 ? 3 : (m_format == BC_FORMAT_BC5 ? 2 : 4);
+
+    // BC7 is decoded by DirectXTex up front; the others block by block
+    DirectX::ScratchImage decodedBC7;
+    if (m_format == BC_FORMAT_BC7) {
+        DirectX::Image img = {};
+        img.width = w;
+        img.height = h;
+        img.format = DXGI_FORMAT_BC7_UNORM;
+        img.rowPitch = GetRowPitch(0);
+        img.slicePitch = size_t(img.rowPitch) * GetRowCount(0);
+        img.pixels = m_pData;
+        if (FAILED(DirectX::Decompress(img, DXGI_FORMAT_R8G8B8A8_UNORM, decodedBC7))) return 0.0f;
+    }
+    const unsigned char* decoded = m_format == BC_FORMAT_BC7 ? decodedBC7.GetPixels() : nullptr;
+
+    std::mutex mtxSum;
+    double sumSq = 0.0;
+    const unsigned int pitch = GetRowPitch(0);
+    const unsigned int sizeBlock = BlockBytes(m_format);
+    JobSystem::Shared().ParallelFor(0, GetRowCount(0), MIN_BLOCK_ROWS_PER_TASK, [&](unsigned int a, unsigned int b) {
+        double local = 0.0;
+        Block ref, out;
+        for (unsigned int by = a; by < b; ++by) {
+            for (unsigned int bx = 0; bx < (w + 3) / 4; ++bx) {
+                FetchBlock(src, w, h, bx, by, ref);
+                if (decoded) FetchBlock(decoded, w, h, bx, by, out);
+                else DecodeBlock(m_format, m_pData + size_t(by) * pitch + size_t(bx) * sizeBlock, out);
+
+                for (unsigned int i = 0; i < 16; ++i) {
+                    if (bx * 4 + i % 4 >= w || by * 4 + i / 4 >= h) continue;
+                    for (int k = 0; k < channels; ++k) {
+                        int d = int(ref[i][k]) - int(out[i][k]);
+                        local += d * d;
+                    }
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mtxSum);
+        sumSq += local;
+    });
+
+    const double mse = sumSq / (double(w) * h * channels);
+    if (mse <= 0.0) return 99.0f;
+    return static_cast<float>(10.0 * std::log10(255.0 * 255.0 / mse));
+}
+
+bool BCDecode(BCFormat format, const unsigned char* blocks, unsigned int w, unsigned int h, unsigned char* rgba) {
+    if (format != BC_FORMAT_BC1 && format != BC_FORMAT_BC3 && format != BC_FORMAT_BC5) return false;
+
+    const unsigned int blocksX = (w + 3) / 4;
+    const unsigned int sizeBlock = BCChain::BlockBytes(format);
+    JobSystem::Shared().ParallelFor(0, (h + 3) / 4, MIN_BLOCK_ROWS_PER_TASK, [=](unsigned int a, unsigned int b) {
+        Block px;
+        for (unsigned int by = a; by < b; ++by) {
+            for (unsigned int bx = 0; bx < blocksX; ++bx) {
+                DecodeBlock(format, blocks + (size_t(by) * blocksX + bx) * sizeBlock, px);
+                for (unsigned int y = 0; y < 4 && by * 4 + y < h; ++y) {
+                    const unsigned int n = (std::min)(4u, w - bx * 4);
+                    std::memcpy(rgba + (size_t(by * 4 + y) * w + bx * 4) * 4, px[y * 4], size_t(n) * 4);
+                }
+            }
+        }
+    });
+    return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "MipGen.h"
+#include <cstdint>
+#include <vector>
+
+// Values match DXGI_FORMAT_BCn_UNORM, so they go straight into resource descs and cache entries.
+enum BCFormat { BC_FORMAT_BC1 = 71, BC_FORMAT_BC3 = 77, BC_FORMAT_BC5 = 83, BC_FORMAT_BC7 = 98 };
+
+// Block-compressed copy of an RGBA8 MipChain.
+// BC1/BC3/BC5 use the built-in encoder (PCA endpoints with one least-squares refit), BC7 goes through
+// DirectXTex. Block rows are split across JobSystem::Shared(). Encoded chains can be kept in the
+// TextureCache; a hit is used straight from the mapping.
+class BCChain {
+public:
+    BCChain() = default;
+    ~BCChain();
+    BCChain(const BCChain&) = delete;
+    BCChain& operator=(const BCChain&) = delete;
+
+    // Takes the chain from the cache; size and format come from the entry.
+    bool Load(uint64_t key);
+    // Encodes every level of mips and, with a non-zero key, stores the result in the cache.
+    void Encode(const MipChain& mips, BCFormat format, uint64_t key = 0);
+    // Re-encodes the blocks under the per-level rectangles reported by MipChain::Update.
+    void Update(const MipChain& mips, const std::vector<MipRect>& dirty);
+
+    BCFormat GetFormat() const { return m_format; }
+    unsigned int GetLevelCount() const { return static_cast<unsigned int>(m_listLevels.size()); }
+    const unsigned char* GetLevel(unsigned int i) const { return m_pData + m_listLevels[i].offset; }
+    unsigned int GetWidth(unsigned int i) const { return m_listLevels[i].w; }
+    unsigned int GetHeight(unsigned int i) const { return m_listLevels[i].h; }
+    unsigned int GetRowPitch(unsigned int i) const { return ((m_listLevels[i].w + 3) / 4) * BlockBytes(m_format); }
+    unsigned int GetRowCount(unsigned int i) const { return (m_listLevels[i].h + 3) / 4; }
+    uint64_t GetSize() const { return m_size; }
+
+    // Level 0 against the source, over the channels the format keeps (RGB for BC1, RG for BC5, RGBA otherwise).
+    float GetPSNR() const { return m_psnr; }
+    bool IsCached() const { return m_view != nullptr; }
+
+    static unsigned int BlockBytes(BCFormat format) { return format == BC_FORMAT_BC1 ? 8 : 16; }
+    static const char* FormatName(BCFormat format);
+
+private:
+    struct Level {
+        size_t          offset;
+        unsigned int    w;
+        unsigned int    h;
+    };
+
+    void Layout(BCFormat format, unsigned int w, unsigned int h);
+    void EncodeLevel(const MipChain& mips, unsigned int i,
+        unsigned int bx0, unsigned int by0, unsigned int bx1, unsigned int by1);
+    float ComputePSNR(const unsigned char* src) const;
+    void Release();
+
+    BCFormat                    m_format = BC_FORMAT_BC1;
+    std::vector<Level>          m_listLevels;
+    std::vector<unsigned char>  m_buf;
+    unsigned char*              m_pData = nullptr;
+    void*                       m_view = nullptr;   // TextureCache mapping when loaded from the cache
+    uint64_t                    m_size = 0;
+    float                       m_psnr = 0.0f;
+};
+
+// Decodes one level of BC1/BC3/BC5 blocks into tightly packed RGBA8 (BC5 gives B = 0, A = 255).
+// Returns false for formats the built-in decoder does not handle.
+bool BCDecode(BCFormat format, const unsigned char* blocks, unsigned int w, unsigned int h, unsigned char* rgba);
@@ -85,6 +85,11 @@ void Camera::GetViewFrustum(XMFLOAT4 planes[6])
     }
 }
 
+float Camera::GetPixelAngle() const
+{
+    return 2.0f * std::tanf(XMConvertToRadians(m_fovVertical * 0.5f)) / float(m_hScreen);
+}
+
 Frustum Camera::CalculateFrustumByNearFar(float zNear, float zFar)
 {
     Frustum f{};
@@ -187,6 +192,15 @@ void Camera::LockPosition(XMFLOAT4 p)
     Update();
 }
 
+void Camera::SetPose(XMFLOAT4 p, float yaw, float pitch)
+{
+    m_vPos = p;
+    m_angleYaw = yaw;
+    m_anglePitch = pitch;
+    m_angleRoll = 0.0f;
+    Update();
+}
+
 void Camera::Update()
 {
     XMVECTOR look = XMLoadFloat4(&m_vStartLook);
@@ -29,6 +29,9 @@ public:
 
 	void GetViewFrustum(XMFLOAT4 planes[6]);
 
+	// Angle one pixel row spans at the centre of the screen, in radians.
+	float GetPixelAngle() const;
+
 	void Translate(XMFLOAT3 move);
 
 	void Pitch(float theta);
@@ -41,6 +44,11 @@ public:
 
 	void LockPosition(XMFLOAT4 p);
 
+	// Absolute pose, e.g. from a camera path: yaw and pitch in degrees from the start orientation, no roll.
+	void SetPose(XMFLOAT4 p, float yaw, float pitch);
+	float GetYaw() const { return m_angleYaw; }
+	float GetPitch() const { return m_anglePitch; }
+
 private:
 	void Update();
 
@@ -0,0 +1,138 @@
+#include "CameraPath.h"
+#include "SelfTest.h"
+#include "StartupReport.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+void CameraPath::AddKey(const CameraKey& key) {
+    if (!m_listKeys.empty() && key.t <= m_listKeys.back().t) return;
+    m_listKeys.push_back(key);
+}
+
+CameraKey CameraPath::Sample(float t) const {
+    if (m_listKeys.empty()) return CameraKey();
+    if (t <= m_listKeys.front().t) return m_listKeys.front();
+    if (t >= m_listKeys.back().t) return m_listKeys.back();
+
+    // the segment [i, i + 1] that holds t
+    const size_t i = static_cast<size_t>(std::upper_bound(m_listKeys.begin(), m_listKeys.end(), t,
+        [](float tFind, const CameraKey& k) { return tFind < k.t; }) - m_listKeys.begin()) - 1;
+    const CameraKey& k1 = m_listKeys[i];
+    const CameraKey& k2 = m_listKeys[i + 1];
+    const CameraKey& k0 = m_listKeys[i ? i - 1 : i];
+    const CameraKey& k3 = m_listKeys[(std::min)(i + 2, m_listKeys.size() - 1)];
+    const float u = (t - k1.t) / (k2.t - k1.t);
+
+    // uniform Catmull-Rom: passes through k1 and k2, k0 and k3 only bend it
+    auto spline = [u](float p0, float p1, float p2, float p3) {
+        return 0.5f * (2.0f * p1 + (p2 - p0) * u + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u * u +
+            (3.0f * p1 - p0 - 3.0f * p2 + p3) * u * u * u);
+    };
+    CameraKey key;
+    key.t = t;
+    key.x = spline(k0.x, k1.x, k2.x, k3.x);
+    key.y = spline(k0.y, k1.y, k2.y, k3.y);
+    key.z = spline(k0.z, k1.z, k2.z, k3.z);
+    key.yaw = k1.yaw + (k2.yaw - k1.yaw) * u;
+    key.pitch = k1.pitch + (k2.pitch - k1.pitch) * u;
+    return key;
+}
+
+bool CameraPath::Load(const std::filesystem::path& fn) {
+    m_listKeys.clear();
+    std::ifstream in(fn, std::ios::binary);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream ss(line);
+        CameraKey key;
+        if (ss >> key.t >> key.x >> key.y >> key.z >> key.yaw >> key.pitch) AddKey(key);
+    }
+    return !m_listKeys.empty();
+}
+
+bool CameraPath::Save(const std::filesystem::path& fn) const {
+    std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out << "# t x y z yaw pitch\n";
+    char buf[160];
+    for (const CameraKey& k : m_listKeys) {
+        snprintf(buf, sizeof(buf), "%.4f %.3f %.3f %.3f %.3f %.3f\n", k.t, k.x, k.y, k.z, k.yaw, k.pitch);
+        out << buf;
+    }
+    return static_cast<bool>(out);
+}
+
+CameraPath CameraPath::Flythrough(float cx, float cy, float cz, float radius) {
+    // the camera starts looking along +x +y, i.e. from the (-x, -y) corner towards the middle
+    static const float KEYS[][6] = {
+        //  t     x      y      z     yaw   pitch  (x, y, z in radii from the centre)
+        {  0.0f, -0.70f, -0.70f, 0.60f,   0.0f, -30.0f },
+        {  8.0f, -0.20f, -0.20f, 0.15f,   0.0f, -15.0f },
+        { 16.0f,  0.30f,  0.10f, 0.10f,  60.0f, -10.0f },
+        { 24.0f,  0.20f,  0.50f, 0.15f, 150.0f, -10.0f },
+        { 32.0f, -0.40f,  0.30f, 0.30f, 240.0f, -20.0f },
+        { 40.0f, -0.70f, -0.70f, 0.60f, 360.0f, -30.0f },
+    };
+    CameraPath path;
+    for (const float* k : KEYS) {
+        path.AddKey({ k[0], cx + k[1] * radius, cy + k[2] * radius, cz + k[3] * radius, k[4], k[5] });
+    }
+    return path;
+}
+
+bool CameraPath::SelfTest() {
+    SelfTestExpect expect;
+    auto isNear = [](float a, float b) { return std::fabs(a - b) < 1e-3f; };
+
+    StartupReport::Line("\n=== Camera path: sampling ===\n");
+    CameraPath path;
+    expect(path.IsEmpty() && path.GetDuration() == 0.0f, "a new path is empty");
+    path.AddKey({ 0.0f, 0.0f, 0.0f, 10.0f, 0.0f, 0.0f });
+    path.AddKey({ 1.0f, 10.0f, 0.0f, 10.0f, 90.0f, -10.0f });
+    path.AddKey({ 0.5f, 99.0f, 99.0f, 99.0f, 0.0f, 0.0f });
+    path.AddKey({ 2.0f, 20.0f, 10.0f, 10.0f, 180.0f, -20.0f });
+    path.AddKey({ 3.0f, 30.0f, 10.0f, 10.0f, 180.0f, -20.0f });
+    expect(path.GetKeyCount() == 4 && path.GetDuration() == 3.0f, "a key out of order is ignored");
+
+    const CameraKey atKey = path.Sample(1.0f);
+    expect(isNear(atKey.x, 10.0f) && isNear(atKey.y, 0.0f) && isNear(atKey.yaw, 90.0f), "a key is passed through");
+    const CameraKey mid = path.Sample(1.5f);
+    expect(mid.x > 10.0f && mid.x < 20.0f && isNear(mid.yaw, 135.0f) && isNear(mid.pitch, -15.0f),
+        "between keys: position on the curve, angles halfway");
+    expect(isNear(path.Sample(-1.0f).x, 0.0f) && isNear(path.Sample(10.0f).x, 30.0f), "clamped at both ends");
+    expect(isNear(path.Sample(0.25f).z, 10.0f), "flat keys give a flat curve");
+
+    // same steps, same poses
+    bool isSame = true;
+    for (int i = 0; i <= 180; ++i) {
+        const CameraKey a = path.Sample(i / 60.0f), b = path.Sample(i / 60.0f);
+        isSame = isSame && a.x == b.x && a.y == b.y && a.z == b.z && a.yaw == b.yaw;
+    }
+    expect(isSame, "fixed steps sample the same poses every time");
+
+    StartupReport::Line("\n=== Camera path: files ===\n");
+    const std::filesystem::path fn = std::filesystem::temp_directory_path() / "camera_path_selftest.path";
+    expect(path.Save(fn), "saved");
+    CameraPath loaded;
+    expect(loaded.Load(fn) && loaded.GetKeyCount() == 4 && isNear(loaded.Sample(1.5f).x, mid.x),
+        "loaded back, samples the same");
+    {
+        std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+        out << "# nothing but\n\n1 2 3\nnot a key\n";
+    }
+    expect(!loaded.Load(fn) && loaded.IsEmpty(), "a file without a key fails and leaves the path empty");
+    std::error_code ec;
+    std::filesystem::remove(fn, ec);
+    expect(!loaded.Load(fn), "a missing file fails");
+
+    const CameraPath fly = Flythrough(512.0f, 512.0f, 100.0f, 700.0f);
+    expect(fly.GetDuration() == 40.0f && isNear(fly.Sample(0.0f).x, fly.Sample(40.0f).x), "the flythrough ends where it began");
+
+    return expect.Finish("camera path");
+}
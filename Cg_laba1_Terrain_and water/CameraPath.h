@@ -0,0 +1,46 @@
+#pragma once
+#include <filesystem>
+#include <vector>
+
+// A camera pose at time t (seconds from the start of the path). yaw and pitch in degrees, as Camera
+// counts them from its start orientation: yaw around the up axis, pitch up positive.
+struct CameraKey {
+    float   t = 0.0f;
+    float   x = 0.0f;
+    float   y = 0.0f;
+    float   z = 0.0f;
+    float   yaw = 0.0f;
+    float   pitch = 0.0f;
+};
+
+// A camera flight to replay: keys in time order, positions through a Catmull-Rom spline, angles
+// straight between keys. Sampled at fixed steps it gives the same poses on every run, so timings of
+// two builds can be compared frame by frame.
+//
+// File: one key per line, "t x y z yaw pitch"; '#' starts a comment.
+class CameraPath {
+public:
+    // A key later than the last one; earlier keys are ignored.
+    void AddKey(const CameraKey& key);
+    void Clear() { m_listKeys.clear(); }
+
+    bool IsEmpty() const { return m_listKeys.empty(); }
+    size_t GetKeyCount() const { return m_listKeys.size(); }
+    float GetDuration() const { return m_listKeys.empty() ? 0.0f : m_listKeys.back().t; }
+    // The pose at t; before the first key the first, past the last one the last.
+    CameraKey Sample(float t) const;
+
+    // false when the file cannot be read or holds no key; the path is then left empty.
+    bool Load(const std::filesystem::path& fn);
+    bool Save(const std::filesystem::path& fn) const;
+
+    // 40 s over a terrain of this bounding sphere: down from above a corner, low over the middle,
+    // round and back up.
+    static CameraPath Flythrough(float cx, float cy, float cz, float radius);
+
+    // Sampling at and between keys, the ends, a file round trip and bad files. Prints what it checks.
+    static bool SelfTest();
+
+private:
+    std::vector<CameraKey>  m_listKeys;
+};
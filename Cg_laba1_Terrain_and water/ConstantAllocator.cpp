@@ -0,0 +1,43 @@
+#include "ConstantAllocator.h"
+#include <algorithm>
+
+static unsigned long long AlignConstant(unsigned long long size) {
+    const unsigned long long a = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT;
+    return (size + a - 1) & ~(a - 1);
+}
+
+ConstantAllocator::ConstantAllocator(ResourceManager* rm, unsigned int numSlots, unsigned long long sizePage)
+    : m_numSlots(numSlots), m_sizePage(AlignConstant(sizePage))
+{
+    D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(m_sizePage * m_numSlots);
+    CD3DX12_HEAP_PROPERTIES uploadProps(D3D12_HEAP_TYPE_UPLOAD);
+    rm->NewBuffer(m_pBuffer, &desc, &uploadProps, D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr);
+    m_pBuffer->SetName(L"Frame Constants");
+
+    // stays mapped; write-combined memory, so it is only ever written
+    CD3DX12_RANGE rangeRead(0, 0);
+    void* mapped = nullptr;
+    if (FAILED(m_pBuffer->Map(0, &rangeRead, &mapped))) throw GFX_Exception("ConstantAllocator::ConstantAllocator: Map failed.");
+    m_pMapped = static_cast<unsigned char*>(mapped);
+    m_vaBuffer = m_pBuffer->GetGPUVirtualAddress();
+}
+
+ConstantAllocator::~ConstantAllocator() {
+    // the buffer belongs to the ResourceManager
+    if (m_pBuffer) { m_pBuffer->Unmap(0, nullptr); m_pBuffer = nullptr; }
+    m_pMapped = nullptr;
+}
+
+void ConstantAllocator::BeginFrame(unsigned int slot) {
+    m_sizePeak = (std::max)(m_sizePeak, m_offUsed.load(std::memory_order_relaxed));
+    m_offPage = static_cast<unsigned long long>(slot % m_numSlots) * m_sizePage;
+    m_offUsed.store(0, std::memory_order_relaxed);
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS ConstantAllocator::Allocate(unsigned long long size, void*& mapped) {
+    const unsigned long long sizeAligned = AlignConstant(size);
+    const unsigned long long off = m_offUsed.fetch_add(sizeAligned, std::memory_order_relaxed);
+    if (off + sizeAligned > m_sizePage) throw GFX_Exception("ConstantAllocator::Allocate: the frame's page is full.");
+    mapped = m_pMapped + m_offPage + off;
+    return m_vaBuffer + m_offPage + off;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "ResourceManager.h"
+#include <atomic>
+#include <cstring>
+
+// Dynamic constants of a frame, bound as root CBVs. One persistently mapped upload buffer is split into
+// a page per frame slot; each Push copies a block to the next 256-byte boundary of the current page and
+// returns its GPU address, so a constant block costs neither a resource nor a descriptor. BeginFrame
+// rewinds a page once the FrameScheduler has handed out its slot again, which means the GPU is done
+// with the frame that filled it. Push is safe from the threads recording a frame's passes.
+class ConstantAllocator {
+public:
+    ConstantAllocator(ResourceManager* rm, unsigned int numSlots, unsigned long long sizePage);
+    ~ConstantAllocator();
+    ConstantAllocator(const ConstantAllocator&) = delete;
+    ConstantAllocator& operator=(const ConstantAllocator&) = delete;
+
+    // Rewinds the page of slot. Frame thread, before recording.
+    void BeginFrame(unsigned int slot);
+
+    // Room for size bytes in the current page; throws when the page is full.
+    D3D12_GPU_VIRTUAL_ADDRESS Allocate(unsigned long long size, void*& mapped);
+
+    template <typename T>
+    D3D12_GPU_VIRTUAL_ADDRESS Push(const T& data) {
+        void* mapped = nullptr;
+        const D3D12_GPU_VIRTUAL_ADDRESS va = Allocate(sizeof(T), mapped);
+        std::memcpy(mapped, &data, sizeof(T));
+        return va;
+    }
+
+    unsigned long long GetPageSize() const { return m_sizePage; }
+    // Most bytes one frame has used, padding included.
+    unsigned long long GetPeakUsage() const { return m_sizePeak; }
+
+private:
+    ID3D12Resource*                     m_pBuffer = nullptr;
+    unsigned char*                      m_pMapped = nullptr;
+    D3D12_GPU_VIRTUAL_ADDRESS           m_vaBuffer = 0;
+    unsigned int                        m_numSlots;
+    unsigned long long                  m_sizePage;
+    unsigned long long                  m_offPage = 0;          // start of the current page
+    std::atomic<unsigned long long>     m_offUsed{ 0 };         // bytes taken from it
+    unsigned long long                  m_sizePeak = 0;
+};
@@ -0,0 +1,197 @@
+#include "Counters.h"
+#include "SelfTest.h"
+#include "StartupReport.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// never destroyed: counters are static references in the code that counts, which may run while the process exits
+CounterRegistry& CounterRegistry::Get() {
+    static CounterRegistry* reg = new CounterRegistry();
+    return *reg;
+}
+
+int CounterRegistry::Find(const char* name) const {
+    const unsigned int n = GetCount();
+    for (unsigned int i = 0; i < n; ++i) {
+        if (std::strcmp(m_counters[i].m_name, name) == 0) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+Counter& CounterRegistry::Register(const char* name, CounterKind kind, const char* unit) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    const int i = Find(name);
+    if (i >= 0) return m_counters[i];
+
+    const unsigned int n = m_numCounters.load(std::memory_order_relaxed);
+    if (n == MAX_COUNTERS) {
+        StartupReport::Line("counters: no room for \"%s\", it is not reported\n", name);
+        return m_counterOverflow;
+    }
+    Counter& c = m_counters[n];
+    c.m_name = name;
+    c.m_unit = unit;
+    c.m_kind = kind;
+    c.m_index = n;
+    // the snapshot thread sees the counter only once it is complete
+    m_numCounters.store(n + 1, std::memory_order_release);
+    return c;
+}
+
+unsigned int CounterRegistry::AddReader() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    const unsigned int n = m_numReaders.load(std::memory_order_relaxed);
+    if (n == MAX_READERS) return MAX_READERS;
+    m_pReaders[n].reset(new TripleBuffer<CounterSnapshot>());
+    m_numReaders.store(n + 1, std::memory_order_release);
+    return n;
+}
+
+bool CounterRegistry::Acquire(unsigned int reader, const CounterSnapshot*& snap) {
+    if (reader >= m_numReaders.load(std::memory_order_acquire)) return false;
+    TripleBuffer<CounterSnapshot>& buf = *m_pReaders[reader];
+    if (!buf.Acquire()) return false;
+    snap = &buf.GetReadBuffer();
+    return true;
+}
+
+void CounterRegistry::Snapshot() {
+    const unsigned int n = GetCount();
+    if (m_listTotals.size() < n) m_listTotals.resize(n, 0);
+    ++m_numFrames;
+
+    // the first reader's buffer takes the values, the others copy it; containers keep their capacity
+    const unsigned int numReaders = m_numReaders.load(std::memory_order_acquire);
+    CounterSnapshot scratch;
+    CounterSnapshot& first = numReaders ? m_pReaders[0]->GetWriteBuffer() : scratch;
+    first.frame = m_numFrames;
+    first.values.resize(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        Counter& c = m_counters[i];
+        if (c.m_kind == COUNTER_PER_FRAME) {
+            first.values[i] = c.m_val.exchange(0, std::memory_order_relaxed);
+            m_listTotals[i] += first.values[i];
+        }
+        else {
+            first.values[i] = c.m_val.load(std::memory_order_relaxed);
+            m_listTotals[i] = (std::max)(m_listTotals[i], first.values[i]);
+        }
+    }
+    first.totals.assign(m_listTotals.begin(), m_listTotals.begin() + n);
+
+    for (unsigned int r = 1; r < numReaders; ++r) {
+        CounterSnapshot& snap = m_pReaders[r]->GetWriteBuffer();
+        snap.frame = first.frame;
+        snap.values.assign(first.values.begin(), first.values.end());
+        snap.totals.assign(first.totals.begin(), first.totals.end());
+        m_pReaders[r]->Publish();
+    }
+    if (numReaders) m_pReaders[0]->Publish();
+}
+
+void CounterRegistry::ResetTotals() {
+    const unsigned int n = GetCount();
+    m_listTotals.assign(n, 0);
+    for (unsigned int i = 0; i < n; ++i) {
+        Counter& c = m_counters[i];
+        if (c.m_kind == COUNTER_PER_FRAME) c.m_val.store(0, std::memory_order_relaxed);
+        else m_listTotals[i] = c.m_val.load(std::memory_order_relaxed);
+    }
+    m_numFrames = 0;
+}
+
+std::string CounterRegistry::Format(const CounterSnapshot& snap) const {
+    std::string line;
+    char buf[128];
+    const unsigned int n = (std::min)(GetCount(), static_cast<unsigned int>(snap.values.size()));
+    for (unsigned int i = 0; i < n; ++i) {
+        const Counter& c = m_counters[i];
+        snprintf(buf, sizeof(buf), "%s%s %lld%s%s", i ? " | " : "", c.m_name, snap.values[i], *c.m_unit ? " " : "", c.m_unit);
+        line += buf;
+    }
+    return line;
+}
+
+void CounterRegistry::Report() const {
+    const unsigned int n = (std::min)(GetCount(), static_cast<unsigned int>(m_listTotals.size()));
+    if (!n || !m_numFrames) return;
+    StartupReport::Line("\n=== Counters (%llu frames) ===\n", m_numFrames);
+    for (unsigned int i = 0; i < n; ++i) {
+        const Counter& c = m_counters[i];
+        if (c.m_kind == COUNTER_PER_FRAME) {
+            StartupReport::Line("  %-28s %14.1f %-6s per frame, %lld total\n", c.m_name,
+                static_cast<double>(m_listTotals[i]) / m_numFrames, c.m_unit, m_listTotals[i]);
+        }
+        else {
+            StartupReport::Line("  %-28s %14lld %-6s now, peak %lld\n", c.m_name,
+                c.m_val.load(std::memory_order_relaxed), c.m_unit, m_listTotals[i]);
+        }
+    }
+}
+
+bool CounterRegistry::SelfTest() {
+    SelfTestExpect expect;
+
+    StartupReport::Line("\n=== Counters: registration and snapshots ===\n");
+    CounterRegistry reg;
+    Counter& patches = reg.Register("patches", COUNTER_PER_FRAME);
+    Counter& bytes = reg.Register("upload", COUNTER_PER_FRAME, "B");
+    Counter& used = reg.Register("descriptors", COUNTER_GAUGE);
+    expect(&reg.Register("patches", COUNTER_PER_FRAME) == &patches, "the same name returns the same counter");
+    expect(reg.GetCount() == 3 && reg.Find("upload") == 1 && reg.Find("missing") == -1, "three counters, found by name");
+
+    const unsigned int hud = reg.AddReader();
+    const unsigned int log = reg.AddReader();
+    const CounterSnapshot* snap = nullptr;
+    expect(!reg.Acquire(hud, snap), "nothing to read before the first snapshot");
+
+    patches.Add(10);
+    patches.Add(5);
+    bytes.Add(4096);
+    used.Set(7);
+    reg.Snapshot();
+    expect(reg.Acquire(hud, snap) && snap->values[0] == 15 && snap->values[1] == 4096 && snap->values[2] == 7,
+        "a snapshot holds the frame's sums and the gauge");
+    expect(!reg.Acquire(hud, snap), "a reader sees each snapshot once");
+
+    patches.Add(3);
+    used.Add(-2);
+    reg.Snapshot();
+    expect(reg.Acquire(hud, snap) && snap->values[0] == 3 && snap->values[1] == 0 && snap->values[2] == 5,
+        "per-frame counters start again, the gauge keeps its level");
+    expect(snap->totals[0] == 18 && snap->totals[1] == 4096 && snap->totals[2] == 7, "totals sum frames, a gauge keeps its peak");
+    expect(reg.Acquire(log, snap) && snap->frame == 2 && snap->values[0] == 3, "a slow reader gets the newest snapshot only");
+    expect(reg.Format(*snap) == "patches 3 | upload 0 B | descriptors 5", "a log line");
+
+    StartupReport::Line("\n=== Counters: several threads ===\n");
+    const unsigned int numThreads = 4, numAdds = 100000;
+    std::vector<std::thread> threads;
+    std::atomic<unsigned int> numDone{ 0 };
+    for (unsigned int t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&]() {
+            for (unsigned int i = 0; i < numAdds; ++i) patches.Add();
+            numDone.fetch_add(1);
+        });
+    }
+    // snapshots while they count: nothing may get lost between frames
+    while (numDone.load() < numThreads) reg.Snapshot();
+    for (std::thread& t : threads) t.join();
+    reg.Snapshot();
+    expect(reg.Acquire(hud, snap) && snap->totals[0] == 18 + static_cast<long long>(numThreads) * numAdds,
+        "every add lands in exactly one frame");
+    StartupReport::Line("  %llu snapshots taken while counting\n", reg.GetFrameCount() - 3);
+
+    StartupReport::Line("\n=== Counters: totals from a benchmark's first frame ===\n");
+    patches.Add(100);
+    used.Set(2);
+    reg.ResetTotals();
+    patches.Add(4);
+    reg.Snapshot();
+    expect(reg.Acquire(hud, snap) && snap->frame == 1 && snap->values[0] == 4 && snap->totals[0] == 4,
+        "a reset drops what was counted before it");
+    expect(snap->totals[1] == 0 && snap->totals[2] == 2, "a gauge's peak starts again from its level");
+
+    return expect.Finish("counters");
+}
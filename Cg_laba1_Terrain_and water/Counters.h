@@ -0,0 +1,98 @@
+#pragma once
+#include "TripleBuffer.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// COUNTER_PER_FRAME: what happened since the last snapshot (patches drawn, bytes uploaded); the
+// snapshot takes the value and starts again from 0. COUNTER_GAUGE: a level (descriptors in use),
+// read as it is.
+enum CounterKind { COUNTER_PER_FRAME, COUNTER_GAUGE };
+
+// One named value. Add and Set are a single relaxed atomic each, safe from any thread.
+class Counter {
+public:
+    void Add(long long n = 1) { m_val.fetch_add(n, std::memory_order_relaxed); }
+    void Set(long long val) { m_val.store(val, std::memory_order_relaxed); }
+
+    const char* GetName() const { return m_name; }
+    const char* GetUnit() const { return m_unit; }
+    CounterKind GetKind() const { return m_kind; }
+    unsigned int GetIndex() const { return m_index; }
+
+private:
+    friend class CounterRegistry;
+
+    std::atomic<long long>  m_val{ 0 };
+    const char*             m_name = nullptr;
+    const char*             m_unit = "";
+    CounterKind             m_kind = COUNTER_PER_FRAME;
+    unsigned int            m_index = 0;
+};
+
+// The values of every counter at the end of one frame, by Counter::GetIndex.
+struct CounterSnapshot {
+    unsigned long long      frame = 0;
+    std::vector<long long>  values;     // the frame's amount, or the gauge's level
+    std::vector<long long>  totals;     // per-frame counters summed since the start, the highest level of a gauge
+};
+
+// Named counters behind a registry. Code that counts registers once (a function-local static is
+// enough) and then only adds to its Counter. Once a frame the render thread calls Snapshot, which
+// publishes the values to every reader through a triple buffer of its own; a reader (the window title,
+// a log, a benchmark) takes the newest snapshot whenever it likes, never waiting and never slowing the
+// threads that count.
+class CounterRegistry {
+public:
+    static const unsigned int MAX_COUNTERS = 64;
+    static const unsigned int MAX_READERS = 4;
+
+    // Lives to the end of the process, like the counters handed out.
+    static CounterRegistry& Get();
+
+    CounterRegistry() = default;
+    CounterRegistry(const CounterRegistry&) = delete;
+    CounterRegistry& operator=(const CounterRegistry&) = delete;
+
+    // name and unit are literals. The same name returns the same counter. Past MAX_COUNTERS a counter
+    // that no snapshot reads.
+    Counter& Register(const char* name, CounterKind kind, const char* unit = "");
+    unsigned int GetCount() const { return m_numCounters.load(std::memory_order_acquire); }
+    const Counter& GetCounter(unsigned int i) const { return m_counters[i]; }
+    // -1 when no counter has that name.
+    int Find(const char* name) const;
+
+    // A reader with its own buffer; MAX_READERS, which never reads anything, when there is no room left.
+    unsigned int AddReader();
+    // Reader: the newest snapshot since its last call; false when there is none. The snapshot stays
+    // valid until the reader's next successful Acquire.
+    bool Acquire(unsigned int reader, const CounterSnapshot*& snap);
+
+    // Once a frame, from one thread.
+    void Snapshot();
+    // Totals and the frame count start again from the next snapshot, and what was counted since the last one
+    // is dropped; a gauge's peak starts from its current level. Snapshot thread, or before it takes the first.
+    void ResetTotals();
+    unsigned long long GetFrameCount() const { return m_numFrames; }
+
+    // "name value unit | ..." for a log.
+    std::string Format(const CounterSnapshot& snap) const;
+    // Averages per frame and totals since the start. Snapshot thread.
+    void Report() const;
+
+    // Registration, per-frame reset, gauges, readers and counting from several threads. Prints what it
+    // checks. Needs no device.
+    static bool SelfTest();
+
+private:
+    Counter                                             m_counters[MAX_COUNTERS];
+    Counter                                             m_counterOverflow;
+    std::atomic<unsigned int>                           m_numCounters{ 0 };
+    std::unique_ptr<TripleBuffer<CounterSnapshot>>      m_pReaders[MAX_READERS];
+    std::atomic<unsigned int>                           m_numReaders{ 0 };
+    std::mutex                                          m_mtx;          // Register, AddReader
+    std::vector<long long>                              m_listTotals;   // snapshot thread
+    unsigned long long                                  m_numFrames = 0;
+};
@@ -1,26 +1,20 @@
 #include "Frame.h"
 #include <string>
-#include <cstring>
 
 Frame::Frame(unsigned int indexFrame, Device* dev, ResourceManager* rm, unsigned int h, unsigned int w,
-    unsigned int dimShadowAtlas)
+    ID3D12Resource* depthStencil, ID3D12Resource* shadowAtlas, unsigned int dimShadowAtlas)
     : m_pDev(dev), m_pResMgr(rm), m_iFrame(indexFrame), m_hScreen(h),
     m_wScreen(w), m_wShadowAtlas(dimShadowAtlas), m_hShadowAtlas(dimShadowAtlas)
 {
-    m_pCmdAllocator = nullptr;
+    for (unsigned int i = 0; i < FRAME_PASS_COUNT; ++i) m_pCmdAllocators[i] = nullptr;
     m_pBackBuffer = nullptr;
-    m_pDepthStencilBuffer = nullptr;
-    m_pFence = nullptr;
-    m_hdlFenceEvent = nullptr;
-    m_pFrameConstants = nullptr;
-    m_pFrameConstantsMapped = nullptr;
-    for (int i = 0; i < 4; ++i) {
-        m_pShadowConstants[i] = nullptr;
-        m_pShadowConstantsMapped[i] = nullptr;
-    }
+    m_pDepthStencilBuffer = depthStencil;
+    m_pShadowAtlas = shadowAtlas;
 
-    // command allocator
-    m_pDev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, m_pCmdAllocator);
+    // command allocators, one per pass
+    for (unsigned int i = 0; i < FRAME_PASS_COUNT; ++i) {
+        m_pDev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, m_pCmdAllocators[i]);
+    }
 
     // back buffer RTV
     m_pDev->GetBackBuffer(m_iFrame, m_pBackBuffer);
@@ -28,67 +22,29 @@ Frame::Frame(unsigned int indexFrame, Device* dev, ResourceManager* rm, unsigned
     m_pResMgr->AddExistingResource(m_pBackBuffer);
     m_pResMgr->AddRTV(m_pBackBuffer, nullptr, m_hdlBackBuffer);
 
-    // depth/stencil buffer
-    D3D12_CLEAR_VALUE dsOptimizedClearValue = {};
-    dsOptimizedClearValue.Format = DXGI_FORMAT_D32_FLOAT;
-    dsOptimizedClearValue.DepthStencil.Depth = 1.0f;
-    dsOptimizedClearValue.DepthStencil.Stencil = 0;
-
-    D3D12_RESOURCE_DESC dsDesc =
-        CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, m_wScreen, m_hScreen, 1, 0, 1, 0,
-            D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
-    CD3DX12_HEAP_PROPERTIES defHeapProps(D3D12_HEAP_TYPE_DEFAULT);
-
-    m_pResMgr->NewBuffer(m_pDepthStencilBuffer, &dsDesc, &defHeapProps,
-        D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_DEPTH_WRITE, &dsOptimizedClearValue);
-    m_pDepthStencilBuffer->SetName((L"Depth/Stencil Buffer " + std::to_wstring(m_iFrame)).c_str());
-
-    // DSV for scene depth
+    // DSV for scene depth (D32, see Scene::InitRenderGraph)
     D3D12_DEPTH_STENCIL_VIEW_DESC descDSV = {};
-    descDSV.Format = dsOptimizedClearValue.Format;
+    descDSV.Format = DXGI_FORMAT_D32_FLOAT;
     descDSV.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
     descDSV.Flags = D3D12_DSV_FLAG_NONE;
     m_pResMgr->AddDSV(m_pDepthStencilBuffer, &descDSV, m_hdlDSV);
 
-    // fence
-    m_valFence = 0;
-    m_pDev->CreateFence(m_valFence, D3D12_FENCE_FLAG_NONE, m_pFence);
-    m_hdlFenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    if (!m_hdlFenceEvent) {
-        throw GFX_Exception("Frame::Frame: Create Fence Event failed on init.");
-    }
-
-    InitShadowAtlas();
-    InitConstantBuffers();
+    InitShadowAtlasViews();
 }
 
 Frame::~Frame() {
-    if (m_hdlFenceEvent) CloseHandle(m_hdlFenceEvent);
-
-    if (m_pFence) { m_pFence->Release(); m_pFence = nullptr; }
-    if (m_pCmdAllocator) { m_pCmdAllocator->Release(); m_pCmdAllocator = nullptr; }
+    for (unsigned int i = 0; i < FRAME_PASS_COUNT; ++i) {
+        if (m_pCmdAllocators[i]) { m_pCmdAllocators[i]->Release(); m_pCmdAllocators[i] = nullptr; }
+    }
 
     m_pDev = nullptr;
     m_pResMgr = nullptr;
     m_pDepthStencilBuffer = nullptr;
+    m_pShadowAtlas = nullptr;
     m_pBackBuffer = nullptr;
-
-    if (m_pFrameConstants) {
-        m_pFrameConstants->Unmap(0, nullptr);
-        m_pFrameConstantsMapped = nullptr;
-        m_pFrameConstants = nullptr;
-    }
-
-    for (int i = 0; i < 4; ++i) {
-        if (m_pShadowConstants[i]) {
-            m_pShadowConstants[i]->Unmap(0, nullptr);
-            m_pShadowConstantsMapped[i] = nullptr;
-            m_pShadowConstants[i] = nullptr;
-        }
-    }
 }
 
-void Frame::InitShadowAtlas() {
+void Frame::InitShadowAtlasViews() {
     // viewports/scissors for 2x2 atlas
     int w = m_wShadowAtlas / 2;
     int h = m_hShadowAtlas / 2;
@@ -109,25 +65,7 @@ void Frame::InitShadowAtlas() {
         }
     }
 
-    // typeless 24/8 texture for depth + SRV
-    D3D12_RESOURCE_DESC descTex = {};
-    descTex.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-    descTex.Alignment = 0;
-    descTex.Width = m_wShadowAtlas;
-    descTex.Height = m_hShadowAtlas;
-    descTex.DepthOrArraySize = 1;
-    descTex.MipLevels = 1;
-    descTex.Format = DXGI_FORMAT_R24G8_TYPELESS;
-    descTex.SampleDesc.Count = 1;
-    descTex.SampleDesc.Quality = 0;
-    descTex.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
-    descTex.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
-
-    D3D12_CLEAR_VALUE clearValue = {};
-    clearValue.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
-    clearValue.DepthStencil.Depth = 1.0f;
-    clearValue.DepthStencil.Stencil = 0;
-
+    // the atlas is a typeless 24/8 texture: depth view for the cascades, SRV for the main pass
     D3D12_DEPTH_STENCIL_VIEW_DESC descDSV = {};
     descDSV.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
     descDSV.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
@@ -139,133 +77,56 @@ void Frame::InitShadowAtlas() {
     descSRV.Format = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
     descSRV.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
     descSRV.Texture2D.MostDetailedMip = 0;
-    descSRV.Texture2D.MipLevels = descTex.MipLevels;
+    descSRV.Texture2D.MipLevels = 1;
     descSRV.Texture2D.PlaneSlice = 0;
     descSRV.Texture2D.ResourceMinLODClamp = 0.0f;
 
-    CD3DX12_HEAP_PROPERTIES defaultProps(D3D12_HEAP_TYPE_DEFAULT);
-
-    m_pResMgr->NewBuffer(m_pShadowAtlas, &descTex, &defaultProps,
-        D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, &clearValue);
-    m_pShadowAtlas->SetName((L"Shadow Atlas Texture " + std::to_wstring(m_iFrame)).c_str());
     m_pResMgr->AddDSV(m_pShadowAtlas, &descDSV, m_hdlShadowAtlasDSV);
     m_pResMgr->AddSRV(m_pShadowAtlas, &descSRV, m_hdlShadowAtlasSRV_CPU, m_hdlShadowAtlasSRV_GPU);
 }
 
-void Frame::InitConstantBuffers() {
-    // per-frame CB
-    UINT64 sizeofBuffer = sizeof(PerFrameConstantBuffer);
-    D3D12_RESOURCE_DESC cbDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeofBuffer);
-    CD3DX12_HEAP_PROPERTIES uploadProps(D3D12_HEAP_TYPE_UPLOAD);
-
-    m_pResMgr->NewBuffer(m_pFrameConstants, &cbDesc, &uploadProps,
-        D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr);
-    m_pFrameConstants->SetName((L"Frame Constant Buffer " + std::to_wstring(m_iFrame)).c_str());
-
-    D3D12_CONSTANT_BUFFER_VIEW_DESC descCBV = {};
-    descCBV.BufferLocation = m_pFrameConstants->GetGPUVirtualAddress();
-    descCBV.SizeInBytes = static_cast<UINT>((sizeofBuffer + 255) & ~255);
-    m_pResMgr->AddCBV(&descCBV, m_hdlFrameConstantsCBV_CPU, m_hdlFrameConstantsCBV_GPU);
-
-    CD3DX12_RANGE rangeRead(0, 0);
-    if (FAILED(m_pFrameConstants->Map(0, &rangeRead, reinterpret_cast<void**>(&m_pFrameConstantsMapped)))) {
-        throw GFX_Exception("Frame::InitConstantBuffers failed on Frame Constant Buffer.");
-    }
-
-    // shadow CBs (four cascades)
-    for (int i = 0; i < 4; ++i) {
-        sizeofBuffer = sizeof(ShadowMapShaderConstants);
-        D3D12_RESOURCE_DESC shDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeofBuffer);
-
-        m_pResMgr->NewBuffer(m_pShadowConstants[i], &shDesc, &uploadProps,
-            D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr);
-        m_pShadowConstants[i]->SetName((L"Shadow Constant Buffer " + std::to_wstring(m_iFrame) + L", " + std::to_wstring(i)).c_str());
-
-        descCBV.BufferLocation = m_pShadowConstants[i]->GetGPUVirtualAddress();
-        descCBV.SizeInBytes = static_cast<UINT>((sizeofBuffer + 255) & ~255);
-        m_pResMgr->AddCBV(&descCBV, m_hdlShadowConstantsCBV_CPU[i], m_hdlShadowConstantsCBV_GPU[i]);
-
-        if (FAILED(m_pShadowConstants[i]->Map(0, &rangeRead, reinterpret_cast<void**>(&m_pShadowConstantsMapped[i])))) {
-            throw GFX_Exception(("Frame::InitConstantBuffers failed on Shadow Constant Buffer " + std::to_string(i)).c_str());
+void Frame::Reset() {
+    for (unsigned int i = 0; i < FRAME_PASS_COUNT; ++i) {
+        if (FAILED(m_pCmdAllocators[i]->Reset())) {
+            throw GFX_Exception("Frame::Reset: CommandAllocator Reset failed.");
         }
     }
 }
 
-void Frame::WaitForGPU() {
-    m_pDev->SetFence(m_pFence, m_valFence);
-
-    if (FAILED(m_pFence->SetEventOnCompletion(m_valFence, m_hdlFenceEvent))) {
-        throw GFX_Exception("Frame::WaitForGPU failed to SetEventOnCompletion.");
-    }
-
-    WaitForSingleObject(m_hdlFenceEvent, INFINITE);
-    ++m_valFence;
-}
-
-void Frame::Reset() {
-    WaitForGPU();
-}
-
-void Frame::AttachCommandList(ID3D12GraphicsCommandList* cmdList) {
-    if (FAILED(cmdList->Reset(m_pCmdAllocator, nullptr))) {
+void Frame::AttachCommandList(CommandList* cmdList, unsigned int iPass) {
+    if (FAILED(cmdList->Reset(m_pCmdAllocators[iPass], nullptr))) {
         throw GFX_Exception("Frame::AttachCommandList: CommandList Reset failed.");
     }
 }
 
-void Frame::SetFrameConstants(PerFrameConstantBuffer frameConstants) {
-    std::memcpy(m_pFrameConstantsMapped, &frameConstants, sizeof(PerFrameConstantBuffer));
-}
-
-void Frame::SetShadowConstants(ShadowMapShaderConstants shadowConstants, unsigned int i) {
-    std::memcpy(m_pShadowConstantsMapped[i], &shadowConstants, sizeof(ShadowMapShaderConstants));
-}
-
-void Frame::BeginShadowPass(ID3D12GraphicsCommandList* cmdList) {
-    D3D12_RESOURCE_BARRIER toWrite =
-        CD3DX12_RESOURCE_BARRIER::Transition(m_pShadowAtlas,
-            D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE);
-    cmdList->ResourceBarrier(1, &toWrite);
-
+void Frame::BeginShadowPass(CommandList* cmdList) {
+    // the clear also initialises the atlas after an aliasing barrier
     cmdList->ClearDepthStencilView(m_hdlShadowAtlasDSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
     cmdList->OMSetRenderTargets(0, nullptr, FALSE, &m_hdlShadowAtlasDSV);
 }
 
-void Frame::EndShadowPass(ID3D12GraphicsCommandList* cmdList) {
-    D3D12_RESOURCE_BARRIER toSRV =
-        CD3DX12_RESOURCE_BARRIER::Transition(m_pShadowAtlas,
-            D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-    cmdList->ResourceBarrier(1, &toSRV);
+void Frame::ResumeShadowPass(CommandList* cmdList) {
+    // render targets do not carry over between command lists
+    cmdList->OMSetRenderTargets(0, nullptr, FALSE, &m_hdlShadowAtlasDSV);
 }
 
-void Frame::BeginRenderPass(ID3D12GraphicsCommandList* cmdList, const float clearColor[4]) {
-    D3D12_RESOURCE_BARRIER toRT =
-        CD3DX12_RESOURCE_BARRIER::Transition(m_pBackBuffer,
-            D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET);
-    cmdList->ResourceBarrier(1, &toRT);
-
+void Frame::BeginRenderPass(CommandList* cmdList, const float clearColor[4]) {
     cmdList->ClearRenderTargetView(m_hdlBackBuffer, clearColor, 0, nullptr);
     cmdList->ClearDepthStencilView(m_hdlDSV, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
 
     cmdList->OMSetRenderTargets(1, &m_hdlBackBuffer, FALSE, &m_hdlDSV);
 }
 
-void Frame::EndRenderPass(ID3D12GraphicsCommandList* cmdList) {
-    D3D12_RESOURCE_BARRIER toPresent =
-        CD3DX12_RESOURCE_BARRIER::Transition(m_pBackBuffer,
-            D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT);
-    cmdList->ResourceBarrier(1, &toPresent);
-}
-
-void Frame::AttachShadowPassResources(unsigned int i, ID3D12GraphicsCommandList* cmdList,
-    unsigned int cbvDescTableIndex) {
+void Frame::AttachShadowPassResources(unsigned int i, CommandList* cmdList,
+    unsigned int cbvRootIndex, D3D12_GPU_VIRTUAL_ADDRESS vaConstants) {
     cmdList->RSSetViewports(1, &m_vpShadowAtlas[i]);
     cmdList->RSSetScissorRects(1, &m_srShadowAtlas[i]);
 
-    cmdList->SetGraphicsRootDescriptorTable(cbvDescTableIndex, m_hdlShadowConstantsCBV_GPU[i]);
+    cmdList->SetGraphicsRootConstantBufferView(cbvRootIndex, vaConstants);
 }
 
-void Frame::AttachFrameResources(ID3D12GraphicsCommandList* cmdList, unsigned int srvDescTableIndex,
-    unsigned int cbvDescTableIndex) {
+void Frame::AttachFrameResources(CommandList* cmdList, unsigned int srvDescTableIndex,
+    unsigned int cbvRootIndex, D3D12_GPU_VIRTUAL_ADDRESS vaConstants) {
     cmdList->SetGraphicsRootDescriptorTable(srvDescTableIndex, m_hdlShadowAtlasSRV_GPU);
-    cmdList->SetGraphicsRootDescriptorTable(cbvDescTableIndex, m_hdlFrameConstantsCBV_GPU);
+    cmdList->SetGraphicsRootConstantBufferView(cbvRootIndex, vaConstants);
 }
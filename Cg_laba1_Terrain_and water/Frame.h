@@ -21,60 +21,60 @@ struct ShadowMapShaderConstants {
 	XMFLOAT4	frustum[4];
 };
 
+// Command lists a frame records: one per shadow cascade, then the main pass. Each has its own
+// allocator so the lists can be recorded on different threads at once.
+static const unsigned int FRAME_PASS_COUNT = 5;
+static const unsigned int FRAME_PASS_MAIN = 4;
+
+// Per-frame resources: allocators, the back buffer and views on the depth buffer and
+// shadow atlas. The last two are render graph transients shared by all frames; the graph's barriers
+// put them into the state each pass needs, so the Begin* calls only clear and bind.
 class Frame {
 public:
 	Frame(unsigned int indexFrame, Device* dev, ResourceManager* rm, unsigned int h, unsigned int w,
-		unsigned int dimShadowAtlas = 4096);
+		ID3D12Resource* depthStencil, ID3D12Resource* shadowAtlas, unsigned int dimShadowAtlas = 4096);
 	~Frame();
 
-	ID3D12CommandAllocator* GetAllocator() { return m_pCmdAllocator; }
+	ID3D12Resource* GetBackBuffer() const { return m_pBackBuffer; }
+
+	ID3D12CommandAllocator* GetAllocator(unsigned int iPass = 0) { return m_pCmdAllocators[iPass]; }
 
+	// Resets the allocators. The FrameScheduler has made sure the GPU is done with this frame's commands.
 	void Reset();
 
-	void AttachCommandList(ID3D12GraphicsCommandList* cmdList);
+	// Resets cmdList onto the allocator of pass iPass.
+	void AttachCommandList(CommandList* cmdList, unsigned int iPass = 0);
 
-	void SetFrameConstants(PerFrameConstantBuffer frameConstants);
-	void SetShadowConstants(ShadowMapShaderConstants shadowConstants, unsigned int i);
-	void BeginShadowPass(ID3D12GraphicsCommandList* cmdList);
-	void EndShadowPass(ID3D12GraphicsCommandList* cmdList);
-	void BeginRenderPass(ID3D12GraphicsCommandList* cmdList, const float clearColor[4]);
-	void EndRenderPass(ID3D12GraphicsCommandList* cmdList);
-	void AttachShadowPassResources(unsigned int i, ID3D12GraphicsCommandList* cmdList,
-		unsigned int cbvDescTableIndex);
+	// Clears the shadow atlas and binds it; the atlas is in depth write.
+	void BeginShadowPass(CommandList* cmdList);
+	// Binds the shadow atlas in a further command list of the shadow pass; BeginShadowPass went before it.
+	void ResumeShadowPass(CommandList* cmdList);
+	// Clears and binds the back buffer and depth buffer; both are in their target states.
+	void BeginRenderPass(CommandList* cmdList, const float clearColor[4]);
+	// Viewport of cascade i and its constants, pushed to the ConstantAllocator, as a root CBV.
+	void AttachShadowPassResources(unsigned int i, CommandList* cmdList,
+		unsigned int cbvRootIndex, D3D12_GPU_VIRTUAL_ADDRESS vaConstants);
 
-	void AttachFrameResources(ID3D12GraphicsCommandList* cmdList, unsigned int srvDescTableIndex,
-		unsigned int cbvDescTableIndex);
+	// The shadow atlas SRV and the frame constants as a root CBV.
+	void AttachFrameResources(CommandList* cmdList, unsigned int srvDescTableIndex,
+		unsigned int cbvRootIndex, D3D12_GPU_VIRTUAL_ADDRESS vaConstants);
 
 private:
-	void InitShadowAtlas();
-	void InitConstantBuffers();
-
-	void WaitForGPU();
+	void InitShadowAtlasViews();
 
 	Device* m_pDev;
 	ResourceManager* m_pResMgr;
-	ID3D12CommandAllocator* m_pCmdAllocator;
+	ID3D12CommandAllocator* m_pCmdAllocators[FRAME_PASS_COUNT];
 	ID3D12Resource* m_pBackBuffer;
 	ID3D12Resource* m_pDepthStencilBuffer;
 	ID3D12Resource* m_pShadowAtlas;
-	ID3D12Resource* m_pFrameConstants;
-	ID3D12Resource* m_pShadowConstants[4];
-	ID3D12Fence* m_pFence;
-	HANDLE						m_hdlFenceEvent;
 	D3D12_CPU_DESCRIPTOR_HANDLE m_hdlBackBuffer;
 	D3D12_CPU_DESCRIPTOR_HANDLE m_hdlDSV;
 	D3D12_CPU_DESCRIPTOR_HANDLE m_hdlShadowAtlasDSV;
 	D3D12_CPU_DESCRIPTOR_HANDLE m_hdlShadowAtlasSRV_CPU;
 	D3D12_GPU_DESCRIPTOR_HANDLE m_hdlShadowAtlasSRV_GPU;
-	D3D12_CPU_DESCRIPTOR_HANDLE m_hdlFrameConstantsCBV_CPU;
-	D3D12_GPU_DESCRIPTOR_HANDLE m_hdlFrameConstantsCBV_GPU;
-	D3D12_CPU_DESCRIPTOR_HANDLE m_hdlShadowConstantsCBV_CPU[4];
-	D3D12_GPU_DESCRIPTOR_HANDLE m_hdlShadowConstantsCBV_GPU[4];
 	D3D12_VIEWPORT				m_vpShadowAtlas[4];
 	D3D12_RECT					m_srShadowAtlas[4];
-	PerFrameConstantBuffer* m_pFrameConstantsMapped;
-	ShadowMapShaderConstants* m_pShadowConstantsMapped[4];
-	unsigned long long			m_valFence;						// Value to check fence against to confirm GPU is done.
 	unsigned int				m_iFrame;						// Which frame number is this frame?
 	unsigned int				m_wScreen;
 	unsigned int				m_hScreen;
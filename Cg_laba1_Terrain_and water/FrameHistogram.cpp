@@ -0,0 +1,166 @@
+#include "FrameHistogram.h"
+#include "SelfTest.h"
+#include "StartupReport.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+FrameHistogram::FrameHistogram()
+    : m_listCounts(GetBucket(MAX_US) + 1, 0) {}
+
+unsigned int FrameHistogram::GetBucket(unsigned long long us) {
+    if (us > MAX_US) us = MAX_US;
+    if (us < 2 * SUB_BUCKETS) return static_cast<unsigned int>(us);
+    // the top SUB_BUCKET_BITS + 1 bits pick the bucket, the rest is dropped
+    unsigned int shift = 0;
+    while ((us >> shift) >= 2 * SUB_BUCKETS) ++shift;
+    return SUB_BUCKETS * shift + static_cast<unsigned int>(us >> shift);
+}
+
+unsigned long long FrameHistogram::GetBucketTop(unsigned int i) {
+    if (i < 2 * SUB_BUCKETS) return i;
+    const unsigned int shift = i / SUB_BUCKETS - 1;
+    const unsigned long long top = i - SUB_BUCKETS * shift;
+    return ((top + 1) << shift) - 1;
+}
+
+void FrameHistogram::Record(double ms) {
+    const unsigned long long us = ms > 0.0 ? static_cast<unsigned long long>(ms * 1000.0 + 0.5) : 0;
+    ++m_listCounts[GetBucket(us)];
+    ++m_num;
+    m_msMax = (std::max)(m_msMax, ms);
+}
+
+void FrameHistogram::Add(const FrameHistogram& other) {
+    for (size_t i = 0; i < m_listCounts.size(); ++i) m_listCounts[i] += other.m_listCounts[i];
+    m_num += other.m_num;
+    m_msMax = (std::max)(m_msMax, other.m_msMax);
+}
+
+void FrameHistogram::Reset() {
+    std::fill(m_listCounts.begin(), m_listCounts.end(), 0u);
+    m_num = 0;
+    m_msMax = 0.0;
+}
+
+double FrameHistogram::GetPercentile(double p) const {
+    if (!m_num) return 0.0;
+    // the rank of the frame that p percent of the frames do not exceed, from 1
+    const double rank = std::ceil((std::min)((std::max)(p, 0.0), 100.0) / 100.0 * static_cast<double>(m_num));
+    const unsigned long long target = (std::max)(static_cast<unsigned long long>(rank), 1ull);
+    unsigned long long sum = 0;
+    for (unsigned int i = 0; i < m_listCounts.size(); ++i) {
+        sum += m_listCounts[i];
+        if (sum >= target) return (std::min)(static_cast<double>(GetBucketTop(i)) / 1000.0, m_msMax);
+    }
+    return m_msMax;
+}
+
+FramePercentiles FrameHistogram::GetPercentiles() const {
+    FramePercentiles pct;
+    pct.count = m_num;
+    pct.p50 = GetPercentile(50.0);
+    pct.p95 = GetPercentile(95.0);
+    pct.p99 = GetPercentile(99.0);
+    pct.max = m_msMax;
+    return pct;
+}
+
+bool WriteFrameWindowsCSV(const std::filesystem::path& fn, const std::vector<FrameWindow>& windows, const FrameWindow& total) {
+    std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out << "start_s,frames,cpu_p50_ms,cpu_p95_ms,cpu_p99_ms,cpu_max_ms,gpu_p50_ms,gpu_p95_ms,gpu_p99_ms,gpu_max_ms,"
+        "present_p50_ms,present_p95_ms,present_p99_ms,present_max_ms\n";
+    char buf[64];
+    auto writeRow = [&](const FrameWindow& w, bool isTotal) {
+        if (!isTotal) { snprintf(buf, sizeof(buf), "%.3f", w.sStart); out << buf; }
+        out << ',' << w.present.count;
+        for (const FramePercentiles* pct : { &w.cpu, &w.gpu, &w.present }) {
+            snprintf(buf, sizeof(buf), ",%.3f,%.3f,%.3f,%.3f", pct->p50, pct->p95, pct->p99, pct->max);
+            out << buf;
+        }
+        out << '\n';
+    };
+    for (const FrameWindow& w : windows) writeRow(w, false);
+    writeRow(total, true);
+    return static_cast<bool>(out);
+}
+
+bool FrameHistogram::SelfTest() {
+    SelfTestExpect expect;
+
+    StartupReport::Line("\n=== Frame histogram: buckets ===\n");
+    bool isExact = true, isClose = true, isOrdered = true;
+    unsigned int last = 0;
+    for (unsigned long long us = 0; us < 2 * SUB_BUCKETS; ++us) isExact = isExact && GetBucketTop(GetBucket(us)) == us;
+    for (unsigned long long us = 1; us <= MAX_US; us += 1 + us / 97) {
+        const unsigned int i = GetBucket(us);
+        const unsigned long long top = GetBucketTop(i);
+        isClose = isClose && top >= us && static_cast<double>(top - us) <= static_cast<double>(us) / SUB_BUCKETS;
+        isOrdered = isOrdered && i >= last;
+        last = i;
+    }
+    expect(isExact, "exact below 2 * SUB_BUCKETS us");
+    expect(isClose, "a bucket's top is within 1/SUB_BUCKETS above the time");
+    expect(isOrdered, "longer times never land in earlier buckets");
+
+    StartupReport::Line("\n=== Frame histogram: percentiles ===\n");
+    // 16.6 ms frames with a jitter, a hitch of 40..200 ms every 50th frame
+    FrameHistogram hist, first, second;
+    std::vector<double> listMs;
+    unsigned int seed = 12345;
+    auto next = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / static_cast<double>(1u << 24); };
+    for (unsigned int f = 0; f < 100000; ++f) {
+        const double ms = (f % 50 == 49) ? 40.0 + 160.0 * next() : 16.6 + 2.0 * (next() - 0.5);
+        listMs.push_back(ms);
+        hist.Record(ms);
+        (f < 50000 ? first : second).Record(ms);
+    }
+    std::vector<double> sorted = listMs;
+    std::sort(sorted.begin(), sorted.end());
+    auto exact = [&sorted](double p) {
+        const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+        return sorted[(std::max)(rank, size_t(1)) - 1];
+    };
+    auto isNear = [](double got, double want) { return got >= want && got - want <= want / SUB_BUCKETS + 0.001; };
+    StartupReport::Line("  p50 %.3f (%.3f)  p95 %.3f (%.3f)  p99 %.3f (%.3f)  max %.3f ms\n",
+        hist.GetPercentile(50.0), exact(50.0), hist.GetPercentile(95.0), exact(95.0),
+        hist.GetPercentile(99.0), exact(99.0), hist.GetMax());
+    expect(isNear(hist.GetPercentile(50.0), exact(50.0)) && isNear(hist.GetPercentile(95.0), exact(95.0)) &&
+        isNear(hist.GetPercentile(99.0), exact(99.0)), "p50, p95, p99 within a bucket of the sorted frames");
+    expect(hist.GetPercentile(95.0) < 20.0 && hist.GetPercentile(99.0) > 40.0, "hitches show at p99, not at p95");
+    expect(hist.GetMax() == sorted.back() && hist.GetPercentile(100.0) == sorted.back(), "the max is exact");
+
+    first.Add(second);
+    expect(first.GetCount() == hist.GetCount() && first.GetPercentile(99.0) == hist.GetPercentile(99.0) &&
+        first.GetMax() == hist.GetMax(), "two halves added give the whole");
+    first.Reset();
+    expect(first.GetCount() == 0 && first.GetPercentile(50.0) == 0.0, "a reset histogram is empty");
+
+    FrameHistogram far;
+    far.Record(-1.0);
+    far.Record(120000.0);
+    expect(far.GetPercentile(50.0) == 0.0 && far.GetMax() == 120000.0 && far.GetPercentile(100.0) >= MAX_US / 1000.0,
+        "negative times count as 0, past MAX_US in the last bucket");
+
+    StartupReport::Line("\n=== Frame histogram: CSV ===\n");
+    const std::filesystem::path fn = std::filesystem::temp_directory_path() / "frame_histogram_selftest.csv";
+    FrameWindow w;
+    w.sStart = 1.0;
+    w.cpu = w.gpu = w.present = hist.GetPercentiles();
+    expect(WriteFrameWindowsCSV(fn, { w, w }, w), "written");
+    std::ifstream in(fn, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    in.close();
+    const std::string text = ss.str();
+    expect(std::count(text.begin(), text.end(), '\n') == 4 && text.find("\n1.000,100000,") != std::string::npos &&
+        text.find("\n,100000,") != std::string::npos, "a header, two windows and the total");
+    std::error_code ec;
+    std::filesystem::remove(fn, ec);
+
+    return expect.Finish("frame histogram");
+}
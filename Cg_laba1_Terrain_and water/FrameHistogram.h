@@ -0,0 +1,58 @@
+#pragma once
+#include <filesystem>
+#include <vector>
+
+// The tail of a run of frame times, in ms.
+struct FramePercentiles {
+    unsigned long long  count = 0;
+    double              p50 = 0.0;
+    double              p95 = 0.0;
+    double              p99 = 0.0;
+    double              max = 0.0;
+};
+
+// Latency histogram in the manner of HdrHistogram: times in microseconds, exact up to 2 * SUB_BUCKETS us,
+// then SUB_BUCKETS buckets for every power of two above, so a percentile is off by less than 1% at any
+// scale. Recording is an index and an increment: no allocation, no sorting, nothing that grows with the
+// number of frames. Times past MAX_US land in the last bucket; the max is kept exactly.
+class FrameHistogram {
+public:
+    static const unsigned int SUB_BUCKET_BITS = 7;
+    static const unsigned int SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static const unsigned long long MAX_US = 60ull * 1000 * 1000;
+
+    FrameHistogram();
+
+    void Record(double ms);
+    void Add(const FrameHistogram& other);
+    void Reset();
+
+    unsigned long long GetCount() const { return m_num; }
+    // The time below which p percent of the recorded frames fall (the top of its bucket); 0 when empty.
+    double GetPercentile(double p) const;
+    double GetMax() const { return m_msMax; }
+    FramePercentiles GetPercentiles() const;
+
+    // Bucketing, percentiles against a sorted copy, merging and the far end. Prints what it checks.
+    static bool SelfTest();
+
+private:
+    static unsigned int GetBucket(unsigned long long us);
+    // The highest time that falls into bucket i, in us.
+    static unsigned long long GetBucketTop(unsigned int i);
+
+    std::vector<unsigned int>   m_listCounts;
+    unsigned long long          m_num = 0;
+    double                      m_msMax = 0.0;
+};
+
+// One window of frames as a CSV row: CPU, GPU and present-to-present percentiles.
+struct FrameWindow {
+    double              sStart = 0.0;       // since the first frame
+    FramePercentiles    cpu;
+    FramePercentiles    gpu;
+    FramePercentiles    present;
+};
+
+// Header and rows of the frame time CSV; the run as a whole goes last with an empty start.
+bool WriteFrameWindowsCSV(const std::filesystem::path& fn, const std::vector<FrameWindow>& windows, const FrameWindow& total);
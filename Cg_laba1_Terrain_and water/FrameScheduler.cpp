@@ -0,0 +1,184 @@
+#include "FrameScheduler.h"
+#include "StartupReport.h"
+#include <algorithm>
+
+// Frames go into one window of percentiles for about this long; a row of the CSV each.
+static const double FRAME_WINDOW_SECONDS = 1.0;
+
+FrameScheduler::FrameScheduler(Device* dev, ResourceManager* rm, unsigned int numSlots, unsigned int numInFlight)
+    : m_pDev(dev), m_pResMgr(rm),
+    m_numSlots((std::min)((std::max)(numSlots, 1u), MAX_FRAMES_IN_FLIGHT)),
+    m_numInFlight((std::min)((std::max)(numInFlight, 1u), m_numSlots))
+{
+    m_pDev->SetMaximumFrameLatency(m_numInFlight);
+
+    D3D12_QUERY_HEAP_DESC descHeap = {};
+    descHeap.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+    descHeap.Count = 2 * m_numSlots;
+    m_pDev->CreateQueryHeap(&descHeap, m_pQueryHeap);
+    m_pQueryHeap->SetName(L"Frame Timestamps");
+
+    D3D12_RESOURCE_DESC descReadback = CD3DX12_RESOURCE_DESC::Buffer(2 * m_numSlots * sizeof(unsigned long long));
+    CD3DX12_HEAP_PROPERTIES propsReadback(D3D12_HEAP_TYPE_READBACK);
+    m_pResMgr->NewBuffer(m_pReadback, &descReadback, &propsReadback, D3D12_HEAP_FLAG_NONE,
+        D3D12_RESOURCE_STATE_COPY_DEST, nullptr);
+    m_pReadback->SetName(L"Frame Timestamps Readback");
+
+    // stays mapped: a slot is read only after its frame has retired
+    void* mapped = nullptr;
+    if (FAILED(m_pReadback->Map(0, nullptr, &mapped))) throw GFX_Exception("FrameScheduler::FrameScheduler: Map failed.");
+    m_pTicks = static_cast<const unsigned long long*>(mapped);
+
+    m_msPerTick = 1000.0 / static_cast<double>(m_pDev->GetTimestampFrequency());
+}
+
+FrameScheduler::~FrameScheduler() {
+    // the readback buffer belongs to the ResourceManager; the caller has waited for the GPU
+    if (m_pReadback) { m_pReadback->Unmap(0, nullptr); m_pReadback = nullptr; }
+    m_pTicks = nullptr;
+    if (m_pQueryHeap) { m_pQueryHeap->Release(); m_pQueryHeap = nullptr; }
+    m_pResMgr = nullptr;
+    m_pDev = nullptr;
+}
+
+void FrameScheduler::BeginFrame() {
+    const clock::time_point t0 = clock::now();
+    m_pDev->WaitForFrameLatency(1000);
+    const clock::time_point t1 = clock::now();
+
+    m_timingLast.msWaitLatency = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    m_timingLast.msFrame = m_hasBegun ? std::chrono::duration<double, std::milli>(t0 - m_tBegin).count() : 0.0;
+    m_tBegin = t0;
+    m_tReady = t1;
+    m_hasBegun = true;
+}
+
+unsigned int FrameScheduler::AcquireSlot() {
+    const unsigned int slot = m_pDev->GetCurrentBackBuffer() % m_numSlots;
+
+    // the slot's resources are free once its last frame is done; the limit counts frames, not slots
+    unsigned long long val = m_valSlotFence[slot];
+    if (m_numFrames >= m_numInFlight) {
+        val = (std::max)(val, m_valFrameFence[(m_numFrames - m_numInFlight) % MAX_FRAMES_IN_FLIGHT]);
+    }
+    const clock::time_point t0 = clock::now();
+    m_pResMgr->WaitForFence(val);
+    m_timingLast.msWaitFence = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+    if (m_hasTimestamps[slot]) ReadTimestamps(slot);
+    m_iSlot = slot;
+    return slot;
+}
+
+void FrameScheduler::ReadTimestamps(unsigned int slot) {
+    const unsigned long long tickBegin = m_pTicks[2 * slot];
+    const unsigned long long tickEnd = m_pTicks[2 * slot + 1];
+    m_hasTimestamps[slot] = false;
+    if (tickEnd < tickBegin) return;
+
+    // slots retire in frame order, so the last end read belongs to the frame right before this one
+    m_timingLast.msGPUFrame = (tickEnd - tickBegin) * m_msPerTick;
+    m_timingLast.msGPUIdle = (m_tickLastEnd && tickBegin > m_tickLastEnd) ? (tickBegin - m_tickLastEnd) * m_msPerTick : 0.0;
+    m_tickLastEnd = tickEnd;
+
+    m_timingSum.msGPUFrame += m_timingLast.msGPUFrame;
+    m_timingSum.msGPUIdle += m_timingLast.msGPUIdle;
+    ++m_numTimedGPU;
+    m_histGPU.Record(m_timingLast.msGPUFrame);
+}
+
+void FrameScheduler::RecordBegin(CommandList* cmdList) {
+    cmdList->EndQuery(m_pQueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, 2 * m_iSlot);
+}
+
+void FrameScheduler::RecordEnd(CommandList* cmdList) {
+    cmdList->EndQuery(m_pQueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, 2 * m_iSlot + 1);
+    cmdList->ResolveQueryData(m_pQueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, 2 * m_iSlot, 2, m_pReadback,
+        2 * m_iSlot * sizeof(unsigned long long));
+}
+
+void FrameScheduler::EndFrame(unsigned long long valFence) {
+    m_valSlotFence[m_iSlot] = valFence;
+    m_valFrameFence[m_numFrames % MAX_FRAMES_IN_FLIGHT] = valFence;
+    m_hasTimestamps[m_iSlot] = true;
+    ++m_numFrames;
+
+    const clock::time_point now = clock::now();
+    // the first frame has no frame time yet and waits on startup work, leave it out
+    if (m_numFrames == 1) {
+        m_tFirstPresent = m_tLastPresent = m_tWindow = now;
+        return;
+    }
+    m_histCPU.Record(std::chrono::duration<double, std::milli>(now - m_tReady).count() - m_timingLast.msWaitFence);
+    m_histPresent.Record(std::chrono::duration<double, std::milli>(now - m_tLastPresent).count());
+    m_tLastPresent = now;
+    if (std::chrono::duration<double>(now - m_tWindow).count() >= FRAME_WINDOW_SECONDS) CloseWindow(now);
+
+    m_timingSum.msFrame += m_timingLast.msFrame;
+    m_timingSum.msWaitLatency += m_timingLast.msWaitLatency;
+    m_timingSum.msWaitFence += m_timingLast.msWaitFence;
+    m_msMaxWaitLatency = (std::max)(m_msMaxWaitLatency, m_timingLast.msWaitLatency);
+    m_msMaxWaitFence = (std::max)(m_msMaxWaitFence, m_timingLast.msWaitFence);
+    ++m_numTimed;
+}
+
+void FrameScheduler::CloseWindow(clock::time_point now) {
+    m_windowLast.sStart = std::chrono::duration<double>(m_tWindow - m_tFirstPresent).count();
+    m_windowLast.cpu = m_histCPU.GetPercentiles();
+    m_windowLast.gpu = m_histGPU.GetPercentiles();
+    m_windowLast.present = m_histPresent.GetPercentiles();
+    m_listWindows.push_back(m_windowLast);
+
+    m_histCPUAll.Add(m_histCPU);
+    m_histGPUAll.Add(m_histGPU);
+    m_histPresentAll.Add(m_histPresent);
+    m_histCPU.Reset();
+    m_histGPU.Reset();
+    m_histPresent.Reset();
+    m_tWindow = now;
+}
+
+FrameWindow FrameScheduler::GetTotal() const {
+    FrameHistogram cpu = m_histCPUAll, gpu = m_histGPUAll, present = m_histPresentAll;
+    cpu.Add(m_histCPU);
+    gpu.Add(m_histGPU);
+    present.Add(m_histPresent);
+    FrameWindow total;
+    total.cpu = cpu.GetPercentiles();
+    total.gpu = gpu.GetPercentiles();
+    total.present = present.GetPercentiles();
+    return total;
+}
+
+bool FrameScheduler::WriteCSV(const std::filesystem::path& fn) const {
+    std::vector<FrameWindow> windows = m_listWindows;
+    if (m_histPresent.GetCount()) {
+        FrameWindow w;
+        w.sStart = std::chrono::duration<double>(m_tWindow - m_tFirstPresent).count();
+        w.cpu = m_histCPU.GetPercentiles();
+        w.gpu = m_histGPU.GetPercentiles();
+        w.present = m_histPresent.GetPercentiles();
+        windows.push_back(w);
+    }
+    return WriteFrameWindowsCSV(fn, windows, GetTotal());
+}
+
+void FrameScheduler::Report() const {
+    if (!m_numTimed) return;
+    const double n = static_cast<double>(m_numTimed);
+    const double nGPU = m_numTimedGPU ? static_cast<double>(m_numTimedGPU) : 1.0;
+    StartupReport::Line("\n=== Frame pacing (%u of %u frames in flight, %llu frames) ===\n",
+        m_numInFlight, m_numSlots, m_numFrames);
+    StartupReport::Line("  CPU frame %.2f ms | waiting for the swap chain %.2f ms (max %.2f) | for the GPU %.2f ms (max %.2f)\n",
+        m_timingSum.msFrame / n, m_timingSum.msWaitLatency / n, m_msMaxWaitLatency,
+        m_timingSum.msWaitFence / n, m_msMaxWaitFence);
+    StartupReport::Line("  GPU frame %.2f ms | GPU idle between frames %.2f ms\n",
+        m_timingSum.msGPUFrame / nGPU, m_timingSum.msGPUIdle / nGPU);
+    const FrameWindow total = GetTotal();
+    StartupReport::Line("  %-28s %8s %8s %8s %8s\n", "ms", "p50", "p95", "p99", "max");
+    const struct { const char* name; const FramePercentiles& pct; } rows[] = {
+        { "CPU frame, without waits", total.cpu }, { "GPU frame", total.gpu }, { "Present to Present", total.present } };
+    for (const auto& row : rows) {
+        StartupReport::Line("  %-28s %8.2f %8.2f %8.2f %8.2f\n", row.name, row.pct.p50, row.pct.p95, row.pct.p99, row.pct.max);
+    }
+}
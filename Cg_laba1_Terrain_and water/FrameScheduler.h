@@ -0,0 +1,92 @@
+#pragma once
+#include "ResourceManager.h"
+#include "FrameHistogram.h"
+#include <chrono>
+#include <filesystem>
+#include <vector>
+
+static const unsigned int MAX_FRAMES_IN_FLIGHT = 3;
+
+// Where the time of a frame went. The CPU waits are those of the frame just ended; the GPU times
+// come from timestamps around a frame's command list and belong to the frame that retired last.
+struct FrameTiming {
+    double  msFrame = 0.0;          // CPU, BeginFrame to BeginFrame
+    double  msWaitLatency = 0.0;    // blocked on the swap chain's waitable object
+    double  msWaitFence = 0.0;      // blocked on the fence of a frame still on the GPU
+    double  msGPUFrame = 0.0;       // first to last command of the frame's list
+    double  msGPUIdle = 0.0;        // from the previous frame's last command to this frame's first
+};
+
+// Paces the frame loop. Frame resources come in numSlots slots that rotate with the back buffers;
+// at most numInFlight frames (1..numSlots) are recorded or on the GPU at once, so the CPU works on
+// frame N+1 while the GPU runs frame N. Waits go to the swap chain's latency object and to the
+// queue fence value signalled behind each frame, never to a sleep. Frame thread only.
+class FrameScheduler {
+public:
+    FrameScheduler(Device* dev, ResourceManager* rm, unsigned int numSlots, unsigned int numInFlight);
+    ~FrameScheduler();
+    FrameScheduler(const FrameScheduler&) = delete;
+    FrameScheduler& operator=(const FrameScheduler&) = delete;
+
+    // Start of a CPU frame, before input and simulation: waits until the swap chain takes another present.
+    void BeginFrame();
+    // Before recording: waits until the previous frame of the current back buffer's slot and the frame
+    // numInFlight frames back have retired, and returns the slot.
+    unsigned int AcquireSlot();
+    // Timestamps around the frame's commands; RecordEnd also resolves them for reading once the frame retires.
+    void RecordBegin(CommandList* cmdList);
+    void RecordEnd(CommandList* cmdList);
+    // After Present, with the fence value signalled behind the frame.
+    void EndFrame(unsigned long long valFence);
+
+    unsigned int GetFramesInFlight() const { return m_numInFlight; }
+    const FrameTiming& GetLastTiming() const { return m_timingLast; }
+    // Percentiles of the last full window, about a second of frames.
+    const FrameWindow& GetLastWindow() const { return m_windowLast; }
+    // Averages since the start; max for the CPU waits; percentiles of the whole run.
+    void Report() const;
+    // A row per window, the unfinished one included, and the run as a whole.
+    bool WriteCSV(const std::filesystem::path& fn) const;
+    // Percentiles of every frame so far.
+    FrameWindow GetTotal() const;
+
+private:
+    using clock = std::chrono::high_resolution_clock;
+
+    void ReadTimestamps(unsigned int slot);
+    void CloseWindow(clock::time_point now);
+
+    Device*                 m_pDev;
+    ResourceManager*        m_pResMgr;
+    unsigned int            m_numSlots;
+    unsigned int            m_numInFlight;
+    ID3D12QueryHeap*        m_pQueryHeap = nullptr;
+    ID3D12Resource*         m_pReadback = nullptr;
+    const unsigned long long* m_pTicks = nullptr;           // mapped readback, two per slot
+    double                  m_msPerTick = 0.0;
+    unsigned long long      m_valSlotFence[MAX_FRAMES_IN_FLIGHT] = {};
+    unsigned long long      m_valFrameFence[MAX_FRAMES_IN_FLIGHT] = {};   // by frame number
+    bool                    m_hasTimestamps[MAX_FRAMES_IN_FLIGHT] = {};
+    unsigned long long      m_tickLastEnd = 0;
+    unsigned long long      m_numFrames = 0;
+    unsigned int            m_iSlot = 0;
+    clock::time_point       m_tBegin;
+    clock::time_point       m_tReady;                   // the swap chain took the frame
+    bool                    m_hasBegun = false;
+
+    FrameTiming             m_timingLast;
+    FrameTiming             m_timingSum;
+    double                  m_msMaxWaitLatency = 0.0;
+    double                  m_msMaxWaitFence = 0.0;
+    unsigned long long      m_numTimed = 0;             // frames in the CPU sums
+    unsigned long long      m_numTimedGPU = 0;          // frames in the GPU sums
+
+    // CPU: from the swap chain's go to Present, less the wait for the fence; present: Present to Present
+    FrameHistogram          m_histCPU, m_histGPU, m_histPresent;            // the current window
+    FrameHistogram          m_histCPUAll, m_histGPUAll, m_histPresentAll;   // windows already closed
+    std::vector<FrameWindow> m_listWindows;
+    FrameWindow             m_windowLast;
+    clock::time_point       m_tFirstPresent;
+    clock::time_point       m_tLastPresent;
+    clock::time_point       m_tWindow;                  // start of the current window
+};
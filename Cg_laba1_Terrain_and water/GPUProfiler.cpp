@@ -0,0 +1,86 @@
+#include "GPUProfiler.h"
+#include <algorithm>
+
+GPUProfiler::GPUProfiler(Device* dev, ResourceManager* rm, unsigned int numSlots, Profiler& prof)
+    : m_pDev(dev), m_pResMgr(rm), m_Prof(prof), m_numSlots((std::max)(numSlots, 1u)),
+    m_listWritten(m_numSlots * MAX_GPU_SCOPES, 0)
+{
+    m_track = m_Prof.AddTrack("GPU");
+
+    D3D12_QUERY_HEAP_DESC descHeap = {};
+    descHeap.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+    descHeap.Count = 2 * MAX_GPU_SCOPES * m_numSlots;
+    m_pDev->CreateQueryHeap(&descHeap, m_pQueryHeap);
+    m_pQueryHeap->SetName(L"Pass Timestamps");
+
+    D3D12_RESOURCE_DESC descReadback = CD3DX12_RESOURCE_DESC::Buffer(descHeap.Count * sizeof(unsigned long long));
+    CD3DX12_HEAP_PROPERTIES propsReadback(D3D12_HEAP_TYPE_READBACK);
+    m_pResMgr->NewBuffer(m_pReadback, &descReadback, &propsReadback, D3D12_HEAP_FLAG_NONE,
+        D3D12_RESOURCE_STATE_COPY_DEST, nullptr);
+    m_pReadback->SetName(L"Pass Timestamps Readback");
+
+    // stays mapped, as in FrameScheduler: a slot is read only after its frame has retired
+    void* mapped = nullptr;
+    if (FAILED(m_pReadback->Map(0, nullptr, &mapped))) throw GFX_Exception("GPUProfiler::GPUProfiler: Map failed.");
+    m_pTicks = static_cast<const unsigned long long*>(mapped);
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    m_nsPerTick = 1e9 / static_cast<double>(m_pDev->GetTimestampFrequency());
+    m_nsPerCounter = 1e9 / static_cast<double>(freq.QuadPart);
+}
+
+GPUProfiler::~GPUProfiler() {
+    // the readback buffer belongs to the ResourceManager
+    if (m_pReadback) { m_pReadback->Unmap(0, nullptr); m_pReadback = nullptr; }
+    m_pTicks = nullptr;
+    if (m_pQueryHeap) { m_pQueryHeap->Release(); m_pQueryHeap = nullptr; }
+    m_pResMgr = nullptr;
+    m_pDev = nullptr;
+}
+
+unsigned int GPUProfiler::AddScope(const char* name, unsigned int depth) {
+    if (m_listScopes.size() == MAX_GPU_SCOPES) throw GFX_Exception("GPUProfiler::AddScope: out of scopes.");
+    m_listScopes.push_back({ name, depth });
+    return static_cast<unsigned int>(m_listScopes.size() - 1);
+}
+
+void GPUProfiler::BeginFrame(unsigned int slot) {
+    m_iSlot = slot % m_numSlots;
+    char* written = &m_listWritten[m_iSlot * MAX_GPU_SCOPES];
+    if (std::none_of(written, written + MAX_GPU_SCOPES, [](char c) { return c != 0; })) return;
+
+    // GPU ticks to profiler time: a queue timestamp and the performance counter taken together, and the
+    // counter against the profiler's clock right now
+    unsigned long long tickGPU = 0, tickCPU = 0;
+    m_pDev->GetClockCalibration(tickGPU, tickCPU);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    const long long nsNow = m_Prof.Now();
+    const double nsCalibration = nsNow - static_cast<double>(counter.QuadPart - static_cast<long long>(tickCPU)) * m_nsPerCounter;
+    auto toProfiler = [&](unsigned long long tick) {
+        return static_cast<long long>(nsCalibration + static_cast<double>(static_cast<long long>(tick - tickGPU)) * m_nsPerTick);
+    };
+
+    for (unsigned int i = 0; i < m_listScopes.size(); ++i) {
+        if (!written[i]) continue;
+        written[i] = 0;
+        const unsigned long long tickBegin = m_pTicks[GetQuery(m_iSlot, i)];
+        const unsigned long long tickEnd = m_pTicks[GetQuery(m_iSlot, i) + 1];
+        // recorded but never submitted (BenchmarkRecording) leaves nothing sensible behind
+        if (!tickBegin || tickEnd < tickBegin) continue;
+        m_Prof.Record(m_track, m_listScopes[i].name, toProfiler(tickBegin), toProfiler(tickEnd), m_listScopes[i].depth);
+    }
+}
+
+void GPUProfiler::BeginScope(CommandList* cmdList, unsigned int scope) {
+    cmdList->EndQuery(m_pQueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, GetQuery(m_iSlot, scope));
+}
+
+void GPUProfiler::EndScope(CommandList* cmdList, unsigned int scope) {
+    const unsigned int query = GetQuery(m_iSlot, scope);
+    cmdList->EndQuery(m_pQueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, query + 1);
+    cmdList->ResolveQueryData(m_pQueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, query, 2, m_pReadback,
+        query * sizeof(unsigned long long));
+    m_listWritten[m_iSlot * MAX_GPU_SCOPES + scope] = 1;
+}
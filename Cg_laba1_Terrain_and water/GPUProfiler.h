@@ -0,0 +1,66 @@
+#pragma once
+#include "ResourceManager.h"
+#include "Profiler.h"
+#include <vector>
+
+static const unsigned int MAX_GPU_SCOPES = 16;
+
+// Timestamp queries around passes of a frame, put on a "GPU" track of the Profiler in CPU time, so a
+// trace shows the passes under the CPU scopes that recorded them. Each slot has its own queries and
+// its own part of the readback buffer; a scope resolves itself at its end, in the list that wrote it.
+// A slot's timestamps are read in BeginFrame, once the slot's last frame has retired.
+class GPUProfiler {
+public:
+    GPUProfiler(Device* dev, ResourceManager* rm, unsigned int numSlots, Profiler& prof);
+    // The caller has waited for the GPU.
+    ~GPUProfiler();
+    GPUProfiler(const GPUProfiler&) = delete;
+    GPUProfiler& operator=(const GPUProfiler&) = delete;
+
+    // Before the first frame; name is a literal. Throws once MAX_GPU_SCOPES are taken.
+    unsigned int AddScope(const char* name, unsigned int depth = 0);
+
+    // Frame thread, after FrameScheduler::AcquireSlot: hands the slot's finished scopes to the
+    // profiler; the frame recorded next writes into slot.
+    void BeginFrame(unsigned int slot);
+    // Around the commands of scope. Any recording thread; a scope is written by one list per frame.
+    void BeginScope(CommandList* cmdList, unsigned int scope);
+    void EndScope(CommandList* cmdList, unsigned int scope);
+
+private:
+    struct Scope {
+        const char*     name;
+        unsigned int    depth;
+    };
+
+    unsigned int GetQuery(unsigned int slot, unsigned int scope) const { return 2 * (slot * MAX_GPU_SCOPES + scope); }
+
+    Device*                     m_pDev;
+    ResourceManager*            m_pResMgr;
+    Profiler&                   m_Prof;
+    unsigned int                m_numSlots;
+    unsigned int                m_track;
+    ID3D12QueryHeap*            m_pQueryHeap = nullptr;
+    ID3D12Resource*             m_pReadback = nullptr;
+    const unsigned long long*   m_pTicks = nullptr;         // mapped readback, two per scope and slot
+    double                      m_nsPerTick = 0.0;
+    double                      m_nsPerCounter = 0.0;       // QueryPerformanceCounter
+    std::vector<Scope>          m_listScopes;
+    std::vector<char>           m_listWritten;              // by slot and scope; ended in the slot's last frame
+    unsigned int                m_iSlot = 0;
+};
+
+// A GPU scope until the end of the enclosing block.
+class GPUProfileScope {
+public:
+    GPUProfileScope(GPUProfiler& prof, CommandList* cmdList, unsigned int scope)
+        : m_Prof(prof), m_pCmdList(cmdList), m_scope(scope) { m_Prof.BeginScope(m_pCmdList, m_scope); }
+    ~GPUProfileScope() { m_Prof.EndScope(m_pCmdList, m_scope); }
+    GPUProfileScope(const GPUProfileScope&) = delete;
+    GPUProfileScope& operator=(const GPUProfileScope&) = delete;
+
+private:
+    GPUProfiler&                m_Prof;
+    CommandList*                m_pCmdList;
+    unsigned int                m_scope;
+};
@@ -1,55 +1,157 @@
 
 #include "Graphics.h"
+#include "JobSystem.h"
+#include <algorithm>
 #include <string>
 
 namespace graphics {
 
-	void CompileShader(LPCWSTR fn, ShaderType st, D3D12_SHADER_BYTECODE& bcShader) {
-		LPCSTR version;
+	ShaderDesc MakeShaderDesc(LPCWSTR fn, ShaderType st) {
+		ShaderDesc desc;
+		for (LPCWSTR c = fn; *c; ++c) desc.file += static_cast<char>(*c); // shader names are ASCII
 		switch (st) {
 		case PIXEL_SHADER:
-			version = "ps_5_0";
+			desc.target = "ps_5_0";
 			break;
 		case VERTEX_SHADER:
-			version = "vs_5_0";
+			desc.target = "vs_5_0";
 			break;
 		case GEOMETRY_SHADER:
-			version = "gs_5_0";
+			desc.target = "gs_5_0";
 			break;
 		case HULL_SHADER:
-			version = "hs_5_0";
+			desc.target = "hs_5_0";
 			break;
 		case DOMAIN_SHADER:
-			version = "ds_5_0";
+			desc.target = "ds_5_0";
 			break;
 		default:
-			version = "";
+			desc.target = "";
 		}
+		desc.flags = SHADER_COMPILE_FLAGS;
+		return desc;
+	}
 
-		ID3DBlob* shader;
-		ID3DBlob* err;
-		if (FAILED(D3DCompileFromFile(fn, NULL, NULL, "main", version, D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION, 0, &shader, &err))) {
+	bool CompileShaderBytecode(const ShaderDesc& desc, std::vector<unsigned char>& bytecode, std::string& err) {
+		std::vector<D3D_SHADER_MACRO> macros;
+		for (const auto& def : desc.defines) macros.push_back({ def.first.c_str(), def.second.c_str() });
+		macros.push_back({ nullptr, nullptr });
+		const std::wstring fn(desc.file.begin(), desc.file.end());
+
+		ID3DBlob* shader = nullptr;
+		ID3DBlob* errors = nullptr;
+		const HRESULT hr = D3DCompileFromFile(fn.c_str(), macros.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE,
+			desc.entry.c_str(), desc.target.c_str(), desc.flags, 0, &shader, &errors);
+		if (errors) {
+			if (FAILED(hr)) err.assign(static_cast<const char*>(errors->GetBufferPointer()), errors->GetBufferSize());
+			errors->Release();
+		}
+		if (FAILED(hr) || !shader) {
 			if (shader) shader->Release();
-			if (err) {
-				std::string msg((char*)err->GetBufferPointer());
-				msg = "graphics::CompileShader: " + msg;
-				throw GFX_Exception(msg.c_str());
-			}
-			else {
-				std::string msg(version);
-				msg = "graphics::CompileShader: Failed to compile shader version " + msg + ". No error returned from compiler";
-				throw GFX_Exception(msg.c_str());
-			}
+			if (err.empty()) err = "Failed to compile shader version " + desc.target + ". No error returned from compiler";
+			return false;
+		}
+		const unsigned char* data = static_cast<const unsigned char*>(shader->GetBufferPointer());
+		bytecode.assign(data, data + shader->GetBufferSize());
+		shader->Release();
+		return true;
+	}
+
+	ShaderCache& GetShaderCache() {
+		static ShaderCache cache(CompileShaderBytecode, &JobSystem::Shared(), "shadercache");
+		return cache;
+	}
+
+	void PrefetchShader(LPCWSTR fn, ShaderType st) {
+		GetShaderCache().Request(MakeShaderDesc(fn, st));
+	}
+
+	void CompileShader(LPCWSTR fn, ShaderType st, D3D12_SHADER_BYTECODE& bcShader) {
+		ShaderCache& cache = GetShaderCache();
+		const unsigned int handle = cache.Request(MakeShaderDesc(fn, st));
+		std::string err;
+		if (!cache.Wait(handle, &err)) {
+			std::string msg = "graphics::CompileShader: " + err;
+			throw GFX_Exception(msg.c_str());
 		}
-		bcShader.BytecodeLength = shader->GetBufferSize();
-		bcShader.pShaderBytecode = shader->GetBufferPointer();
+		const std::vector<unsigned char>& bytecode = cache.GetBytecode(handle);
+		bcShader.BytecodeLength = bytecode.size();
+		bcShader.pShaderBytecode = bytecode.data();
 	}
 
-	Device::Device(HWND win, unsigned int h, unsigned int w, bool fullscreen, unsigned int numFrames) :
+	// CommandList over the D3D12 list it owns; every call goes straight through.
+	class D3D12CommandList : public CommandList {
+	public:
+		explicit D3D12CommandList(ID3D12GraphicsCommandList* list) : m_pList(list) {}
+
+		ID3D12GraphicsCommandList* GetNative() const { return m_pList; }
+
+		void Release() override {
+			m_pList->Release();
+			delete this;
+		}
+
+		HRESULT Reset(ID3D12CommandAllocator* alloc, ID3D12PipelineState* psoInit) override { return m_pList->Reset(alloc, psoInit); }
+		HRESULT Close() override { return m_pList->Close(); }
+
+		void SetPipelineState(ID3D12PipelineState* pso) override { m_pList->SetPipelineState(pso); }
+		void SetGraphicsRootSignature(ID3D12RootSignature* root) override { m_pList->SetGraphicsRootSignature(root); }
+		void SetDescriptorHeaps(UINT numHeaps, ID3D12DescriptorHeap* const* heaps) override { m_pList->SetDescriptorHeaps(numHeaps, heaps); }
+		void SetGraphicsRootDescriptorTable(UINT index, D3D12_GPU_DESCRIPTOR_HANDLE table) override {
+			m_pList->SetGraphicsRootDescriptorTable(index, table);
+		}
+		void SetGraphicsRootConstantBufferView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS va) override {
+			m_pList->SetGraphicsRootConstantBufferView(index, va);
+		}
+		void SetGraphicsRoot32BitConstants(UINT index, UINT num, const void* data, UINT offset) override {
+			m_pList->SetGraphicsRoot32BitConstants(index, num, data, offset);
+		}
+
+		void IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology) override { m_pList->IASetPrimitiveTopology(topology); }
+		void IASetVertexBuffers(UINT start, UINT num, const D3D12_VERTEX_BUFFER_VIEW* views) override { m_pList->IASetVertexBuffers(start, num, views); }
+		void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* view) override { m_pList->IASetIndexBuffer(view); }
+		void RSSetViewports(UINT num, const D3D12_VIEWPORT* vps) override { m_pList->RSSetViewports(num, vps); }
+		void RSSetScissorRects(UINT num, const D3D12_RECT* rects) override { m_pList->RSSetScissorRects(num, rects); }
+		void OMSetRenderTargets(UINT numRTVs, const D3D12_CPU_DESCRIPTOR_HANDLE* rtvs, BOOL isSingleRange,
+			const D3D12_CPU_DESCRIPTOR_HANDLE* dsv) override {
+			m_pList->OMSetRenderTargets(numRTVs, rtvs, isSingleRange, dsv);
+		}
+
+		void ClearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE rtv, const FLOAT color[4], UINT numRects, const D3D12_RECT* rects) override {
+			m_pList->ClearRenderTargetView(rtv, color, numRects, rects);
+		}
+		void ClearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE dsv, D3D12_CLEAR_FLAGS flags, FLOAT depth, UINT8 stencil,
+			UINT numRects, const D3D12_RECT* rects) override {
+			m_pList->ClearDepthStencilView(dsv, flags, depth, stencil, numRects, rects);
+		}
+		void ResourceBarrier(UINT num, const D3D12_RESOURCE_BARRIER* barriers) override { m_pList->ResourceBarrier(num, barriers); }
+		void DrawInstanced(UINT numVertices, UINT numInstances, UINT startVertex, UINT startInstance) override {
+			m_pList->DrawInstanced(numVertices, numInstances, startVertex, startInstance);
+		}
+		void DrawIndexedInstanced(UINT numIndices, UINT numInstances, UINT startIndex, INT baseVertex, UINT startInstance) override {
+			m_pList->DrawIndexedInstanced(numIndices, numInstances, startIndex, baseVertex, startInstance);
+		}
+
+		void EndQuery(ID3D12QueryHeap* heap, D3D12_QUERY_TYPE type, UINT index) override { m_pList->EndQuery(heap, type, index); }
+		void ResolveQueryData(ID3D12QueryHeap* heap, D3D12_QUERY_TYPE type, UINT start, UINT num,
+			ID3D12Resource* dst, UINT64 offsetDst) override {
+			m_pList->ResolveQueryData(heap, type, start, num, dst, offsetDst);
+		}
+		UINT64 UpdateSubresources(ID3D12Resource* dst, ID3D12Resource* staging, UINT64 offset,
+			UINT firstSubResource, UINT numSubResources, D3D12_SUBRESOURCE_DATA* data) override {
+			return ::UpdateSubresources(m_pList, dst, staging, offset, firstSubResource, numSubResources, data);
+		}
+
+	private:
+		ID3D12GraphicsCommandList* m_pList;
+	};
+
+	D3D12Device::D3D12Device(HWND win, unsigned int h, unsigned int w, bool fullscreen, unsigned int numFrames) :
 		m_hScreen(h), m_wScreen(w), m_isWindowed(!fullscreen), m_numFrames(numFrames) {
 		m_pDev = nullptr;
 		m_pCmdQ = nullptr;
 		m_pSwapChain = nullptr;
+		m_hdlFrameLatency = nullptr;
 
 		IDXGIFactory4* factory;
 		if (FAILED(CreateDXGIFactory2(FACTORY_DEBUG, IID_PPV_ARGS(&factory))))
@@ -106,12 +208,15 @@ namespace graphics {
 		descSwapChain.Windowed = m_isWindowed;
 		descSwapChain.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
 		descSwapChain.SampleDesc = descSample;
+		descSwapChain.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
 
 		IDXGISwapChain* swapChain;
 		if (FAILED(factory->CreateSwapChain(m_pCmdQ, &descSwapChain, &swapChain))) {
 			throw GFX_Exception("In Device::Device: CreateSwapChain failed on init.");
 		}
 		m_pSwapChain = static_cast<IDXGISwapChain3*>(swapChain);
+		m_pSwapChain->SetMaximumFrameLatency(m_numFrames);
+		m_hdlFrameLatency = m_pSwapChain->GetFrameLatencyWaitableObject();
 
 		swapChain = NULL;
 		if (factory) {
@@ -120,7 +225,11 @@ namespace graphics {
 		}
 	}
 
-	Device::~Device() {
+	D3D12Device::~D3D12Device() {
+		if (m_hdlFrameLatency) {
+			CloseHandle(m_hdlFrameLatency);
+			m_hdlFrameLatency = nullptr;
+		}
 		if (m_pSwapChain) {
 			m_pSwapChain->SetFullscreenState(false, NULL);
 			m_pSwapChain->Release();
@@ -137,17 +246,17 @@ namespace graphics {
 		}
 	}
 
-	unsigned int Device::GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE ht) {
+	unsigned int D3D12Device::GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE ht) {
 		return m_pDev->GetDescriptorHandleIncrementSize(ht);
 	}
 
-	void Device::CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE clt, ID3D12CommandAllocator*& allocator) {
+	void D3D12Device::CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE clt, ID3D12CommandAllocator*& allocator) {
 		if (FAILED(m_pDev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&allocator)))) {
 			throw GFX_Exception("Device::CreateCommandAllocator failed.");
 		}
 	}
 
-	void Device::GetBackBuffer(unsigned int i, ID3D12Resource*& buffer) {
+	void D3D12Device::GetBackBuffer(unsigned int i, ID3D12Resource*& buffer) {
 		if (i >= m_numFrames || i < 0) {
 			throw GFX_Exception("Invalid buffer index provided to Device::GetBackBuffer.");
 		}
@@ -157,11 +266,11 @@ namespace graphics {
 		}
 	}
 
-	unsigned int Device::GetCurrentBackBuffer() {
+	unsigned int D3D12Device::GetCurrentBackBuffer() {
 		return m_pSwapChain->GetCurrentBackBufferIndex();
 	}
 
-	void Device::CreateRootSig(CD3DX12_ROOT_SIGNATURE_DESC* desc, ID3D12RootSignature*& root) {
+	void D3D12Device::CreateRootSig(CD3DX12_ROOT_SIGNATURE_DESC* desc, ID3D12RootSignature*& root) {
 		ID3DBlob* err;
 		ID3DBlob* sig;
 
@@ -176,52 +285,73 @@ namespace graphics {
 		sig->Release();
 	}
 
-	void Device::CreatePSO(D3D12_GRAPHICS_PIPELINE_STATE_DESC* desc, ID3D12PipelineState*& pso) {
+	void D3D12Device::CreateRootSig(const void* blob, size_t size, ID3D12RootSignature*& root) {
+		if (FAILED(m_pDev->CreateRootSignature(0, blob, size, IID_PPV_ARGS(&root)))) {
+			throw GFX_Exception("Device::CreateRootSig failed.");
+		}
+	}
+
+	void D3D12Device::CreatePSO(D3D12_GRAPHICS_PIPELINE_STATE_DESC* desc, ID3D12PipelineState*& pso) {
 		if (FAILED(m_pDev->CreateGraphicsPipelineState(desc, IID_PPV_ARGS(&pso)))) {
 			throw GFX_Exception("Device::CreateGraphicsPipeline failed.");
 		}
 	}
 
-	void Device::CreateDescriptorHeap(D3D12_DESCRIPTOR_HEAP_DESC* desc, ID3D12DescriptorHeap*& heap) {
+	bool D3D12Device::CreatePipelineLibrary(const void* blob, size_t size, ID3D12PipelineLibrary*& lib) {
+		lib = nullptr;
+		ID3D12Device1* dev1 = nullptr;
+		if (FAILED(m_pDev->QueryInterface(IID_PPV_ARGS(&dev1)))) return false;
+		const HRESULT hr = dev1->CreatePipelineLibrary(blob, blob ? size : 0, IID_PPV_ARGS(&lib));
+		dev1->Release();
+		if (FAILED(hr)) {
+			lib = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	void D3D12Device::CreateDescriptorHeap(D3D12_DESCRIPTOR_HEAP_DESC* desc, ID3D12DescriptorHeap*& heap) {
 		if FAILED(m_pDev->CreateDescriptorHeap(desc, IID_PPV_ARGS(&heap))) {
 			throw GFX_Exception("Device::CreateDescriptorHeap failed.");
 		}
 	}
 
-	void Device::CreateSRV(ID3D12Resource*& tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+	void D3D12Device::CreateSRV(ID3D12Resource*& tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
 		m_pDev->CreateShaderResourceView(tex, desc, handle);
 	}
 
-	void Device::CreateCBV(D3D12_CONSTANT_BUFFER_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+	void D3D12Device::CreateCBV(D3D12_CONSTANT_BUFFER_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
 		m_pDev->CreateConstantBufferView(desc, handle);
 	}
 
-	void Device::CreateDSV(ID3D12Resource*& tex, D3D12_DEPTH_STENCIL_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+	void D3D12Device::CreateDSV(ID3D12Resource*& tex, D3D12_DEPTH_STENCIL_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
 		m_pDev->CreateDepthStencilView(tex, desc, handle);
 	}
 
-	void Device::CreateRTV(ID3D12Resource*& tex, D3D12_RENDER_TARGET_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+	void D3D12Device::CreateRTV(ID3D12Resource*& tex, D3D12_RENDER_TARGET_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
 		m_pDev->CreateRenderTargetView(tex, desc, handle);
 	}
 
-	void Device::CreateSampler(D3D12_SAMPLER_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+	void D3D12Device::CreateSampler(D3D12_SAMPLER_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
 		m_pDev->CreateSampler(desc, handle);
 	}
 
-	void Device::CreateFence(unsigned long long valInit, D3D12_FENCE_FLAGS flags, ID3D12Fence*& fence) {
+	void D3D12Device::CreateFence(unsigned long long valInit, D3D12_FENCE_FLAGS flags, ID3D12Fence*& fence) {
 		if (FAILED(m_pDev->CreateFence(valInit, flags, IID_PPV_ARGS(&fence)))) {
 			throw GFX_Exception("Device::CreateFence failed on init.");
 		}
 	}
 
-	void Device::CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE type, ID3D12CommandAllocator* alloc, ID3D12GraphicsCommandList*& list, unsigned int mask,
+	void D3D12Device::CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE type, ID3D12CommandAllocator* alloc, CommandList*& list, unsigned int mask,
 		ID3D12PipelineState* psoInit) {
-		if (FAILED(m_pDev->CreateCommandList(mask, type, alloc, psoInit, IID_PPV_ARGS(&list)))) {
+		ID3D12GraphicsCommandList* native = nullptr;
+		if (FAILED(m_pDev->CreateCommandList(mask, type, alloc, psoInit, IID_PPV_ARGS(&native)))) {
 			throw GFX_Exception("Device::CreateCommandList failed.");
 		}
+		list = new D3D12CommandList(native);
 	}
 
-	void Device::CreateCommittedResource(ID3D12Resource*& heap, D3D12_RESOURCE_DESC* desc,
+	void D3D12Device::CreateCommittedResource(ID3D12Resource*& heap, D3D12_RESOURCE_DESC* desc,
 		D3D12_HEAP_PROPERTIES* props, D3D12_HEAP_FLAGS flags, D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) {
 		HRESULT hr = m_pDev->CreateCommittedResource(props, flags, desc, state, clear, IID_PPV_ARGS(&heap));
 		if (FAILED(hr)) {
@@ -230,19 +360,80 @@ namespace graphics {
 		}
 	}
 
-	void Device::SetFence(ID3D12Fence* fence, unsigned long long val) {
+	D3D12_RESOURCE_ALLOCATION_INFO D3D12Device::GetResourceAllocationInfo(const D3D12_RESOURCE_DESC* desc) {
+		return m_pDev->GetResourceAllocationInfo(0, 1, desc);
+	}
+
+	unsigned long long D3D12Device::GetRequiredIntermediateSize(ID3D12Resource* res, unsigned int firstSubResource,
+		unsigned int numSubResources) {
+		return ::GetRequiredIntermediateSize(res, firstSubResource, numSubResources);
+	}
+
+	void D3D12Device::CreateHeap(D3D12_HEAP_DESC* desc, ID3D12Heap*& heap) {
+		if (FAILED(m_pDev->CreateHeap(desc, IID_PPV_ARGS(&heap)))) {
+			throw GFX_Exception("Device::CreateHeap failed.");
+		}
+	}
+
+	void D3D12Device::CreatePlacedResource(ID3D12Resource*& res, ID3D12Heap* heap, unsigned long long offset,
+		D3D12_RESOURCE_DESC* desc, D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) {
+		if (FAILED(m_pDev->CreatePlacedResource(heap, offset, desc, state, clear, IID_PPV_ARGS(&res)))) {
+			throw GFX_Exception("Device::CreatePlacedResource failed.");
+		}
+	}
+
+	void D3D12Device::SetFence(ID3D12Fence* fence, unsigned long long val) {
 		if (FAILED(m_pCmdQ->Signal(fence, val))) {
 			throw GFX_Exception("Device::SetFence failed.");
 		}
 	}
 
-	void Device::ExecuteCommandLists(ID3D12CommandList* lCmds[], unsigned int numCommands) {
-		m_pCmdQ->ExecuteCommandLists(numCommands, lCmds);
+	void D3D12Device::ExecuteCommandLists(CommandList* lCmds[], unsigned int numCommands) {
+		// the D3D12 lists behind them, a batch at a time
+		ID3D12CommandList* native[32];
+		for (unsigned int first = 0; first < numCommands; first += _countof(native)) {
+			const unsigned int num = (std::min)(numCommands - first, static_cast<unsigned int>(_countof(native)));
+			for (unsigned int i = 0; i < num; ++i) native[i] = static_cast<D3D12CommandList*>(lCmds[first + i])->GetNative();
+			m_pCmdQ->ExecuteCommandLists(num, native);
+		}
 	}
 
-	void Device::Present() {
+	void D3D12Device::Present() {
 		if (FAILED(m_pSwapChain->Present(0, 0))) {
 			throw GFX_Exception("Device::Present SwapChain failed to present.");
 		}
 	}
+
+	void D3D12Device::SetMaximumFrameLatency(unsigned int n) {
+		if (FAILED(m_pSwapChain->SetMaximumFrameLatency(n))) {
+			throw GFX_Exception("Device::SetMaximumFrameLatency failed.");
+		}
+	}
+
+	bool D3D12Device::WaitForFrameLatency(unsigned long ms) {
+		return WaitForSingleObjectEx(m_hdlFrameLatency, ms, TRUE) == WAIT_OBJECT_0;
+	}
+
+	void D3D12Device::CreateQueryHeap(D3D12_QUERY_HEAP_DESC* desc, ID3D12QueryHeap*& heap) {
+		if (FAILED(m_pDev->CreateQueryHeap(desc, IID_PPV_ARGS(&heap)))) {
+			throw GFX_Exception("Device::CreateQueryHeap failed.");
+		}
+	}
+
+	unsigned long long D3D12Device::GetTimestampFrequency() {
+		UINT64 freq = 0;
+		if (FAILED(m_pCmdQ->GetTimestampFrequency(&freq))) {
+			throw GFX_Exception("Device::GetTimestampFrequency failed.");
+		}
+		return freq;
+	}
+
+	void D3D12Device::GetClockCalibration(unsigned long long& tickGPU, unsigned long long& tickCPU) {
+		UINT64 gpu = 0, cpu = 0;
+		if (FAILED(m_pCmdQ->GetClockCalibration(&gpu, &cpu))) {
+			throw GFX_Exception("Device::GetClockCalibration failed.");
+		}
+		tickGPU = gpu;
+		tickCPU = cpu;
+	}
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <DirectXMath.h>
 #include <D3DCompiler.h>
 #include <stdexcept>
+#include "ShaderCache.h"
 
 namespace graphics {
 	using namespace DirectX;
@@ -28,50 +29,181 @@ namespace graphics {
 	};
 
 
+#ifdef _DEBUG
+	static const UINT SHADER_COMPILE_FLAGS = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#else
+	static const UINT SHADER_COMPILE_FLAGS = D3DCOMPILE_OPTIMIZATION_LEVEL3;
+#endif
+
+	// D3DCompileFromFile for ShaderCache; #include resolves next to the shader.
+	bool CompileShaderBytecode(const ShaderDesc& desc, std::vector<unsigned char>& bytecode, std::string& err);
+	// fn's main() for st with SHADER_COMPILE_FLAGS.
+	ShaderDesc MakeShaderDesc(LPCWSTR fn, ShaderType st);
+	// Process-wide cache on the shared job system, kept on disk in "shadercache".
+	ShaderCache& GetShaderCache();
+	// Starts compiling fn's main in the background; CompileShader of it later only waits.
+	void PrefetchShader(LPCWSTR fn, ShaderType st);
+	// Bytecode owned by the shader cache. Throws GFX_Exception with the compiler's message.
 	void CompileShader(LPCWSTR fn, ShaderType st, D3D12_SHADER_BYTECODE& bcShader);
 
+	// The commands the renderer records, named and typed as on ID3D12GraphicsCommandList so the calls
+	// read the same on every backend. Created by Device::CreateGraphicsCommandList, released like the
+	// COM objects around it.
+	class CommandList {
+	public:
+		virtual void Release() = 0;
+
+		virtual HRESULT Reset(ID3D12CommandAllocator* alloc, ID3D12PipelineState* psoInit) = 0;
+		virtual HRESULT Close() = 0;
+
+		virtual void SetPipelineState(ID3D12PipelineState* pso) = 0;
+		virtual void SetGraphicsRootSignature(ID3D12RootSignature* root) = 0;
+		virtual void SetDescriptorHeaps(UINT numHeaps, ID3D12DescriptorHeap* const* heaps) = 0;
+		virtual void SetGraphicsRootDescriptorTable(UINT index, D3D12_GPU_DESCRIPTOR_HANDLE table) = 0;
+		virtual void SetGraphicsRootConstantBufferView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS va) = 0;
+		virtual void SetGraphicsRoot32BitConstants(UINT index, UINT num, const void* data, UINT offset) = 0;
+
+		virtual void IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology) = 0;
+		virtual void IASetVertexBuffers(UINT start, UINT num, const D3D12_VERTEX_BUFFER_VIEW* views) = 0;
+		virtual void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* view) = 0;
+		virtual void RSSetViewports(UINT num, const D3D12_VIEWPORT* vps) = 0;
+		virtual void RSSetScissorRects(UINT num, const D3D12_RECT* rects) = 0;
+		virtual void OMSetRenderTargets(UINT numRTVs, const D3D12_CPU_DESCRIPTOR_HANDLE* rtvs, BOOL isSingleRange,
+			const D3D12_CPU_DESCRIPTOR_HANDLE* dsv) = 0;
+
+		virtual void ClearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE rtv, const FLOAT color[4], UINT numRects, const D3D12_RECT* rects) = 0;
+		virtual void ClearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE dsv, D3D12_CLEAR_FLAGS flags, FLOAT depth, UINT8 stencil,
+			UINT numRects, const D3D12_RECT* rects) = 0;
+		virtual void ResourceBarrier(UINT num, const D3D12_RESOURCE_BARRIER* barriers) = 0;
+		virtual void DrawInstanced(UINT numVertices, UINT numInstances, UINT startVertex, UINT startInstance) = 0;
+		virtual void DrawIndexedInstanced(UINT numIndices, UINT numInstances, UINT startIndex, INT baseVertex, UINT startInstance) = 0;
+
+		virtual void EndQuery(ID3D12QueryHeap* heap, D3D12_QUERY_TYPE type, UINT index) = 0;
+		virtual void ResolveQueryData(ID3D12QueryHeap* heap, D3D12_QUERY_TYPE type, UINT start, UINT num,
+			ID3D12Resource* dst, UINT64 offsetDst) = 0;
+		// d3dx12's UpdateSubresources: data into staging at offset, copies from there into dst. The bytes
+		// it took from staging; 0 when the layouts did not fit.
+		virtual UINT64 UpdateSubresources(ID3D12Resource* dst, ID3D12Resource* staging, UINT64 offset,
+			UINT firstSubResource, UINT numSubResources, D3D12_SUBRESOURCE_DATA* data) = 0;
+
+	protected:
+		virtual ~CommandList() {}
+	};
+
+	// The device, its queue and swap chain. D3D12Device drives the GPU; RecordingDevice (RecordingDevice.h)
+	// stands in for it without one and only records what it is asked to do.
 	class Device {
 	public:
-		Device(HWND win, unsigned int h, unsigned int w, bool fullscreen = false, unsigned int numFrames = 3);
-		~Device();
+		virtual ~Device() {}
 
 
-		unsigned int GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE ht);
+		virtual unsigned int GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE ht) = 0;
 
 
-		void CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE clt, ID3D12CommandAllocator*& allocator);
+		virtual void CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE clt, ID3D12CommandAllocator*& allocator) = 0;
 
-		void GetBackBuffer(unsigned int i, ID3D12Resource*& buffer);
+		virtual void GetBackBuffer(unsigned int i, ID3D12Resource*& buffer) = 0;
 
-		unsigned int GetCurrentBackBuffer();
+		virtual unsigned int GetCurrentBackBuffer() = 0;
 
-		void SetFence(ID3D12Fence* fence, unsigned long long val);
+		virtual void SetFence(ID3D12Fence* fence, unsigned long long val) = 0;
 
 
-		void CreateRootSig(CD3DX12_ROOT_SIGNATURE_DESC* desc, ID3D12RootSignature*& root);
+		virtual void CreateRootSig(CD3DX12_ROOT_SIGNATURE_DESC* desc, ID3D12RootSignature*& root) = 0;
+		virtual void CreateRootSig(const void* blob, size_t size, ID3D12RootSignature*& root) = 0;
 
-		void CreatePSO(D3D12_GRAPHICS_PIPELINE_STATE_DESC* desc, ID3D12PipelineState*& pso);
+		virtual void CreatePSO(D3D12_GRAPHICS_PIPELINE_STATE_DESC* desc, ID3D12PipelineState*& pso) = 0;
+		// From a serialized library, or an empty one when blob is null. false when the device has no
+		// pipeline libraries or refuses the blob (another driver or adapter).
+		virtual bool CreatePipelineLibrary(const void* blob, size_t size, ID3D12PipelineLibrary*& lib) = 0;
 
-		void CreateDescriptorHeap(D3D12_DESCRIPTOR_HEAP_DESC* desc, ID3D12DescriptorHeap*& heap);
-		void CreateSRV(ID3D12Resource*& tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle);
-		void CreateCBV(D3D12_CONSTANT_BUFFER_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle);
-		void CreateDSV(ID3D12Resource*& tex, D3D12_DEPTH_STENCIL_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle);
-		void CreateRTV(ID3D12Resource*& tex, D3D12_RENDER_TARGET_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle);
-		void CreateSampler(D3D12_SAMPLER_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle);
-		void CreateFence(unsigned long long valInit, D3D12_FENCE_FLAGS flags, ID3D12Fence*& fence);
-		void CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE type, ID3D12CommandAllocator* alloc, ID3D12GraphicsCommandList*& list,
-			unsigned int mask = 0, ID3D12PipelineState* psoInit = nullptr);
+		virtual void CreateDescriptorHeap(D3D12_DESCRIPTOR_HEAP_DESC* desc, ID3D12DescriptorHeap*& heap) = 0;
+		virtual void CreateSRV(ID3D12Resource*& tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) = 0;
+		virtual void CreateCBV(D3D12_CONSTANT_BUFFER_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) = 0;
+		virtual void CreateDSV(ID3D12Resource*& tex, D3D12_DEPTH_STENCIL_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) = 0;
+		virtual void CreateRTV(ID3D12Resource*& tex, D3D12_RENDER_TARGET_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) = 0;
+		virtual void CreateSampler(D3D12_SAMPLER_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) = 0;
+		virtual void CreateFence(unsigned long long valInit, D3D12_FENCE_FLAGS flags, ID3D12Fence*& fence) = 0;
+		// The list is open, as D3D12 creates it.
+		virtual void CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE type, ID3D12CommandAllocator* alloc, CommandList*& list,
+			unsigned int mask = 0, ID3D12PipelineState* psoInit = nullptr) = 0;
 
-		void CreateCommittedResource(ID3D12Resource*& heap, D3D12_RESOURCE_DESC* desc, D3D12_HEAP_PROPERTIES* props, D3D12_HEAP_FLAGS flags,
-			D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear);
+		virtual void CreateCommittedResource(ID3D12Resource*& heap, D3D12_RESOURCE_DESC* desc, D3D12_HEAP_PROPERTIES* props, D3D12_HEAP_FLAGS flags,
+			D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) = 0;
+		// Size and alignment a resource with desc takes inside a heap.
+		virtual D3D12_RESOURCE_ALLOCATION_INFO GetResourceAllocationInfo(const D3D12_RESOURCE_DESC* desc) = 0;
+		// Staging bytes CommandList::UpdateSubresources needs for these subresources of res.
+		virtual unsigned long long GetRequiredIntermediateSize(ID3D12Resource* res, unsigned int firstSubResource,
+			unsigned int numSubResources) = 0;
+		virtual void CreateHeap(D3D12_HEAP_DESC* desc, ID3D12Heap*& heap) = 0;
+		virtual void CreatePlacedResource(ID3D12Resource*& res, ID3D12Heap* heap, unsigned long long offset, D3D12_RESOURCE_DESC* desc,
+			D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) = 0;
+
+		// Lists of this device only.
+		virtual void ExecuteCommandLists(CommandList* lCmds[], unsigned int numCommands) = 0;
+		virtual void Present() = 0;
+
+		// Frame pacing through the swap chain's latency waitable object instead of sleeping.
+		// At most n presents are queued; WaitForFrameLatency blocks until another one may be.
+		virtual void SetMaximumFrameLatency(unsigned int n) = 0;
+		virtual bool WaitForFrameLatency(unsigned long ms = INFINITE) = 0;
 
-		void ExecuteCommandLists(ID3D12CommandList* lCmds[], unsigned int numCommands);
-		void Present();
+		virtual void CreateQueryHeap(D3D12_QUERY_HEAP_DESC* desc, ID3D12QueryHeap*& heap) = 0;
+		// Ticks per second of the queue's timestamp queries.
+		virtual unsigned long long GetTimestampFrequency() = 0;
+		// A queue timestamp and the QueryPerformanceCounter value taken at the same moment.
+		virtual void GetClockCalibration(unsigned long long& tickGPU, unsigned long long& tickCPU) = 0;
+	};
+
+	class D3D12Device : public Device {
+	public:
+		D3D12Device(HWND win, unsigned int h, unsigned int w, bool fullscreen = false, unsigned int numFrames = 3);
+		~D3D12Device();
+
+		unsigned int GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE ht) override;
+		void CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE clt, ID3D12CommandAllocator*& allocator) override;
+		void GetBackBuffer(unsigned int i, ID3D12Resource*& buffer) override;
+		unsigned int GetCurrentBackBuffer() override;
+		void SetFence(ID3D12Fence* fence, unsigned long long val) override;
+
+		void CreateRootSig(CD3DX12_ROOT_SIGNATURE_DESC* desc, ID3D12RootSignature*& root) override;
+		void CreateRootSig(const void* blob, size_t size, ID3D12RootSignature*& root) override;
+		void CreatePSO(D3D12_GRAPHICS_PIPELINE_STATE_DESC* desc, ID3D12PipelineState*& pso) override;
+		bool CreatePipelineLibrary(const void* blob, size_t size, ID3D12PipelineLibrary*& lib) override;
+
+		void CreateDescriptorHeap(D3D12_DESCRIPTOR_HEAP_DESC* desc, ID3D12DescriptorHeap*& heap) override;
+		void CreateSRV(ID3D12Resource*& tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+		void CreateCBV(D3D12_CONSTANT_BUFFER_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+		void CreateDSV(ID3D12Resource*& tex, D3D12_DEPTH_STENCIL_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+		void CreateRTV(ID3D12Resource*& tex, D3D12_RENDER_TARGET_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+		void CreateSampler(D3D12_SAMPLER_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+		void CreateFence(unsigned long long valInit, D3D12_FENCE_FLAGS flags, ID3D12Fence*& fence) override;
+		void CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE type, ID3D12CommandAllocator* alloc, CommandList*& list,
+			unsigned int mask = 0, ID3D12PipelineState* psoInit = nullptr) override;
+
+		void CreateCommittedResource(ID3D12Resource*& heap, D3D12_RESOURCE_DESC* desc, D3D12_HEAP_PROPERTIES* props, D3D12_HEAP_FLAGS flags,
+			D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) override;
+		D3D12_RESOURCE_ALLOCATION_INFO GetResourceAllocationInfo(const D3D12_RESOURCE_DESC* desc) override;
+		unsigned long long GetRequiredIntermediateSize(ID3D12Resource* res, unsigned int firstSubResource,
+			unsigned int numSubResources) override;
+		void CreateHeap(D3D12_HEAP_DESC* desc, ID3D12Heap*& heap) override;
+		void CreatePlacedResource(ID3D12Resource*& res, ID3D12Heap* heap, unsigned long long offset, D3D12_RESOURCE_DESC* desc,
+			D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) override;
+
+		void ExecuteCommandLists(CommandList* lCmds[], unsigned int numCommands) override;
+		void Present() override;
+		void SetMaximumFrameLatency(unsigned int n) override;
+		bool WaitForFrameLatency(unsigned long ms = INFINITE) override;
+
+		void CreateQueryHeap(D3D12_QUERY_HEAP_DESC* desc, ID3D12QueryHeap*& heap) override;
+		unsigned long long GetTimestampFrequency() override;
+		void GetClockCalibration(unsigned long long& tickGPU, unsigned long long& tickCPU) override;
 
 	private:
 		ID3D12Device* m_pDev;
 		ID3D12CommandQueue* m_pCmdQ;
 		IDXGISwapChain3* m_pSwapChain;
+		HANDLE						m_hdlFrameLatency;
 		unsigned int				m_wScreen;
 		unsigned int				m_hScreen;
 		unsigned int				m_numFrames;
@@ -0,0 +1,31 @@
+#include "ImageBuffer.h"
+#include "TextureCache.h"
+#include <cstdlib>
+
+ImageBuffer& ImageBuffer::operator=(ImageBuffer&& other) noexcept {
+    if (this != &other) {
+        Reset();
+        m_pData = other.m_pData;
+        m_view = other.m_view;
+        m_size = other.m_size;
+        m_alloc = other.m_alloc;
+        other.m_pData = nullptr;
+        other.m_view = nullptr;
+        other.m_size = 0;
+        other.m_alloc = IMAGE_ALLOC_NONE;
+    }
+    return *this;
+}
+
+void ImageBuffer::Reset() {
+    switch (m_alloc) {
+    case IMAGE_ALLOC_MALLOC: free(m_pData); break;
+    case IMAGE_ALLOC_NEW:    delete[] m_pData; break;
+    case IMAGE_ALLOC_VIEW:   TextureCache::ReleaseView(m_view); break;
+    default: break;
+    }
+    m_pData = nullptr;
+    m_view = nullptr;
+    m_size = 0;
+    m_alloc = IMAGE_ALLOC_NONE;
+}
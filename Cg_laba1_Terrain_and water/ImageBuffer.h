@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+
+// Who allocated the texels of an ImageBuffer, and so how they are given back:
+// lodepng uses malloc, the DDS and DirectXTex paths use new[], cache hits are TextureCache mappings.
+enum ImageAlloc { IMAGE_ALLOC_NONE, IMAGE_ALLOC_MALLOC, IMAGE_ALLOC_NEW, IMAGE_ALLOC_VIEW };
+
+// Owning pointer to one decoded image that remembers its deallocator.
+// Move-only; the texels are released in the destructor or by Reset.
+class ImageBuffer {
+public:
+    ImageBuffer() = default;
+    ~ImageBuffer() { Reset(); }
+    ImageBuffer(const ImageBuffer&) = delete;
+    ImageBuffer& operator=(const ImageBuffer&) = delete;
+    ImageBuffer(ImageBuffer&& other) noexcept { *this = static_cast<ImageBuffer&&>(other); }
+    ImageBuffer& operator=(ImageBuffer&& other) noexcept;
+
+    static ImageBuffer FromMalloc(unsigned char* data, size_t size) { return ImageBuffer(data, nullptr, size, IMAGE_ALLOC_MALLOC); }
+    static ImageBuffer FromNew(unsigned char* data, size_t size) { return ImageBuffer(data, nullptr, size, IMAGE_ALLOC_NEW); }
+    // data points somewhere inside view; the whole view is unmapped on release.
+    static ImageBuffer FromView(unsigned char* data, void* view, size_t size) { return ImageBuffer(data, view, size, IMAGE_ALLOC_VIEW); }
+
+    unsigned char* Get() const { return m_pData; }
+    size_t GetSize() const { return m_size; }
+    ImageAlloc GetAlloc() const { return m_alloc; }
+    bool IsMapped() const { return m_alloc == IMAGE_ALLOC_VIEW; }
+    explicit operator bool() const { return m_pData != nullptr; }
+
+    void Reset();
+
+private:
+    ImageBuffer(unsigned char* data, void* view, size_t size, ImageAlloc alloc)
+        : m_pData(data), m_view(view), m_size(data ? size : 0), m_alloc(data ? alloc : IMAGE_ALLOC_NONE) {}
+
+    unsigned char*  m_pData = nullptr;
+    void*           m_view = nullptr;
+    size_t          m_size = 0;
+    ImageAlloc      m_alloc = IMAGE_ALLOC_NONE;
+};
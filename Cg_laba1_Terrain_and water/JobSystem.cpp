@@ -0,0 +1,181 @@
+#include "JobSystem.h"
+#include "StartupReport.h"
+#include "Profiler.h"
+#include <chrono>
+#include <string>
+
+using std::chrono::steady_clock;
+
+// which system and which of its workers the calling thread is; -1 for other threads
+static thread_local const JobSystem* t_pJobSystem = nullptr;
+static thread_local int t_iWorker = -1;
+
+static unsigned long long MicrosecondsSince(steady_clock::time_point t0) {
+    return static_cast<unsigned long long>(
+        std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - t0).count());
+}
+
+JobSystem::JobSystem(unsigned int numWorkers) {
+    if (numWorkers == 0) {
+        unsigned int hw = std::thread::hardware_concurrency();
+        numWorkers = hw > 1 ? hw - 1 : 1;
+    }
+    for (unsigned int i = 0; i <= numWorkers; ++i) {
+        m_listQueues.emplace_back(new Queue());
+        m_listStats.emplace_back(new Stats());
+    }
+    for (unsigned int i = 0; i < numWorkers; ++i) {
+        m_listThreads.emplace_back(&JobSystem::RunWorker, this, i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtxSleep);
+        m_isStopping.store(true);
+    }
+    m_cvSleep.notify_all();
+    for (std::thread& t : m_listThreads) {
+        if (t.joinable()) t.join();
+    }
+}
+
+JobSystem& JobSystem::Shared() {
+    static JobSystem jobs;
+    return jobs;
+}
+
+int JobSystem::GetWorkerIndex() const {
+    return t_pJobSystem == this ? t_iWorker : -1;
+}
+
+void JobSystem::Run(std::function<void()> job, JobCounter* counter) {
+    if (counter) counter->m_num.fetch_add(1, std::memory_order_relaxed);
+    Push({ std::move(job), counter }, false);
+}
+
+void JobSystem::RunBackground(std::function<void()> job, JobCounter* counter) {
+    if (counter) counter->m_num.fetch_add(1, std::memory_order_relaxed);
+    Push({ std::move(job), counter }, true);
+}
+
+void JobSystem::Push(Job job, bool isBackground) {
+    const int iWorker = GetWorkerIndex();
+    Queue& q = isBackground ? m_queueBackground
+        : *m_listQueues[iWorker >= 0 ? iWorker : m_listQueues.size() - 1];
+    {
+        std::lock_guard<std::mutex> lock(q.mtx);
+        q.jobs.push_back(std::move(job));
+    }
+
+    // a worker going to sleep counts itself before it checks m_numQueued, so one of the two sees the other
+    m_numQueued.fetch_add(1);
+    if (m_numSleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_mtxSleep);
+        m_cvSleep.notify_one();
+    }
+}
+
+bool JobSystem::TryTake(int iWorker, Job& job, bool allowBackground) {
+    const size_t numQueues = m_listQueues.size();
+    const size_t iOwn = iWorker >= 0 ? static_cast<size_t>(iWorker) : numQueues - 1;
+    Stats& stats = *m_listStats[iOwn];
+
+    {
+        Queue& q = *m_listQueues[iOwn];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.jobs.empty()) {
+            job = std::move(q.jobs.back());
+            q.jobs.pop_back();
+            m_numQueued.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // the shared deque first: that is where the frame thread's bands wait
+    for (size_t k = 1; k < numQueues; ++k) {
+        Queue& q = *m_listQueues[(iOwn + numQueues - k) % numQueues];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.jobs.empty()) {
+            job = std::move(q.jobs.front());
+            q.jobs.pop_front();
+            m_numQueued.fetch_sub(1);
+            stats.numStolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    if (allowBackground) {
+        std::lock_guard<std::mutex> lock(m_queueBackground.mtx);
+        if (!m_queueBackground.jobs.empty()) {
+            job = std::move(m_queueBackground.jobs.front());
+            m_queueBackground.jobs.pop_front();
+            m_numQueued.fetch_sub(1);
+            stats.numBackground.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::Execute(int iWorker, Job& job) {
+    Stats& stats = *m_listStats[iWorker >= 0 ? static_cast<size_t>(iWorker) : m_listStats.size() - 1];
+    const steady_clock::time_point t0 = steady_clock::now();
+    job.fn();
+    stats.usBusy.fetch_add(MicrosecondsSince(t0), std::memory_order_relaxed);
+    stats.numJobs.fetch_add(1, std::memory_order_relaxed);
+    if (job.pCounter) job.pCounter->m_num.fetch_sub(1, std::memory_order_release);
+    job.fn = nullptr;
+}
+
+void JobSystem::Wait(JobCounter& counter) {
+    const int iWorker = GetWorkerIndex();
+    while (!counter.IsDone()) {
+        Job job;
+        if (TryTake(iWorker, job, false)) Execute(iWorker, job);
+        else std::this_thread::yield();    // the last bands run elsewhere and are short
+    }
+}
+
+void JobSystem::RunWorker(unsigned int iWorker) {
+    t_pJobSystem = this;
+    t_iWorker = static_cast<int>(iWorker);
+    Profiler::Get().SetThreadName(("worker " + std::to_string(iWorker)).c_str());
+    Stats& stats = *m_listStats[iWorker];
+
+    for (;;) {
+        Job job;
+        if (TryTake(t_iWorker, job, true)) {
+            Execute(t_iWorker, job);
+            continue;
+        }
+
+        const steady_clock::time_point t0 = steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(m_mtxSleep);
+            m_numSleeping.fetch_add(1);
+            m_cvSleep.wait(lock, [this]() { return m_isStopping.load() || m_numQueued.load() > 0; });
+            m_numSleeping.fetch_sub(1);
+        }
+        stats.usSleep.fetch_add(MicrosecondsSince(t0), std::memory_order_relaxed);
+        // stopping only once everything queued has run
+        if (m_isStopping.load() && m_numQueued.load() == 0) return;
+    }
+}
+
+void JobSystem::Report() const {
+    StartupReport::Line("\n=== Job system (%u workers) ===\n", GetWorkerCount());
+    for (size_t i = 0; i < m_listStats.size(); ++i) {
+        const Stats& s = *m_listStats[i];
+        const unsigned long long numJobs = s.numJobs.load(std::memory_order_relaxed);
+        if (i == m_listStats.size() - 1) {
+            StartupReport::Line("  others   %8llu jobs (%llu stolen)                 busy %9.1f ms\n",
+                numJobs, s.numStolen.load(std::memory_order_relaxed), s.usBusy.load(std::memory_order_relaxed) / 1000.0);
+            continue;
+        }
+        StartupReport::Line("  worker %u %8llu jobs (%llu stolen, %llu background) busy %9.1f ms, asleep %9.1f ms\n",
+            static_cast<unsigned int>(i), numJobs, s.numStolen.load(std::memory_order_relaxed),
+            s.numBackground.load(std::memory_order_relaxed), s.usBusy.load(std::memory_order_relaxed) / 1000.0,
+            s.usSleep.load(std::memory_order_relaxed) / 1000.0);
+    }
+}
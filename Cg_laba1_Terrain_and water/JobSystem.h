@@ -0,0 +1,141 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts unfinished jobs. Pass it to JobSystem::Run for each job of a group and JobSystem::Wait on it.
+class JobCounter {
+public:
+    JobCounter() = default;
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    bool IsDone() const { return m_num.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+    std::atomic<unsigned int> m_num{ 0 };
+};
+
+// Work-stealing job system shared by the frame loop and the loaders. Every worker has its own deque:
+// it pushes and pops its jobs at the back, idle workers steal from the front of the others. Threads
+// that are not workers (the frame thread, loaders) push into a shared deque everyone steals from.
+//
+// Wait does not block: the waiting thread runs queued jobs until its counter reaches zero, so the
+// frame thread takes part in its own ParallelFor and a job may wait on jobs it started.
+//
+// Long jobs (file decode, terrain builds, export) go through RunBackground/Submit into a separate
+// FIFO that only idle workers take from; a waiting thread never picks one up, so a frame never
+// stalls behind a terrain build.
+class JobSystem {
+public:
+    // numWorkers == 0: hardware threads - 1, the frame thread being the last one.
+    explicit JobSystem(unsigned int numWorkers = 0);
+    ~JobSystem();
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Short job. counter, if given, counts it until it has run. The job must not throw.
+    void Run(std::function<void()> job, JobCounter* counter = nullptr);
+    // Long job, taken only by idle workers. The job must not throw.
+    void RunBackground(std::function<void()> job, JobCounter* counter = nullptr);
+    // Runs queued short jobs on the calling thread until counter is done.
+    void Wait(JobCounter& counter);
+
+    // Long job with a result; exceptions reach the future.
+    template <typename F>
+    auto Submit(F&& task) -> std::future<decltype(task())> {
+        using R = decltype(task());
+        auto pkg = std::make_shared<std::packaged_task<R()>>(std::forward<F>(task));
+        std::future<R> result = pkg->get_future();
+        RunBackground([pkg]() { (*pkg)(); });
+        return result;
+    }
+
+    // Runs fn(begin, end) over [first, last) split into bands of at least minPerTask items.
+    // The calling thread takes the first band and helps with the rest; returns once every band is
+    // done and rethrows the first exception a band threw. Safe to call from inside a job.
+    template <typename F>
+    void ParallelFor(unsigned int first, unsigned int last, unsigned int minPerTask, const F& fn) {
+        if (last <= first) return;
+        const unsigned int count = last - first;
+        const unsigned int bands = (std::min)(GetWorkerCount() + 1, count / (minPerTask ? minPerTask : 1));
+        if (bands <= 1) {
+            fn(first, last);
+            return;
+        }
+
+        const unsigned int step = (count + bands - 1) / bands;
+        JobCounter counter;
+        std::exception_ptr err;
+        std::mutex mtxErr;
+        auto band = [&fn, &err, &mtxErr](unsigned int b, unsigned int e) {
+            try { fn(b, e); }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(mtxErr);
+                if (!err) err = std::current_exception();
+            }
+        };
+        for (unsigned int b = first + step; b < last; b += step) {
+            const unsigned int e = (std::min)(b + step, last);
+            Run([&band, b, e]() { band(b, e); }, &counter);
+        }
+        band(first, (std::min)(first + step, last));
+        Wait(counter);
+        if (err) std::rethrow_exception(err);
+    }
+
+    unsigned int GetWorkerCount() const { return static_cast<unsigned int>(m_listThreads.size()); }
+
+    // Jobs run, stolen and time spent per worker (and for the other threads together) since the start.
+    void Report() const;
+
+    // Process-wide system sized to the machine.
+    static JobSystem& Shared();
+
+private:
+    struct Job {
+        std::function<void()>   fn;
+        JobCounter*             pCounter = nullptr;
+    };
+
+    // One per worker, the last one shared by the threads that are not workers.
+    struct Queue {
+        std::mutex              mtx;
+        std::deque<Job>         jobs;
+    };
+
+    struct Stats {
+        std::atomic<unsigned long long> numJobs{ 0 };
+        std::atomic<unsigned long long> numStolen{ 0 };
+        std::atomic<unsigned long long> numBackground{ 0 };
+        std::atomic<unsigned long long> usBusy{ 0 };
+        std::atomic<unsigned long long> usSleep{ 0 };
+    };
+
+    void RunWorker(unsigned int iWorker);
+    void Push(Job job, bool isBackground);
+    // Own deque from the back, then the shared one and the other workers' from the front, then (if
+    // allowed) the background FIFO.
+    bool TryTake(int iWorker, Job& job, bool allowBackground);
+    void Execute(int iWorker, Job& job);
+    int GetWorkerIndex() const;
+
+    std::vector<std::thread>                m_listThreads;
+    std::vector<std::unique_ptr<Queue>>     m_listQueues;       // numWorkers + 1
+    std::vector<std::unique_ptr<Stats>>     m_listStats;        // numWorkers + 1
+    Queue                                   m_queueBackground;
+    std::atomic<unsigned int>               m_numQueued{ 0 };   // short and background jobs not yet taken
+    std::atomic<unsigned int>               m_numSleeping{ 0 };
+    std::mutex                              m_mtxSleep;
+    std::condition_variable                 m_cvSleep;
+    std::atomic<bool>                       m_isStopping{ false };
+};
@@ -0,0 +1,333 @@
+#include "LoadDDS.h"
+#include "BlockCompress.h"
+#include <Windows.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+    const uint32_t DDS_MAGIC = 0x20534444;         // "DDS "
+
+    const uint32_t DDSD_DEPTH = 0x800000;
+    const uint32_t DDPF_ALPHAPIXELS = 0x1;
+    const uint32_t DDPF_FOURCC = 0x4;
+    const uint32_t DDPF_RGB = 0x40;
+    const uint32_t DDPF_LUMINANCE = 0x20000;
+    const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+    const uint32_t DDSCAPS2_CUBEMAP_ALLFACES = 0xFC00;
+    const uint32_t DDSCAPS2_VOLUME = 0x200000;
+
+    const uint32_t DX10_DIMENSION_TEXTURE2D = 3;
+    const uint32_t DX10_DIMENSION_TEXTURE3D = 4;
+    const uint32_t DX10_MISC_TEXTURECUBE = 0x4;
+
+    struct DDSPixelFormat {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t fourCC;
+        uint32_t bitCount;
+        uint32_t maskR, maskG, maskB, maskA;
+    };
+
+    struct DDSHeader {
+        uint32_t        size;
+        uint32_t        flags;
+        uint32_t        height;
+        uint32_t        width;
+        uint32_t        pitchOrLinearSize;
+        uint32_t        depth;
+        uint32_t        mipMapCount;
+        uint32_t        reserved1[11];
+        DDSPixelFormat  pf;
+        uint32_t        caps, caps2, caps3, caps4;
+        uint32_t        reserved2;
+    };
+    static_assert(sizeof(DDSHeader) == 124, "DDS header is 124 bytes");
+
+    struct DDSHeaderDX10 {
+        uint32_t dxgiFormat;
+        uint32_t resourceDimension;
+        uint32_t miscFlag;
+        uint32_t arraySize;
+        uint32_t miscFlags2;
+    };
+
+    constexpr uint32_t FourCC(char a, char b, char c, char d) {
+        return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+    }
+
+    bool IsMask(const DDSPixelFormat& pf, uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+        return pf.maskR == r && pf.maskG == g && pf.maskB == b && pf.maskA == a;
+    }
+
+    // legacy pixel format -> DXGI; only layouts D3D12 can sample without conversion
+    DXGI_FORMAT LegacyFormat(const DDSPixelFormat& pf) {
+        if (pf.flags & DDPF_FOURCC) {
+            switch (pf.fourCC) {
+            case FourCC('D', 'X', 'T', '1'): return DXGI_FORMAT_BC1_UNORM;
+            case FourCC('D', 'X', 'T', '2'):
+            case FourCC('D', 'X', 'T', '3'): return DXGI_FORMAT_BC2_UNORM;
+            case FourCC('D', 'X', 'T', '4'):
+            case FourCC('D', 'X', 'T', '5'): return DXGI_FORMAT_BC3_UNORM;
+            case FourCC('A', 'T', 'I', '1'):
+            case FourCC('B', 'C', '4', 'U'): return DXGI_FORMAT_BC4_UNORM;
+            case FourCC('B', 'C', '4', 'S'): return DXGI_FORMAT_BC4_SNORM;
+            case FourCC('A', 'T', 'I', '2'):
+            case FourCC('B', 'C', '5', 'U'): return DXGI_FORMAT_BC5_UNORM;
+            case FourCC('B', 'C', '5', 'S'): return DXGI_FORMAT_BC5_SNORM;
+            case 36:  return DXGI_FORMAT_R16G16B16A16_UNORM;
+            case 110: return DXGI_FORMAT_R16G16B16A16_SNORM;
+            case 111: return DXGI_FORMAT_R16_FLOAT;
+            case 112: return DXGI_FORMAT_R16G16_FLOAT;
+            case 113: return DXGI_FORMAT_R16G16B16A16_FLOAT;
+            case 114: return DXGI_FORMAT_R32_FLOAT;
+            case 115: return DXGI_FORMAT_R32G32_FLOAT;
+            case 116: return DXGI_FORMAT_R32G32B32A32_FLOAT;
+            }
+            return DXGI_FORMAT_UNKNOWN;
+        }
+        if (pf.flags & DDPF_RGB) {
+            const uint32_t a = (pf.flags & DDPF_ALPHAPIXELS) ? pf.maskA : 0;
+            if (pf.bitCount == 32) {
+                if (IsMask(pf, 0xFF, 0xFF00, 0xFF0000, a) && a == 0xFF000000) return DXGI_FORMAT_R8G8B8A8_UNORM;
+                if (IsMask(pf, 0xFF0000, 0xFF00, 0xFF, a) && a == 0xFF000000) return DXGI_FORMAT_B8G8R8A8_UNORM;
+                if (IsMask(pf, 0xFF0000, 0xFF00, 0xFF, a) && a == 0) return DXGI_FORMAT_B8G8R8X8_UNORM;
+                if (IsMask(pf, 0xFFFF, 0xFFFF0000, 0, a) && a == 0) return DXGI_FORMAT_R16G16_UNORM;
+            }
+            if (pf.bitCount == 16 && IsMask(pf, 0xF800, 0x7E0, 0x1F, a) && a == 0) return DXGI_FORMAT_B5G6R5_UNORM;
+            return DXGI_FORMAT_UNKNOWN;
+        }
+        if (pf.flags & DDPF_LUMINANCE) {
+            if (pf.bitCount == 8 && pf.maskR == 0xFF) return DXGI_FORMAT_R8_UNORM;
+            if (pf.bitCount == 16 && pf.maskR == 0xFFFF) return DXGI_FORMAT_R16_UNORM;
+        }
+        return DXGI_FORMAT_UNKNOWN;
+    }
+
+    // bits per texel, or bytes per 4x4 block for BC formats (isBlock); 0 = not handled here
+    unsigned int FormatSize(DXGI_FORMAT f, bool& isBlock) {
+        isBlock = false;
+        if (f >= DXGI_FORMAT_BC1_TYPELESS && f <= DXGI_FORMAT_BC1_UNORM_SRGB) { isBlock = true; return 8; }
+        if (f >= DXGI_FORMAT_BC4_TYPELESS && f <= DXGI_FORMAT_BC4_SNORM) { isBlock = true; return 8; }
+        if ((f >= DXGI_FORMAT_BC2_TYPELESS && f <= DXGI_FORMAT_BC3_UNORM_SRGB) ||
+            (f >= DXGI_FORMAT_BC5_TYPELESS && f <= DXGI_FORMAT_BC5_SNORM) ||
+            (f >= DXGI_FORMAT_BC6H_TYPELESS && f <= DXGI_FORMAT_BC7_UNORM_SRGB)) {
+            isBlock = true;
+            return 16;
+        }
+        if (f >= DXGI_FORMAT_R32G32B32A32_TYPELESS && f <= DXGI_FORMAT_R32G32B32A32_SINT) return 128;
+        if (f >= DXGI_FORMAT_R32G32B32_TYPELESS && f <= DXGI_FORMAT_R32G32B32_SINT) return 96;
+        if (f >= DXGI_FORMAT_R16G16B16A16_TYPELESS && f <= DXGI_FORMAT_R32G32_SINT) return 64;
+        if (f >= DXGI_FORMAT_R10G10B10A2_TYPELESS && f <= DXGI_FORMAT_R32_SINT) return 32;
+        if (f >= DXGI_FORMAT_R8G8_TYPELESS && f <= DXGI_FORMAT_R16_SINT) return 16;
+        if (f >= DXGI_FORMAT_R8_TYPELESS && f <= DXGI_FORMAT_A8_UNORM) return 8;
+        if (f == DXGI_FORMAT_B5G6R5_UNORM || f == DXGI_FORMAT_B5G5R5A1_UNORM || f == DXGI_FORMAT_B4G4R4A4_UNORM) return 16;
+        if (f >= DXGI_FORMAT_B8G8R8A8_UNORM && f <= DXGI_FORMAT_B8G8R8X8_UNORM_SRGB) return 32;
+        return 0;
+    }
+}
+
+DDSFile::~DDSFile() {
+    Close();
+}
+
+void DDSFile::Close() {
+    if (m_view) UnmapViewOfFile(m_view);
+    m_view = nullptr;
+    m_listSubresources.clear();
+}
+
+bool DDSFile::Open(const wchar_t* path) {
+    Close();
+
+    HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER sizeFile{};
+    if (!GetFileSizeEx(file, &sizeFile) || sizeFile.QuadPart < LONGLONG(4 + sizeof(DDSHeader))) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) return false;
+    m_view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!m_view) return false;
+
+    const unsigned char* base = static_cast<const unsigned char*>(m_view);
+    const uint64_t size = uint64_t(sizeFile.QuadPart);
+    uint32_t magic;
+    std::memcpy(&magic, base, 4);
+    const DDSHeader* hdr = reinterpret_cast<const DDSHeader*>(base + 4);
+    if (magic != DDS_MAGIC || hdr->size != sizeof(DDSHeader) || hdr->pf.size != sizeof(DDSPixelFormat)) {
+        Close();
+        return false;
+    }
+
+    uint64_t offset = 4 + sizeof(DDSHeader);
+    m_w = hdr->width;
+    m_h = hdr->height;
+    m_depth = 1;
+    m_arraySize = 1;
+    m_mipLevels = (std::max)(1u, hdr->mipMapCount);
+    m_isCube = false;
+    m_is3D = false;
+
+    if ((hdr->pf.flags & DDPF_FOURCC) && hdr->pf.fourCC == FourCC('D', 'X', '1', '0')) {
+        if (size < offset + sizeof(DDSHeaderDX10)) { Close(); return false; }
+        const DDSHeaderDX10* ext = reinterpret_cast<const DDSHeaderDX10*>(base + offset);
+        offset += sizeof(DDSHeaderDX10);
+
+        m_format = static_cast<DXGI_FORMAT>(ext->dxgiFormat);
+        m_arraySize = (std::max)(1u, ext->arraySize);
+        if (ext->resourceDimension == DX10_DIMENSION_TEXTURE3D) {
+            m_is3D = true;
+            m_depth = (std::max)(1u, hdr->depth);
+        }
+        else if (ext->resourceDimension == DX10_DIMENSION_TEXTURE2D) {
+            if (ext->miscFlag & DX10_MISC_TEXTURECUBE) {
+                m_isCube = true;
+                m_arraySize *= 6;
+            }
+        }
+        else {
+            Close();
+            return false;
+        }
+    }
+    else {
+        m_format = LegacyFormat(hdr->pf);
+        if ((hdr->flags & DDSD_DEPTH) && (hdr->caps2 & DDSCAPS2_VOLUME)) {
+            m_is3D = true;
+            m_depth = (std::max)(1u, hdr->depth);
+        }
+        else if (hdr->caps2 & DDSCAPS2_CUBEMAP) {
+            // partial cube maps cannot be created in D3D12
+            if ((hdr->caps2 & DDSCAPS2_CUBEMAP_ALLFACES) != DDSCAPS2_CUBEMAP_ALLFACES) { Close(); return false; }
+            m_isCube = true;
+            m_arraySize = 6;
+        }
+    }
+
+    bool isBlock;
+    const unsigned int sizeTexel = FormatSize(m_format, isBlock);
+    if (!sizeTexel || !m_w || !m_h || (m_is3D && m_arraySize > 1)) {
+        Close();
+        return false;
+    }
+    m_isCompressed = isBlock;
+
+    // file layout: for every array slice, mips 0..N-1 (each mip holds all its depth slices)
+    m_listSubresources.reserve(size_t(m_arraySize) * m_mipLevels);
+    for (unsigned int a = 0; a < m_arraySize; ++a) {
+        unsigned int w = m_w, h = m_h, d = m_depth;
+        for (unsigned int m = 0; m < m_mipLevels; ++m) {
+            uint64_t pitchRow, numRows;
+            if (isBlock) {
+                pitchRow = uint64_t((std::max)(1u, (w + 3) / 4)) * sizeTexel;
+                numRows = (std::max)(1u, (h + 3) / 4);
+            }
+            else {
+                pitchRow = (uint64_t(w) * sizeTexel + 7) / 8;
+                numRows = h;
+            }
+            const uint64_t pitchSlice = pitchRow * numRows;
+            if (offset + pitchSlice * d > size) {
+                Close();
+                return false;
+            }
+
+            D3D12_SUBRESOURCE_DATA sub;
+            sub.pData = base + offset;
+            sub.RowPitch = LONG_PTR(pitchRow);
+            sub.SlicePitch = LONG_PTR(pitchSlice);
+            m_listSubresources.push_back(sub);
+
+            offset += pitchSlice * d;
+            w = (std::max)(1u, w / 2);
+            h = (std::max)(1u, h / 2);
+            d = (std::max)(1u, d / 2);
+        }
+    }
+    return true;
+}
+
+unsigned char* DDSFile::DetachRGBA8(void*& view) {
+    view = nullptr;
+    if (m_listSubresources.empty()) return nullptr;
+
+    unsigned char* p = GetPixels(0);
+    const size_t count = size_t(m_w) * m_h;
+    switch (m_format) {
+    case DXGI_FORMAT_R8G8B8A8_UNORM:
+        break;
+    case DXGI_FORMAT_B8G8R8A8_UNORM:
+    case DXGI_FORMAT_B8G8R8X8_UNORM:
+        SwizzleBGRAToRGBA(p, count, m_format == DXGI_FORMAT_B8G8R8X8_UNORM);
+        break;
+    case DXGI_FORMAT_BC1_UNORM:
+    case DXGI_FORMAT_BC3_UNORM:
+    case DXGI_FORMAT_BC5_UNORM: {
+        unsigned char* data = new unsigned char[count * 4];
+        BCDecode(static_cast<BCFormat>(m_format), p, m_w, m_h, data);
+        return data;
+    }
+    default:
+        return nullptr;
+    }
+
+    // texels stay in the mapping: hand it over
+    view = m_view;
+    m_view = nullptr;
+    m_listSubresources.clear();
+    return p;
+}
+
+void SwizzleBGRAToRGBA(unsigned char* p, size_t count, bool isOpaque) {
+    const __m128i maskGA = _mm_set1_epi32(int(0xFF00FF00));
+    const __m128i maskB = _mm_set1_epi32(0xFF);
+    const __m128i alpha = _mm_set1_epi32(isOpaque ? int(0xFF000000) : 0);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i* q = reinterpret_cast<__m128i*>(p + i * 4);
+        __m128i v = _mm_loadu_si128(q);
+        __m128i r = _mm_or_si128(_mm_and_si128(v, maskGA),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), maskB), _mm_slli_epi32(_mm_and_si128(v, maskB), 16)));
+        _mm_storeu_si128(q, _mm_or_si128(r, alpha));
+    }
+    for (; i < count; ++i) {
+        unsigned char* t = p + i * 4;
+        std::swap(t[0], t[2]);
+        if (isOpaque) t[3] = 255;
+    }
+}
+
+bool AlphaFromRedIfOpaque(unsigned char* p, size_t count) {
+    const __m128i maskA = _mm_set1_epi32(int(0xFF000000));
+
+    // 1) scan: any alpha below 255 leaves the image alone
+    size_t i = 0;
+    __m128i acc = maskA;
+    for (; i + 4 <= count; i += 4) {
+        acc = _mm_and_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 4)));
+        if ((i & 1023) == 0 && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(acc, maskA), maskA)) != 0xFFFF) return false;
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(acc, maskA), maskA)) != 0xFFFF) return false;
+    for (size_t t = i; t < count; ++t) {
+        if (p[t * 4 + 3] != 255) return false;
+    }
+
+    // 2) A = R
+    const __m128i maskRGB = _mm_set1_epi32(0x00FFFFFF);
+    for (i = 0; i + 4 <= count; i += 4) {
+        __m128i* q = reinterpret_cast<__m128i*>(p + i * 4);
+        __m128i v = _mm_loadu_si128(q);
+        _mm_storeu_si128(q, _mm_or_si128(_mm_and_si128(v, maskRGB), _mm_slli_epi32(v, 24)));
+    }
+    for (; i < count; ++i) p[i * 4 + 3] = p[i * 4];
+    return true;
+}
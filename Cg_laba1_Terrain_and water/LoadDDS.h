@@ -1 +1,62 @@
 #pragma once
+#include <d3d12.h>
+#include <cstddef>
+#include <vector>
+
+// Memory-mapped .dds with the header parsed in place.
+// Subresources point straight into the mapping, so they can go to the upload ring without an
+// intermediate copy. The view is copy-on-write: texels may be converted in place and only the touched
+// pages get copied. Open returns false for anything the reader does not understand (1D, packed
+// or planar formats, truncated files); callers then fall back to DirectXTex.
+class DDSFile {
+public:
+    DDSFile() = default;
+    ~DDSFile();
+    DDSFile(const DDSFile&) = delete;
+    DDSFile& operator=(const DDSFile&) = delete;
+
+    bool Open(const wchar_t* path);
+    void Close();
+
+    DXGI_FORMAT GetFormat() const { return m_format; }
+    unsigned int GetWidth() const { return m_w; }
+    unsigned int GetHeight() const { return m_h; }
+    unsigned int GetDepth() const { return m_depth; }
+    unsigned int GetArraySize() const { return m_arraySize; }   // faces included for cube maps
+    unsigned int GetMipLevels() const { return m_mipLevels; }
+    bool IsCube() const { return m_isCube; }
+    bool Is3D() const { return m_is3D; }
+    bool IsCompressed() const { return m_isCompressed; }
+
+    // D3D12 subresource order: array slice (cube face) major, mip minor.
+    unsigned int GetSubresourceCount() const { return static_cast<unsigned int>(m_listSubresources.size()); }
+    D3D12_SUBRESOURCE_DATA* GetSubresources() { return m_listSubresources.data(); }
+    unsigned char* GetPixels(unsigned int i) const {
+        return static_cast<unsigned char*>(const_cast<void*>(m_listSubresources[i].pData));
+    }
+
+    // Level 0 of slice 0 as tightly packed RGBA8, converted only when the format needs it:
+    // R8G8B8A8 is returned as is, B8G8R8A8/X8 are swizzled in place, BC1/BC3/BC5 are decoded into a
+    // new[] buffer. When the texels stay in the mapping, view receives it and the file gives up
+    // ownership (release it with TextureCache::ReleaseView). nullptr: format needs DirectXTex.
+    unsigned char* DetachRGBA8(void*& view);
+
+private:
+    void*                               m_view = nullptr;
+    DXGI_FORMAT                         m_format = DXGI_FORMAT_UNKNOWN;
+    unsigned int                        m_w = 0;
+    unsigned int                        m_h = 0;
+    unsigned int                        m_depth = 1;
+    unsigned int                        m_arraySize = 1;
+    unsigned int                        m_mipLevels = 1;
+    bool                                m_isCube = false;
+    bool                                m_is3D = false;
+    bool                                m_isCompressed = false;
+    std::vector<D3D12_SUBRESOURCE_DATA> m_listSubresources;
+};
+
+// SSE2 kernels over tightly packed 32-bit texels.
+// BGRA -> RGBA in place; with isOpaque the fourth byte is forced to 255 (B8G8R8X8).
+void SwizzleBGRAToRGBA(unsigned char* p, size_t count, bool isOpaque);
+// When every alpha is 255, copies R into A (grey height maps keep their value in A). Returns whether it did.
+bool AlphaFromRedIfOpaque(unsigned char* p, size_t count);
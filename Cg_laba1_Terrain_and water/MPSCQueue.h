@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <utility>
+
+// Unbounded multi-producer single-consumer queue (Vyukov's linked design, one node per element).
+// Push never locks or waits, so any number of threads can hand work over; TryPop must only run on
+// one thread at a time (the owner serialises consumers itself). T needs a default constructor.
+template <typename T>
+class MPSCQueue {
+public:
+    MPSCQueue() : m_pHead(new Node()), m_pTail(m_pHead.load(std::memory_order_relaxed)) {}
+    ~MPSCQueue() {
+        T value;
+        while (TryPop(value)) {}
+        delete m_pTail;
+    }
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    void Push(T value) {
+        Node* node = new Node();
+        node->value = std::move(value);
+        // the node becomes the head first and is linked in after; until then the consumer sees the
+        // queue end right before it and simply picks it up on the next TryPop
+        Node* prev = m_pHead.exchange(node, std::memory_order_acq_rel);
+        prev->pNext.store(node, std::memory_order_release);
+    }
+
+    bool TryPop(T& value) {
+        Node* tail = m_pTail;
+        Node* next = tail->pNext.load(std::memory_order_acquire);
+        if (!next) return false;
+        // next turns into the new stub; its value is moved out now
+        value = std::move(next->value);
+        m_pTail = next;
+        delete tail;
+        return true;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*>  pNext{ nullptr };
+        T                   value{};
+    };
+
+    std::atomic<Node*>  m_pHead;    // last pushed, producers only
+    Node*               m_pTail;    // stub before the oldest element, consumer only
+};
@@ -1,8 +1,16 @@
 #include "Window.h"
 #include "Scene.h"
+#include "StartupReport.h"
+#include "Profiler.h"
+#include "Counters.h"
+#include "FrameHistogram.h"
+#include "CameraPath.h"
+#include "RecordingDevice.h"
 #include <windowsx.h>
 #include <windows.h>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <chrono>
 
@@ -44,6 +52,10 @@ static void KeyDown(UINT key) {
 	case _2:
 	//case _T:
 	case _L:
+	case _P:
+	case _C:
+	case _R:
+	case _H:
 		if (pScene) pScene->HandleKeyboardInput(key);
 		break;
 	}
@@ -113,6 +125,65 @@ static LRESULT CALLBACK WndProc(HWND win, UINT msg, WPARAM wp, LPARAM lp) {
 	return 0;
 }
 
+//  -> ;        ,
+//  ,     (-null-device-test  -null-device),   
+struct SelfTestFlag {
+	const char*	flag;
+	bool		(*run)();
+};
+static const SelfTestFlag SELF_TESTS[] = {
+	{ "-stream-sim",		TerrainMaterial::SimulateStreaming },	//      
+	{ "-graph-test",		RenderGraph::SelfTest },				//        
+	{ "-shader-test",		ShaderCache::SelfTest },				//    -
+	{ "-profile-test",		Profiler::SelfTest },					//  ,    
+	{ "-histogram-test",	FrameHistogram::SelfTest },			//   ,   CSV
+	{ "-path-test",			CameraPath::SelfTest },				//      
+	{ "-counter-test",		CounterRegistry::SelfTest },			// ,    
+	{ "-pipeline-test",		PipelineRegistry::SelfTest },			//   PSO     
+	{ "-null-device-test",	RecordingDevice::SelfTest },			//    GPU  ResourceManager  
+};
+
+// -pause:   Enter      ;       
+static void PauseIfAsked(const char* cmdLine) {
+	if (!cmdLine || !strstr(cmdLine, "-pause")) return;
+	FILE* fp;
+	freopen_s(&fp, "CONIN$", "r", stdin);
+	printf("press Enter to exit\n");
+	getchar();
+}
+
+// -null-device:  ,  swap chain,  GPU    RecordingDevice,     device_trace.txt.
+//    ,             benchmark.json
+static int RunWithoutWindow(const char* cmdLine, unsigned int numFramesInFlight, const CameraPath& path, const std::string& fnPath) {
+	StartupReport::Get().BeginPhase("device");
+	RecordingDevice dev(WINDOW_HEIGHT, WINDOW_WIDTH);
+	dev.ReportOnExit("device_trace.txt");
+	StartupReport::Get().EndPhase();
+	StartupReport::Get().BeginPhase("scene");
+	Scene S(WINDOW_HEIGHT, WINDOW_WIDTH, &dev, numFramesInFlight);
+	StartupReport::Get().EndPhase();
+	StartupReport::Get().Print();
+
+	if (cmdLine && strstr(cmdLine, "-serial-record")) S.SetParallelRecording(false);
+
+	// -record-bench ( -null-device  ):          ,
+	//         CPU 
+	if (cmdLine && strstr(cmdLine, "-record-bench")) {
+		S.BenchmarkRecording(500);
+		PauseIfAsked(cmdLine);
+		return 0;
+	}
+
+	S.StartBenchmark(path, fnPath, 1.0f / 60.0f, "benchmark.json");
+	S.StartRenderThread();
+	const HANDLE hdlPacketRequest = S.GetPacketRequestEvent();
+	while (!S.IsBenchmarkDone()) {
+		if (WaitForSingleObject(hdlPacketRequest, INFINITE) != WAIT_OBJECT_0) return 1;
+		S.Update();
+	}
+	//    ,  - 
+	return 0;
+}
 
 
 
@@ -124,17 +195,102 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prevInstance, PSTR cmdLine, int
 	SetConsoleTitleW(L"Debug Console");
 	printf("=== Debug console attached ===\n");
 
+	// -trusted-assets: PNG    , CRC  Adler32    
+	if (cmdLine && strstr(cmdLine, "-trusted-assets")) ResourceManager::SetTrustedAssets(true);
+
+	// -texcache-bench: /   PNG   exe,    
+	// -png-bench:   PNG,      
+	bool isTexCacheBench = cmdLine && strstr(cmdLine, "-texcache-bench");
+	bool isPNGBench = cmdLine && strstr(cmdLine, "-png-bench");
+	if (isTexCacheBench || isPNGBench) {
+		std::vector<std::string> files;
+		std::error_code ec;
+		for (const auto& e : std::filesystem::directory_iterator(".", ec)) {
+			if (e.path().extension() == ".png") files.push_back(e.path().filename().string());
+		}
+		if (isPNGBench) ResourceManager::BenchmarkPNGDecode(files);
+		if (isTexCacheBench) ResourceManager::BenchmarkTextureCache(files);
+		PauseIfAsked(cmdLine);
+		return 0;
+	}
+
+	//       ;   0  
+	for (const SelfTestFlag& t : SELF_TESTS) {
+		if (cmdLine && strstr(cmdLine, t.flag)) {
+			bool isOk = t.run();
+			PauseIfAsked(cmdLine);
+			return isOk ? 0 : 1;
+		}
+	}
+
+	// -trace FILE:        FILE   (Chrome trace / Perfetto);
+	//    R     profile.json
+	Profiler::Get().SetThreadName("window + simulation");
+	if (const char* arg = cmdLine ? strstr(cmdLine, "-trace ") : nullptr) {
+		std::string fnTrace(arg + strlen("-trace "));
+		fnTrace = fnTrace.substr(0, fnTrace.find(' '));
+		if (!fnTrace.empty() && !Profiler::Get().BeginStream(fnTrace)) printf("cannot open %s for the trace\n", fnTrace.c_str());
+	}
+
+	// -frames N:     (1..3); 1    CPU  GPU,  
+	unsigned int numFramesInFlight = 2;
+	if (const char* arg = cmdLine ? strstr(cmdLine, "-frames ") : nullptr) {
+		int n = atoi(arg + strlen("-frames "));
+		if (n >= 1 && n <= 3) numFramesInFlight = static_cast<unsigned int>(n);
+	}
+
+	// -benchmark [FILE]:    FILE ( C    camera.path)   ,
+	//   1/60 ,   ;       benchmark.json  .
+	//        .  -null-device     GPU
+	const char* argBenchmark = cmdLine ? strstr(cmdLine, "-benchmark") : nullptr;
+	std::string fnPath;
+	CameraPath pathBenchmark;
+	if (argBenchmark) {
+		const char* arg = argBenchmark + strlen("-benchmark");
+		while (*arg == ' ') ++arg;
+		if (*arg && *arg != '-') fnPath = std::string(arg).substr(0, std::string(arg).find(' '));
+		if (!fnPath.empty() && !pathBenchmark.Load(fnPath)) {
+			printf("cannot read the camera path %s\n", fnPath.c_str());
+			return 1;
+		}
+	}
+
 	try {
+		if (cmdLine && (strstr(cmdLine, "-null-device") || strstr(cmdLine, "-record-bench"))) {
+			return RunWithoutWindow(cmdLine, numFramesInFlight, pathBenchmark, fnPath);
+		}
+
+		StartupReport::Get().BeginPhase("window");
 		Window WIN(appName, WINDOW_HEIGHT, WINDOW_WIDTH, WndProc, FULL_SCREEN);
-		Device DEV(WIN.GetWindow(), WIN.Height(), WIN.Width());
-		Scene S(WIN.Height(), WIN.Width(), &DEV);
-		pScene = &S;
+		StartupReport::Get().EndPhase();
+		StartupReport::Get().BeginPhase("device");
+		D3D12Device dev(WIN.GetWindow(), WIN.Height(), WIN.Width());
+		StartupReport::Get().EndPhase();
+		StartupReport::Get().BeginPhase("scene");
+		Scene S(WIN.Height(), WIN.Width(), &dev, numFramesInFlight);
+		StartupReport::Get().EndPhase();
+		StartupReport::Get().Print();
+		//       
+		pScene = argBenchmark ? nullptr : &S;
+		if (argBenchmark) S.StartBenchmark(pathBenchmark, fnPath, 1.0f / 60.0f, "benchmark.json");
+
+		// -serial-record:       
+		if (cmdLine && strstr(cmdLine, "-serial-record")) S.SetParallelRecording(false);
+
+		//     -;      
+		S.StartRenderThread();
+		const HANDLE hdlPacketRequest = S.GetPacketRequestEvent();
 
 		// === FPS state ===
 		using clock = std::chrono::high_resolution_clock;
 		auto lastTitleTime = clock::now();
 		int frames = 0;
 
+		//  :   ,  -counter-log,      
+		CounterRegistry& counters = CounterRegistry::Get();
+		const unsigned int readerTitle = counters.AddReader();
+		const unsigned int readerLog = (cmdLine && strstr(cmdLine, "-counter-log")) ? counters.AddReader() : CounterRegistry::MAX_READERS;
+
 		MSG msg;
 		ZeroMemory(&msg, sizeof(MSG));
 
@@ -153,8 +309,14 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prevInstance, PSTR cmdLine, int
 				continue;
 			}
 
+			//       ;     
+			DWORD res = MsgWaitForMultipleObjectsEx(1, &hdlPacketRequest, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+			if (res != WAIT_OBJECT_0) continue;
+
 			S.Update();
 			++frames;
+			//  :    ,  - 
+			if (argBenchmark && S.IsBenchmarkDone()) return 0;
 
 			//   ~1    
 			auto now = clock::now();
@@ -163,15 +325,34 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prevInstance, PSTR cmdLine, int
 				double fps = frames / span.count();
 				double ms = 1000.0 / (fps > 0.0 ? fps : 1.0);
 
-				wchar_t title[256];
-				swprintf_s(title, L"%s | FPS: %.1f | %.2f ms", appName, fps, ms);
+				const FrameStats stats = S.GetFrameStats();
+				const FrameTiming& t = stats.timing;
+				//  ; ,     ,    
+				long long numVisible = 0, numSubmitted = 0, numTriangles = 0;
+				const CounterSnapshot* snap = nullptr;
+				if (counters.Acquire(readerTitle, snap)) {
+					auto value = [&](const char* name) {
+						const int i = counters.Find(name);
+						return (i >= 0 && i < (int)snap->values.size()) ? snap->values[i] : 0;
+					};
+					numVisible = value("patches visible");
+					numSubmitted = value("patches submitted");
+					numTriangles = value("triangles (estimate)");
+				}
+				if (counters.Acquire(readerLog, snap)) StartupReport::Line("[counters] %s\n", counters.Format(*snap).c_str());
+
+				//   :    Present   
+				const FramePercentiles& present = stats.window.present;
+				wchar_t title[384];
+				swprintf_s(title, L"%s | FPS: %.1f | %.2f ms | p99 %.2f ms, max %.2f | %u in flight | CPU wait %.2f ms | GPU idle %.2f ms"
+					L" | input %.1f ms | patches %lld/%lld | ~%.2fM tris",
+					appName, fps, ms, present.p99, present.max, S.GetFramesInFlight(), t.msWaitLatency + t.msWaitFence,
+					t.msGPUIdle, stats.msInputToPresent, numVisible, numSubmitted, numTriangles / 1e6);
 				SetWindowTextW(WIN.GetWindow(), title);
 
 				frames = 0;
 				lastTitleTime = now;
 			}
-
-			Sleep(1);
 		}
 	}
 	catch (GFX_Exception& e) {
@@ -184,5 +365,11 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prevInstance, PSTR cmdLine, int
 		pScene = nullptr;
 		return 4;
 	}
+	// ,  bad_alloc  : -  ,  Scene::Update  
+	catch (const std::exception& e) {
+		OutputDebugStringA(e.what());
+		pScene = nullptr;
+		return 5;
+	}
 }
 
@@ -1,4 +1,49 @@
 #include "Material.h"
+#include "StartupReport.h"
+#include "TextureCache.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <chrono>
+
+// BC7  :   BC1,      (    )
+static const bool MATERIAL_DIFFUSE_BC7 = false;
+
+//  :    GPU    128 ,      
+static const unsigned int MATERIAL_STREAM_START_SIZE = 128;
+static const uint64_t MATERIAL_STREAM_BUDGET = 32ull << 20;
+static const D3D12_RESOURCE_STATES MATERIAL_STATE =
+    D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+
+//     RenderTerrainTessPS.hlsl:    wpos / 2 (  75,   50),
+//    0   wpos / 4   
+static const float MATERIAL_DIFFUSE_MAX_DISTANCE = 75.0f;
+static const float MATERIAL_NORMALS_MAX_DISTANCE = 50.0f;
+static MipFootprint FootprintLayers(float w, float maxDistance) { return { w / 2.0f, maxDistance }; }
+static MipFootprint FootprintPaint(float w) { return { w / 4.0f, 0.0f }; }
+
+//  ,      ;     
+//    BC- ( 4)
+static unsigned int StreamTailMip(unsigned int levels, unsigned int w, unsigned int h) {
+    unsigned int tail = 0;
+    while (tail + 1 < levels && (std::max)(w >> tail, h >> tail) > MATERIAL_STREAM_START_SIZE &&
+        (w >> (tail + 1)) % 4 == 0 && (h >> (tail + 1)) % 4 == 0) {
+        ++tail;
+    }
+    return tail;
+}
+
+static void MakeArraySRV(ID3D12Resource* tex, D3D12_SHADER_RESOURCE_VIEW_DESC& descSRV) {
+    descSRV = {};
+    descSRV.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    descSRV.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+    descSRV.Format = tex->GetDesc().Format;
+    descSRV.Texture2DArray.MostDetailedMip = 0;
+    descSRV.Texture2DArray.MipLevels = tex->GetDesc().MipLevels;
+    descSRV.Texture2DArray.FirstArraySlice = 0;
+    descSRV.Texture2DArray.ArraySize = 4;
+    descSRV.Texture2DArray.PlaneSlice = 0;
+    descSRV.Texture2DArray.ResourceMinLODClamp = 0.0f;
+}
 
 TerrainMaterial::TerrainMaterial(ResourceManager* rm,
     const char* fnNormals1, const char* fnNormals2, const char* fnNormals3, const char* fnNormals4,
@@ -6,75 +51,243 @@ TerrainMaterial::TerrainMaterial(ResourceManager* rm,
     XMFLOAT4 colors[4])
     : m_pResMgr(rm)
 {
-    unsigned int index[8], height = 0, width = 0;
-
-    index[0] = m_pResMgr->LoadFile(fnNormals1, height, width);
-    index[1] = m_pResMgr->LoadFile(fnNormals2, height, width);
-    index[2] = m_pResMgr->LoadFile(fnNormals3, height, width);
-    index[3] = m_pResMgr->LoadFile(fnNormals4, height, width);
-    index[4] = m_pResMgr->LoadFile(fnDiff1, height, width);
-    index[5] = m_pResMgr->LoadFile(fnDiff2, height, width);
-    index[6] = m_pResMgr->LoadFile(fnDiff3, height, width);
-    index[7] = m_pResMgr->LoadFile(fnDiff4, height, width);
-
-    // 2D array  8 
+    const char* normals[4] = { fnNormals1, fnNormals2, fnNormals3, fnNormals4 };
+    const char* diffuse[4] = { fnDiff1, fnDiff2, fnDiff3, fnDiff4 };
+
+    //   BC1/BC3 ( BC7),   BC5 (xy, z  )
+    m_residency.SetBudget(MATERIAL_STREAM_BUDGET);
+    m_arrDiffuse.name = L"Material Diffuse Array";
+    m_arrNormals.name = L"Material Normals Array";
+    LoadLayerArray(diffuse, false, m_arrDiffuse);
+    LoadLayerArray(normals, true, m_arrNormals);
+
+    // SRV    :   t3 () + t4 ()
+    WriteTable();
+
+    m_listColors[0] = colors[0];
+    m_listColors[1] = colors[1];
+    m_listColors[2] = colors[2];
+    m_listColors[3] = colors[3];
+}
+
+TerrainMaterial::~TerrainMaterial() {
+    if (m_futPageIn.valid()) m_futPageIn.wait();
+    m_pResMgr = nullptr;
+}
+
+void TerrainMaterial::LoadLayerArray(const char* const files[4], bool isNormal, LayerArray& arr) {
+    TextureCache& cache = TextureCache::Get();
+    const char* params = isNormal ? "material-bc5-kaiser-nrm" :
+        (MATERIAL_DIFFUSE_BC7 ? "material-bc7-kaiser" : "material-bc1bc3-kaiser");
+
+    //  :     PNG,  ,  
+    BCChain* chains = arr.chains;
+    uint64_t keys[4];
+    bool isHit[4];
+    bool isAllHit = true;
+    for (int i = 0; i < 4; ++i) {
+        keys[i] = cache.MakeKey(files[i], params);
+        isHit[i] = chains[i].Load(keys[i]);
+        isAllHit = isAllHit && isHit[i] && chains[i].GetFormat() == chains[0].GetFormat();
+    }
+
+    if (!isAllHit) {
+        BCFormat format = isNormal ? BC_FORMAT_BC5 : (MATERIAL_DIFFUSE_BC7 ? BC_FORMAT_BC7 : BC_FORMAT_BC1);
+        unsigned int index[4], height[4], width[4];
+        for (int i = 0; i < 4; ++i) {
+            index[i] = m_pResMgr->LoadFile(files[i], height[i], width[i]);
+            if (width[i] % 4 || height[i] % 4) {
+                throw GFX_Exception(("TerrainMaterial: layer size is not a multiple of 4 in " + std::string(files[i])).c_str());
+            }
+        }
+
+        //  BC1  :        255,     BC3
+        if (format == BC_FORMAT_BC1) {
+            for (int i = 0; i < 4 && format == BC_FORMAT_BC1; ++i) {
+                const unsigned char* p = m_pResMgr->GetFileData(index[i]);
+                for (size_t t = 0; t < size_t(width[i]) * height[i]; ++t) {
+                    if (p[t * 4 + 3] != 255) {
+                        format = BC_FORMAT_BC3;
+                        break;
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < 4; ++i) {
+            if (isHit[i] && chains[i].GetFormat() == format) continue;
+
+            MipChain mips;
+            mips.Generate(m_pResMgr->GetFileData(index[i]), width[i], height[i], MIP_FILTER_KAISER,
+                isNormal ? MIP_NORMAL_MAP : MIP_NONE);
+            chains[i].Encode(mips, format, keys[i]);
+            isHit[i] = false;
+        }
+
+        // RGBA8     
+        for (int i = 0; i < 4; ++i) m_pResMgr->UnloadFileData(index[i]);
+    }
+
+    for (int i = 1; i < 4; ++i) {
+        if (chains[i].GetWidth(0) != chains[0].GetWidth(0) || chains[i].GetHeight(0) != chains[0].GetHeight(0)) {
+            throw GFX_Exception(("TerrainMaterial: layer size mismatch in " + std::string(files[i])).c_str());
+        }
+    }
+
+    //    CPU (   ),  GPU   
+    const unsigned int levels = chains[0].GetLevelCount();
+    std::vector<uint64_t> levelBytes(levels, 0);
+    for (unsigned int l = 0; l < levels; ++l) {
+        for (int i = 0; i < 4; ++i) levelBytes[l] += (uint64_t)chains[i].GetRowPitch(l) * chains[i].GetRowCount(l);
+    }
+    const unsigned int tail = StreamTailMip(levels, chains[0].GetWidth(0), chains[0].GetHeight(0));
+    arr.idxResidency = m_residency.AddTexture(levelBytes, tail);
+    ID3D12Resource* tex = nullptr;
+    const unsigned int idx = CreateArrayTexture(arr, tail, tex);
+    SetArrayTexture(arr, idx, tex);
+
+    for (int i = 0; i < 4; ++i) {
+        unsigned long long bytesRaw = 0;
+        for (unsigned int l = 0; l < chains[i].GetLevelCount(); ++l) {
+            bytesRaw += 4ull * chains[i].GetWidth(l) * chains[i].GetHeight(l);
+        }
+        StartupReport::Get().AddTextureQuality(files[i], BCChain::FormatName(chains[i].GetFormat()),
+            chains[i].GetPSNR(), bytesRaw, chains[i].GetSize(), isHit[i]);
+    }
+}
+
+unsigned int TerrainMaterial::CreateArrayTexture(const LayerArray& arr, unsigned int mip, ID3D12Resource*& tex) const {
+    // 2D array  4 ,  mip..N-1
+    const BCChain& c0 = arr.chains[0];
     D3D12_RESOURCE_DESC descTex = {};
-    descTex.MipLevels = 1;
-    descTex.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    descTex.Width = width;
-    descTex.Height = height;
+    descTex.MipLevels = (UINT16)(c0.GetLevelCount() - mip);
+    descTex.Format = (DXGI_FORMAT)c0.GetFormat();
+    descTex.Width = c0.GetWidth(mip);
+    descTex.Height = c0.GetHeight(mip);
     descTex.Flags = D3D12_RESOURCE_FLAG_NONE;
-    descTex.DepthOrArraySize = 8;                                // 8 
+    descTex.DepthOrArraySize = 4;
     descTex.SampleDesc.Count = 1;
     descTex.SampleDesc.Quality = 0;
     descTex.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
 
-    ID3D12Resource* textures = nullptr;
     CD3DX12_HEAP_PROPERTIES defHeap(D3D12_HEAP_TYPE_DEFAULT);
 
-    // /   SRV ( pixel  non-pixel )
-    unsigned int iBuffer = m_pResMgr->NewBuffer(
-        textures, &descTex, &defHeap, D3D12_HEAP_FLAG_NONE,
-        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
-        nullptr
-    );
-    textures->SetName(L"Texture Array Buffer");
-
-    // 8 :    
-    D3D12_SUBRESOURCE_DATA dataTex[8] = {};
-    for (int i = 0; i < 8; ++i) {
-        dataTex[i].pData = m_pResMgr->GetFileData(index[i]);
-        dataTex[i].RowPitch = width * 4;                // RGBA8
-        dataTex[i].SlicePitch = height * dataTex[i].RowPitch;
+    // /   SRV ( pixel  non-pixel );  , 
+    //       ,    
+    tex = nullptr;
+    const unsigned int idx = m_pResMgr->NewBuffer(tex, &descTex, &defHeap, D3D12_HEAP_FLAG_NONE, MATERIAL_STATE, nullptr);
+    tex->SetName(arr.name);
+
+    //   i: i * MipLevels .. i * MipLevels + MipLevels - 1
+    for (int i = 0; i < 4; ++i) {
+        m_pResMgr->UploadBCChain(idx, i * descTex.MipLevels, arr.chains[i], MATERIAL_STATE, mip);
     }
+    return idx;
+}
 
-    m_pResMgr->UploadToBuffer(iBuffer, 8, dataTex,
-        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+void TerrainMaterial::SetArrayTexture(LayerArray& arr, unsigned int idx, ID3D12Resource* tex) {
+    //     ,      
+    if (arr.idxBuffer != (unsigned int)-1) m_pResMgr->ReleaseResource(arr.idxBuffer);
+    arr.idxBuffer = idx;
+    arr.pTex = tex;
+}
 
-    // SRV  Texture2DArray
-    D3D12_SHADER_RESOURCE_VIEW_DESC descSRV = {};
-    descSRV.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-    descSRV.Format = descTex.Format;
-    descSRV.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
-    descSRV.Texture2DArray.MostDetailedMip = 0;
-    descSRV.Texture2DArray.MipLevels = descTex.MipLevels; // 1
-    descSRV.Texture2DArray.FirstArraySlice = 0;
-    descSRV.Texture2DArray.ArraySize = descTex.DepthOrArraySize; // 8
-    descSRV.Texture2DArray.PlaneSlice = 0;
-    descSRV.Texture2DArray.ResourceMinLODClamp = 0.0f;
+void TerrainMaterial::WriteTable() {
+    m_pResMgr->AllocateCBVSRVUAVRange(2, m_hdlTableCPU, m_hdlTableGPU);
 
-    m_pResMgr->AddSRV(textures, &descSRV, m_hdlTextureSRV_CPU, m_hdlTextureSRV_GPU);
+    D3D12_SHADER_RESOURCE_VIEW_DESC descSRV;
+    CD3DX12_CPU_DESCRIPTOR_HANDLE hdl(m_hdlTableCPU);
+    MakeArraySRV(m_arrDiffuse.pTex, descSRV);
+    m_pResMgr->UpdateSRV(m_arrDiffuse.pTex, &descSRV, hdl);
+    MakeArraySRV(m_arrNormals.pTex, descSRV);
+    m_pResMgr->UpdateSRV(m_arrNormals.pTex, &descSRV, hdl.Offset(1, m_pResMgr->GetCBVSRVUAVDescriptorSize()));
+}
 
-    m_listColors[0] = colors[0];
-    m_listColors[1] = colors[1];
-    m_listColors[2] = colors[2];
-    m_listColors[3] = colors[3];
+void TerrainMaterial::SetResidentMip(LayerArray& arr, unsigned int mip) {
+    ID3D12Resource* tex = nullptr;
+    const unsigned int idx = CreateArrayTexture(arr, mip, tex);
+    SetArrayTexture(arr, idx, tex);
+    SwapTable();
 }
 
-TerrainMaterial::~TerrainMaterial() {
-    m_pResMgr = nullptr;
+void TerrainMaterial::SwapTable() {
+    //       :     ,   
+    m_pResMgr->ReleaseCBVSRVUAVRange(m_hdlTableCPU, 2);
+    WriteTable();
+}
+
+void TerrainMaterial::Stream(const XMFLOAT3& eye, const std::vector<PatchBounds>& patches, float pixelAngle,
+    bool useTextures) {
+    //            :   
+    if (m_futPageIn.valid() && m_futPageIn.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        const unsigned int idx = m_futPageIn.get();
+        SetArrayTexture(m_opPageIn.tex == m_arrDiffuse.idxResidency ? m_arrDiffuse : m_arrNormals, idx,
+            m_pResMgr->GetResource(idx));
+        SwapTable();
+        m_residency.OnLoaded(m_opPageIn.tex);
+    }
+
+    const float eyePos[3] = { eye.x, eye.y, eye.z };
+    const float wDiffuse = (float)m_arrDiffuse.chains[0].GetWidth(0);
+    const float wNormals = (float)m_arrNormals.chains[0].GetWidth(0);
+    m_residency.BeginFrame();
+    if (useTextures) {
+        m_residency.RequestPatches(m_arrDiffuse.idxResidency, FootprintLayers(wDiffuse, MATERIAL_DIFFUSE_MAX_DISTANCE),
+            patches, eyePos, pixelAngle);
+    }
+    m_residency.RequestPatches(m_arrDiffuse.idxResidency, FootprintPaint(wDiffuse), patches, eyePos, pixelAngle);
+    m_residency.RequestPatches(m_arrNormals.idxResidency, FootprintLayers(wNormals, MATERIAL_NORMALS_MAX_DISTANCE),
+        patches, eyePos, pixelAngle);
+
+    //    :      
+    m_residency.Update(m_futPageIn.valid() ? 0 : 1, m_listOps);
+    for (const MipStreamOp& op : m_listOps) {
+        LayerArray& arr = op.tex == m_arrDiffuse.idxResidency ? m_arrDiffuse : m_arrNormals;
+        if (op.mipTo > op.mipFrom) {
+            SetResidentMip(arr, op.mipTo);
+            continue;
+        }
+
+        //      :         
+        //    ,    
+        m_opPageIn = op;
+        const LayerArray* pArr = &arr;
+        m_futPageIn = JobSystem::Shared().Submit([this, pArr, op]() {
+            ID3D12Resource* tex = nullptr;
+            return CreateArrayTexture(*pArr, op.mipTo, tex);
+        });
+    }
+}
+
+bool TerrainMaterial::SimulateStreaming() {
+    //  : 1k,  BC1,  BC5
+    auto describe = [](const char* name, unsigned int blockBytes, std::vector<MipFootprint> footprints) {
+        const unsigned int w = 1024;
+        StreamedTextureInfo info{ name, {}, 0, footprints };
+        const unsigned int levels = MipChain::CountLevels(w, w);
+        for (unsigned int l = 0; l < levels; ++l) {
+            const uint64_t blocks = (uint64_t)(((w >> l) + 3) / 4) * (((w >> l) + 3) / 4);
+            info.levelBytes.push_back(4 * blocks * blockBytes);
+        }
+        info.tailMip = StreamTailMip(levels, w, w);
+        return info;
+    };
+    std::vector<StreamedTextureInfo> textures;
+    textures.push_back(describe("diffuse", BCChain::BlockBytes(BC_FORMAT_BC1),
+        { FootprintLayers(1024.0f, MATERIAL_DIFFUSE_MAX_DISTANCE), FootprintPaint(1024.0f) }));
+    textures.push_back(describe("normals", BCChain::BlockBytes(BC_FORMAT_BC5),
+        { FootprintLayers(1024.0f, MATERIAL_NORMALS_MAX_DISTANCE) }));
+
+    uint64_t total = 0;
+    for (const StreamedTextureInfo& info : textures) {
+        for (uint64_t bytes : info.levelBytes) total += bytes;
+    }
+    const bool isOkDefault = SimulateMipStreaming(textures, MATERIAL_STREAM_BUDGET);
+    const bool isOkHalf = SimulateMipStreaming(textures, total / 2);
+    return isOkDefault && isOkHalf;
 }
 
-void TerrainMaterial::Attach(ID3D12GraphicsCommandList* cmdList, unsigned int srvDescTableIndex) {
-    cmdList->SetGraphicsRootDescriptorTable(srvDescTableIndex, m_hdlTextureSRV_GPU);
+void TerrainMaterial::Attach(CommandList* cmdList, unsigned int srvDescTableIndex) {
+    //    ,    
+    cmdList->SetGraphicsRootDescriptorTable(srvDescTableIndex, m_hdlTableGPU);
 }
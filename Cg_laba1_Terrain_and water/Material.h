@@ -1,6 +1,9 @@
 
 #pragma once
 #include "ResourceManager.h"
+#include "MipStreaming.h"
+#include <future>
+#include <vector>
 
 class TerrainMaterial {
 public:
@@ -9,12 +12,50 @@ public:
 		XMFLOAT4 colors[4]);
 	~TerrainMaterial();
 
-	void Attach(ID3D12GraphicsCommandList* cmdList, unsigned int srvDescTableIndex);
+	void Attach(CommandList* cmdList, unsigned int srvDescTableIndex);
 	XMFLOAT4* GetColors() { return m_listColors; }
+
+	// Mip streaming of the layer arrays. Both start with only the levels up to 128 texels on the GPU;
+	// the patches visible this frame say which finer levels are needed, and those are paged in and uploaded
+	// on the worker pool one array at a time under the budget, evicting the least recently needed levels.
+	// Call once per frame before the command list is recorded.
+	void Stream(const XMFLOAT3& eye, const std::vector<PatchBounds>& patches, float pixelAngle, bool useTextures);
+	// Runs the residency logic over a scripted camera path for the scene's two arrays (1k BC1 and BC5),
+	// once with the default budget and once with half the full chains. Needs no device.
+	static bool SimulateStreaming();
 private:
+	struct LayerArray {
+		BCChain			chains[4];
+		unsigned int	idxBuffer = (unsigned int)-1;	// slot in the ResourceManager
+		unsigned int	idxResidency = 0;
+		ID3D12Resource*	pTex = nullptr;					// current GPU copy, the resident levels only
+		const wchar_t*	name = L"";
+	};
+
+	// Block-compressed 4-layer array; encoded chains come from / go to the TextureCache and stay on the CPU
+	// as the source for streaming.
+	void LoadLayerArray(const char* const files[4], bool isNormal, LayerArray& arr);
+	// Creates a texture with levels mip..N-1 of arr in a new ResourceManager slot and uploads them. Leaves arr
+	// alone, so it runs on a worker (through that thread's upload context) while frames still draw the old one.
+	unsigned int CreateArrayTexture(const LayerArray& arr, unsigned int mip, ID3D12Resource*& tex) const;
+	// Makes the texture in slot idx current; the one it replaces goes to the deferred release queue.
+	void SetArrayTexture(LayerArray& arr, unsigned int idx, ID3D12Resource* tex);
+	// New SRV table for both arrays.
+	void WriteTable();
+	// Queues the current table for release and writes a new one.
+	void SwapTable();
+	// CreateArrayTexture and SetArrayTexture on the calling thread, then SwapTable.
+	void SetResidentMip(LayerArray& arr, unsigned int mip);
+
 	ResourceManager* m_pResMgr;
-	D3D12_CPU_DESCRIPTOR_HANDLE m_hdlTextureSRV_CPU;
-	D3D12_GPU_DESCRIPTOR_HANDLE m_hdlTextureSRV_GPU;
+	LayerArray					m_arrDiffuse;
+	LayerArray					m_arrNormals;
+	D3D12_CPU_DESCRIPTOR_HANDLE	m_hdlTableCPU;			// diffuse, normals right after it
+	D3D12_GPU_DESCRIPTOR_HANDLE	m_hdlTableGPU;
+	MipResidency				m_residency;
+	std::future<unsigned int>	m_futPageIn;			// slot of the texture the load in flight creates
+	MipStreamOp					m_opPageIn = {};
+	std::vector<MipStreamOp>	m_listOps;
 	XMFLOAT4					m_listColors[4];
 };
 
@@ -0,0 +1,250 @@
+#include "MipGen.h"
+#include "JobSystem.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+    const int KAISER_TAPS = 8;              // source texels -3.5 .. +3.5 around the destination centre
+    const unsigned int MIN_ROWS_PER_TASK = 32;
+
+    struct Plane {
+        const unsigned char*    src;
+        unsigned char*          dst;
+        unsigned int            sw, sh;     // source level
+        unsigned int            dw, dh;     // destination level
+    };
+
+    double BesselI0(double x) {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; ++k) {
+            double t = x / (2.0 * k);
+            term *= t * t;
+            sum += term;
+            if (term < sum * 1e-12) break;
+        }
+        return sum;
+    }
+
+    struct KaiserKernel {
+        float w[KAISER_TAPS];
+
+        KaiserKernel() {
+            const double PI = 3.14159265358979323846;
+            const double alpha = 4.0, halfWidth = 2.0;  // in destination texels
+            double sum = 0.0, wd[KAISER_TAPS];
+            for (int t = 0; t < KAISER_TAPS; ++t) {
+                double d = (t - 3.5) / 2.0;
+                double sinc = std::sin(PI * d) / (PI * d);
+                double r = d / halfWidth;
+                double window = BesselI0(alpha * std::sqrt((std::max)(0.0, 1.0 - r * r))) / BesselI0(alpha);
+                wd[t] = sinc * window;
+                sum += wd[t];
+            }
+            for (int t = 0; t < KAISER_TAPS; ++t) w[t] = static_cast<float>(wd[t] / sum);
+        }
+    };
+
+    const KaiserKernel& Kaiser() {
+        static KaiserKernel kernel;
+        return kernel;
+    }
+
+    inline __m128 LoadPixel(const unsigned char* p) {
+        int v;
+        std::memcpy(&v, p, 4);
+        const __m128i z = _mm_setzero_si128();
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), z), z));
+    }
+
+    inline void StorePixel(unsigned char* p, __m128 v) {
+        __m128i i = _mm_cvtps_epi32(v);
+        i = _mm_packs_epi32(i, i);
+        i = _mm_packus_epi16(i, i);     // clamps the Kaiser over/undershoot to 0..255
+        int out = _mm_cvtsi128_si32(i);
+        std::memcpy(p, &out, 4);
+    }
+
+    void BoxRows(const Plane& pl, unsigned int x0, unsigned int x1, unsigned int y0, unsigned int y1) {
+        const bool isExact = pl.sw == pl.dw * 2 && pl.sh == pl.dh * 2;
+        const __m128i z = _mm_setzero_si128();
+        const __m128i two = _mm_set1_epi16(2);
+
+        for (unsigned int y = y0; y < y1; ++y) {
+            const unsigned char* r0 = pl.src + size_t((std::min)(2 * y, pl.sh - 1)) * pl.sw * 4;
+            const unsigned char* r1 = pl.src + size_t((std::min)(2 * y + 1, pl.sh - 1)) * pl.sw * 4;
+            unsigned char* out = pl.dst + size_t(y) * pl.dw * 4;
+
+            unsigned int x = x0;
+            if (isExact) {
+                // 4 source texels of two rows -> 2 destination texels per iteration
+                for (; x + 2 <= x1; x += 2) {
+                    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + size_t(x) * 8));
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + size_t(x) * 8));
+                    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, z), _mm_unpacklo_epi8(b, z));
+                    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, z), _mm_unpackhi_epi8(b, z));
+                    lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+                    hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+                    __m128i s = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + size_t(x) * 4), _mm_packus_epi16(s, s));
+                }
+            }
+            for (; x < x1; ++x) {
+                const unsigned int sx0 = (std::min)(2 * x, pl.sw - 1) * 4;
+                const unsigned int sx1 = (std::min)(2 * x + 1, pl.sw - 1) * 4;
+                for (int c = 0; c < 4; ++c) {
+                    out[x * 4 + c] = static_cast<unsigned char>(
+                        (r0[sx0 + c] + r0[sx1 + c] + r1[sx0 + c] + r1[sx1 + c] + 2) >> 2);
+                }
+            }
+        }
+    }
+
+    void KaiserRows(const Plane& pl, unsigned int x0, unsigned int x1, unsigned int y0, unsigned int y1) {
+        const float* w = Kaiser().w;
+        const int sxBegin = (std::max)(0, 2 * (int)x0 - 3);
+        const int sxEnd = (std::min)((int)pl.sw, 2 * (int)x1 + 3);
+        std::vector<float> col(size_t(sxEnd - sxBegin) * 4);
+
+        __m128 wv[KAISER_TAPS];
+        for (int t = 0; t < KAISER_TAPS; ++t) wv[t] = _mm_set1_ps(w[t]);
+
+        for (unsigned int y = y0; y < y1; ++y) {
+            // vertical pass over the source columns this span needs
+            const unsigned char* rows[KAISER_TAPS];
+            for (int t = 0; t < KAISER_TAPS; ++t) {
+                int sy = (std::min)((std::max)(2 * (int)y - 3 + t, 0), (int)pl.sh - 1);
+                rows[t] = pl.src + size_t(sy) * pl.sw * 4;
+            }
+            for (int sx = sxBegin; sx < sxEnd; ++sx) {
+                __m128 acc = _mm_setzero_ps();
+                for (int t = 0; t < KAISER_TAPS; ++t) {
+                    acc = _mm_add_ps(acc, _mm_mul_ps(wv[t], LoadPixel(rows[t] + size_t(sx) * 4)));
+                }
+                _mm_storeu_ps(&col[size_t(sx - sxBegin) * 4], acc);
+            }
+
+            // horizontal pass
+            unsigned char* out = pl.dst + size_t(y) * pl.dw * 4;
+            for (unsigned int x = x0; x < x1; ++x) {
+                __m128 acc = _mm_set1_ps(0.0f);
+                for (int t = 0; t < KAISER_TAPS; ++t) {
+                    int sx = (std::min)((std::max)(2 * (int)x - 3 + t, 0), (int)pl.sw - 1);
+                    acc = _mm_add_ps(acc, _mm_mul_ps(wv[t], _mm_loadu_ps(&col[size_t(sx - sxBegin) * 4])));
+                }
+                StorePixel(out + size_t(x) * 4, acc);
+            }
+        }
+    }
+
+    void FinishRows(const Plane& pl, unsigned int flags,
+        unsigned int x0, unsigned int x1, unsigned int y0, unsigned int y1) {
+        for (unsigned int y = y0; y < y1; ++y) {
+            const unsigned char* r0 = pl.src + size_t((std::min)(2 * y, pl.sh - 1)) * pl.sw * 4;
+            const unsigned char* r1 = pl.src + size_t((std::min)(2 * y + 1, pl.sh - 1)) * pl.sw * 4;
+            unsigned char* out = pl.dst + size_t(y) * pl.dw * 4;
+
+            for (unsigned int x = x0; x < x1; ++x) {
+                unsigned char* p = out + size_t(x) * 4;
+
+                if (flags & MIP_NORMAL_MAP) {
+                    float n[3] = { p[0] / 127.5f - 1.0f, p[1] / 127.5f - 1.0f, p[2] / 127.5f - 1.0f };
+                    float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    if (len > 1e-4f) {
+                        for (int c = 0; c < 3; ++c) n[c] /= len;
+                    }
+                    else {
+                        n[0] = 0.0f; n[1] = 0.0f; n[2] = 1.0f;
+                    }
+                    for (int c = 0; c < 3; ++c) {
+                        float v = (n[c] * 0.5f + 0.5f) * 255.0f + 0.5f;
+                        p[c] = static_cast<unsigned char>(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+                    }
+                }
+
+                if (flags & MIP_ALPHA_MAX) {
+                    const unsigned int sx0 = (std::min)(2 * x, pl.sw - 1) * 4 + 3;
+                    const unsigned int sx1 = (std::min)(2 * x + 1, pl.sw - 1) * 4 + 3;
+                    p[3] = (std::max)((std::max)(r0[sx0], r0[sx1]), (std::max)(r1[sx0], r1[sx1]));
+                }
+            }
+        }
+    }
+}
+
+unsigned int MipChain::CountLevels(unsigned int w, unsigned int h) {
+    unsigned int n = 1;
+    while (w > 1 || h > 1) {
+        w = (std::max)(1u, w / 2);
+        h = (std::max)(1u, h / 2);
+        ++n;
+    }
+    return n;
+}
+
+void MipChain::Generate(const unsigned char* level0, unsigned int w, unsigned int h,
+    MipFilter filter, unsigned int flags) {
+    m_pLevel0 = level0;
+    m_filter = filter;
+    m_flags = flags;
+
+    const unsigned int n = CountLevels(w, h);
+    m_listLevels.clear();
+    m_listLevels.push_back({ 0, w, h });
+
+    size_t total = 0;
+    for (unsigned int i = 1; i < n; ++i) {
+        w = (std::max)(1u, w / 2);
+        h = (std::max)(1u, h / 2);
+        m_listLevels.push_back({ total, w, h });
+        total += size_t(w) * h * 4;
+    }
+    m_bufMips.resize(total);
+
+    for (unsigned int i = 1; i < n; ++i) {
+        BuildLevel(i, 0, 0, m_listLevels[i].w, m_listLevels[i].h);
+    }
+}
+
+void MipChain::Update(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+    std::vector<MipRect>* outRects) {
+    if (outRects) outRects->clear();
+    if (m_listLevels.empty()) return;
+
+    x1 = (std::min)(x1, m_listLevels[0].w);
+    y1 = (std::min)(y1, m_listLevels[0].h);
+    if (x0 >= x1 || y0 >= y1) return;
+    if (outRects) outRects->push_back({ x0, y0, x1, y1 });
+
+    // the Kaiser taps reach 2 destination texels past the box footprint
+    const unsigned int pad = m_filter == MIP_FILTER_KAISER ? 2 : 0;
+    for (unsigned int i = 1; i < GetLevelCount(); ++i) {
+        const Level& lv = m_listLevels[i];
+        x0 = x0 / 2 > pad ? x0 / 2 - pad : 0;
+        y0 = y0 / 2 > pad ? y0 / 2 - pad : 0;
+        x1 = (std::min)((x1 + 1) / 2 + pad, lv.w);
+        y1 = (std::min)((y1 + 1) / 2 + pad, lv.h);
+        BuildLevel(i, x0, y0, x1, y1);
+        if (outRects) outRects->push_back({ x0, y0, x1, y1 });
+    }
+}
+
+void MipChain::BuildLevel(unsigned int i, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1) {
+    Plane pl;
+    pl.src = GetLevel(i - 1);
+    pl.dst = m_bufMips.data() + m_listLevels[i].offset;
+    pl.sw = m_listLevels[i - 1].w;
+    pl.sh = m_listLevels[i - 1].h;
+    pl.dw = m_listLevels[i].w;
+    pl.dh = m_listLevels[i].h;
+
+    const MipFilter filter = m_filter;
+    const unsigned int flags = m_flags;
+    JobSystem::Shared().ParallelFor(y0, y1, MIN_ROWS_PER_TASK,
+        [&pl, filter, flags, x0, x1](unsigned int a, unsigned int b) {
+        if (filter == MIP_FILTER_KAISER) KaiserRows(pl, x0, x1, a, b);
+        else BoxRows(pl, x0, x1, a, b);
+        if (flags) FinishRows(pl, flags, x0, x1, a, b);
+    });
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Downsampling filter used to build each level from the one above it.
+// Box is the plain 2x2 average; Kaiser is an 8-tap windowed sinc that keeps distant detail sharper.
+enum MipFilter { MIP_FILTER_BOX, MIP_FILTER_KAISER };
+
+// MIP_NORMAL_MAP: RGB holds a unit vector in [0,1], renormalised after filtering.
+// MIP_ALPHA_MAX: alpha is the max of the 2x2 footprint instead of the filtered value (paint mask).
+enum MipFlags { MIP_NONE = 0, MIP_NORMAL_MAP = 1, MIP_ALPHA_MAX = 2 };
+
+// Texel rectangle [x0,x1) x [y0,y1) of one level.
+struct MipRect {
+    unsigned int x0, y0, x1, y1;
+};
+
+// Full mip chain of a tightly packed RGBA8 image.
+// Level 0 is the caller's buffer and is not copied; levels 1..N live in the chain.
+// Rows of each level are split across JobSystem::Shared(), the calling thread takes a share too.
+class MipChain {
+public:
+    MipChain() = default;
+
+    void Generate(const unsigned char* level0, unsigned int w, unsigned int h,
+        MipFilter filter = MIP_FILTER_BOX, unsigned int flags = MIP_NONE);
+
+    // Rebuilds only the texels of levels 1..N that depend on [x0,x1) x [y0,y1) of level 0.
+    // outRects receives the touched rectangle of every level, level 0 included (empty if nothing was touched).
+    void Update(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+        std::vector<MipRect>* outRects = nullptr);
+
+    unsigned int GetLevelCount() const { return static_cast<unsigned int>(m_listLevels.size()); }
+    const unsigned char* GetLevel(unsigned int i) const { return i ? m_bufMips.data() + m_listLevels[i].offset : m_pLevel0; }
+    unsigned int GetWidth(unsigned int i) const { return m_listLevels[i].w; }
+    unsigned int GetHeight(unsigned int i) const { return m_listLevels[i].h; }
+
+    static unsigned int CountLevels(unsigned int w, unsigned int h);
+
+private:
+    struct Level {
+        size_t          offset;     // into m_bufMips, unused for level 0
+        unsigned int    w;
+        unsigned int    h;
+    };
+
+    void BuildLevel(unsigned int i, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1);
+
+    const unsigned char*        m_pLevel0 = nullptr;
+    std::vector<Level>          m_listLevels;
+    std::vector<unsigned char>  m_bufMips;
+    MipFilter                   m_filter = MIP_FILTER_BOX;
+    unsigned int                m_flags = MIP_NONE;
+};
@@ -0,0 +1,247 @@
+#include "MipStreaming.h"
+#include "StartupReport.h"
+#include <algorithm>
+#include <cmath>
+
+float MipForDistance(float d, float texelsPerUnit, float pixelAngle) {
+    // texels under one pixel; the sampler goes one level coarser each time it doubles
+    const float texelsPerPixel = texelsPerUnit * d * pixelAngle;
+    return texelsPerPixel > 1.0f ? std::log2(texelsPerPixel) : 0.0f;
+}
+
+unsigned int MipResidency::AddTexture(const std::vector<uint64_t>& levelBytes, unsigned int tailMip) {
+    Texture t;
+    t.levelBytes = levelBytes;
+    t.lastUsed.assign(levelBytes.size(), 0);
+    t.tailMip = (std::min)(tailMip, static_cast<unsigned int>(levelBytes.size()) - 1);
+    t.residentMip = t.tailMip;
+    t.loadingMip = t.tailMip;
+    t.wantedMip = static_cast<float>(levelBytes.size());
+    t.weight = 0.0f;
+    m_sizeResident += BytesOf(t, t.tailMip, static_cast<unsigned int>(levelBytes.size()));
+    m_listTextures.push_back(std::move(t));
+    return static_cast<unsigned int>(m_listTextures.size() - 1);
+}
+
+uint64_t MipResidency::BytesOf(const Texture& t, unsigned int first, unsigned int last) const {
+    uint64_t bytes = 0;
+    for (unsigned int l = first; l < last; ++l) bytes += t.levelBytes[l];
+    return bytes;
+}
+
+uint64_t MipResidency::GetTotalBytes() const {
+    uint64_t bytes = 0;
+    for (const Texture& t : m_listTextures) bytes += BytesOf(t, 0, static_cast<unsigned int>(t.levelBytes.size()));
+    return bytes;
+}
+
+unsigned int MipResidency::GetWantedMip(unsigned int tex) const {
+    const Texture& t = m_listTextures[tex];
+    const unsigned int levels = static_cast<unsigned int>(t.levelBytes.size());
+    if (t.wantedMip >= static_cast<float>(levels)) return levels;
+    return (std::min)(static_cast<unsigned int>(t.wantedMip), levels - 1);
+}
+
+void MipResidency::BeginFrame() {
+    ++m_frame;
+    for (Texture& t : m_listTextures) {
+        t.wantedMip = static_cast<float>(t.levelBytes.size());
+        t.weight = 0.0f;
+    }
+}
+
+void MipResidency::Request(unsigned int tex, float mip, float weight) {
+    Texture& t = m_listTextures[tex];
+    t.wantedMip = (std::min)(t.wantedMip, (std::max)(mip, 0.0f));
+    t.weight += weight;
+}
+
+void MipResidency::RequestPatches(unsigned int tex, const MipFootprint& fp, const std::vector<PatchBounds>& patches,
+    const float eye[3], float pixelAngle) {
+    for (const PatchBounds& p : patches) {
+        // nearest point of the box: the finest mip anywhere on the patch is needed there
+        const float dx = (std::max)((std::max)(p.x0 - eye[0], eye[0] - p.x1), 0.0f);
+        const float dy = (std::max)((std::max)(p.y0 - eye[1], eye[1] - p.y1), 0.0f);
+        const float dz = (std::max)((std::max)(p.z0 - eye[2], eye[2] - p.z1), 0.0f);
+        const float d = std::sqrt(dx * dx + dy * dy + dz * dz);
+        if (fp.maxDistance > 0.0f && d > fp.maxDistance) continue;
+
+        const float area = (p.x1 - p.x0) * (p.y1 - p.y0);
+        Request(tex, MipForDistance(d, fp.texelsPerUnit, pixelAngle), area / (std::max)(d * d, 1.0f));
+    }
+}
+
+bool MipResidency::EvictOne(unsigned int except, std::vector<MipStreamOp>& ops) {
+    // least recently wanted finest level among idle textures; anything wanted this frame stays
+    unsigned int victim = static_cast<unsigned int>(m_listTextures.size());
+    uint64_t oldest = m_frame;
+    for (unsigned int i = 0; i < m_listTextures.size(); ++i) {
+        const Texture& t = m_listTextures[i];
+        if (i == except || t.loadingMip != t.residentMip || t.residentMip >= t.tailMip) continue;
+        if (t.lastUsed[t.residentMip] < oldest) {
+            oldest = t.lastUsed[t.residentMip];
+            victim = i;
+        }
+    }
+    if (victim == m_listTextures.size()) return false;
+
+    Texture& t = m_listTextures[victim];
+    m_sizeResident -= t.levelBytes[t.residentMip];
+    ++t.residentMip;
+    t.loadingMip = t.residentMip;
+    ++m_numEvictions;
+
+    // several levels of one texture in a row become one op
+    if (!ops.empty() && ops.back().tex == victim && ops.back().mipTo > ops.back().mipFrom) {
+        ops.back().mipTo = t.residentMip;
+    }
+    else {
+        ops.push_back({ victim, t.residentMip - 1, t.residentMip });
+    }
+    return true;
+}
+
+void MipResidency::Update(unsigned int maxLoads, std::vector<MipStreamOp>& ops) {
+    ops.clear();
+
+    struct Candidate {
+        unsigned int    tex;
+        unsigned int    target;
+        float           priority;
+    };
+    std::vector<Candidate> candidates;
+    for (unsigned int i = 0; i < m_listTextures.size(); ++i) {
+        Texture& t = m_listTextures[i];
+        const unsigned int wanted = GetWantedMip(i);
+        for (unsigned int l = wanted; l < t.levelBytes.size(); ++l) t.lastUsed[l] = m_frame;
+        if (t.loadingMip != t.residentMip || wanted >= t.residentMip) continue;
+        candidates.push_back({ i, wanted, static_cast<float>(t.residentMip - wanted) * t.weight });
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+        [](const Candidate& a, const Candidate& b) { return a.priority > b.priority; });
+
+    unsigned int numStarted = 0;
+    for (const Candidate& c : candidates) {
+        if (numStarted >= maxLoads) break;
+        Texture& t = m_listTextures[c.tex];
+
+        while (m_sizeResident + BytesOf(t, c.target, t.residentMip) > m_sizeBudget && EvictOne(c.tex, ops)) {}
+
+        // still too big: stream in as much of the way as fits
+        unsigned int target = c.target;
+        while (target < t.residentMip && m_sizeResident + BytesOf(t, target, t.residentMip) > m_sizeBudget) ++target;
+        if (target >= t.residentMip) continue;
+
+        m_sizeResident += BytesOf(t, target, t.residentMip);
+        t.loadingMip = target;
+        ops.push_back({ c.tex, t.residentMip, target });
+        ++m_numLoads;
+        ++numStarted;
+    }
+}
+
+void MipResidency::OnLoaded(unsigned int tex) {
+    Texture& t = m_listTextures[tex];
+    t.residentMip = t.loadingMip;
+}
+
+// ---- camera-path simulation ----
+
+static float SimHeight(float x, float y) {
+    return 200.0f + 150.0f * std::sin(x / 300.0f) * std::cos(y / 270.0f);
+}
+
+bool SimulateMipStreaming(const std::vector<StreamedTextureInfo>& textures, uint64_t budget) {
+    static const int   NUM_FRAMES = 600;
+    static const int   LOAD_FRAMES = 4;         // a load lands this many frames after it was started
+    static const float TERRAIN_SIZE = 4096.0f;
+    static const float PATCH_SIZE = 64.0f;
+    static const float PIXEL_ANGLE = 2.0f * 0.57735f / 1080.0f;    // 60 degree vertical fov, 1080 rows
+
+    // 64x64 patches, z bounds from the corners and the centre
+    std::vector<PatchBounds> patches;
+    for (float y = 0.0f; y < TERRAIN_SIZE; y += PATCH_SIZE) {
+        for (float x = 0.0f; x < TERRAIN_SIZE; x += PATCH_SIZE) {
+            const float z[5] = { SimHeight(x, y), SimHeight(x + PATCH_SIZE, y), SimHeight(x, y + PATCH_SIZE),
+                SimHeight(x + PATCH_SIZE, y + PATCH_SIZE), SimHeight(x + 0.5f * PATCH_SIZE, y + 0.5f * PATCH_SIZE) };
+            patches.push_back({ x, y, *std::min_element(z, z + 5), x + PATCH_SIZE, y + PATCH_SIZE, *std::max_element(z, z + 5) });
+        }
+    }
+
+    MipResidency res;
+    res.SetBudget(budget);
+    for (const StreamedTextureInfo& info : textures) res.AddTexture(info.levelBytes, info.tailMip);
+
+    StartupReport::Line("\n=== Mip streaming simulation (%zu textures, %.2f of %.2f MB budget, loads land after %d frames) ===\n",
+        textures.size(), budget / 1048576.0, res.GetTotalBytes() / 1048576.0, LOAD_FRAMES);
+
+    bool isOk = true;
+    uint64_t peak = res.GetResidentBytes();
+    std::vector<int> landing(textures.size(), -1);
+    std::vector<MipStreamOp> ops;
+    for (int frame = 0; frame < NUM_FRAMES; ++frame) {
+        // down from 1500 over the centre, hold, skim 1000 units at 5 above the ground, climb back out
+        float eye[3] = { 2048.0f, 2048.0f, 0.0f };
+        float altitude = 5.0f;
+        if (frame < 150) altitude = 1500.0f + (5.0f - 1500.0f) * frame / 150.0f;
+        else if (frame >= 210 && frame < 390) eye[0] += 1000.0f * (frame - 210) / 180.0f;
+        else if (frame >= 390) {
+            eye[0] = 3048.0f - 1000.0f * (frame - 390) / 210.0f;
+            altitude = 5.0f + 1495.0f * (frame - 390) / 210.0f;
+        }
+        eye[2] = SimHeight(eye[0], eye[1]) + altitude;
+
+        for (size_t i = 0; i < textures.size(); ++i) {
+            if (landing[i] == frame) {
+                res.OnLoaded(static_cast<unsigned int>(i));
+                landing[i] = -1;
+            }
+        }
+
+        res.BeginFrame();
+        for (unsigned int i = 0; i < textures.size(); ++i) {
+            for (const MipFootprint& fp : textures[i].footprints) res.RequestPatches(i, fp, patches, eye, PIXEL_ANGLE);
+        }
+        res.Update(1, ops);
+        for (const MipStreamOp& op : ops) {
+            if (op.mipTo < op.mipFrom) landing[op.tex] = frame + LOAD_FRAMES;
+        }
+
+        peak = (std::max)(peak, res.GetResidentBytes());
+        if (res.GetResidentBytes() > budget) {
+            StartupReport::Line("  FAILED: frame %d is over budget (%.2f MB)\n", frame, res.GetResidentBytes() / 1048576.0);
+            isOk = false;
+        }
+
+        // end of the hold: whatever is wanted and fits into the budget has to be resident by now
+        if (frame == 209) {
+            uint64_t bytesWanted = 0;
+            for (unsigned int i = 0; i < textures.size(); ++i) {
+                unsigned int w = (std::min)(res.GetWantedMip(i), textures[i].tailMip);
+                for (unsigned int l = w; l < textures[i].levelBytes.size(); ++l) bytesWanted += textures[i].levelBytes[l];
+            }
+            for (unsigned int i = 0; i < textures.size() && bytesWanted <= budget; ++i) {
+                if (res.GetResidentMip(i) > res.GetWantedMip(i)) {
+                    StartupReport::Line("  FAILED: %s wants mip %u after the hold, resident %u\n",
+                        textures[i].name, res.GetWantedMip(i), res.GetResidentMip(i));
+                    isOk = false;
+                }
+            }
+        }
+
+        if (frame % 50 == 0 || frame == NUM_FRAMES - 1) {
+            char line[256];
+            int n = snprintf(line, sizeof(line), "  frame %3d  altitude %7.1f |", frame, altitude);
+            for (unsigned int i = 0; i < textures.size() && n > 0 && n < (int)sizeof(line); ++i) {
+                n += snprintf(line + n, sizeof(line) - n, " %s %u/%u%s", textures[i].name, res.GetWantedMip(i),
+                    res.GetResidentMip(i), res.IsLoading(i) ? "*" : "");
+            }
+            StartupReport::Line("%s | %.2f MB, %u loads, %u evictions\n", line, res.GetResidentBytes() / 1048576.0,
+                res.GetLoadCount(), res.GetEvictionCount());
+        }
+    }
+
+    StartupReport::Line("  wanted/resident mip per texture, * = load in flight; peak %.2f MB, %u loads, %u evictions: %s\n",
+        peak / 1048576.0, res.GetLoadCount(), res.GetEvictionCount(), isOk ? "ok" : "FAILED");
+    return isOk;
+}
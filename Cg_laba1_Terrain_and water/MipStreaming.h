@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// World-space bounds of one terrain patch.
+struct PatchBounds {
+    float x0, y0, z0;
+    float x1, y1, z1;
+};
+
+// How a streamed texture lands on the terrain: texels per world unit along the surface and the
+// distance beyond which the shader no longer samples it (0: sampled at any distance).
+struct MipFootprint {
+    float texelsPerUnit;
+    float maxDistance;
+};
+
+// One residency change: levels mipTo..N-1 resident instead of mipFrom..N-1.
+// mipTo < mipFrom streams finer levels in, mipTo > mipFrom evicts.
+struct MipStreamOp {
+    unsigned int tex;
+    unsigned int mipFrom;
+    unsigned int mipTo;
+};
+
+// Finest mip a surface at distance d needs when one pixel spans pixelAngle radians.
+float MipForDistance(float d, float texelsPerUnit, float pixelAngle);
+
+// Which mip levels of the streamed textures stay resident under a byte budget.
+// Feedback arrives as Request calls during a frame; Update turns it into residency changes: loads
+// ordered by how many levels are missing times screen share, and LRU eviction of the finest levels
+// nobody asked for lately whenever a load would not fit. Knows nothing about the GPU, so the same
+// code runs under the camera-path simulation.
+class MipResidency {
+public:
+    MipResidency() = default;
+
+    // levelBytes[0] is the finest level. Levels tailMip..N-1 are resident from the start and never evicted.
+    unsigned int AddTexture(const std::vector<uint64_t>& levelBytes, unsigned int tailMip);
+    void SetBudget(uint64_t bytes) { m_sizeBudget = bytes; }
+
+    void BeginFrame();
+    // A visible surface wants texture tex down to mip; weight is its share of the screen.
+    void Request(unsigned int tex, float mip, float weight);
+    // One request per patch within fp.maxDistance of eye.
+    void RequestPatches(unsigned int tex, const MipFootprint& fp, const std::vector<PatchBounds>& patches,
+        const float eye[3], float pixelAngle);
+    // Starts at most maxLoads loads. Evictions come first in ops and are committed right away;
+    // a load reserves its bytes now and is committed by OnLoaded once the texels are on the GPU.
+    void Update(unsigned int maxLoads, std::vector<MipStreamOp>& ops);
+    void OnLoaded(unsigned int tex);
+
+    unsigned int GetTextureCount() const { return static_cast<unsigned int>(m_listTextures.size()); }
+    unsigned int GetLevelCount(unsigned int tex) const { return static_cast<unsigned int>(m_listTextures[tex].levelBytes.size()); }
+    unsigned int GetResidentMip(unsigned int tex) const { return m_listTextures[tex].residentMip; }
+    // Finest level asked for this frame, GetLevelCount(tex) when nobody asked.
+    unsigned int GetWantedMip(unsigned int tex) const;
+    bool IsLoading(unsigned int tex) const { return m_listTextures[tex].loadingMip != m_listTextures[tex].residentMip; }
+    uint64_t GetResidentBytes() const { return m_sizeResident; }
+    uint64_t GetBudget() const { return m_sizeBudget; }
+    uint64_t GetTotalBytes() const;
+    unsigned int GetLoadCount() const { return m_numLoads; }
+    unsigned int GetEvictionCount() const { return m_numEvictions; }
+
+private:
+    struct Texture {
+        std::vector<uint64_t>   levelBytes;
+        std::vector<uint64_t>   lastUsed;       // frame each level was last wanted
+        unsigned int            tailMip;
+        unsigned int            residentMip;
+        unsigned int            loadingMip;     // equals residentMip when no load is in flight
+        float                   wantedMip;      // this frame; level count when nobody asked
+        float                   weight;
+    };
+
+    uint64_t BytesOf(const Texture& t, unsigned int first, unsigned int last) const;
+    bool EvictOne(unsigned int except, std::vector<MipStreamOp>& ops);
+
+    std::vector<Texture>    m_listTextures;
+    uint64_t                m_sizeBudget = UINT64_MAX;
+    uint64_t                m_sizeResident = 0;     // loads in flight included
+    uint64_t                m_frame = 0;
+    unsigned int            m_numLoads = 0;
+    unsigned int            m_numEvictions = 0;
+};
+
+// Everything the camera-path simulation needs to know about one streamed texture.
+struct StreamedTextureInfo {
+    const char*                 name;
+    std::vector<uint64_t>       levelBytes;
+    unsigned int                tailMip;
+    std::vector<MipFootprint>   footprints;     // one request per footprint and patch
+};
+
+// Flies a scripted camera down onto a synthetic 4096x4096 terrain, along it and back up, with loads
+// landing a few frames late, and prints residency every 50 frames. Returns false if the budget was
+// ever exceeded or a wanted level that fits never arrived. Needs no device.
+bool SimulateMipStreaming(const std::vector<StreamedTextureInfo>& textures, uint64_t budget);
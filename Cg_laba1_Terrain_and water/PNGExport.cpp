@@ -0,0 +1,255 @@
+#include "PNGExport.h"
+#include "JobSystem.h"
+#include "lodepng.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+    const size_t PIECE_SIZE = 256 * 1024;  // filtered bytes per deflate piece
+    const unsigned int MIN_ROWS_PER_TASK = 64;
+    const uint32_t ADLER_BASE = 65521;
+
+    uint32_t Adler32(const unsigned char* p, size_t size) {
+        uint32_t s1 = 1, s2 = 0;
+        while (size > 0) {
+            size_t n = size < 5552 ? size : 5552;   // largest run before s2 can overflow
+            size -= n;
+            while (n--) {
+                s1 += *p++;
+                s2 += s1;
+            }
+            s1 %= ADLER_BASE;
+            s2 %= ADLER_BASE;
+        }
+        return (s2 << 16) | s1;
+    }
+
+    // Adler32 of A followed by B, from adler(A), adler(B) and the length of B (same as zlib's adler32_combine).
+    uint32_t Adler32Combine(uint32_t a1, uint32_t a2, size_t len2) {
+        uint32_t rem = static_cast<uint32_t>(len2 % ADLER_BASE);
+        uint32_t sum1 = a1 & 0xffff;
+        uint32_t sum2 = (rem * sum1) % ADLER_BASE;
+        sum1 += (a2 & 0xffff) + ADLER_BASE - 1;
+        sum2 += ((a1 >> 16) & 0xffff) + ((a2 >> 16) & 0xffff) + ADLER_BASE - rem;
+        if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+        if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+        if (sum2 >= 2 * ADLER_BASE) sum2 -= 2 * ADLER_BASE;
+        if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+        return (sum2 << 16) | sum1;
+    }
+
+    void Put32(std::vector<unsigned char>& out, uint32_t v) {
+        out.push_back(static_cast<unsigned char>(v >> 24));
+        out.push_back(static_cast<unsigned char>(v >> 16));
+        out.push_back(static_cast<unsigned char>(v >> 8));
+        out.push_back(static_cast<unsigned char>(v));
+    }
+
+    // Length, type, data and CRC; the CRC covers type and data.
+    void PutChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t size) {
+        Put32(out, static_cast<uint32_t>(size));
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        Put32(out, lodepng_crc32(out.data() + start, size + 4));
+    }
+
+    unsigned char Paeth(int a, int b, int c) {
+        int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - c - c);
+        if (pc < pa && pc < pb) return static_cast<unsigned char>(c);
+        if (pb < pa) return static_cast<unsigned char>(b);
+        return static_cast<unsigned char>(a);
+    }
+
+    // Tries the five PNG filters on one row (2 bytes per pixel) and keeps the one with the smallest sum of
+    // |signed byte|, the usual heuristic and lodepng's default. dst receives the filter byte and the row.
+    void FilterRow(unsigned char* dst, const unsigned char* row, const unsigned char* prev, size_t size,
+        unsigned char* scratch) {
+        const size_t bpp = 2;
+        size_t bestSum = SIZE_MAX;
+        for (unsigned char type = 0; type < 5; ++type) {
+            // the first row has no row above: Up is None, Average and Paeth only see the left pixel
+            if (!prev && type == 2) continue;
+            unsigned char* out = scratch;
+            size_t i;
+            switch (type) {
+            case 0:
+                std::memcpy(out, row, size);
+                break;
+            case 1:
+                for (i = 0; i < bpp && i < size; ++i) out[i] = row[i];
+                for (; i < size; ++i) out[i] = static_cast<unsigned char>(row[i] - row[i - bpp]);
+                break;
+            case 2:
+                for (i = 0; i < size; ++i) out[i] = static_cast<unsigned char>(row[i] - prev[i]);
+                break;
+            case 3:
+                if (prev) {
+                    for (i = 0; i < bpp && i < size; ++i) out[i] = static_cast<unsigned char>(row[i] - (prev[i] >> 1));
+                    for (; i < size; ++i) out[i] = static_cast<unsigned char>(row[i] - ((row[i - bpp] + prev[i]) >> 1));
+                }
+                else {
+                    for (i = 0; i < bpp && i < size; ++i) out[i] = row[i];
+                    for (; i < size; ++i) out[i] = static_cast<unsigned char>(row[i] - (row[i - bpp] >> 1));
+                }
+                break;
+            case 4:
+                if (prev) {
+                    for (i = 0; i < bpp && i < size; ++i) out[i] = static_cast<unsigned char>(row[i] - prev[i]);
+                    for (; i < size; ++i) out[i] = static_cast<unsigned char>(row[i] - Paeth(row[i - bpp], prev[i], prev[i - bpp]));
+                }
+                else {
+                    for (i = 0; i < bpp && i < size; ++i) out[i] = row[i];
+                    for (; i < size; ++i) out[i] = static_cast<unsigned char>(row[i] - row[i - bpp]);
+                }
+                break;
+            }
+            size_t sum = 0;
+            for (i = 0; i < size; ++i) sum += out[i] < 128 ? out[i] : 256 - out[i];
+            if (sum < bestSum) {
+                bestSum = sum;
+                dst[0] = type;
+                std::memcpy(dst + 1, out, size);
+            }
+        }
+    }
+}
+
+bool EncodePNG16(const uint16_t* grey, unsigned int w, unsigned int h, std::vector<unsigned char>& png,
+    PNGExportStats* stats) {
+    using clock = std::chrono::high_resolution_clock;
+    png.clear();
+    if (!grey || w == 0 || h == 0) return false;
+
+    JobSystem& jobs = JobSystem::Shared();
+    const size_t rowBytes = static_cast<size_t>(w) * 2;
+    const size_t strideFiltered = rowBytes + 1;
+
+    // PNG stores 16-bit samples big-endian
+    auto t0 = clock::now();
+    std::vector<unsigned char> raw(rowBytes * h);
+    std::vector<unsigned char> filtered(strideFiltered * h);
+    jobs.ParallelFor(0, h, MIN_ROWS_PER_TASK, [&](unsigned int y0, unsigned int y1) {
+        std::vector<unsigned char> scratch(rowBytes);
+        // the row above the band is converted here too, bands must not read each other's output
+        unsigned int yFirst = y0 ? y0 - 1 : 0;
+        for (unsigned int y = yFirst; y < y1; ++y) {
+            const uint16_t* src = grey + static_cast<size_t>(y) * w;
+            unsigned char* dst = raw.data() + y * rowBytes;
+            for (unsigned int x = 0; x < w; ++x) {
+                dst[2 * x] = static_cast<unsigned char>(src[x] >> 8);
+                dst[2 * x + 1] = static_cast<unsigned char>(src[x]);
+            }
+        }
+        for (unsigned int y = y0; y < y1; ++y) {
+            FilterRow(filtered.data() + y * strideFiltered, raw.data() + y * rowBytes,
+                y ? raw.data() + (y - 1) * rowBytes : nullptr, rowBytes, scratch.data());
+        }
+    });
+    raw.clear();
+    raw.shrink_to_fit();
+    auto t1 = clock::now();
+
+    struct Piece {
+        unsigned char*  data = nullptr;
+        size_t          size = 0;
+        uint32_t        adler = 1;
+        unsigned int    error = 0;
+    };
+    const size_t total = filtered.size();
+    const unsigned int numPieces = static_cast<unsigned int>((total + PIECE_SIZE - 1) / PIECE_SIZE);
+    std::vector<Piece> pieces(numPieces);
+
+    LodePNGCompressSettings settings;
+    lodepng_compress_settings_init(&settings);
+    jobs.ParallelFor(0, numPieces, 1, [&](unsigned int p0, unsigned int p1) {
+        for (unsigned int p = p0; p < p1; ++p) {
+            size_t start = p * PIECE_SIZE;
+            size_t size = (std::min)(PIECE_SIZE, total - start);
+            size_t dict = (std::min)(start, static_cast<size_t>(settings.windowsize));
+            Piece& piece = pieces[p];
+            piece.error = lodepng_deflate_piece(&piece.data, &piece.size, filtered.data() + start, dict, size,
+                &settings, p + 1 == numPieces);
+            piece.adler = Adler32(filtered.data() + start, size);
+        }
+    });
+    auto t2 = clock::now();
+
+    bool isOk = true;
+    uint32_t adler = 1;
+    size_t sizeCompressed = 0;
+    for (unsigned int p = 0; p < numPieces; ++p) {
+        if (pieces[p].error) isOk = false;
+        adler = p ? Adler32Combine(adler, pieces[p].adler, (std::min)(PIECE_SIZE, total - p * PIECE_SIZE)) : pieces[p].adler;
+        sizeCompressed += pieces[p].size;
+    }
+
+    if (isOk) {
+        static const unsigned char SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        png.reserve(sizeCompressed + numPieces * 12 + 64);
+        png.insert(png.end(), SIGNATURE, SIGNATURE + 8);
+
+        unsigned char ihdr[13];
+        ihdr[0] = static_cast<unsigned char>(w >> 24); ihdr[1] = static_cast<unsigned char>(w >> 16);
+        ihdr[2] = static_cast<unsigned char>(w >> 8);  ihdr[3] = static_cast<unsigned char>(w);
+        ihdr[4] = static_cast<unsigned char>(h >> 24); ihdr[5] = static_cast<unsigned char>(h >> 16);
+        ihdr[6] = static_cast<unsigned char>(h >> 8);  ihdr[7] = static_cast<unsigned char>(h);
+        ihdr[8] = 16;   // bit depth
+        ihdr[9] = 0;    // greyscale
+        ihdr[10] = ihdr[11] = ihdr[12] = 0;
+        PutChunk(png, "IHDR", ihdr, sizeof(ihdr));
+
+        // zlib header (deflate, 32K window, no dictionary) in front of the first piece, Adler32 in its own IDAT
+        std::vector<unsigned char> first;
+        first.reserve(pieces[0].size + 2);
+        first.push_back(0x78);
+        first.push_back(0x01);
+        first.insert(first.end(), pieces[0].data, pieces[0].data + pieces[0].size);
+        PutChunk(png, "IDAT", first.data(), first.size());
+        for (unsigned int p = 1; p < numPieces; ++p) PutChunk(png, "IDAT", pieces[p].data, pieces[p].size);
+        unsigned char trailer[4] = { static_cast<unsigned char>(adler >> 24), static_cast<unsigned char>(adler >> 16),
+            static_cast<unsigned char>(adler >> 8), static_cast<unsigned char>(adler) };
+        PutChunk(png, "IDAT", trailer, 4);
+        PutChunk(png, "IEND", nullptr, 0);
+    }
+    for (Piece& piece : pieces) free(piece.data);
+
+    if (stats) {
+        stats->msFilter = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        stats->msDeflate = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        stats->bytesRaw = total;
+        stats->bytesPNG = png.size();
+        stats->numPieces = numPieces;
+    }
+    return isOk;
+}
+
+bool SavePNG16(const std::string& fn, const uint16_t* grey, unsigned int w, unsigned int h, PNGExportStats* stats) {
+    std::vector<unsigned char> png;
+    if (!EncodePNG16(grey, w, h, png, stats)) return false;
+
+    // write under a temp name, then rename, so a crash mid-write never leaves a truncated export behind
+    std::filesystem::path tmp = fn + ".tmp";
+    std::error_code ec;
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(png.data()), static_cast<std::streamsize>(png.size()));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp, fn, ec);
+    if (ec) {
+        std::error_code ecRemove;
+        std::filesystem::remove(tmp, ecRemove);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct PNGExportStats {
+    double          msFilter = 0.0;
+    double          msDeflate = 0.0;
+    size_t          bytesRaw = 0;       // filtered scanlines, filter bytes included
+    size_t          bytesPNG = 0;
+    unsigned int    numPieces = 0;
+};
+
+// 16-bit greyscale PNG writer for terrain data.
+// Rows are filtered in parallel, then the filtered stream is cut into pieces that are deflated
+// independently on JobSystem::Shared(), pigz style: each piece is primed with the LZ77 window before it
+// and ends on a sync flush, so the pieces concatenate into a single zlib stream. Each piece becomes one
+// IDAT chunk, and the Adler32 is combined from the per-piece sums.
+bool EncodePNG16(const uint16_t* grey, unsigned int w, unsigned int h, std::vector<unsigned char>& png,
+    PNGExportStats* stats = nullptr);
+bool SavePNG16(const std::string& fn, const uint16_t* grey, unsigned int w, unsigned int h,
+    PNGExportStats* stats = nullptr);
@@ -0,0 +1,379 @@
+#include "PipelineRegistry.h"
+#include "JobSystem.h"
+#include "SelfTest.h"
+#include "StartupReport.h"
+#include "TextureCache.h"
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+using std::chrono::steady_clock;
+
+static const char* PIPELINE_LIBRARY_FILE = "pipelines.bin";
+
+static unsigned long long MicrosecondsSince(steady_clock::time_point t0) {
+    return static_cast<unsigned long long>(
+        std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - t0).count());
+}
+
+template <typename T>
+static uint64_t HashValue(const T& v, uint64_t h) {
+    return HashBytes(&v, sizeof(v), h);
+}
+
+PipelineRegistry::PipelineRegistry(Device* dev, const std::filesystem::path& dir)
+    : m_pDev(dev), m_dir(dir), m_tStart(steady_clock::now()) {
+    OpenLibrary();
+}
+
+PipelineRegistry::~PipelineRegistry() {
+    WaitAll();
+    for (std::unique_ptr<Pipeline>& p : m_listPipelines) {
+        ID3D12PipelineState* pso = p->pPSO.exchange(nullptr);
+        if (pso) pso->Release();
+    }
+    for (RootSignature& rs : m_listRootSigs) {
+        if (rs.pRootSig) { rs.pRootSig->Release(); rs.pRootSig = nullptr; }
+    }
+    if (m_pLibrary) { m_pLibrary->Release(); m_pLibrary = nullptr; }
+    m_pDev = nullptr;
+}
+
+// A library from another driver or GPU is refused; then it starts empty and Save replaces the file.
+void PipelineRegistry::OpenLibrary() {
+    if (!m_dir.empty()) {
+        std::ifstream in(m_dir / PIPELINE_LIBRARY_FILE, std::ios::binary);
+        if (in) m_bufLibrary.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    if (!m_bufLibrary.empty() && m_pDev->CreatePipelineLibrary(m_bufLibrary.data(), m_bufLibrary.size(), m_pLibrary)) return;
+    m_bufLibrary.clear();
+    m_pDev->CreatePipelineLibrary(nullptr, 0, m_pLibrary);
+}
+
+unsigned int PipelineRegistry::AddRootSignature(const CD3DX12_ROOT_SIGNATURE_DESC& desc) {
+    ID3DBlob* sig = nullptr;
+    ID3DBlob* err = nullptr;
+    if (FAILED(D3D12SerializeRootSignature(&desc, D3D_ROOT_SIGNATURE_VERSION_1, &sig, &err))) {
+        std::string msg = "PipelineRegistry::AddRootSignature: ";
+        if (err) {
+            msg += static_cast<const char*>(err->GetBufferPointer());
+            err->Release();
+        }
+        if (sig) sig->Release();
+        throw GFX_Exception(msg.c_str());
+    }
+    if (err) err->Release();
+    const uint64_t key = HashBytes(sig->GetBufferPointer(), sig->GetBufferSize());
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (unsigned int i = 0; i < m_listRootSigs.size(); ++i) {
+        if (m_listRootSigs[i].key == key) {
+            sig->Release();
+            return i;
+        }
+    }
+    ID3D12RootSignature* rootSig = nullptr;
+    try {
+        m_pDev->CreateRootSig(sig->GetBufferPointer(), sig->GetBufferSize(), rootSig);
+    }
+    catch (...) {
+        sig->Release();
+        throw;
+    }
+    sig->Release();
+    m_listRootSigs.push_back({ key, rootSig });
+    return static_cast<unsigned int>(m_listRootSigs.size() - 1);
+}
+
+// Field by field: the blend and depth-stencil descs have padding and the input layout is behind a pointer.
+// Root signature and shaders are keyed by the caller; StreamOutput is empty (Request refuses any).
+// CachedPSO is left out: a driver blob of the same state, not part of what the PSO is.
+uint64_t PipelineRegistry::HashDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, uint64_t h) {
+    const D3D12_BLEND_DESC& blend = desc.BlendState;
+    h = HashValue(blend.AlphaToCoverageEnable, h);
+    h = HashValue(blend.IndependentBlendEnable, h);
+    for (const D3D12_RENDER_TARGET_BLEND_DESC& rt : blend.RenderTarget) {
+        h = HashValue(rt.BlendEnable, h);
+        h = HashValue(rt.LogicOpEnable, h);
+        h = HashValue(rt.SrcBlend, h);
+        h = HashValue(rt.DestBlend, h);
+        h = HashValue(rt.BlendOp, h);
+        h = HashValue(rt.SrcBlendAlpha, h);
+        h = HashValue(rt.DestBlendAlpha, h);
+        h = HashValue(rt.BlendOpAlpha, h);
+        h = HashValue(rt.LogicOp, h);
+        h = HashValue(rt.RenderTargetWriteMask, h);
+    }
+    h = HashValue(desc.SampleMask, h);
+    h = HashValue(desc.RasterizerState, h);
+    const D3D12_DEPTH_STENCIL_DESC& ds = desc.DepthStencilState;
+    h = HashValue(ds.DepthEnable, h);
+    h = HashValue(ds.DepthWriteMask, h);
+    h = HashValue(ds.DepthFunc, h);
+    h = HashValue(ds.StencilEnable, h);
+    h = HashValue(ds.StencilReadMask, h);
+    h = HashValue(ds.StencilWriteMask, h);
+    h = HashValue(ds.FrontFace, h);
+    h = HashValue(ds.BackFace, h);
+    for (UINT i = 0; i < desc.InputLayout.NumElements; ++i) {
+        const D3D12_INPUT_ELEMENT_DESC& e = desc.InputLayout.pInputElementDescs[i];
+        h = HashBytes(e.SemanticName, strlen(e.SemanticName), h);
+        h = HashValue(e.SemanticIndex, h);
+        h = HashValue(e.Format, h);
+        h = HashValue(e.InputSlot, h);
+        h = HashValue(e.AlignedByteOffset, h);
+        h = HashValue(e.InputSlotClass, h);
+        h = HashValue(e.InstanceDataStepRate, h);
+    }
+    h = HashValue(desc.IBStripCutValue, h);
+    h = HashValue(desc.PrimitiveTopologyType, h);
+    h = HashValue(desc.NumRenderTargets, h);
+    h = HashValue(desc.RTVFormats, h);
+    h = HashValue(desc.DSVFormat, h);
+    h = HashValue(desc.SampleDesc, h);
+    h = HashValue(desc.NodeMask, h);
+    h = HashValue(desc.Flags, h);
+    return h;
+}
+
+unsigned int PipelineRegistry::Request(const char* name, unsigned int rootSig, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+    const PipelineShaders& shaders, unsigned int fallback) {
+    if (desc.StreamOutput.NumEntries || desc.StreamOutput.pSODeclaration || desc.StreamOutput.NumStrides) {
+        throw GFX_Exception("PipelineRegistry::Request: stream output is not supported.");
+    }
+    // shaders into the cache's queue before the build job, which then only waits for jobs ahead of it
+    ShaderCache& cache = GetShaderCache();
+    const LPCWSTR files[5] = { shaders.vs, shaders.hs, shaders.ds, shaders.gs, shaders.ps };
+    const ShaderType types[5] = { VERTEX_SHADER, HULL_SHADER, DOMAIN_SHADER, GEOMETRY_SHADER, PIXEL_SHADER };
+    unsigned int handles[5];
+    uint64_t key = HashDesc(desc, 0);
+    for (int i = 0; i < 5; ++i) {
+        handles[i] = files[i] ? cache.Request(MakeShaderDesc(files[i], types[i])) : PIPELINE_NONE;
+        key = HashValue(files[i] ? cache.GetKey(handles[i]) : 0ull, key);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (rootSig >= m_listRootSigs.size()) throw GFX_Exception("PipelineRegistry::Request: unknown root signature.");
+    key = HashValue(m_listRootSigs[rootSig].key, key);
+    key = key ? key : 1;
+    auto it = m_mapKeys.find(key);
+    if (it != m_mapKeys.end()) {
+        ++m_numShared;
+        return it->second;
+    }
+
+    const unsigned int handle = static_cast<unsigned int>(m_listPipelines.size());
+    m_listPipelines.push_back(std::make_unique<Pipeline>());
+    Pipeline* p = m_listPipelines.back().get();
+    p->key = key;
+    p->name = name;
+    p->rootSig = rootSig;
+    p->fallback = fallback;
+    p->desc = desc;
+    p->desc.pRootSignature = m_listRootSigs[rootSig].pRootSig;
+    // the description outlives the caller's locals
+    p->listSemantics.reserve(desc.InputLayout.NumElements);
+    for (UINT i = 0; i < desc.InputLayout.NumElements; ++i) {
+        p->listElements.push_back(desc.InputLayout.pInputElementDescs[i]);
+        p->listSemantics.push_back(desc.InputLayout.pInputElementDescs[i].SemanticName);
+        p->listElements.back().SemanticName = p->listSemantics.back().c_str();
+    }
+    p->desc.InputLayout.pInputElementDescs = p->listElements.empty() ? nullptr : p->listElements.data();
+    for (int i = 0; i < 5; ++i) p->shaders[i] = handles[i];
+    m_mapKeys[key] = handle;
+
+    p->fut = JobSystem::Shared().Submit([this, p]() { Build(*p); }).share();
+    return handle;
+}
+
+void PipelineRegistry::Build(Pipeline& p) {
+    try {
+        ShaderCache& cache = GetShaderCache();
+        D3D12_SHADER_BYTECODE* stages[5] = { &p.desc.VS, &p.desc.HS, &p.desc.DS, &p.desc.GS, &p.desc.PS };
+        for (int i = 0; i < 5; ++i) {
+            if (p.shaders[i] == PIPELINE_NONE) continue;
+            std::string err;
+            if (!cache.Wait(p.shaders[i], &err)) throw GFX_Exception(err.c_str());
+            const std::vector<unsigned char>& bytecode = cache.GetBytecode(p.shaders[i]);
+            stages[i]->pShaderBytecode = bytecode.data();
+            stages[i]->BytecodeLength = bytecode.size();
+        }
+
+        auto t0 = steady_clock::now();
+        wchar_t nameLib[24];
+        swprintf_s(nameLib, L"%016llx", static_cast<unsigned long long>(p.key));
+        ID3D12PipelineState* pso = nullptr;
+        if (m_pLibrary && SUCCEEDED(m_pLibrary->LoadGraphicsPipeline(nameLib, &p.desc, IID_PPV_ARGS(&pso)))) {
+            p.isFromLibrary = true;
+            ++m_numFromLibrary;
+        }
+        else {
+            m_pDev->CreatePSO(&p.desc, pso);
+            ++m_numCreated;
+            if (m_pLibrary) {
+                // the library synchronises loads itself; stores and Serialize take turns here
+                std::lock_guard<std::mutex> lock(m_mtxLibrary);
+                if (SUCCEEDED(m_pLibrary->StorePipeline(nameLib, pso))) ++m_numStored;
+            }
+        }
+        p.msBuild = MicrosecondsSince(t0) / 1000.0;
+        std::wstring nameDebug(p.name.begin(), p.name.end());
+        pso->SetName(nameDebug.c_str());
+        p.pPSO.store(pso, std::memory_order_release);
+        m_usLastReady.store(MicrosecondsSince(m_tStart));
+    }
+    catch (const std::exception& ex) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!m_hasFailed.load()) {
+            m_errFirst = "PipelineRegistry: " + p.name + ": " + ex.what();
+            m_hasFailed.store(true, std::memory_order_release);
+        }
+    }
+}
+
+bool PipelineRegistry::SetPipeline(CommandList* cmdList, unsigned int handle) const {
+    const Pipeline* p = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        p = m_listPipelines[handle].get();
+        ID3D12PipelineState* pso = p->pPSO.load(std::memory_order_acquire);
+        if (!pso && p->fallback != PIPELINE_NONE) {
+            p = m_listPipelines[p->fallback].get();
+            pso = p->pPSO.load(std::memory_order_acquire);
+        }
+        if (!pso) return false;
+        cmdList->SetPipelineState(pso);
+        cmdList->SetGraphicsRootSignature(m_listRootSigs[p->rootSig].pRootSig);
+    }
+    return true;
+}
+
+bool PipelineRegistry::IsReady(unsigned int handle) const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_listPipelines[handle]->pPSO.load(std::memory_order_acquire) != nullptr;
+}
+
+void PipelineRegistry::WaitAll() {
+    std::vector<std::shared_future<void>> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        for (const std::unique_ptr<Pipeline>& p : m_listPipelines) pending.push_back(p->fut);
+    }
+    for (std::shared_future<void>& fut : pending) {
+        if (fut.valid()) fut.wait();
+    }
+}
+
+void PipelineRegistry::ThrowIfFailed() const {
+    if (!m_hasFailed.load(std::memory_order_acquire)) return;
+    std::string err;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        err = m_errFirst;
+    }
+    throw GFX_Exception(err.c_str());
+}
+
+void PipelineRegistry::Save() {
+    if (!m_pLibrary || m_dir.empty() || !m_numStored.load()) return;
+    WaitAll();
+
+    std::vector<char> blob;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxLibrary);
+        blob.resize(m_pLibrary->GetSerializedSize());
+        if (blob.empty() || FAILED(m_pLibrary->Serialize(blob.data(), blob.size()))) return;
+        m_numStored.store(0);
+    }
+
+    // temp name, then rename, as in TextureCache
+    std::error_code ec;
+    std::filesystem::create_directories(m_dir, ec);
+    const std::filesystem::path p = m_dir / PIPELINE_LIBRARY_FILE;
+    std::filesystem::path tmp = p;
+    tmp += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream outFile(tmp, std::ios::binary | std::ios::trunc);
+        if (!outFile) return;
+        outFile.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+        if (!outFile) {
+            outFile.close();
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(tmp, p, ec);
+    if (ec) std::filesystem::remove(tmp, ec);
+}
+
+void PipelineRegistry::Report() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    StartupReport::Line("  pipelines: %u built (%u from the library, %u created), %u shared, last ready %.1f ms after start%s\n",
+        m_numFromLibrary.load() + m_numCreated.load(), m_numFromLibrary.load(), m_numCreated.load(), m_numShared.load(),
+        m_usLastReady.load() / 1000.0, m_pLibrary ? "" : ", no pipeline library on this device");
+    for (const std::unique_ptr<Pipeline>& p : m_listPipelines) {
+        if (!p->pPSO.load()) continue;
+        StartupReport::Line("    %-16s %7.2f ms%s\n", p->name.c_str(), p->msBuild, p->isFromLibrary ? " (library)" : "");
+    }
+}
+
+bool PipelineRegistry::SelfTest() {
+    SelfTestExpect expect;
+    StartupReport::Line("\n=== Pipeline registry: description keys ===\n");
+
+    // the same state over memory filled with pad: what a copied CD3DX12 desc leaves between the fields
+    auto makeDesc = [](D3D12_GRAPHICS_PIPELINE_STATE_DESC& d, unsigned char pad) {
+        memset(&d, pad, sizeof(d));
+        const CD3DX12_BLEND_DESC blend(D3D12_DEFAULT);
+        d.BlendState.AlphaToCoverageEnable = blend.AlphaToCoverageEnable;
+        d.BlendState.IndependentBlendEnable = blend.IndependentBlendEnable;
+        for (UINT i = 0; i < 8; ++i) {
+            const D3D12_RENDER_TARGET_BLEND_DESC& src = blend.RenderTarget[i];
+            D3D12_RENDER_TARGET_BLEND_DESC& rt = d.BlendState.RenderTarget[i];
+            rt.BlendEnable = src.BlendEnable;
+            rt.LogicOpEnable = src.LogicOpEnable;
+            rt.SrcBlend = src.SrcBlend;
+            rt.DestBlend = src.DestBlend;
+            rt.BlendOp = src.BlendOp;
+            rt.SrcBlendAlpha = src.SrcBlendAlpha;
+            rt.DestBlendAlpha = src.DestBlendAlpha;
+            rt.BlendOpAlpha = src.BlendOpAlpha;
+            rt.LogicOp = src.LogicOp;
+            rt.RenderTargetWriteMask = src.RenderTargetWriteMask;
+        }
+        d.SampleMask = UINT_MAX;
+        d.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
+        const CD3DX12_DEPTH_STENCIL_DESC ds(D3D12_DEFAULT);
+        d.DepthStencilState.DepthEnable = ds.DepthEnable;
+        d.DepthStencilState.DepthWriteMask = ds.DepthWriteMask;
+        d.DepthStencilState.DepthFunc = ds.DepthFunc;
+        d.DepthStencilState.StencilEnable = ds.StencilEnable;
+        d.DepthStencilState.StencilReadMask = ds.StencilReadMask;
+        d.DepthStencilState.StencilWriteMask = ds.StencilWriteMask;
+        d.DepthStencilState.FrontFace = ds.FrontFace;
+        d.DepthStencilState.BackFace = ds.BackFace;
+        d.InputLayout = { nullptr, 0 };
+        d.IBStripCutValue = D3D12_INDEX_BUFFER_STRIP_CUT_VALUE_DISABLED;
+        d.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+        d.NumRenderTargets = 1;
+        for (UINT i = 0; i < 8; ++i) d.RTVFormats[i] = i ? DXGI_FORMAT_UNKNOWN : DXGI_FORMAT_R8G8B8A8_UNORM;
+        d.DSVFormat = DXGI_FORMAT_D32_FLOAT;
+        d.SampleDesc = { 1, 0 };
+        d.NodeMask = 0;
+        d.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+    };
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC a, b;
+    makeDesc(a, 0x00);
+    makeDesc(b, 0xCD);
+    expect(HashDesc(a, 0) == HashDesc(b, 0), "equal descriptions, different padding: one key");
+
+    b.BlendState.RenderTarget[3].RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_RED;
+    expect(HashDesc(a, 0) != HashDesc(b, 0), "a render target's write mask changes the key");
+    makeDesc(b, 0xCD);
+    b.DepthStencilState.StencilReadMask = 0x0F;
+    expect(HashDesc(a, 0) != HashDesc(b, 0), "a stencil mask changes the key");
+
+    return expect.Finish("pipeline registry");
+}
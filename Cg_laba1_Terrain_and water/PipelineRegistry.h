@@ -0,0 +1,110 @@
+#pragma once
+#include "Graphics.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace graphics;
+
+static const unsigned int PIPELINE_NONE = 0xFFFFFFFF;
+
+// Shader files of a pipeline, main() of each; null for an unused stage.
+struct PipelineShaders {
+    LPCWSTR vs = nullptr;
+    LPCWSTR hs = nullptr;
+    LPCWSTR ds = nullptr;
+    LPCWSTR gs = nullptr;
+    LPCWSTR ps = nullptr;
+};
+
+// Root signatures and graphics PSOs behind handles. A PSO is keyed by a hash of its whole description:
+// the fixed-function state, the input layout, the root signature's serialized form and the shader
+// cache keys of its stages. An identical request returns the existing handle.
+//
+// Request does not block. The shaders go to the ShaderCache first, then a background job waits for
+// them and creates the PSO, loading it from the pipeline library on disk when a previous run stored
+// it there. Until it is ready SetPipeline binds the fallback named in the request, if that one is
+// ready, or reports that nothing can be drawn with it yet.
+class PipelineRegistry {
+public:
+    // The library lives in dir; empty dir keeps it in memory only.
+    PipelineRegistry(Device* dev, const std::filesystem::path& dir);
+    // Waits for the builds still running. The caller has waited for the GPU.
+    ~PipelineRegistry();
+    PipelineRegistry(const PipelineRegistry&) = delete;
+    PipelineRegistry& operator=(const PipelineRegistry&) = delete;
+
+    // Created on the spot; identical descriptions share one root signature. Throws on a bad description.
+    unsigned int AddRootSignature(const CD3DX12_ROOT_SIGNATURE_DESC& desc);
+    // desc without root signature and shaders; both come from the handles. No stream output: throws
+    // GFX_Exception for a description with any. Safe from any thread.
+    unsigned int Request(const char* name, unsigned int rootSig, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+        const PipelineShaders& shaders, unsigned int fallback = PIPELINE_NONE);
+
+    // Binds the PSO of handle, or its fallback, with the matching root signature. false: neither is
+    // ready, skip the draws.
+    bool SetPipeline(CommandList* cmdList, unsigned int handle) const;
+    bool IsReady(unsigned int handle) const;
+    // Blocks until every requested PSO is built or has failed.
+    void WaitAll();
+    // Rethrows the first build failure as GFX_Exception. Cheap when there is none.
+    void ThrowIfFailed() const;
+
+    // Writes the pipeline library back if a PSO was added to it.
+    void Save();
+    void Report() const;
+
+    // Description keys: equal descriptions with different padding bytes share a key, a changed field does
+    // not. Prints what it checks. Needs no device.
+    static bool SelfTest();
+
+private:
+    struct Pipeline {
+        uint64_t                                key = 0;
+        std::string                             name;
+        unsigned int                            rootSig = 0;
+        unsigned int                            fallback = PIPELINE_NONE;
+        D3D12_GRAPHICS_PIPELINE_STATE_DESC      desc = {};
+        std::vector<D3D12_INPUT_ELEMENT_DESC>   listElements;
+        std::vector<std::string>                listSemantics;
+        unsigned int                            shaders[5];         // ShaderCache handles, VS HS DS GS PS
+        std::atomic<ID3D12PipelineState*>       pPSO{ nullptr };
+        std::shared_future<void>                fut;
+        bool                                    isFromLibrary = false;
+        double                                  msBuild = 0.0;
+    };
+    struct RootSignature {
+        uint64_t                key;
+        ID3D12RootSignature*    pRootSig;
+    };
+
+    // Shaders, then the library, else the driver. Job thread.
+    void Build(Pipeline& p);
+    static uint64_t HashDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, uint64_t h);
+    void OpenLibrary();
+
+    Device*                                     m_pDev;
+    std::filesystem::path                       m_dir;
+    mutable std::mutex                          m_mtx;
+    std::vector<std::unique_ptr<Pipeline>>      m_listPipelines;
+    std::unordered_map<uint64_t, unsigned int>  m_mapKeys;              // key -> handle
+    std::vector<RootSignature>                  m_listRootSigs;
+    ID3D12PipelineLibrary*                      m_pLibrary = nullptr;   // null when the device has none
+    std::vector<char>                           m_bufLibrary;           // the library reads from it while alive
+    std::mutex                                  m_mtxLibrary;
+    std::atomic<bool>                           m_hasFailed{ false };
+    std::string                                 m_errFirst;
+    std::atomic<unsigned int>                   m_numShared{ 0 };
+    std::atomic<unsigned int>                   m_numFromLibrary{ 0 };
+    std::atomic<unsigned int>                   m_numCreated{ 0 };
+    std::atomic<unsigned int>                   m_numStored{ 0 };
+    std::chrono::steady_clock::time_point       m_tStart;
+    std::atomic<unsigned long long>             m_usLastReady{ 0 };     // since m_tStart
+};
@@ -0,0 +1,437 @@
+#include "Profiler.h"
+#include "SelfTest.h"
+#include "StartupReport.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+thread_local unsigned int ProfileScope::t_depth = 0;
+
+// the ring of the profiler the thread wrote to last; a miss looks the thread up under the lock
+struct ProfilerThreadCache {
+    unsigned int    idProfiler = 0;
+    void*           pRing = nullptr;
+};
+static thread_local ProfilerThreadCache t_cacheProfiler;
+static std::atomic<unsigned int> s_idNextProfiler{ 1 };
+
+// never destroyed: job workers and other statics may still close scopes while the process exits
+Profiler& Profiler::Get() {
+    static Profiler* prof = new Profiler();
+    return *prof;
+}
+
+Profiler::Profiler() : m_id(s_idNextProfiler.fetch_add(1)), m_tStart(std::chrono::steady_clock::now()) {}
+
+Profiler::~Profiler() {
+    EndStream();
+    for (unsigned int i = 0; i < MAX_TRACKS; ++i) delete m_pRings[i].load();
+}
+
+long long Profiler::Now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_tStart).count();
+}
+
+Profiler::Ring* Profiler::NewRing(const char* name) {
+    // the caller holds m_mtxRings
+    const unsigned int track = m_numTracks.load(std::memory_order_relaxed);
+    if (track == MAX_TRACKS) return nullptr;
+    Ring* ring = new Ring();
+    ring->track = track;
+    if (name) ring->name = name;
+    else ring->name = "thread " + std::to_string(track);
+    m_pRings[track].store(ring, std::memory_order_release);
+    m_numTracks.store(track + 1, std::memory_order_release);
+    return ring;
+}
+
+Profiler::Ring* Profiler::GetThreadRing() {
+    ProfilerThreadCache& cache = t_cacheProfiler;
+    if (cache.idProfiler == m_id) return static_cast<Ring*>(cache.pRing);
+
+    std::lock_guard<std::mutex> lock(m_mtxRings);
+    const std::thread::id id = std::this_thread::get_id();
+    Ring* ring = nullptr;
+    const unsigned int numTracks = m_numTracks.load(std::memory_order_relaxed);
+    for (unsigned int i = 0; i < numTracks && !ring; ++i) {
+        Ring* r = m_pRings[i].load(std::memory_order_relaxed);
+        if (r->idThread == id) ring = r;
+    }
+    if (!ring) {
+        ring = NewRing(nullptr);
+        if (ring) ring->idThread = id;
+    }
+    cache.idProfiler = m_id;
+    cache.pRing = ring;
+    return ring;
+}
+
+void Profiler::SetThreadName(const char* name) {
+    Ring* ring = GetThreadRing();
+    if (!ring) return;
+    std::lock_guard<std::mutex> lock(m_mtxRings);
+    ring->name = name;
+}
+
+unsigned int Profiler::AddTrack(const char* name) {
+    std::lock_guard<std::mutex> lock(m_mtxRings);
+    Ring* ring = NewRing(name);
+    return ring ? ring->track : MAX_TRACKS;
+}
+
+void Profiler::Push(Ring* ring, const ProfileEvent& e) {
+    if (!ring) return;
+    // one producer: only the collector moves tail, and only forward
+    const unsigned int head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == RING_CAPACITY) {
+        ring->numDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring->events[head % RING_CAPACITY] = e;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::Record(const char* name, long long nsBegin, long long nsEnd, unsigned int depth) {
+    ProfileEvent e;
+    e.name = name;
+    e.nsBegin = nsBegin;
+    e.nsEnd = nsEnd;
+    e.depth = depth;
+    Push(GetThreadRing(), e);
+}
+
+void Profiler::Record(unsigned int track, const char* name, long long nsBegin, long long nsEnd, unsigned int depth) {
+    if (track >= m_numTracks.load(std::memory_order_acquire)) return;
+    ProfileEvent e;
+    e.name = name;
+    e.nsBegin = nsBegin;
+    e.nsEnd = nsEnd;
+    e.depth = depth;
+    Push(m_pRings[track].load(std::memory_order_acquire), e);
+}
+
+void Profiler::Consume(unsigned int track, const ProfileEvent& e) {
+    if (m_listStatIndex.size() <= track) m_listStatIndex.resize(track + 1);
+    auto it = m_listStatIndex[track].find(e.name);
+    if (it == m_listStatIndex[track].end()) {
+        Stat st;
+        st.track = track;
+        st.depth = e.depth;
+        st.nsFirst = e.nsBegin;
+        st.name = e.name;
+        it = m_listStatIndex[track].emplace(e.name, static_cast<unsigned int>(m_listStats.size())).first;
+        m_listStats.push_back(st);
+    }
+    Stat& st = m_listStats[it->second];
+    const long long ns = e.nsEnd - e.nsBegin;
+    ++st.count;
+    st.nsTotal += ns;
+    st.nsMax = (std::max)(st.nsMax, ns);
+    st.hist.Record(ns / 1e6);
+
+    TrackedEvent te;
+    te.track = track;
+    te.e = e;
+    if (m_listHistory.size() < HISTORY_CAPACITY) m_listHistory.push_back(te);
+    else {
+        m_listHistory[m_iHistory] = te;
+        m_iHistory = (m_iHistory + 1) % HISTORY_CAPACITY;
+    }
+
+    if (m_fileStream.is_open()) {
+        WriteEvent(m_fileStream, track, e, m_isStreamEmpty);
+        m_isStreamEmpty = false;
+        ++m_numStreamed;
+    }
+    ++m_numCollected;
+}
+
+void Profiler::Collect() {
+    std::lock_guard<std::mutex> lockCollect(m_mtxCollect);
+    std::lock_guard<std::mutex> lockRings(m_mtxRings);
+    const unsigned int numTracks = m_numTracks.load(std::memory_order_acquire);
+    for (unsigned int i = 0; i < numTracks; ++i) {
+        Ring* ring = m_pRings[i].load(std::memory_order_acquire);
+        // events pushed after this load wait for the next Collect
+        const unsigned int head = ring->head.load(std::memory_order_acquire);
+        unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+        if (tail == head) continue;
+        if (m_fileStream.is_open() && !ring->isNamed) {
+            WriteTrackName(m_fileStream, *ring, m_isStreamEmpty);
+            m_isStreamEmpty = false;
+            ring->isNamed = true;
+        }
+        for (; tail != head; ++tail) Consume(ring->track, ring->events[tail % RING_CAPACITY]);
+        ring->tail.store(tail, std::memory_order_release);
+    }
+    if (m_fileStream.is_open()) m_fileStream.flush();
+}
+
+// names in the trace are literals and thread names; quotes and backslashes are all that needs escaping
+static void WriteJSONString(std::ostream& out, const char* s) {
+    out << '"';
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') out << '\\';
+        if (static_cast<unsigned char>(*s) >= 0x20) out << *s;
+    }
+    out << '"';
+}
+
+void Profiler::WriteEvent(std::ostream& out, unsigned int track, const ProfileEvent& e, bool isFirst) {
+    // microseconds with the nanoseconds kept as decimals; a GPU event from before the start sits at 0
+    const long long ns = (std::max)(e.nsBegin, 0ll);
+    const long long nsDur = (std::max)(e.nsEnd - e.nsBegin, 0ll);
+    char buf[128];
+    snprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld.%03lld,\"dur\":%lld.%03lld}",
+        track, ns / 1000, ns % 1000, nsDur / 1000, nsDur % 1000);
+    out << (isFirst ? "" : ",\n") << "{\"name\":";
+    WriteJSONString(out, e.name);
+    out << buf;
+}
+
+void Profiler::WriteTrackName(std::ostream& out, const Ring& ring, bool isFirst) {
+    out << (isFirst ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring.track
+        << ",\"args\":{\"name\":";
+    WriteJSONString(out, ring.name.c_str());
+    out << "}}";
+}
+
+bool Profiler::BeginStream(const std::filesystem::path& fn) {
+    EndStream();
+    std::lock_guard<std::mutex> lockCollect(m_mtxCollect);
+    m_fileStream.open(fn, std::ios::binary | std::ios::trunc);
+    if (!m_fileStream) {
+        m_fileStream.close();
+        return false;
+    }
+    // an array of events: a stream cut short by a crash still loads without the closing bracket
+    m_fileStream << "[\n";
+    m_isStreamEmpty = true;
+    std::lock_guard<std::mutex> lockRings(m_mtxRings);
+    for (unsigned int i = 0; i < m_numTracks.load(std::memory_order_acquire); ++i) {
+        m_pRings[i].load(std::memory_order_acquire)->isNamed = false;
+    }
+    return true;
+}
+
+void Profiler::EndStream() {
+    Collect();
+    std::lock_guard<std::mutex> lockCollect(m_mtxCollect);
+    if (!m_fileStream.is_open()) return;
+    m_fileStream << "\n]\n";
+    m_fileStream.close();
+}
+
+bool Profiler::WriteTrace(const std::filesystem::path& fn) {
+    Collect();
+    std::lock_guard<std::mutex> lockCollect(m_mtxCollect);
+    std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out << "[\n";
+    bool isFirst = true;
+    {
+        std::lock_guard<std::mutex> lockRings(m_mtxRings);
+        for (unsigned int i = 0; i < m_numTracks.load(std::memory_order_acquire); ++i) {
+            WriteTrackName(out, *m_pRings[i].load(std::memory_order_acquire), isFirst);
+            isFirst = false;
+        }
+    }
+    // oldest first
+    for (size_t i = 0; i < m_listHistory.size(); ++i) {
+        const TrackedEvent& te = m_listHistory[(m_iHistory + i) % m_listHistory.size()];
+        WriteEvent(out, te.track, te.e, isFirst);
+        isFirst = false;
+    }
+    out << "\n]\n";
+    return static_cast<bool>(out);
+}
+
+std::vector<const Profiler::Stat*> Profiler::SortStats() const {
+    std::vector<const Stat*> sorted;
+    for (const Stat& st : m_listStats) sorted.push_back(&st);
+    std::sort(sorted.begin(), sorted.end(), [](const Stat* a, const Stat* b) {
+        return a->track != b->track ? a->track < b->track : a->nsFirst < b->nsFirst;
+    });
+    return sorted;
+}
+
+void Profiler::Report() {
+    Collect();
+    std::lock_guard<std::mutex> lockCollect(m_mtxCollect);
+    if (m_listStats.empty()) return;
+    const std::vector<const Stat*> sorted = SortStats();
+
+    std::lock_guard<std::mutex> lockRings(m_mtxRings);
+    unsigned long long numDropped = 0;
+    for (unsigned int i = 0; i < m_numTracks.load(std::memory_order_acquire); ++i) {
+        numDropped += m_pRings[i].load(std::memory_order_acquire)->numDropped.load(std::memory_order_relaxed);
+    }
+    StartupReport::Line("\n=== Profiler (%llu events, %llu dropped, %llu streamed) ===\n",
+        m_numCollected, numDropped, m_numStreamed);
+    unsigned int trackLast = MAX_TRACKS;
+    for (const Stat* st : sorted) {
+        if (st->track != trackLast) {
+            StartupReport::Line("  %s\n", m_pRings[st->track].load(std::memory_order_acquire)->name.c_str());
+            trackLast = st->track;
+        }
+        const unsigned int indent = 2 * (std::min)(st->depth, 8u);
+        StartupReport::Line("    %*s%-*s %8llu x  avg %8.3f ms  max %8.3f ms\n", static_cast<int>(indent), "",
+            static_cast<int>(32 - indent), st->name, st->count, st->nsTotal / 1e6 / st->count, st->nsMax / 1e6);
+    }
+}
+
+void Profiler::GetSummary(std::vector<ProfileSummary>& out) {
+    Collect();
+    std::lock_guard<std::mutex> lockCollect(m_mtxCollect);
+    std::lock_guard<std::mutex> lockRings(m_mtxRings);
+    out.clear();
+    for (const Stat* st : SortStats()) {
+        ProfileSummary sum;
+        sum.track = m_pRings[st->track].load(std::memory_order_acquire)->name;
+        sum.name = st->name;
+        sum.depth = st->depth;
+        sum.msAvg = st->nsTotal / 1e6 / st->count;
+        sum.ms = st->hist.GetPercentiles();
+        out.push_back(sum);
+    }
+}
+
+bool Profiler::SelfTest() {
+    SelfTestExpect expect;
+    auto findStat = [](const Profiler& prof, const char* name) -> const Stat* {
+        for (const Stat& st : prof.m_listStats) {
+            if (std::strcmp(st.name, name) == 0) return &st;
+        }
+        return nullptr;
+    };
+    auto countOf = [](const std::string& text, const char* what) {
+        size_t n = 0;
+        for (size_t pos = text.find(what); pos != std::string::npos; pos = text.find(what, pos + 1)) ++n;
+        return n;
+    };
+    auto readFile = [](const std::filesystem::path& fn) {
+        std::ifstream in(fn, std::ios::binary);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return ss.str();
+    };
+
+    StartupReport::Line("\n=== Profiler: nesting ===\n");
+    {
+        Profiler prof;
+        prof.SetThreadName("main");
+        {
+            ProfileScope outer(prof, "outer");
+            for (int i = 0; i < 3; ++i) ProfileScope inner(prof, "inner");
+        }
+        prof.SetEnabled(false);
+        { ProfileScope off(prof, "disabled"); }
+        prof.Collect();
+        const Stat* outer = findStat(prof, "outer");
+        const Stat* inner = findStat(prof, "inner");
+        expect(outer && outer->count == 1 && outer->depth == 0, "outer scope once at depth 0");
+        expect(inner && inner->count == 3 && inner->depth == 1, "inner scope three times at depth 1");
+        expect(outer && inner && inner->nsTotal <= outer->nsTotal, "inner time within the outer scope");
+        expect(!findStat(prof, "disabled"), "a scope while disabled records nothing");
+        expect(prof.m_listHistory.size() == 4, "history holds the four events");
+        bool isInside = true;
+        const ProfileEvent& eOuter = prof.m_listHistory.back().e;
+        for (size_t i = 0; i + 1 < prof.m_listHistory.size(); ++i) {
+            const ProfileEvent& e = prof.m_listHistory[i].e;
+            isInside = isInside && e.nsBegin >= eOuter.nsBegin && e.nsEnd <= eOuter.nsEnd;
+        }
+        expect(isInside, "inner events lie inside the outer one on the timeline");
+
+        std::vector<ProfileSummary> summary;
+        prof.GetSummary(summary);
+        expect(summary.size() == 2 && summary[0].track == "main" && std::strcmp(summary[1].name, "inner") == 0 &&
+            summary[1].ms.count == 3 && summary[1].ms.max <= summary[0].ms.max, "summary: outer, then inner with its percentiles");
+    }
+
+    StartupReport::Line("\n=== Profiler: ring overflow ===\n");
+    {
+        Profiler prof;
+        for (unsigned int i = 0; i < RING_CAPACITY + 10; ++i) prof.Record("spam", i, i + 1, 0);
+        prof.Collect();
+        expect(prof.m_numCollected == RING_CAPACITY, "a full ring keeps RING_CAPACITY events");
+        expect(prof.m_pRings[0].load()->numDropped.load() == 10, "and counts the ten it dropped");
+        prof.Record("after", 0, 1, 0);
+        prof.Collect();
+        expect(prof.m_numCollected == RING_CAPACITY + 1, "a drained ring takes events again");
+    }
+
+    StartupReport::Line("\n=== Profiler: producer threads ===\n");
+    {
+        Profiler prof;
+        const unsigned int numThreads = 4, numScopes = 20000;
+        std::atomic<unsigned int> numDone{ 0 };
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < numThreads; ++t) {
+            threads.emplace_back([&prof, &numDone, t]() {
+                const char* names[] = { "worker 0", "worker 1", "worker 2", "worker 3" };
+                prof.SetThreadName(names[t]);
+                for (unsigned int i = 0; i < numScopes; ++i) {
+                    ProfileScope outer(prof, "job");
+                    ProfileScope inner(prof, "step");
+                }
+                numDone.fetch_add(1);
+            });
+        }
+        // drains while they write; each ring holds fewer events than a thread makes
+        while (numDone.load() < numThreads) prof.Collect();
+        for (std::thread& t : threads) t.join();
+        prof.Collect();
+        unsigned long long numDropped = 0;
+        for (unsigned int i = 0; i < prof.m_numTracks.load(); ++i) numDropped += prof.m_pRings[i].load()->numDropped.load();
+        expect(prof.m_numTracks.load() == numThreads, "one track per thread");
+        expect(prof.m_numCollected + numDropped == 2ull * numThreads * numScopes, "every event collected or counted as dropped");
+        const Stat* job = findStat(prof, "job");
+        expect(job && job->depth == 0, "per-thread depth: job at 0");
+        const Stat* step = findStat(prof, "step");
+        expect(step && step->depth == 1, "per-thread depth: step at 1");
+        bool isNamed = true;
+        for (unsigned int i = 0; i < numThreads; ++i) {
+            isNamed = isNamed && prof.m_pRings[i].load()->name.compare(0, 7, "worker ") == 0;
+        }
+        expect(isNamed, "threads named their tracks");
+        StartupReport::Line("  %llu events collected, %llu dropped\n", prof.m_numCollected, numDropped);
+    }
+
+    StartupReport::Line("\n=== Profiler: trace files ===\n");
+    {
+        const std::filesystem::path dir = std::filesystem::temp_directory_path() / "profiler_selftest";
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+
+        Profiler prof;
+        const unsigned int trackGPU = prof.AddTrack("GPU \"queue\"");
+        expect(trackGPU == 0, "a track added by hand");
+        expect(prof.BeginStream(dir / "stream.json"), "stream opened");
+        prof.Record("cpu", 1000, 2500, 0);
+        prof.Record(trackGPU, "gpu", 1500, 3000, 0);
+        prof.Collect();
+        prof.Record("cpu", 4000, 5000, 0);
+        prof.EndStream();
+        prof.Record("late", 6000, 7000, 0);
+        expect(prof.WriteTrace(dir / "trace.json"), "trace written");
+
+        const std::string textStream = readFile(dir / "stream.json");
+        expect(countOf(textStream, "\"ph\":\"X\"") == 3, "stream: the three events before EndStream");
+        expect(countOf(textStream, "\"thread_name\"") == 2, "stream: both track names");
+        expect(textStream.find("\"ts\":1.500,\"dur\":1.500") != std::string::npos, "stream: microseconds, ns as decimals");
+        expect(textStream.find("GPU \\\"queue\\\"") != std::string::npos, "stream: names escaped");
+        expect(textStream.size() > 4 && textStream.front() == '[' && textStream.compare(textStream.size() - 2, 2, "]\n") == 0,
+            "stream: closed array");
+
+        const std::string textTrace = readFile(dir / "trace.json");
+        expect(countOf(textTrace, "\"ph\":\"X\"") == 4, "trace: all four kept events");
+        expect(textTrace.find("\"late\"") != std::string::npos, "trace: collects first");
+
+        const Stat* gpu = findStat(prof, "gpu");
+        expect(gpu && gpu->track == trackGPU && gpu->nsTotal == 1500, "stat on the hand-written track");
+        std::filesystem::remove_all(dir, ec);
+    }
+
+    return expect.Finish("Profiler");
+}
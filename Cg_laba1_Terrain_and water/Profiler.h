@@ -0,0 +1,167 @@
+#pragma once
+#include "FrameHistogram.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// One finished scope. name is a string literal (or otherwise outlives the profiler).
+struct ProfileEvent {
+    const char*     name = nullptr;
+    long long       nsBegin = 0;        // since the profiler started
+    long long       nsEnd = 0;
+    unsigned int    depth = 0;          // scopes open around it on the same track
+};
+
+// One scope of the summary: its track, its nesting and its times over the run.
+struct ProfileSummary {
+    std::string         track;
+    const char*         name = nullptr;
+    unsigned int        depth = 0;
+    double              msAvg = 0.0;
+    FramePercentiles    ms;                 // count, p50, p95, p99, max
+};
+
+// Scoped CPU timings and anything else placed on a timeline, e.g. GPU timestamps. Every thread writes
+// the scopes it closes into a ring of its own: one producer, one consumer, no lock and no allocation
+// once the ring exists. A full ring drops the event and counts it. Collect drains all rings, once a
+// frame on the render thread; the events go to the summary printed by Report, to the last
+// HISTORY_CAPACITY events kept for WriteTrace and, while a stream is open, straight to its file.
+//
+// The trace is Chrome trace JSON (chrome://tracing, ui.perfetto.dev): one complete event ("ph":"X")
+// per scope, one tid per track, track names as metadata.
+class Profiler {
+public:
+    static const unsigned int RING_CAPACITY = 1 << 14;         // events per thread between two Collects
+    static const unsigned int HISTORY_CAPACITY = 1 << 18;
+    static const unsigned int MAX_TRACKS = 256;                 // past that a new thread's scopes are dropped
+
+    // The one PROFILE_SCOPE writes to. Lives to the end of the process; close its stream before then.
+    static Profiler& Get();
+
+    Profiler();
+    // Closes the stream.
+    ~Profiler();
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // Name of the calling thread's track; "thread N" otherwise.
+    void SetThreadName(const char* name);
+    // A track written by hand rather than by a thread's scopes, e.g. a GPU queue. One writer at a time.
+    // MAX_TRACKS when there is no room left.
+    unsigned int AddTrack(const char* name);
+
+    long long Now() const;
+    // The calling thread's track.
+    void Record(const char* name, long long nsBegin, long long nsEnd, unsigned int depth);
+    void Record(unsigned int track, const char* name, long long nsBegin, long long nsEnd, unsigned int depth);
+
+    // Off: scopes cost a load and a branch. Events already in the rings are still collected.
+    void SetEnabled(bool isEnabled) { m_isEnabled.store(isEnabled, std::memory_order_relaxed); }
+    bool IsEnabled() const { return m_isEnabled.load(std::memory_order_relaxed); }
+
+    // Drains every ring. Any thread, one at a time is enough; they serialise on a mutex.
+    void Collect();
+    // Every collected event goes to fn from now on, until EndStream. false when fn cannot be opened.
+    bool BeginStream(const std::filesystem::path& fn);
+    void EndStream();
+    // The kept history as one trace file. Collects first.
+    bool WriteTrace(const std::filesystem::path& fn);
+
+    // Per track and scope, in the order they first began, indented by depth: count, average and max.
+    void Report();
+    // The same scopes in the same order, with percentiles, for a benchmark's output. Collects first.
+    void GetSummary(std::vector<ProfileSummary>& out);
+
+    // Nesting, a ring overflow, several producer threads, the history and the trace file. Prints what it
+    // checks. Needs no device.
+    static bool SelfTest();
+
+private:
+    struct Ring {
+        std::string                 name;
+        unsigned int                track = 0;
+        std::thread::id             idThread;           // default for a track written by hand
+        ProfileEvent                events[RING_CAPACITY];
+        std::atomic<unsigned int>   head{ 0 };      // next write, producer only
+        std::atomic<unsigned int>   tail{ 0 };      // next read, consumer only
+        std::atomic<unsigned int>   numDropped{ 0 };
+        bool                        isNamed = false;    // in the stream, collector only
+    };
+    struct Stat {
+        unsigned int        track = 0;
+        unsigned int        depth = 0;
+        long long           nsFirst = 0;        // begin of the first event: parents sort before children
+        const char*         name = nullptr;
+        unsigned long long  count = 0;
+        long long           nsTotal = 0;
+        long long           nsMax = 0;
+        FrameHistogram      hist;
+    };
+    struct TrackedEvent {
+        unsigned int    track;
+        ProfileEvent    e;
+    };
+
+    // null past MAX_TRACKS
+    Ring* GetThreadRing();
+    Ring* NewRing(const char* name);
+    // Report's order: by track, parents before children. Under m_mtxCollect.
+    std::vector<const Stat*> SortStats() const;
+    static void Push(Ring* ring, const ProfileEvent& e);
+    void Consume(unsigned int track, const ProfileEvent& e);
+    static void WriteEvent(std::ostream& out, unsigned int track, const ProfileEvent& e, bool isFirst);
+    static void WriteTrackName(std::ostream& out, const Ring& ring, bool isFirst);
+
+    unsigned int                                m_id;                   // tells profilers apart in the thread's cache
+    std::chrono::steady_clock::time_point       m_tStart;
+    std::atomic<bool>                           m_isEnabled{ true };
+    std::mutex                                  m_mtxRings;             // adding a ring, naming one, draining them
+    std::atomic<Ring*>                          m_pRings[MAX_TRACKS] = {};  // by track; set once, read without the lock
+    std::atomic<unsigned int>                   m_numTracks{ 0 };
+    std::mutex                                  m_mtxCollect;           // everything below
+    std::vector<std::unordered_map<const char*, unsigned int>> m_listStatIndex;   // by track: name -> m_listStats
+    std::vector<Stat>                           m_listStats;
+    std::vector<TrackedEvent>                   m_listHistory;          // ring, oldest at m_iHistory once full
+    size_t                                      m_iHistory = 0;
+    std::ofstream                               m_fileStream;
+    bool                                        m_isStreamEmpty = true;
+    unsigned long long                          m_numCollected = 0;
+    unsigned long long                          m_numStreamed = 0;
+};
+
+// Records the time from construction to destruction on the calling thread's track. Scopes nest; the
+// depth of each is kept per thread.
+class ProfileScope {
+public:
+    ProfileScope(Profiler& prof, const char* name) : m_pProf(prof.IsEnabled() ? &prof : nullptr), m_name(name) {
+        if (!m_pProf) return;
+        m_depth = t_depth++;
+        m_nsBegin = m_pProf->Now();
+    }
+    ~ProfileScope() {
+        if (!m_pProf) return;
+        m_pProf->Record(m_name, m_nsBegin, m_pProf->Now(), m_depth);
+        --t_depth;
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    static thread_local unsigned int t_depth;
+
+    Profiler*       m_pProf;
+    const char*     m_name;
+    long long       m_nsBegin = 0;
+    unsigned int    m_depth = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// A scope of Profiler::Get() until the end of the enclosing block; name is a string literal.
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profScope, __LINE__)(Profiler::Get(), name)
@@ -0,0 +1,1129 @@
+#include "RecordingDevice.h"
+#include "Counters.h"
+#include "ResourceManager.h"
+#include "SelfTest.h"
+#include "StartupReport.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace graphics {
+
+    static const unsigned long long RECORDING_RESOURCE_ALIGNMENT = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+    static const unsigned int RECORDING_MAX_ROOT_ARGS = 16;
+
+    static unsigned long long AlignUp(unsigned long long val, unsigned long long align) {
+        return (val + align - 1) & ~(align - 1);
+    }
+
+    static unsigned long long ReadTicks() {
+        LARGE_INTEGER t;
+        QueryPerformanceCounter(&t);
+        return static_cast<unsigned long long>(t.QuadPart);
+    }
+
+    // FNV-1a, to tell a state set again from a new one
+    static unsigned long long HashBytes(const void* data, size_t size, unsigned long long h = 14695981039346656037ull) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) h = (h ^ p[i]) * 1099511628211ull;
+        return h;
+    }
+
+    // Bits per texel, per 4x4 block for the BC formats. Formats not listed count as 32 bits.
+    static unsigned int GetFormatBits(DXGI_FORMAT fmt, bool& isBlock) {
+        isBlock = false;
+        switch (fmt) {
+        case DXGI_FORMAT_R32G32B32A32_TYPELESS: case DXGI_FORMAT_R32G32B32A32_FLOAT:
+        case DXGI_FORMAT_R32G32B32A32_UINT: case DXGI_FORMAT_R32G32B32A32_SINT:
+            return 128;
+        case DXGI_FORMAT_R32G32B32_TYPELESS: case DXGI_FORMAT_R32G32B32_FLOAT:
+        case DXGI_FORMAT_R32G32B32_UINT: case DXGI_FORMAT_R32G32B32_SINT:
+            return 96;
+        case DXGI_FORMAT_R16G16B16A16_TYPELESS: case DXGI_FORMAT_R16G16B16A16_FLOAT: case DXGI_FORMAT_R16G16B16A16_UNORM:
+        case DXGI_FORMAT_R16G16B16A16_UINT: case DXGI_FORMAT_R16G16B16A16_SNORM: case DXGI_FORMAT_R16G16B16A16_SINT:
+        case DXGI_FORMAT_R32G32_TYPELESS: case DXGI_FORMAT_R32G32_FLOAT: case DXGI_FORMAT_R32G32_UINT: case DXGI_FORMAT_R32G32_SINT:
+        case DXGI_FORMAT_R32G8X24_TYPELESS: case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
+        case DXGI_FORMAT_R32_FLOAT_X8X24_TYPELESS: case DXGI_FORMAT_X32_TYPELESS_G8X24_UINT:
+            return 64;
+        case DXGI_FORMAT_R8G8_TYPELESS: case DXGI_FORMAT_R8G8_UNORM: case DXGI_FORMAT_R8G8_UINT:
+        case DXGI_FORMAT_R8G8_SNORM: case DXGI_FORMAT_R8G8_SINT:
+        case DXGI_FORMAT_R16_TYPELESS: case DXGI_FORMAT_R16_FLOAT: case DXGI_FORMAT_D16_UNORM: case DXGI_FORMAT_R16_UNORM:
+        case DXGI_FORMAT_R16_UINT: case DXGI_FORMAT_R16_SNORM: case DXGI_FORMAT_R16_SINT:
+        case DXGI_FORMAT_B5G6R5_UNORM: case DXGI_FORMAT_B5G5R5A1_UNORM: case DXGI_FORMAT_B4G4R4A4_UNORM:
+            return 16;
+        case DXGI_FORMAT_R8_TYPELESS: case DXGI_FORMAT_R8_UNORM: case DXGI_FORMAT_R8_UINT:
+        case DXGI_FORMAT_R8_SNORM: case DXGI_FORMAT_R8_SINT: case DXGI_FORMAT_A8_UNORM:
+            return 8;
+        case DXGI_FORMAT_BC1_TYPELESS: case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB:
+        case DXGI_FORMAT_BC4_TYPELESS: case DXGI_FORMAT_BC4_UNORM: case DXGI_FORMAT_BC4_SNORM:
+            isBlock = true;
+            return 64;
+        case DXGI_FORMAT_BC2_TYPELESS: case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC2_UNORM_SRGB:
+        case DXGI_FORMAT_BC3_TYPELESS: case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB:
+        case DXGI_FORMAT_BC5_TYPELESS: case DXGI_FORMAT_BC5_UNORM: case DXGI_FORMAT_BC5_SNORM:
+        case DXGI_FORMAT_BC6H_TYPELESS: case DXGI_FORMAT_BC6H_UF16: case DXGI_FORMAT_BC6H_SF16:
+        case DXGI_FORMAT_BC7_TYPELESS: case DXGI_FORMAT_BC7_UNORM: case DXGI_FORMAT_BC7_UNORM_SRGB:
+            isBlock = true;
+            return 128;
+        default:
+            return 32;
+        }
+    }
+
+    // GetCopyableFootprints of the stand-in: rows padded to D3D12_TEXTURE_DATA_PITCH_ALIGNMENT, subresources
+    // at D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT after offsetBase. The bytes from offsetBase to the end of the
+    // last row; any of the arrays may be null.
+    static unsigned long long GetFootprints(const D3D12_RESOURCE_DESC& desc, unsigned int first, unsigned int num,
+        unsigned long long offsetBase, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* layouts, UINT* numRows, UINT64* rowSizes) {
+        if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER) {
+            if (layouts) {
+                layouts[0].Offset = offsetBase;
+                layouts[0].Footprint.Format = DXGI_FORMAT_UNKNOWN;
+                layouts[0].Footprint.Width = static_cast<UINT>(desc.Width);
+                layouts[0].Footprint.Height = 1;
+                layouts[0].Footprint.Depth = 1;
+                layouts[0].Footprint.RowPitch = static_cast<UINT>(AlignUp(desc.Width, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT));
+            }
+            if (numRows) numRows[0] = 1;
+            if (rowSizes) rowSizes[0] = desc.Width;
+            return desc.Width;
+        }
+
+        bool isBlock = false;
+        const unsigned int bits = GetFormatBits(desc.Format, isBlock);
+        const unsigned int numMips = desc.MipLevels ? desc.MipLevels : 1;
+        const bool is3D = desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D;
+        unsigned long long offset = offsetBase, end = offsetBase;
+        for (unsigned int i = 0; i < num; ++i) {
+            const unsigned int mip = (first + i) % numMips;
+            unsigned int w = (std::max)(1u, static_cast<unsigned int>(desc.Width >> mip));
+            unsigned int h = (std::max)(1u, desc.Height >> mip);
+            const unsigned int d = is3D ? (std::max)(1u, static_cast<unsigned int>(desc.DepthOrArraySize >> mip)) : 1u;
+            unsigned int rows = h;
+            unsigned long long rowSize = (static_cast<unsigned long long>(w) * bits + 7) / 8;
+            if (isBlock) {
+                w = (w + 3) & ~3u;
+                h = (h + 3) & ~3u;
+                rows = h / 4;
+                rowSize = static_cast<unsigned long long>(w / 4) * bits / 8;
+            }
+            const unsigned long long pitch = AlignUp(rowSize, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
+            offset = AlignUp(offset, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+            if (layouts) {
+                layouts[i].Offset = offset;
+                layouts[i].Footprint.Format = desc.Format;
+                layouts[i].Footprint.Width = w;
+                layouts[i].Footprint.Height = h;
+                layouts[i].Footprint.Depth = d;
+                layouts[i].Footprint.RowPitch = static_cast<UINT>(pitch);
+            }
+            if (numRows) numRows[i] = rows;
+            if (rowSizes) rowSizes[i] = rowSize;
+            end = offset + pitch * (static_cast<unsigned long long>(rows) * d - 1) + rowSize;
+            offset += pitch * rows * d;
+        }
+        return end - offsetBase;
+    }
+
+    // What a resource of desc takes: all of its subresources, in whole 64 KB pages.
+    static unsigned long long GetAllocationSize(const D3D12_RESOURCE_DESC& desc) {
+        if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER) return AlignUp((std::max)(desc.Width, 1ull), RECORDING_RESOURCE_ALIGNMENT);
+        const unsigned int numMips = desc.MipLevels ? desc.MipLevels : 1;
+        const unsigned int numSlices = (desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D) ? 1u : desc.DepthOrArraySize;
+        const unsigned long long size = GetFootprints(desc, 0, numMips * numSlices, 0, nullptr, nullptr, nullptr);
+        return AlignUp(size * (std::max)(desc.SampleDesc.Count, 1u), RECORDING_RESOURCE_ALIGNMENT);
+    }
+
+    // MipLevels 0 asks for the whole chain.
+    static D3D12_RESOURCE_DESC ResolveDesc(const D3D12_RESOURCE_DESC& desc) {
+        D3D12_RESOURCE_DESC res = desc;
+        if (res.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER && !res.MipLevels) {
+            unsigned long long dim = (std::max)(res.Width, static_cast<unsigned long long>(res.Height));
+            if (res.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D) dim = (std::max)(dim, static_cast<unsigned long long>(res.DepthOrArraySize));
+            res.MipLevels = 1;
+            for (; dim > 1; dim >>= 1) ++res.MipLevels;
+        }
+        return res;
+    }
+
+    // Stats, trace and address space of one device, shared with every object it made so they can
+    // outlive it.
+    class RecordingLog {
+    public:
+        explicit RecordingLog(size_t maxEvents) : m_maxEvents(maxEvents) {
+            CounterRegistry& counters = CounterRegistry::Get();
+            m_pCommands = &counters.Register("commands", COUNTER_PER_FRAME);
+            m_pDraws = &counters.Register("draws", COUNTER_PER_FRAME);
+            m_pStateChanges = &counters.Register("state changes", COUNTER_PER_FRAME);
+            m_pRedundant = &counters.Register("redundant state sets", COUNTER_PER_FRAME);
+        }
+
+        void Add(TraceOp op, const char* name, unsigned long long arg, unsigned long long bytes = 0) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            Keep({ op, name, 0, false, arg, bytes });
+        }
+
+        unsigned long long Created(const char* kind, unsigned long long bytes) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            const unsigned long long id = ++m_numObjects;
+            ++m_stats.numCreated;
+            m_stats.bytesResident += bytes;
+            m_stats.bytesResidentPeak = (std::max)(m_stats.bytesResidentPeak, m_stats.bytesResident);
+            Keep({ TRACE_CREATE, kind, 0, false, id, bytes });
+            return id;
+        }
+
+        void Released(const char* kind, unsigned long long id, unsigned long long bytes) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            ++m_stats.numReleased;
+            m_stats.bytesResident -= bytes;
+            Keep({ TRACE_RELEASE, kind, 0, false, id, bytes });
+        }
+
+        void Mapped(long long bytes) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_stats.bytesMapped += bytes;
+        }
+
+        // A list the queue has got to: its commands into the stats and the trace, in order.
+        void Submit(const std::vector<TraceEvent>& events) {
+            long long numDraws = 0, numChanges = 0, numRedundant = 0;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                for (const TraceEvent& e : events) {
+                    switch (e.op) {
+                    case TRACE_DRAW: ++numDraws; break;
+                    case TRACE_STATE:
+                    case TRACE_ROOT:
+                        ++numChanges;
+                        if (e.isRedundant) ++numRedundant;
+                        break;
+                    case TRACE_BARRIER: m_stats.numBarriers += e.arg; break;
+                    case TRACE_COPY: m_stats.bytesCopied += e.bytes; break;
+                    default: break;
+                    }
+                    Keep(e);
+                }
+                m_stats.numCommands += events.size();
+                m_stats.numDraws += numDraws;
+                m_stats.numStateChanges += numChanges;
+                m_stats.numRedundantChanges += numRedundant;
+                ++m_stats.numListsExecuted;
+            }
+            m_pCommands->Add(static_cast<long long>(events.size()));
+            m_pDraws->Add(numDraws);
+            m_pStateChanges->Add(numChanges);
+            m_pRedundant->Add(numRedundant);
+        }
+
+        void Executed(unsigned int numLists) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            ++m_stats.numExecutes;
+            Keep({ TRACE_EXECUTE, "ExecuteCommandLists", 0, false, numLists, 0 });
+        }
+
+        void Presented(unsigned int iBackBuffer) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            ++m_stats.numPresents;
+            Keep({ TRACE_PRESENT, "Present", 0, false, iBackBuffer, 0 });
+        }
+
+        RecordingStats GetStats() const {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            return m_stats;
+        }
+        std::vector<TraceEvent> GetTrace() const {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            return m_listEvents;
+        }
+        void ClearTrace() {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_listEvents.clear();
+        }
+
+        unsigned long long AllocateAddress(unsigned long long size) {
+            return m_vaNext.fetch_add(AlignUp((std::max)(size, 1ull), RECORDING_RESOURCE_ALIGNMENT));
+        }
+        // Handles of a heap never overlap another heap's, so a view traced by its handle is unambiguous.
+        SIZE_T AllocateDescriptors(unsigned int num) {
+            return m_descNext.fetch_add(static_cast<SIZE_T>(AlignUp((std::max)(num, 1u) * RecordingDevice::DESCRIPTOR_SIZE, 4096)));
+        }
+        unsigned int NextList() { return ++m_numLists; }
+
+    private:
+        // caller holds m_mtx
+        void Keep(const TraceEvent& e) {
+            if (m_listEvents.size() < m_maxEvents) m_listEvents.push_back(e);
+            else ++m_stats.numEventsDropped;
+        }
+
+        mutable std::mutex              m_mtx;
+        std::vector<TraceEvent>         m_listEvents;
+        size_t                          m_maxEvents;
+        RecordingStats                  m_stats;
+        unsigned long long              m_numObjects = 0;
+        std::atomic<unsigned long long> m_vaNext{ 1ull << 32 };
+        std::atomic<SIZE_T>             m_descNext{ 0x10000000 };
+        std::atomic<unsigned int>       m_numLists{ 0 };
+        Counter*                        m_pCommands;
+        Counter*                        m_pDraws;
+        Counter*                        m_pStateChanges;
+        Counter*                        m_pRedundant;
+    };
+
+    // IUnknown, ID3D12Object and ID3D12DeviceChild for a stand-in of I. Traced as kind with its bytes from
+    // creation to the last Release.
+    template <class I>
+    class RecordingObject : public I {
+    public:
+        RecordingObject(const std::shared_ptr<RecordingLog>& log, const char* kind, unsigned long long bytes)
+            : m_pLog(log), m_kind(kind), m_bytes(bytes), m_id(log->Created(kind, bytes)) {}
+        virtual ~RecordingObject() {}
+
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+            if (!ppv) return E_POINTER;
+            if (riid == __uuidof(I) || riid == __uuidof(IUnknown)) {
+                *ppv = static_cast<I*>(this);
+                AddRef();
+                return S_OK;
+            }
+            *ppv = nullptr;
+            return E_NOINTERFACE;
+        }
+        ULONG STDMETHODCALLTYPE AddRef() override { return ++m_numRefs; }
+        ULONG STDMETHODCALLTYPE Release() override {
+            const ULONG n = --m_numRefs;
+            if (!n) {
+                m_pLog->Released(m_kind, m_id, m_bytes);
+                delete this;
+            }
+            return n;
+        }
+
+        HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID, UINT* size, void*) override {
+            if (size) *size = 0;
+            return DXGI_ERROR_NOT_FOUND;
+        }
+        HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID, UINT, const void*) override { return S_OK; }
+        HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID, const IUnknown*) override { return S_OK; }
+        HRESULT STDMETHODCALLTYPE SetName(LPCWSTR) override { return S_OK; }
+        // There is no ID3D12Device behind the stand-in; d3dx12 helpers that ask for one are routed
+        // through Device and CommandList instead.
+        HRESULT STDMETHODCALLTYPE GetDevice(REFIID, void** ppv) override {
+            if (ppv) *ppv = nullptr;
+            return E_NOINTERFACE;
+        }
+
+    protected:
+        std::shared_ptr<RecordingLog>   m_pLog;
+        const char*                     m_kind;
+        unsigned long long              m_bytes;
+        unsigned long long              m_id;
+        std::atomic<ULONG>              m_numRefs{ 1 };
+    };
+
+    class RecordingResource : public RecordingObject<ID3D12Resource> {
+    public:
+        RecordingResource(const std::shared_ptr<RecordingLog>& log, const D3D12_RESOURCE_DESC& desc,
+            const D3D12_HEAP_PROPERTIES& props, D3D12_HEAP_FLAGS flags, unsigned long long bytesResident, unsigned long long va)
+            : RecordingObject<ID3D12Resource>(log, "Resource", bytesResident), m_desc(desc), m_props(props), m_flags(flags), m_va(va) {}
+        ~RecordingResource() {
+            if (!m_listData.empty()) m_pLog->Mapped(-static_cast<long long>(m_listData.size()));
+        }
+
+        // CPU memory of an upload or readback resource, made on first use; nullptr for the other heaps.
+        unsigned char* GetData() {
+            if (m_props.Type != D3D12_HEAP_TYPE_UPLOAD && m_props.Type != D3D12_HEAP_TYPE_READBACK) return nullptr;
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_listData.empty()) {
+                m_listData.resize(static_cast<size_t>(GetAllocationSize(m_desc)));
+                m_pLog->Mapped(static_cast<long long>(m_listData.size()));
+            }
+            return m_listData.data();
+        }
+        size_t GetDataSize() const { return static_cast<size_t>(GetAllocationSize(m_desc)); }
+
+        HRESULT STDMETHODCALLTYPE Map(UINT subResource, const D3D12_RANGE*, void** ppData) override {
+            unsigned char* data = subResource ? nullptr : GetData();
+            if (ppData) *ppData = data;
+            return data ? S_OK : E_INVALIDARG;
+        }
+        void STDMETHODCALLTYPE Unmap(UINT, const D3D12_RANGE*) override {}
+        D3D12_RESOURCE_DESC STDMETHODCALLTYPE GetDesc() override { return m_desc; }
+        D3D12_GPU_VIRTUAL_ADDRESS STDMETHODCALLTYPE GetGPUVirtualAddress() override {
+            return (m_desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER) ? m_va : 0;
+        }
+        HRESULT STDMETHODCALLTYPE WriteToSubresource(UINT, const D3D12_BOX*, const void*, UINT, UINT) override { return E_NOTIMPL; }
+        HRESULT STDMETHODCALLTYPE ReadFromSubresource(void*, UINT, UINT, UINT, const D3D12_BOX*) override { return E_NOTIMPL; }
+        HRESULT STDMETHODCALLTYPE GetHeapProperties(D3D12_HEAP_PROPERTIES* props, D3D12_HEAP_FLAGS* flags) override {
+            if (props) *props = m_props;
+            if (flags) *flags = m_flags;
+            return S_OK;
+        }
+
+    private:
+        D3D12_RESOURCE_DESC             m_desc;
+        D3D12_HEAP_PROPERTIES           m_props;
+        D3D12_HEAP_FLAGS                m_flags;
+        D3D12_GPU_VIRTUAL_ADDRESS       m_va;
+        std::vector<unsigned char>      m_listData;
+        std::mutex                      m_mtx;
+    };
+
+    // Completes what the queue signals at once: the lists before the signal have been "executed" already.
+    class RecordingFence : public RecordingObject<ID3D12Fence> {
+    public:
+        RecordingFence(const std::shared_ptr<RecordingLog>& log, unsigned long long valInit)
+            : RecordingObject<ID3D12Fence>(log, "Fence", 0), m_val(valInit) {}
+
+        UINT64 STDMETHODCALLTYPE GetCompletedValue() override { return m_val.load(std::memory_order_acquire); }
+        HRESULT STDMETHODCALLTYPE SetEventOnCompletion(UINT64 val, HANDLE h) override {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_val.load(std::memory_order_relaxed) >= val) {
+                if (h) SetEvent(h);
+                return S_OK;
+            }
+            if (!h) return E_INVALIDARG;   // nothing else would ever signal it while the caller blocks
+            m_listWaits.push_back({ val, h });
+            return S_OK;
+        }
+        HRESULT STDMETHODCALLTYPE Signal(UINT64 val) override {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_val.store(val, std::memory_order_release);
+            for (size_t i = 0; i < m_listWaits.size();) {
+                if (m_listWaits[i].first > val) { ++i; continue; }
+                SetEvent(m_listWaits[i].second);
+                m_listWaits[i] = m_listWaits.back();
+                m_listWaits.pop_back();
+            }
+            return S_OK;
+        }
+
+    private:
+        std::atomic<unsigned long long>                         m_val;
+        std::vector<std::pair<unsigned long long, HANDLE>>      m_listWaits;
+        std::mutex                                              m_mtx;
+    };
+
+    class RecordingDescriptorHeap : public RecordingObject<ID3D12DescriptorHeap> {
+    public:
+        RecordingDescriptorHeap(const std::shared_ptr<RecordingLog>& log, const D3D12_DESCRIPTOR_HEAP_DESC& desc)
+            : RecordingObject<ID3D12DescriptorHeap>(log, "DescriptorHeap",
+                static_cast<unsigned long long>(desc.NumDescriptors) * RecordingDevice::DESCRIPTOR_SIZE),
+            m_desc(desc), m_base(log->AllocateDescriptors(desc.NumDescriptors)) {}
+
+        D3D12_DESCRIPTOR_HEAP_DESC STDMETHODCALLTYPE GetDesc() override { return m_desc; }
+        D3D12_CPU_DESCRIPTOR_HANDLE STDMETHODCALLTYPE GetCPUDescriptorHandleForHeapStart() override {
+            D3D12_CPU_DESCRIPTOR_HANDLE hdl;
+            hdl.ptr = m_base;
+            return hdl;
+        }
+        D3D12_GPU_DESCRIPTOR_HANDLE STDMETHODCALLTYPE GetGPUDescriptorHandleForHeapStart() override {
+            D3D12_GPU_DESCRIPTOR_HANDLE hdl;
+            hdl.ptr = (m_desc.Flags & D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE) ? m_base : 0;
+            return hdl;
+        }
+
+    private:
+        D3D12_DESCRIPTOR_HEAP_DESC      m_desc;
+        SIZE_T                          m_base;
+    };
+
+    class RecordingAllocator : public RecordingObject<ID3D12CommandAllocator> {
+    public:
+        explicit RecordingAllocator(const std::shared_ptr<RecordingLog>& log)
+            : RecordingObject<ID3D12CommandAllocator>(log, "CommandAllocator", 0) {}
+
+        HRESULT STDMETHODCALLTYPE Reset() override { return S_OK; }
+    };
+
+    class RecordingPipelineState : public RecordingObject<ID3D12PipelineState> {
+    public:
+        explicit RecordingPipelineState(const std::shared_ptr<RecordingLog>& log)
+            : RecordingObject<ID3D12PipelineState>(log, "PipelineState", 0) {}
+
+        HRESULT STDMETHODCALLTYPE GetCachedBlob(ID3DBlob** ppBlob) override {
+            if (ppBlob) *ppBlob = nullptr;
+            return E_NOTIMPL;
+        }
+    };
+
+    class RecordingHeap : public RecordingObject<ID3D12Heap> {
+    public:
+        RecordingHeap(const std::shared_ptr<RecordingLog>& log, const D3D12_HEAP_DESC& desc)
+            : RecordingObject<ID3D12Heap>(log, "Heap", desc.SizeInBytes), m_desc(desc) {}
+
+        D3D12_HEAP_DESC STDMETHODCALLTYPE GetDesc() override { return m_desc; }
+
+    private:
+        D3D12_HEAP_DESC                 m_desc;
+    };
+
+    class RecordingQueryHeap : public RecordingObject<ID3D12QueryHeap> {
+    public:
+        RecordingQueryHeap(const std::shared_ptr<RecordingLog>& log, unsigned int count)
+            : RecordingObject<ID3D12QueryHeap>(log, "QueryHeap", static_cast<unsigned long long>(count) * 8), m_listValues(count, 0) {}
+
+        void Write(unsigned int i, unsigned long long val) { if (i < m_listValues.size()) m_listValues[i] = val; }
+        void Resolve(unsigned int first, unsigned int num, RecordingResource* dst, unsigned long long offset) {
+            unsigned char* data = dst ? dst->GetData() : nullptr;
+            if (!data || first + num > m_listValues.size() || offset + num * 8ull > dst->GetDataSize()) return;
+            memcpy(data + offset, &m_listValues[first], num * 8ull);
+        }
+
+    private:
+        std::vector<unsigned long long> m_listValues;
+    };
+
+    // Records into memory what a D3D12 list would hold and which of its state sets changed nothing.
+    // State does not carry over between lists: every Reset starts from none, as on D3D12.
+    class RecordingCommandList : public CommandList {
+    public:
+        explicit RecordingCommandList(const std::shared_ptr<RecordingLog>& log)
+            : m_pLog(log), m_id(log->Created("CommandList", 0)), m_iList(log->NextList()) {
+            ClearState();
+        }
+
+        bool IsOpen() const { return m_isOpen; }
+        const std::vector<TraceEvent>& GetEvents() const { return m_listEvents; }
+
+        // What the queue does when it gets to the list: the timestamps and their resolves.
+        void Execute() {
+            for (const QueryOp& q : m_listQueries) {
+                if (q.pDst) q.pHeap->Resolve(q.index, q.num, q.pDst, q.offset);
+                else q.pHeap->Write(q.index, ReadTicks());
+            }
+        }
+
+        void Release() override {
+            m_pLog->Released("CommandList", m_id, 0);
+            delete this;
+        }
+
+        HRESULT Reset(ID3D12CommandAllocator*, ID3D12PipelineState* psoInit) override {
+            if (m_isOpen) return E_FAIL;
+            m_isOpen = true;
+            m_listEvents.clear();       // keeps its memory: a list recorded every frame stops allocating
+            m_listQueries.clear();
+            ClearState();
+            if (psoInit) SetPipelineState(psoInit);
+            return S_OK;
+        }
+        HRESULT Close() override {
+            if (!m_isOpen) return E_FAIL;
+            m_isOpen = false;
+            return S_OK;
+        }
+
+        void SetPipelineState(ID3D12PipelineState* pso) override {
+            Set(STATE_PIPELINE, reinterpret_cast<uintptr_t>(pso), TRACE_STATE, "SetPipelineState", 0);
+        }
+        void SetGraphicsRootSignature(ID3D12RootSignature* root) override {
+            // another signature drops every root argument
+            const unsigned long long key = reinterpret_cast<uintptr_t>(root);
+            if (!m_hasState[STATE_ROOT_SIGNATURE] || m_state[STATE_ROOT_SIGNATURE] != key) {
+                for (unsigned int i = 0; i < RECORDING_MAX_ROOT_ARGS; ++i) m_hasState[STATE_ROOT_ARGS + i] = false;
+            }
+            Set(STATE_ROOT_SIGNATURE, key, TRACE_STATE, "SetGraphicsRootSignature", 0);
+        }
+        void SetDescriptorHeaps(UINT numHeaps, ID3D12DescriptorHeap* const* heaps) override {
+            Set(STATE_HEAPS, HashBytes(heaps, numHeaps * sizeof(*heaps)), TRACE_STATE, "SetDescriptorHeaps", numHeaps);
+        }
+        void SetGraphicsRootDescriptorTable(UINT index, D3D12_GPU_DESCRIPTOR_HANDLE table) override {
+            SetRoot(index, table.ptr, "SetGraphicsRootDescriptorTable");
+        }
+        void SetGraphicsRootConstantBufferView(UINT index, D3D12_GPU_VIRTUAL_ADDRESS va) override {
+            SetRoot(index, va, "SetGraphicsRootConstantBufferView");
+        }
+        void SetGraphicsRoot32BitConstants(UINT index, UINT num, const void* data, UINT offset) override {
+            SetRoot(index, HashBytes(data, num * 4ull, HashBytes(&offset, sizeof(offset))), "SetGraphicsRoot32BitConstants");
+        }
+
+        void IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology) override {
+            Set(STATE_TOPOLOGY, topology, TRACE_STATE, "IASetPrimitiveTopology", topology);
+        }
+        void IASetVertexBuffers(UINT start, UINT num, const D3D12_VERTEX_BUFFER_VIEW* views) override {
+            const UINT range[2] = { start, num };
+            const unsigned long long key = HashBytes(range, sizeof(range));
+            Set(STATE_VERTEX_BUFFERS, views ? HashBytes(views, num * sizeof(*views), key) : key, TRACE_STATE, "IASetVertexBuffers", num);
+        }
+        void IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* view) override {
+            Set(STATE_INDEX_BUFFER, view ? HashBytes(view, sizeof(*view)) : 0, TRACE_STATE, "IASetIndexBuffer", 0);
+        }
+        void RSSetViewports(UINT num, const D3D12_VIEWPORT* vps) override {
+            Set(STATE_VIEWPORTS, HashBytes(vps, num * sizeof(*vps)), TRACE_STATE, "RSSetViewports", num);
+        }
+        void RSSetScissorRects(UINT num, const D3D12_RECT* rects) override {
+            Set(STATE_SCISSORS, HashBytes(rects, num * sizeof(*rects)), TRACE_STATE, "RSSetScissorRects", num);
+        }
+        void OMSetRenderTargets(UINT numRTVs, const D3D12_CPU_DESCRIPTOR_HANDLE* rtvs, BOOL isSingleRange,
+            const D3D12_CPU_DESCRIPTOR_HANDLE* dsv) override {
+            unsigned long long key = HashBytes(&numRTVs, sizeof(numRTVs));
+            if (rtvs) key = HashBytes(rtvs, (isSingleRange ? 1 : numRTVs) * sizeof(*rtvs), key);
+            if (dsv) key = HashBytes(dsv, sizeof(*dsv), key);
+            Set(STATE_TARGETS, key, TRACE_STATE, "OMSetRenderTargets", numRTVs);
+        }
+
+        void ClearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE rtv, const FLOAT[4], UINT, const D3D12_RECT*) override {
+            Record(TRACE_CLEAR, "ClearRenderTargetView", rtv.ptr);
+        }
+        void ClearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE dsv, D3D12_CLEAR_FLAGS, FLOAT, UINT8, UINT, const D3D12_RECT*) override {
+            Record(TRACE_CLEAR, "ClearDepthStencilView", dsv.ptr);
+        }
+        void ResourceBarrier(UINT num, const D3D12_RESOURCE_BARRIER*) override {
+            Record(TRACE_BARRIER, "ResourceBarrier", num);
+        }
+        void DrawInstanced(UINT numVertices, UINT numInstances, UINT, UINT) override {
+            Record(TRACE_DRAW, "DrawInstanced", static_cast<unsigned long long>(numVertices) * numInstances);
+        }
+        void DrawIndexedInstanced(UINT numIndices, UINT numInstances, UINT, INT, UINT) override {
+            Record(TRACE_DRAW, "DrawIndexedInstanced", static_cast<unsigned long long>(numIndices) * numInstances);
+        }
+
+        void EndQuery(ID3D12QueryHeap* heap, D3D12_QUERY_TYPE, UINT index) override {
+            Record(TRACE_QUERY, "EndQuery", 1);
+            m_listQueries.push_back({ static_cast<RecordingQueryHeap*>(heap), index, 1, nullptr, 0 });
+        }
+        void ResolveQueryData(ID3D12QueryHeap* heap, D3D12_QUERY_TYPE, UINT start, UINT num,
+            ID3D12Resource* dst, UINT64 offsetDst) override {
+            Record(TRACE_QUERY, "ResolveQueryData", num, num * 8ull);
+            m_listQueries.push_back({ static_cast<RecordingQueryHeap*>(heap), start, num, static_cast<RecordingResource*>(dst), offsetDst });
+        }
+
+        // As d3dx12's: the same checks, the rows into staging now, the copy when the list runs.
+        UINT64 UpdateSubresources(ID3D12Resource* dst, ID3D12Resource* staging, UINT64 offset,
+            UINT firstSubResource, UINT numSubResources, D3D12_SUBRESOURCE_DATA* data) override {
+            if (!numSubResources) return 0;
+            const D3D12_RESOURCE_DESC descDst = dst->GetDesc();
+            const D3D12_RESOURCE_DESC descStaging = staging->GetDesc();
+            m_listLayouts.resize(numSubResources);
+            m_listNumRows.resize(numSubResources);
+            m_listRowSizes.resize(numSubResources);
+            const UINT64 size = GetFootprints(descDst, firstSubResource, numSubResources, offset,
+                m_listLayouts.data(), m_listNumRows.data(), m_listRowSizes.data());
+            if (descStaging.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER || descStaging.Width < size + m_listLayouts[0].Offset ||
+                (descDst.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER && (firstSubResource != 0 || numSubResources != 1))) {
+                return 0;
+            }
+
+            BYTE* mapped = nullptr;
+            if (FAILED(staging->Map(0, nullptr, reinterpret_cast<void**>(&mapped)))) return 0;
+            for (UINT i = 0; i < numSubResources; ++i) {
+                const D3D12_PLACED_SUBRESOURCE_FOOTPRINT& l = m_listLayouts[i];
+                D3D12_MEMCPY_DEST dest = { mapped + l.Offset, l.Footprint.RowPitch,
+                    static_cast<SIZE_T>(l.Footprint.RowPitch) * m_listNumRows[i] };
+                MemcpySubresource(&dest, &data[i], static_cast<SIZE_T>(m_listRowSizes[i]), m_listNumRows[i], l.Footprint.Depth);
+            }
+            staging->Unmap(0, nullptr);
+
+            const bool isBuffer = descDst.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER;
+            Record(TRACE_COPY, isBuffer ? "CopyBufferRegion" : "CopyTextureRegion", numSubResources, size);
+            return size;
+        }
+
+    private:
+        enum StateSlot {
+            STATE_PIPELINE, STATE_ROOT_SIGNATURE, STATE_HEAPS, STATE_TOPOLOGY, STATE_VERTEX_BUFFERS, STATE_INDEX_BUFFER,
+            STATE_VIEWPORTS, STATE_SCISSORS, STATE_TARGETS, STATE_ROOT_ARGS,
+            STATE_COUNT = STATE_ROOT_ARGS + RECORDING_MAX_ROOT_ARGS
+        };
+        struct QueryOp {
+            RecordingQueryHeap*     pHeap;
+            unsigned int            index;
+            unsigned int            num;
+            RecordingResource*      pDst;       // nullptr: EndQuery
+            unsigned long long      offset;
+        };
+
+        void ClearState() {
+            for (unsigned int i = 0; i < STATE_COUNT; ++i) m_hasState[i] = false;
+        }
+        void Record(TraceOp op, const char* name, unsigned long long arg, unsigned long long bytes = 0, bool isRedundant = false) {
+            m_listEvents.push_back({ op, name, m_iList, isRedundant, arg, bytes });
+        }
+        void Set(unsigned int slot, unsigned long long key, TraceOp op, const char* name, unsigned long long arg) {
+            const bool isRedundant = m_hasState[slot] && m_state[slot] == key;
+            m_state[slot] = key;
+            m_hasState[slot] = true;
+            Record(op, name, arg, 0, isRedundant);
+        }
+        void SetRoot(UINT index, unsigned long long key, const char* name) {
+            if (index < RECORDING_MAX_ROOT_ARGS) Set(STATE_ROOT_ARGS + index, key, TRACE_ROOT, name, index);
+            else Record(TRACE_ROOT, name, index);
+        }
+
+        std::shared_ptr<RecordingLog>                       m_pLog;
+        unsigned long long                                  m_id;
+        unsigned int                                        m_iList;
+        bool                                                m_isOpen = true;    // created open, as on D3D12
+        std::vector<TraceEvent>                             m_listEvents;
+        std::vector<QueryOp>                                m_listQueries;
+        unsigned long long                                  m_state[STATE_COUNT];
+        bool                                                m_hasState[STATE_COUNT];
+        std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT>     m_listLayouts;      // UpdateSubresources scratch
+        std::vector<UINT>                                   m_listNumRows;
+        std::vector<UINT64>                                 m_listRowSizes;
+    };
+
+    RecordingDevice::RecordingDevice(unsigned int h, unsigned int w, unsigned int numFrames, size_t maxEvents)
+        : m_pLog(std::make_shared<RecordingLog>(maxEvents)), m_numLatency(numFrames) {
+        D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(DESIRED_FORMAT, w, h, 1, 1);
+        desc.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+        const D3D12_HEAP_PROPERTIES props = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+        for (unsigned int i = 0; i < numFrames; ++i) {
+            const unsigned long long size = GetAllocationSize(desc);
+            m_listBackBuffers.push_back(new RecordingResource(m_pLog, desc, props, D3D12_HEAP_FLAG_NONE, size, m_pLog->AllocateAddress(size)));
+        }
+    }
+
+    RecordingDevice::~RecordingDevice() {
+        for (ID3D12Resource* b : m_listBackBuffers) b->Release();
+        m_listBackBuffers.clear();
+        if (!m_fnReport.empty()) {
+            Report();
+            if (!WriteTrace(m_fnReport)) StartupReport::Line("  cannot write %s\n", m_fnReport.string().c_str());
+        }
+    }
+
+    unsigned int RecordingDevice::GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE) {
+        return DESCRIPTOR_SIZE;
+    }
+
+    void RecordingDevice::CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE, ID3D12CommandAllocator*& allocator) {
+        allocator = new RecordingAllocator(m_pLog);
+    }
+
+    void RecordingDevice::GetBackBuffer(unsigned int i, ID3D12Resource*& buffer) {
+        if (i >= m_listBackBuffers.size()) {
+            throw GFX_Exception("Invalid buffer index provided to RecordingDevice::GetBackBuffer.");
+        }
+        buffer = m_listBackBuffers[i];
+        buffer->AddRef();
+    }
+
+    unsigned int RecordingDevice::GetCurrentBackBuffer() {
+        return m_iBackBuffer;
+    }
+
+    void RecordingDevice::SetFence(ID3D12Fence* fence, unsigned long long val) {
+        m_pLog->Add(TRACE_SIGNAL, "Signal", val);
+        fence->Signal(val);
+    }
+
+    void RecordingDevice::CreateRootSig(CD3DX12_ROOT_SIGNATURE_DESC*, ID3D12RootSignature*& root) {
+        root = new RecordingObject<ID3D12RootSignature>(m_pLog, "RootSignature", 0);
+    }
+
+    void RecordingDevice::CreateRootSig(const void*, size_t, ID3D12RootSignature*& root) {
+        root = new RecordingObject<ID3D12RootSignature>(m_pLog, "RootSignature", 0);
+    }
+
+    void RecordingDevice::CreatePSO(D3D12_GRAPHICS_PIPELINE_STATE_DESC*, ID3D12PipelineState*& pso) {
+        pso = new RecordingPipelineState(m_pLog);
+    }
+
+    bool RecordingDevice::CreatePipelineLibrary(const void*, size_t, ID3D12PipelineLibrary*& lib) {
+        lib = nullptr;
+        return false;
+    }
+
+    void RecordingDevice::CreateDescriptorHeap(D3D12_DESCRIPTOR_HEAP_DESC* desc, ID3D12DescriptorHeap*& heap) {
+        heap = new RecordingDescriptorHeap(m_pLog, *desc);
+    }
+
+    void RecordingDevice::CreateSRV(ID3D12Resource*&, D3D12_SHADER_RESOURCE_VIEW_DESC*, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+        m_pLog->Add(TRACE_VIEW, "CreateShaderResourceView", handle.ptr);
+    }
+
+    void RecordingDevice::CreateCBV(D3D12_CONSTANT_BUFFER_VIEW_DESC*, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+        m_pLog->Add(TRACE_VIEW, "CreateConstantBufferView", handle.ptr);
+    }
+
+    void RecordingDevice::CreateDSV(ID3D12Resource*&, D3D12_DEPTH_STENCIL_VIEW_DESC*, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+        m_pLog->Add(TRACE_VIEW, "CreateDepthStencilView", handle.ptr);
+    }
+
+    void RecordingDevice::CreateRTV(ID3D12Resource*&, D3D12_RENDER_TARGET_VIEW_DESC*, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+        m_pLog->Add(TRACE_VIEW, "CreateRenderTargetView", handle.ptr);
+    }
+
+    void RecordingDevice::CreateSampler(D3D12_SAMPLER_DESC*, D3D12_CPU_DESCRIPTOR_HANDLE handle) {
+        m_pLog->Add(TRACE_VIEW, "CreateSampler", handle.ptr);
+    }
+
+    void RecordingDevice::CreateFence(unsigned long long valInit, D3D12_FENCE_FLAGS, ID3D12Fence*& fence) {
+        fence = new RecordingFence(m_pLog, valInit);
+    }
+
+    void RecordingDevice::CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE, ID3D12CommandAllocator*, CommandList*& list,
+        unsigned int, ID3D12PipelineState* psoInit) {
+        RecordingCommandList* rec = new RecordingCommandList(m_pLog);
+        if (psoInit) rec->SetPipelineState(psoInit);
+        list = rec;
+    }
+
+    void RecordingDevice::CreateCommittedResource(ID3D12Resource*& heap, D3D12_RESOURCE_DESC* desc, D3D12_HEAP_PROPERTIES* props,
+        D3D12_HEAP_FLAGS flags, D3D12_RESOURCE_STATES, D3D12_CLEAR_VALUE*) {
+        const D3D12_RESOURCE_DESC descRes = ResolveDesc(*desc);
+        const unsigned long long size = GetAllocationSize(descRes);
+        heap = new RecordingResource(m_pLog, descRes, *props, flags, size, m_pLog->AllocateAddress(size));
+    }
+
+    D3D12_RESOURCE_ALLOCATION_INFO RecordingDevice::GetResourceAllocationInfo(const D3D12_RESOURCE_DESC* desc) {
+        D3D12_RESOURCE_ALLOCATION_INFO info;
+        info.SizeInBytes = GetAllocationSize(ResolveDesc(*desc));
+        info.Alignment = RECORDING_RESOURCE_ALIGNMENT;
+        return info;
+    }
+
+    unsigned long long RecordingDevice::GetRequiredIntermediateSize(ID3D12Resource* res, unsigned int firstSubResource,
+        unsigned int numSubResources) {
+        return GetFootprints(res->GetDesc(), firstSubResource, numSubResources, 0, nullptr, nullptr, nullptr);
+    }
+
+    void RecordingDevice::CreateHeap(D3D12_HEAP_DESC* desc, ID3D12Heap*& heap) {
+        heap = new RecordingHeap(m_pLog, *desc);
+    }
+
+    void RecordingDevice::CreatePlacedResource(ID3D12Resource*& res, ID3D12Heap* heap, unsigned long long offset,
+        D3D12_RESOURCE_DESC* desc, D3D12_RESOURCE_STATES, D3D12_CLEAR_VALUE*) {
+        const D3D12_HEAP_DESC descHeap = heap->GetDesc();
+        const D3D12_RESOURCE_DESC descRes = ResolveDesc(*desc);
+        if (offset + GetAllocationSize(descRes) > descHeap.SizeInBytes) {
+            throw GFX_Exception("RecordingDevice::CreatePlacedResource: the resource does not fit into the heap.");
+        }
+        res = new RecordingResource(m_pLog, descRes, descHeap.Properties, descHeap.Flags, 0, m_pLog->AllocateAddress(GetAllocationSize(descRes)));
+    }
+
+    void RecordingDevice::ExecuteCommandLists(CommandList* lCmds[], unsigned int numCommands) {
+        for (unsigned int i = 0; i < numCommands; ++i) {
+            if (static_cast<RecordingCommandList*>(lCmds[i])->IsOpen()) {
+                throw GFX_Exception("RecordingDevice::ExecuteCommandLists: a command list is still open.");
+            }
+        }
+        for (unsigned int i = 0; i < numCommands; ++i) {
+            RecordingCommandList* list = static_cast<RecordingCommandList*>(lCmds[i]);
+            list->Execute();
+            m_pLog->Submit(list->GetEvents());
+        }
+        m_pLog->Executed(numCommands);
+    }
+
+    void RecordingDevice::Present() {
+        m_pLog->Presented(m_iBackBuffer);
+        m_iBackBuffer = (m_iBackBuffer + 1) % static_cast<unsigned int>(m_listBackBuffers.size());
+    }
+
+    void RecordingDevice::SetMaximumFrameLatency(unsigned int n) {
+        m_numLatency = n;
+    }
+
+    bool RecordingDevice::WaitForFrameLatency(unsigned long) {
+        return true;
+    }
+
+    void RecordingDevice::CreateQueryHeap(D3D12_QUERY_HEAP_DESC* desc, ID3D12QueryHeap*& heap) {
+        heap = new RecordingQueryHeap(m_pLog, desc->Count);
+    }
+
+    unsigned long long RecordingDevice::GetTimestampFrequency() {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        return static_cast<unsigned long long>(freq.QuadPart);
+    }
+
+    void RecordingDevice::GetClockCalibration(unsigned long long& tickGPU, unsigned long long& tickCPU) {
+        tickCPU = tickGPU = ReadTicks();
+    }
+
+    RecordingStats RecordingDevice::GetStats() const {
+        return m_pLog->GetStats();
+    }
+
+    std::vector<TraceEvent> RecordingDevice::GetTrace() const {
+        return m_pLog->GetTrace();
+    }
+
+    void RecordingDevice::ClearTrace() {
+        m_pLog->ClearTrace();
+    }
+
+    bool RecordingDevice::WriteTrace(const std::filesystem::path& fn) const {
+        static const char* OP_NAMES[] = { "create", "release", "view", "state", "root", "barrier", "clear", "draw",
+            "copy", "query", "execute", "signal", "present" };
+        std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out << "# op name list arg bytes [redundant]\n";
+        char buf[192];
+        for (const TraceEvent& e : GetTrace()) {
+            snprintf(buf, sizeof(buf), "%s %s %u %llu %llu%s\n", OP_NAMES[e.op], e.name, e.list, e.arg, e.bytes,
+                e.isRedundant ? " redundant" : "");
+            out << buf;
+        }
+        return static_cast<bool>(out);
+    }
+
+    void RecordingDevice::Report() const {
+        const RecordingStats s = GetStats();
+        const double numPresents = s.numPresents ? static_cast<double>(s.numPresents) : 1.0;
+        StartupReport::Line("\n=== Recording device (no GPU) ===\n");
+        StartupReport::Line("  %llu lists in %llu submissions, %llu presents\n", s.numListsExecuted, s.numExecutes, s.numPresents);
+        StartupReport::Line("  commands %llu (%.1f per present), draws %llu (%.1f), barriers %llu (%.1f)\n",
+            s.numCommands, s.numCommands / numPresents, s.numDraws, s.numDraws / numPresents, s.numBarriers, s.numBarriers / numPresents);
+        StartupReport::Line("  state changes %llu (%.1f per present), %llu of them redundant (%.1f%%)\n",
+            s.numStateChanges, s.numStateChanges / numPresents, s.numRedundantChanges,
+            s.numStateChanges ? 100.0 * s.numRedundantChanges / s.numStateChanges : 0.0);
+        StartupReport::Line("  %.1f MB copied through staging\n", s.bytesCopied / 1048576.0);
+        StartupReport::Line("  objects: %llu created, %llu released; resident %.1f MB, peak %.1f MB; mapped %.1f MB\n",
+            s.numCreated, s.numReleased, s.bytesResident / 1048576.0, s.bytesResidentPeak / 1048576.0, s.bytesMapped / 1048576.0);
+        StartupReport::Line("  trace: %llu events kept, %llu dropped\n",
+            static_cast<unsigned long long>(GetTrace().size()), s.numEventsDropped);
+    }
+
+    bool RecordingDevice::SelfTest() {
+        SelfTestExpect expect;
+
+        RecordingDevice dev(64, 64, 2, 4096);
+        CD3DX12_HEAP_PROPERTIES propsDefault(D3D12_HEAP_TYPE_DEFAULT);
+        CD3DX12_HEAP_PROPERTIES propsUpload(D3D12_HEAP_TYPE_UPLOAD);
+        CD3DX12_HEAP_PROPERTIES propsReadback(D3D12_HEAP_TYPE_READBACK);
+
+        StartupReport::Line("\n=== Recording device: resources ===\n");
+        const unsigned long long bytesStart = dev.GetStats().bytesResident;
+        expect(bytesStart == 2 * 65536, "two 64x64 back buffers, a 64 KB page each");
+        D3D12_RESOURCE_DESC descBuffer = CD3DX12_RESOURCE_DESC::Buffer(100000);
+        expect(dev.GetResourceAllocationInfo(&descBuffer).SizeInBytes == 131072, "a 100000-byte buffer takes two pages");
+        ID3D12Resource* buffer = nullptr;
+        dev.CreateCommittedResource(buffer, &descBuffer, &propsDefault,
+            D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nullptr);
+        void* mapped = nullptr;
+        expect(dev.GetStats().bytesResident == bytesStart + 131072 && buffer->GetGPUVirtualAddress() % 65536 == 0,
+            "a committed buffer is resident, at a page-aligned address");
+        expect(FAILED(buffer->Map(0, nullptr, &mapped)) && !mapped, "a default-heap buffer cannot be mapped");
+
+        D3D12_RESOURCE_DESC descUpload = CD3DX12_RESOURCE_DESC::Buffer(1 << 20);
+        ID3D12Resource* staging = nullptr;
+        dev.CreateCommittedResource(staging, &descUpload, &propsUpload,
+            D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr);
+        expect(SUCCEEDED(staging->Map(0, nullptr, &mapped)) && mapped && dev.GetStats().bytesMapped == (1 << 20),
+            "an upload buffer maps to CPU memory of its size");
+
+        D3D12_HEAP_DESC descHeap = {};
+        descHeap.SizeInBytes = 4 << 20;
+        descHeap.Properties = propsDefault;
+        ID3D12Heap* heap = nullptr;
+        dev.CreateHeap(&descHeap, heap);
+        const unsigned long long bytesWithHeap = dev.GetStats().bytesResident;
+        D3D12_RESOURCE_DESC descTex = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, 512, 512, 1, 1);
+        ID3D12Resource* placed = nullptr;
+        dev.CreatePlacedResource(placed, heap, 0, &descTex, D3D12_RESOURCE_STATE_COMMON, nullptr);
+        expect(dev.GetStats().bytesResident == bytesWithHeap, "a placed resource takes its memory from the heap");
+        bool threw = false;
+        ID3D12Resource* outside = nullptr;
+        try { dev.CreatePlacedResource(outside, heap, 7 << 19, &descTex, D3D12_RESOURCE_STATE_COMMON, nullptr); }
+        catch (const GFX_Exception&) { threw = true; }
+        expect(threw && !outside, "a placed resource past the end of its heap throws");
+        placed->Release();
+        heap->Release();
+
+        buffer->AddRef();
+        buffer->Release();
+        expect(dev.GetStats().bytesResident == bytesStart + 131072 + (1 << 20), "AddRef keeps it; the heap gave its bytes back");
+        buffer->Release();
+        {
+            const std::vector<TraceEvent> trace = dev.GetTrace();
+            const TraceEvent& last = trace.back();
+            expect(last.op == TRACE_RELEASE && last.bytes == 131072 && dev.GetStats().bytesResident == bytesStart + (1 << 20),
+                "the last Release is traced with the bytes it returns");
+        }
+
+        StartupReport::Line("\n=== Recording device: state churn ===\n");
+        ID3D12CommandAllocator* alloc = nullptr;
+        dev.CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, alloc);
+        CommandList* list = nullptr;
+        dev.CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE_DIRECT, alloc, list);
+        ID3D12PipelineState* pso = nullptr;
+        D3D12_GRAPHICS_PIPELINE_STATE_DESC descPSO = {};
+        dev.CreatePSO(&descPSO, pso);
+        ID3D12RootSignature* roots[2] = {};
+        dev.CreateRootSig(nullptr, 0, roots[0]);
+        dev.CreateRootSig(nullptr, 0, roots[1]);
+        D3D12_GPU_DESCRIPTOR_HANDLE table;
+        table.ptr = 0x1000;
+
+        expect(list->Reset(alloc, nullptr) == E_FAIL, "a new list is open: Reset before Close fails");
+        list->SetPipelineState(pso);
+        list->SetPipelineState(pso);                            // redundant
+        list->SetGraphicsRootSignature(roots[0]);
+        list->SetGraphicsRootDescriptorTable(0, table);
+        list->SetGraphicsRootDescriptorTable(0, table);         // redundant
+        list->SetGraphicsRootSignature(roots[1]);
+        list->SetGraphicsRootDescriptorTable(0, table);         // a new signature: not redundant
+        const float constants[2] = { 1.0f, 2.0f };
+        list->SetGraphicsRoot32BitConstants(1, 2, constants, 0);
+        list->SetGraphicsRoot32BitConstants(1, 2, constants, 0); // redundant
+        list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        list->DrawInstanced(3, 2, 0, 0);
+        list->DrawIndexedInstanced(6, 1, 0, 0, 0);
+        expect(dev.GetStats().numCommands == 0, "nothing counts before the list is executed");
+        CommandList* lists[] = { list };
+        threw = false;
+        try { dev.ExecuteCommandLists(lists, 1); }
+        catch (const GFX_Exception&) { threw = true; }
+        expect(threw && dev.GetStats().numCommands == 0, "executing an open list throws");
+
+        expect(SUCCEEDED(list->Close()) && list->Close() == E_FAIL, "closed once, not twice");
+        dev.ClearTrace();
+        dev.ExecuteCommandLists(lists, 1);
+        RecordingStats stats = dev.GetStats();
+        expect(stats.numCommands == 12 && stats.numDraws == 2 && stats.numStateChanges == 10,
+            "12 commands: 2 draws and 10 state changes");
+        expect(stats.numRedundantChanges == 3, "3 sets that changed nothing");
+        const std::vector<TraceEvent> trace = dev.GetTrace();
+        expect(trace.size() == 13 && trace[1].isRedundant && trace[10].op == TRACE_DRAW && trace[10].arg == 6 &&
+            trace[12].op == TRACE_EXECUTE, "the trace keeps the commands in order, then the submission");
+
+        expect(SUCCEEDED(list->Reset(alloc, nullptr)), "reset after Close");
+        list->SetPipelineState(pso);
+        list->Close();
+        dev.ExecuteCommandLists(lists, 1);
+        expect(dev.GetStats().numRedundantChanges == 3, "state does not carry over a Reset");
+
+        StartupReport::Line("\n=== Recording device: uploads ===\n");
+        D3D12_RESOURCE_DESC descMips = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, 16, 16, 1, 0);
+        ID3D12Resource* texMips = nullptr;
+        dev.CreateCommittedResource(texMips, &descMips, &propsDefault,
+            D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nullptr);
+        expect(texMips->GetDesc().MipLevels == 5, "MipLevels 0 makes the whole chain");
+        expect(dev.GetRequiredIntermediateSize(texMips, 0, 5) == 7684, "16x16 RGBA8 chain: rows of 256, levels at 512");
+        D3D12_RESOURCE_DESC descBC = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_BC1_UNORM, 64, 64, 1, 1);
+        ID3D12Resource* texBC = nullptr;
+        dev.CreateCommittedResource(texBC, &descBC, &propsDefault,
+            D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nullptr);
+        expect(dev.GetRequiredIntermediateSize(texBC, 0, 1) == 256 * 15 + 128, "64x64 BC1: 16 rows of 4x4 blocks");
+
+        std::vector<unsigned char> pixels(16 * 16 * 4);
+        for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = static_cast<unsigned char>(i * 7);
+        D3D12_SUBRESOURCE_DATA sub = {};
+        sub.pData = pixels.data();
+        sub.RowPitch = 16 * 4;
+        sub.SlicePitch = sub.RowPitch * 16;
+        list->Reset(alloc, nullptr);
+        const UINT64 size = list->UpdateSubresources(texMips, staging, 512, 0, 1, &sub);
+        const unsigned char* rows = static_cast<const unsigned char*>(mapped) + 512;
+        expect(size == 256 * 15 + 64 && !memcmp(rows, pixels.data(), 64) && !memcmp(rows + 256 * 15, pixels.data() + 64 * 15, 64),
+            "rows land in staging at the offset, 256 bytes apart");
+        expect(list->UpdateSubresources(staging, texMips, 0, 0, 1, &sub) == 0, "a texture as staging is refused");
+        list->Close();
+        dev.ExecuteCommandLists(lists, 1);
+        expect(dev.GetStats().bytesCopied == size, "the copy counts its bytes when executed");
+        texMips->Release();
+        texBC->Release();
+
+        StartupReport::Line("\n=== Recording device: fences and queries ===\n");
+        ID3D12Fence* fence = nullptr;
+        dev.CreateFence(0, D3D12_FENCE_FLAG_NONE, fence);
+        HANDLE hdl = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        dev.SetFence(fence, 5);
+        expect(fence->GetCompletedValue() == 5, "a queue signal completes at once");
+        fence->SetEventOnCompletion(3, hdl);
+        expect(WaitForSingleObject(hdl, 0) == WAIT_OBJECT_0, "a value already passed sets the event");
+        fence->SetEventOnCompletion(7, hdl);
+        const bool isEarly = WaitForSingleObject(hdl, 0) == WAIT_OBJECT_0;
+        fence->Signal(7);
+        expect(!isEarly && WaitForSingleObject(hdl, 0) == WAIT_OBJECT_0, "a later value sets it when signalled");
+        CloseHandle(hdl);
+        fence->Release();
+
+        D3D12_QUERY_HEAP_DESC descQuery = {};
+        descQuery.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+        descQuery.Count = 2;
+        ID3D12QueryHeap* queries = nullptr;
+        dev.CreateQueryHeap(&descQuery, queries);
+        D3D12_RESOURCE_DESC descReadback = CD3DX12_RESOURCE_DESC::Buffer(16);
+        ID3D12Resource* readback = nullptr;
+        dev.CreateCommittedResource(readback, &descReadback, &propsReadback,
+            D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, nullptr);
+        list->Reset(alloc, nullptr);
+        list->EndQuery(queries, D3D12_QUERY_TYPE_TIMESTAMP, 0);
+        list->EndQuery(queries, D3D12_QUERY_TYPE_TIMESTAMP, 1);
+        list->ResolveQueryData(queries, D3D12_QUERY_TYPE_TIMESTAMP, 0, 2, readback, 0);
+        list->Close();
+        unsigned long long tickGPU = 0, tickCPU = 0;
+        dev.GetClockCalibration(tickGPU, tickCPU);
+        dev.ExecuteCommandLists(lists, 1);
+        void* ticks = nullptr;
+        readback->Map(0, nullptr, &ticks);
+        const unsigned long long* t = static_cast<const unsigned long long*>(ticks);
+        expect(t && t[0] >= tickGPU && t[1] >= t[0], "timestamps are taken when the list is executed, in order");
+        readback->Release();
+        queries->Release();
+
+        StartupReport::Line("\n=== Recording device: trace file ===\n");
+        const std::filesystem::path fn = std::filesystem::temp_directory_path() / "recording_device_selftest.txt";
+        expect(dev.WriteTrace(fn), "written");
+        {
+            std::ifstream in(fn, std::ios::binary);
+            std::string line;
+            size_t numLines = 0;
+            bool hasDraw = false;
+            while (std::getline(in, line)) {
+                ++numLines;
+                hasDraw = hasDraw || line.rfind("draw DrawIndexedInstanced ", 0) == 0;
+            }
+            expect(numLines == dev.GetTrace().size() + 1 && hasDraw, "a header and one line per event");
+        }
+        std::error_code ec;
+        std::filesystem::remove(fn, ec);
+        expect(dev.GetStats().numEventsDropped == 0, "nothing dropped below the limit");
+
+        list->Release();
+        alloc->Release();
+        pso->Release();
+        roots[0]->Release();
+        roots[1]->Release();
+        staging->Release();
+        stats = dev.GetStats();
+        expect(stats.numCreated == stats.numReleased + 2 && stats.bytesResident == bytesStart && stats.bytesMapped == 0,
+            "everything released but the back buffers");
+
+        StartupReport::Line("\n=== Recording device: ResourceManager on it ===\n");
+        {
+            RecordingDevice devRM(64, 64, 2);
+            ResourceManager rm(&devRM, 4, 4, 64, 4);
+            D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(65536);
+            ID3D12Resource* res = nullptr;
+            const unsigned int i = rm.NewBuffer(res, &desc, &propsDefault,
+                D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, nullptr);
+            std::vector<unsigned char> data(65536, 0x5a);
+            D3D12_SUBRESOURCE_DATA subData = {};
+            subData.pData = data.data();
+            subData.RowPitch = subData.SlicePitch = 65536;
+            rm.UploadToBuffer(i, 1, &subData, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+            rm.WaitForGPU();
+            RecordingStats s = devRM.GetStats();
+            expect(s.bytesCopied == 65536 && s.numBarriers == 2 && s.numExecutes == 1, "an upload: two barriers and one copy, submitted once");
+
+            D3D12_CPU_DESCRIPTOR_HANDLE hdlCPU;
+            D3D12_GPU_DESCRIPTOR_HANDLE hdlGPU;
+            rm.AllocateCBVSRVUAVRange(8, hdlCPU, hdlGPU);
+            expect(hdlCPU.ptr == rm.GetCBVSRVUAVHeap()->GetCPUDescriptorHandleForHeapStart().ptr && hdlGPU.ptr == hdlCPU.ptr,
+                "descriptors from the start of the shader-visible heap");
+            const unsigned long long numReleased = s.numReleased;
+            rm.ReleaseResource(i);
+            rm.ReleaseCBVSRVUAVRange(hdlCPU, 8);
+            rm.ProcessReleases();
+            const bool isKept = devRM.GetStats().numReleased == numReleased;
+            rm.SignalFrame();
+            rm.ProcessReleases();
+            expect(isKept && devRM.GetStats().numReleased == numReleased + 1 && rm.GetReleaseQueueStats().numPendingDescriptors == 0,
+                "released once the frame fence passes");
+        }
+
+        return expect.Finish("recording device");
+    }
+}
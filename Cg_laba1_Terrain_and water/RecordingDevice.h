@@ -0,0 +1,140 @@
+#pragma once
+#include "Graphics.h"
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace graphics {
+
+    // What a traced call did. Commands enter the trace when their list is executed, in submission
+    // order, with the list they were recorded into; device calls (list 0) when they are made.
+    enum TraceOp {
+        TRACE_CREATE,       // resource, heap, list or other device object; arg: its id, bytes: what it holds
+        TRACE_RELEASE,      // its last reference went; arg: its id, bytes: what it gave back
+        TRACE_VIEW,         // descriptor written; arg: the CPU handle
+        TRACE_STATE,        // pipeline, root signature, heaps, input assembly, viewports, targets
+        TRACE_ROOT,         // root argument; arg: its root index
+        TRACE_BARRIER,      // arg: barriers in the call
+        TRACE_CLEAR,
+        TRACE_DRAW,         // arg: vertices or indices times instances
+        TRACE_COPY,         // arg: subresources, bytes: read from staging
+        TRACE_QUERY,        // arg: queries
+        TRACE_EXECUTE,      // arg: lists
+        TRACE_SIGNAL,       // arg: fence value
+        TRACE_PRESENT,      // arg: back buffer index
+    };
+
+    struct TraceEvent {
+        TraceOp             op;
+        const char*         name;           // the call or the kind of object, a literal
+        unsigned int        list;           // 1.. in creation order; 0 for device calls
+        bool                isRedundant;    // a state or root argument set to what the list already had
+        unsigned long long  arg;
+        unsigned long long  bytes;
+    };
+
+    // Totals since the device was created. Commands count once their list is executed.
+    struct RecordingStats {
+        unsigned long long  numCommands = 0;
+        unsigned long long  numDraws = 0;
+        unsigned long long  numStateChanges = 0;        // TRACE_STATE and TRACE_ROOT calls
+        unsigned long long  numRedundantChanges = 0;    // of those, the ones that changed nothing
+        unsigned long long  numBarriers = 0;
+        unsigned long long  bytesCopied = 0;
+        unsigned long long  numExecutes = 0;
+        unsigned long long  numListsExecuted = 0;
+        unsigned long long  numPresents = 0;
+        unsigned long long  numCreated = 0;
+        unsigned long long  numReleased = 0;
+        unsigned long long  bytesResident = 0;          // committed resources, heaps and descriptor heaps alive now
+        unsigned long long  bytesResidentPeak = 0;
+        unsigned long long  bytesMapped = 0;            // CPU memory behind mapped upload and readback resources
+        unsigned long long  numEventsDropped = 0;       // past the trace limit
+    };
+
+    class RecordingLog;
+
+    // A Device without a GPU. Resources, heaps and fences are COM stand-ins, command lists record into
+    // memory; executing them only traces the commands and writes the timestamps they query, so a fence
+    // the queue signals is complete at once. Upload and readback resources have CPU memory behind Map,
+    // and UpdateSubresources copies into staging as d3dx12 does. What the renderer asks of it is counted
+    // and kept in an inspectable trace: submission cost and state churn can be measured with no adapter.
+    // Textures and views hold no data, nothing is drawn; sizes follow a fixed layout (rows of 256 bytes,
+    // subresources at 512, 64 KB per resource), not a driver's.
+    class RecordingDevice : public Device {
+    public:
+        static const unsigned int DESCRIPTOR_SIZE = 32;
+
+        // numFrames back buffers of w x h. maxEvents bounds the trace; later events still count in
+        // the stats.
+        RecordingDevice(unsigned int h, unsigned int w, unsigned int numFrames = 3, size_t maxEvents = 1 << 20);
+        ~RecordingDevice();
+        RecordingDevice(const RecordingDevice&) = delete;
+        RecordingDevice& operator=(const RecordingDevice&) = delete;
+
+        unsigned int GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE ht) override;
+        void CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE clt, ID3D12CommandAllocator*& allocator) override;
+        void GetBackBuffer(unsigned int i, ID3D12Resource*& buffer) override;
+        unsigned int GetCurrentBackBuffer() override;
+        void SetFence(ID3D12Fence* fence, unsigned long long val) override;
+
+        void CreateRootSig(CD3DX12_ROOT_SIGNATURE_DESC* desc, ID3D12RootSignature*& root) override;
+        void CreateRootSig(const void* blob, size_t size, ID3D12RootSignature*& root) override;
+        void CreatePSO(D3D12_GRAPHICS_PIPELINE_STATE_DESC* desc, ID3D12PipelineState*& pso) override;
+        // No pipeline libraries.
+        bool CreatePipelineLibrary(const void* blob, size_t size, ID3D12PipelineLibrary*& lib) override;
+
+        void CreateDescriptorHeap(D3D12_DESCRIPTOR_HEAP_DESC* desc, ID3D12DescriptorHeap*& heap) override;
+        void CreateSRV(ID3D12Resource*& tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+        void CreateCBV(D3D12_CONSTANT_BUFFER_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+        void CreateDSV(ID3D12Resource*& tex, D3D12_DEPTH_STENCIL_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+        void CreateRTV(ID3D12Resource*& tex, D3D12_RENDER_TARGET_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+        void CreateSampler(D3D12_SAMPLER_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle) override;
+        void CreateFence(unsigned long long valInit, D3D12_FENCE_FLAGS flags, ID3D12Fence*& fence) override;
+        void CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE type, ID3D12CommandAllocator* alloc, CommandList*& list,
+            unsigned int mask = 0, ID3D12PipelineState* psoInit = nullptr) override;
+
+        void CreateCommittedResource(ID3D12Resource*& heap, D3D12_RESOURCE_DESC* desc, D3D12_HEAP_PROPERTIES* props, D3D12_HEAP_FLAGS flags,
+            D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) override;
+        D3D12_RESOURCE_ALLOCATION_INFO GetResourceAllocationInfo(const D3D12_RESOURCE_DESC* desc) override;
+        unsigned long long GetRequiredIntermediateSize(ID3D12Resource* res, unsigned int firstSubResource,
+            unsigned int numSubResources) override;
+        void CreateHeap(D3D12_HEAP_DESC* desc, ID3D12Heap*& heap) override;
+        // Placed resources take their memory from the heap's and add nothing to bytesResident.
+        void CreatePlacedResource(ID3D12Resource*& res, ID3D12Heap* heap, unsigned long long offset, D3D12_RESOURCE_DESC* desc,
+            D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) override;
+
+        // Throws GFX_Exception for a list that is still open.
+        void ExecuteCommandLists(CommandList* lCmds[], unsigned int numCommands) override;
+        void Present() override;
+        void SetMaximumFrameLatency(unsigned int n) override;
+        // Never waits: nothing is queued behind a present.
+        bool WaitForFrameLatency(unsigned long ms = INFINITE) override;
+
+        void CreateQueryHeap(D3D12_QUERY_HEAP_DESC* desc, ID3D12QueryHeap*& heap) override;
+        // Timestamps are QueryPerformanceCounter ticks taken when the list is executed.
+        unsigned long long GetTimestampFrequency() override;
+        void GetClockCalibration(unsigned long long& tickGPU, unsigned long long& tickCPU) override;
+
+        RecordingStats GetStats() const;
+        // A copy of the events kept so far. Any thread.
+        std::vector<TraceEvent> GetTrace() const;
+        void ClearTrace();
+        // One event per line after a header.
+        bool WriteTrace(const std::filesystem::path& fn) const;
+        void Report() const;
+        // Report and the trace into fn when the device goes away, after everything that used it.
+        void ReportOnExit(const std::filesystem::path& fn) { m_fnReport = fn; }
+
+        // Byte accounting, state churn in a recorded list, uploads through staging, fences, timestamp
+        // queries, the trace file, and a ResourceManager running on the stand-in. Prints what it checks.
+        static bool SelfTest();
+
+    private:
+        std::shared_ptr<RecordingLog>   m_pLog;
+        std::vector<ID3D12Resource*>    m_listBackBuffers;
+        unsigned int                    m_iBackBuffer = 0;
+        unsigned int                    m_numLatency;
+        std::filesystem::path           m_fnReport;
+    };
+}
@@ -0,0 +1,353 @@
+#include "RenderGraph.h"
+#include "SelfTest.h"
+#include "StartupReport.h"
+#include <algorithm>
+
+static uint64_t AlignUp(uint64_t v, uint64_t alignment) {
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+static bool IsWrite(unsigned int access) {
+    return (access & RG_ACCESS_WRITE_MASK) != 0;
+}
+
+unsigned int RenderGraph::ImportResource(const char* name, unsigned int accessBegin, unsigned int accessEnd) {
+    Resource r;
+    r.name = name;
+    r.accessBegin = accessBegin;
+    r.accessEnd = accessEnd;
+    r.accessInitial = accessBegin;
+    m_listResources.push_back(r);
+    return GetResourceCount() - 1;
+}
+
+unsigned int RenderGraph::CreateTransient(const char* name, uint64_t size, uint64_t alignment) {
+    Resource r;
+    r.name = name;
+    r.isTransient = true;
+    r.size = size;
+    r.alignment = alignment ? alignment : 1;
+    m_listResources.push_back(r);
+    return GetResourceCount() - 1;
+}
+
+unsigned int RenderGraph::AddPass(const char* name) {
+    Pass p;
+    p.name = name;
+    m_listPasses.push_back(p);
+    return GetPassCount() - 1;
+}
+
+void RenderGraph::Use(unsigned int pass, unsigned int resource, unsigned int access) {
+    for (PassUse& u : m_listPasses[pass].listUses) {
+        if (u.resource == resource) {
+            u.access |= access;
+            return;
+        }
+    }
+    m_listPasses[pass].listUses.push_back({ resource, access });
+}
+
+bool RenderGraph::Fail(std::string* err, const std::string& msg) const {
+    if (err) *err = msg;
+    return false;
+}
+
+uint64_t RenderGraph::GetTransientBytes() const {
+    uint64_t bytes = 0;
+    for (const Resource& r : m_listResources) {
+        if (r.isTransient) bytes += AlignUp(r.size, r.alignment);
+    }
+    return bytes;
+}
+
+bool RenderGraph::Compile(std::string* err) {
+    m_listFinalBarriers.clear();
+    for (Pass& p : m_listPasses) p.barriers.clear();
+
+    // per resource, the passes touching it in order with their combined access
+    struct Step {
+        unsigned int pass;
+        unsigned int access;
+        unsigned int state;     // the state the resource is in during the pass
+    };
+    std::vector<std::vector<Step>> listSteps(m_listResources.size());
+    for (unsigned int p = 0; p < GetPassCount(); ++p) {
+        for (const PassUse& u : m_listPasses[p].listUses) {
+            const std::string where = "pass '" + m_listPasses[p].name + "', '" + m_listResources[u.resource].name + "'";
+            if (u.access == RG_ACCESS_PRESENT) return Fail(err, where + ": PRESENT is not an access inside a pass");
+            // a write bit alone: one state per pass and resource
+            if (IsWrite(u.access) && (u.access & (u.access - 1))) {
+                return Fail(err, where + ": a write combined with another access in the same pass");
+            }
+            listSteps[u.resource].push_back({ p, u.access, 0 });
+        }
+    }
+
+    for (unsigned int i = 0; i < GetResourceCount(); ++i) {
+        Resource& r = m_listResources[i];
+        std::vector<Step>& steps = listSteps[i];
+        if (r.isTransient) {
+            if (steps.empty()) return Fail(err, "transient '" + r.name + "' is never used");
+            if (!IsWrite(steps[0].access)) {
+                return Fail(err, "transient '" + r.name + "' is read in pass '" + m_listPasses[steps[0].pass].name +
+                    "' before it is written");
+            }
+        }
+        if (steps.empty()) continue;
+        r.firstPass = steps.front().pass;
+        r.lastPass = steps.back().pass;
+
+        // reads go to the union of the reads up to the next write
+        unsigned int state = r.isTransient ? steps[0].access : r.accessBegin;
+        for (size_t k = 0; k < steps.size(); ++k) {
+            const unsigned int access = steps[k].access;
+            if (IsWrite(access)) state = access;
+            else if (IsWrite(state) || state == RG_ACCESS_PRESENT || (state & access) != access) {
+                state = 0;
+                for (size_t n = k; n < steps.size() && !IsWrite(steps[n].access); ++n) state |= steps[n].access;
+            }
+            steps[k].state = state;
+        }
+        // a transient starts the frame where the last one left it
+        if (r.isTransient) r.accessInitial = steps.back().state;
+    }
+
+    m_sizeHeap = 0;
+    PlaceTransients();
+
+    for (unsigned int i = 0; i < GetResourceCount(); ++i) {
+        const Resource& r = m_listResources[i];
+        const std::vector<Step>& steps = listSteps[i];
+        if (r.isAliased) {
+            m_listPasses[r.firstPass].barriers.push_back({ RG_BARRIER_ALIASING, i, 0, 0 });
+        }
+        unsigned int state = r.accessInitial;
+        for (const Step& s : steps) {
+            if (s.state != state) m_listPasses[s.pass].barriers.push_back({ RG_BARRIER_TRANSITION, i, state, s.state });
+            state = s.state;
+        }
+        if (!r.isTransient && state != r.accessEnd) {
+            m_listFinalBarriers.push_back({ RG_BARRIER_TRANSITION, i, state, r.accessEnd });
+        }
+    }
+
+    // an aliasing barrier has to come before the transitions of the resource it activates
+    for (Pass& p : m_listPasses) {
+        std::stable_sort(p.barriers.begin(), p.barriers.end(), [](const RenderGraphBarrier& a, const RenderGraphBarrier& b) {
+            return a.type == RG_BARRIER_ALIASING && b.type != RG_BARRIER_ALIASING;
+        });
+    }
+    return true;
+}
+
+// largest first, each at the lowest offset that does not overlap a transient in use at the same time
+void RenderGraph::PlaceTransients() {
+    std::vector<unsigned int> order;
+    for (unsigned int i = 0; i < GetResourceCount(); ++i) {
+        if (m_listResources[i].isTransient) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) {
+        return m_listResources[a].size > m_listResources[b].size;
+    });
+
+    auto isLiveTogether = [](const Resource& a, const Resource& b) {
+        return !(a.lastPass < b.firstPass || b.lastPass < a.firstPass);
+    };
+    auto isOverlapping = [](const Resource& a, uint64_t offset, uint64_t size) {
+        return offset < a.offset + a.size && a.offset < offset + size;
+    };
+
+    std::vector<unsigned int> placed;
+    for (unsigned int i : order) {
+        Resource& r = m_listResources[i];
+        std::vector<uint64_t> candidates(1, 0);
+        for (unsigned int j : placed) {
+            if (isLiveTogether(r, m_listResources[j])) {
+                candidates.push_back(AlignUp(m_listResources[j].offset + m_listResources[j].size, r.alignment));
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        for (uint64_t offset : candidates) {
+            bool isFree = true;
+            for (unsigned int j : placed) {
+                if (isLiveTogether(r, m_listResources[j]) && isOverlapping(m_listResources[j], offset, r.size)) {
+                    isFree = false;
+                    break;
+                }
+            }
+            if (isFree) {
+                r.offset = offset;
+                break;
+            }
+        }
+        m_sizeHeap = (std::max)(m_sizeHeap, r.offset + r.size);
+        placed.push_back(i);
+    }
+
+    for (unsigned int i : placed) {
+        Resource& r = m_listResources[i];
+        r.isAliased = false;
+        for (unsigned int j : placed) {
+            if (j != i && isOverlapping(m_listResources[j], r.offset, r.size)) r.isAliased = true;
+        }
+    }
+}
+
+static std::string AccessName(unsigned int access) {
+    static const struct { unsigned int bit; const char* name; } names[] = {
+        { RG_ACCESS_RENDER_TARGET, "render target" }, { RG_ACCESS_DEPTH_WRITE, "depth write" },
+        { RG_ACCESS_COPY_DEST, "copy dest" }, { RG_ACCESS_DEPTH_READ, "depth read" },
+        { RG_ACCESS_SHADER_READ, "shader read" }, { RG_ACCESS_COPY_SOURCE, "copy source" },
+    };
+    if (access == RG_ACCESS_PRESENT) return "present";
+    std::string s;
+    for (const auto& n : names) {
+        if (!(access & n.bit)) continue;
+        if (!s.empty()) s += "|";
+        s += n.name;
+    }
+    return s;
+}
+
+bool RenderGraph::SelfTest() {
+    SelfTestExpect expect(true);
+    auto hasTransition = [](const std::vector<RenderGraphBarrier>& barriers, unsigned int res, unsigned int before, unsigned int after) {
+        for (const RenderGraphBarrier& b : barriers) {
+            if (b.type == RG_BARRIER_TRANSITION && b.resource == res && b.before == before && b.after == after) return true;
+        }
+        return false;
+    };
+    auto hasAliasing = [](const std::vector<RenderGraphBarrier>& barriers, unsigned int res) {
+        return !barriers.empty() && barriers[0].type == RG_BARRIER_ALIASING && barriers[0].resource == res;
+    };
+    const uint64_t MB = 1024 * 1024;
+    const uint64_t ALIGN = 64 * 1024;
+
+    // the scene: four shadow cascades into one atlas, then the main pass reading it
+    {
+        StartupReport::Line("\n=== Render graph: scene frame ===\n");
+        RenderGraph g;
+        const unsigned int bb = g.ImportResource("back buffer", RG_ACCESS_PRESENT, RG_ACCESS_PRESENT);
+        const unsigned int atlas = g.CreateTransient("shadow atlas", 64 * MB, ALIGN);
+        const unsigned int depth = g.CreateTransient("depth", 8 * MB, ALIGN);
+        for (unsigned int i = 0; i < 4; ++i) {
+            const unsigned int p = g.AddPass(("shadow cascade " + std::to_string(i)).c_str());
+            g.Use(p, atlas, RG_ACCESS_DEPTH_WRITE);
+        }
+        const unsigned int mainPass = g.AddPass("main");
+        g.Use(mainPass, atlas, RG_ACCESS_SHADER_READ);
+        g.Use(mainPass, depth, RG_ACCESS_DEPTH_WRITE);
+        g.Use(mainPass, bb, RG_ACCESS_RENDER_TARGET);
+
+        std::string err;
+        expect(g.Compile(&err), "the scene graph compiles");
+        for (unsigned int p = 0; p < g.GetPassCount(); ++p) {
+            StartupReport::Line("  %-18s %u barrier(s)\n", g.GetPassName(p), (unsigned int)g.GetBarriers(p).size());
+            for (const RenderGraphBarrier& b : g.GetBarriers(p)) {
+                StartupReport::Line("    %s: %s -> %s\n", g.GetResourceName(b.resource), AccessName(b.before).c_str(),
+                    AccessName(b.after).c_str());
+            }
+        }
+        StartupReport::Line("  heap %.1f MB for %.1f MB of transients\n", g.GetHeapSize() / (double)MB,
+            g.GetTransientBytes() / (double)MB);
+
+        expect(g.GetInitialAccess(atlas) == RG_ACCESS_SHADER_READ, "the atlas starts the frame as the main pass left it");
+        expect(g.GetBarriers(0).size() == 1 && hasTransition(g.GetBarriers(0), atlas, RG_ACCESS_SHADER_READ, RG_ACCESS_DEPTH_WRITE),
+            "the first cascade turns the atlas into a depth target");
+        expect(g.GetBarriers(1).empty() && g.GetBarriers(2).empty() && g.GetBarriers(3).empty(),
+            "the other cascades need no barrier");
+        expect(g.GetBarriers(mainPass).size() == 2 && hasTransition(g.GetBarriers(mainPass), atlas, RG_ACCESS_DEPTH_WRITE, RG_ACCESS_SHADER_READ)
+            && hasTransition(g.GetBarriers(mainPass), bb, RG_ACCESS_PRESENT, RG_ACCESS_RENDER_TARGET),
+            "the main pass starts with one batch of two transitions");
+        expect(g.GetFinalBarriers().size() == 1 && hasTransition(g.GetFinalBarriers(), bb, RG_ACCESS_RENDER_TARGET, RG_ACCESS_PRESENT),
+            "the back buffer goes back to present");
+        expect(g.GetHeapSize() == 72 * MB && !g.IsAliased(atlas) && !g.IsAliased(depth),
+            "atlas and depth are live together and do not alias");
+    }
+
+    // two targets with disjoint lifetimes share memory, a third one live across both does not
+    {
+        StartupReport::Line("\n=== Render graph: aliasing ===\n");
+        RenderGraph g;
+        const unsigned int a = g.CreateTransient("a", 16 * MB, ALIGN);
+        const unsigned int b = g.CreateTransient("b", 16 * MB, ALIGN);
+        const unsigned int c = g.CreateTransient("c", 8 * MB, ALIGN);
+        unsigned int p[4];
+        for (unsigned int i = 0; i < 4; ++i) p[i] = g.AddPass(("pass " + std::to_string(i)).c_str());
+        g.Use(p[0], a, RG_ACCESS_RENDER_TARGET);
+        g.Use(p[1], a, RG_ACCESS_SHADER_READ);
+        g.Use(p[1], c, RG_ACCESS_DEPTH_WRITE);
+        g.Use(p[2], b, RG_ACCESS_RENDER_TARGET);
+        g.Use(p[2], c, RG_ACCESS_DEPTH_READ);
+        g.Use(p[3], b, RG_ACCESS_SHADER_READ);
+
+        expect(g.Compile(), "the aliasing graph compiles");
+        StartupReport::Line("  a @ %.0f MB, b @ %.0f MB, c @ %.0f MB | heap %.0f MB for %.0f MB of transients\n",
+            g.GetTransientOffset(a) / (double)MB, g.GetTransientOffset(b) / (double)MB, g.GetTransientOffset(c) / (double)MB,
+            g.GetHeapSize() / (double)MB, g.GetTransientBytes() / (double)MB);
+        expect(g.GetTransientOffset(a) == g.GetTransientOffset(b) && g.IsAliased(a) && g.IsAliased(b) && !g.IsAliased(c),
+            "a and b share memory, c does not");
+        expect(g.GetHeapSize() == 24 * MB, "the heap holds one of a and b plus c");
+        expect(hasAliasing(g.GetBarriers(p[0]), a) && hasAliasing(g.GetBarriers(p[2]), b),
+            "a and b start with an aliasing barrier");
+        expect(hasTransition(g.GetBarriers(p[2]), c, RG_ACCESS_DEPTH_WRITE, RG_ACCESS_DEPTH_READ),
+            "c goes from depth write to depth read");
+    }
+
+    // consecutive reads in different states take one transition to their union
+    {
+        StartupReport::Line("\n=== Render graph: merged reads ===\n");
+        RenderGraph g;
+        const unsigned int t = g.CreateTransient("t", 4 * MB, ALIGN);
+        unsigned int p[3];
+        for (unsigned int i = 0; i < 3; ++i) p[i] = g.AddPass(("pass " + std::to_string(i)).c_str());
+        g.Use(p[0], t, RG_ACCESS_RENDER_TARGET);
+        g.Use(p[1], t, RG_ACCESS_SHADER_READ);
+        g.Use(p[2], t, RG_ACCESS_COPY_SOURCE);
+
+        expect(g.Compile(), "the read graph compiles");
+        const unsigned int reads = RG_ACCESS_SHADER_READ | RG_ACCESS_COPY_SOURCE;
+        StartupReport::Line("  pass 1: %s -> %s\n", AccessName(RG_ACCESS_RENDER_TARGET).c_str(), AccessName(reads).c_str());
+        expect(g.GetBarriers(p[1]).size() == 1 && hasTransition(g.GetBarriers(p[1]), t, RG_ACCESS_RENDER_TARGET, reads),
+            "the first read goes to both read states");
+        expect(g.GetBarriers(p[2]).empty(), "the second read needs no barrier");
+        expect(hasTransition(g.GetBarriers(p[0]), t, reads, RG_ACCESS_RENDER_TARGET), "the next frame starts from the reads");
+    }
+
+    // graphs the compiler has to refuse
+    {
+        StartupReport::Line("\n=== Render graph: rejected graphs ===\n");
+        auto expectRejected = [&expect](RenderGraph& g, const char* what) {
+            std::string err;
+            const bool isCompiled = g.Compile(&err);
+            StartupReport::Line("  %s: %s\n", what, isCompiled ? "compiled" : err.c_str());
+            expect(!isCompiled, what);
+        };
+
+        RenderGraph readFirst;
+        unsigned int t = readFirst.CreateTransient("t", MB, ALIGN);
+        readFirst.Use(readFirst.AddPass("p"), t, RG_ACCESS_SHADER_READ);
+        expectRejected(readFirst, "a transient read before it is written");
+
+        RenderGraph readWrite;
+        t = readWrite.CreateTransient("t", MB, ALIGN);
+        unsigned int p = readWrite.AddPass("p");
+        readWrite.Use(p, t, RG_ACCESS_RENDER_TARGET);
+        readWrite.Use(p, t, RG_ACCESS_SHADER_READ);
+        expectRejected(readWrite, "a write and a read in one pass");
+
+        RenderGraph unused;
+        unused.CreateTransient("t", MB, ALIGN);
+        unused.AddPass("p");
+        expectRejected(unused, "a transient nobody uses");
+
+        RenderGraph present;
+        const unsigned int bb = present.ImportResource("back buffer", RG_ACCESS_PRESENT, RG_ACCESS_PRESENT);
+        present.Use(present.AddPass("p"), bb, RG_ACCESS_PRESENT);
+        expectRejected(present, "present inside a pass");
+    }
+
+    return expect.Finish("render graph");
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// How a pass touches a resource. Reads may be combined; a write stands alone. The device side maps
+// each bit to a D3D12 resource state.
+enum RenderGraphAccess {
+    RG_ACCESS_PRESENT = 0,              // swap chain; only as the state an imported resource enters or leaves in
+    RG_ACCESS_RENDER_TARGET = 1 << 0,
+    RG_ACCESS_DEPTH_WRITE = 1 << 1,
+    RG_ACCESS_COPY_DEST = 1 << 2,
+    RG_ACCESS_DEPTH_READ = 1 << 3,
+    RG_ACCESS_SHADER_READ = 1 << 4,     // pixel shader SRV
+    RG_ACCESS_COPY_SOURCE = 1 << 5,
+};
+static const unsigned int RG_ACCESS_WRITE_MASK = RG_ACCESS_RENDER_TARGET | RG_ACCESS_DEPTH_WRITE | RG_ACCESS_COPY_DEST;
+
+enum RenderGraphBarrierType { RG_BARRIER_TRANSITION, RG_BARRIER_ALIASING };
+
+// One barrier of a compiled graph. Aliasing barriers activate a transient whose memory another
+// transient used in between; before/after are unused for them.
+struct RenderGraphBarrier {
+    RenderGraphBarrierType  type;
+    unsigned int            resource;
+    unsigned int            before;
+    unsigned int            after;
+};
+
+// Frame graph of passes and the resources they read and write. Passes are declared in the order they
+// run, each with the access it needs to every resource it touches; Compile derives the transitions
+// and places the transient resources in one heap.
+//
+// Transitions are batched per pass, so a pass starts with one ResourceBarrier call. A resource going
+// to a read state goes straight to the union of the reads up to its next write, so consecutive readers
+// need no further barrier.
+//
+// Transients live in a heap shared by every frame: frames run on one queue, and the transition or
+// aliasing barrier in front of a transient's first use orders it after the previous frame's last one.
+// Their contents do not survive the frame, so their first use has to be a write that initialises them
+// (a clear). Two transients whose uses do not overlap share memory and get an aliasing barrier before
+// their first use. Between frames a transient stays in the state of its last use; GetInitialAccess is
+// the state to create it in.
+//
+// Knows nothing about the device, so the compiler runs under SelfTest without one.
+class RenderGraph {
+public:
+    RenderGraph() = default;
+
+    // A resource owned outside the graph (the back buffer), in accessBegin when the frame starts and
+    // returned to accessEnd after the last pass.
+    unsigned int ImportResource(const char* name, unsigned int accessBegin, unsigned int accessEnd);
+    // A resource the graph places; size and alignment as the device reports them.
+    unsigned int CreateTransient(const char* name, uint64_t size, uint64_t alignment);
+    unsigned int AddPass(const char* name);
+    // Pass pass touches resource with access; several calls for the same pair are combined.
+    void Use(unsigned int pass, unsigned int resource, unsigned int access);
+
+    // Returns false and fills err on a graph it cannot schedule: a write combined with another access in
+    // one pass, a transient read before it is written or never used, PRESENT inside a pass.
+    bool Compile(std::string* err = nullptr);
+
+    unsigned int GetResourceCount() const { return static_cast<unsigned int>(m_listResources.size()); }
+    unsigned int GetPassCount() const { return static_cast<unsigned int>(m_listPasses.size()); }
+    const char* GetResourceName(unsigned int resource) const { return m_listResources[resource].name.c_str(); }
+    const char* GetPassName(unsigned int pass) const { return m_listPasses[pass].name.c_str(); }
+    bool IsTransient(unsigned int resource) const { return m_listResources[resource].isTransient; }
+
+    // After Compile. Barriers recorded at the start of pass, and after the last pass.
+    const std::vector<RenderGraphBarrier>& GetBarriers(unsigned int pass) const { return m_listPasses[pass].barriers; }
+    const std::vector<RenderGraphBarrier>& GetFinalBarriers() const { return m_listFinalBarriers; }
+    unsigned int GetInitialAccess(unsigned int resource) const { return m_listResources[resource].accessInitial; }
+    uint64_t GetTransientOffset(unsigned int resource) const { return m_listResources[resource].offset; }
+    bool IsAliased(unsigned int resource) const { return m_listResources[resource].isAliased; }
+    // Bytes of the transient heap, and what the transients would take without aliasing.
+    uint64_t GetHeapSize() const { return m_sizeHeap; }
+    uint64_t GetTransientBytes() const;
+
+    // Compiles the scene's frame graph and a few made-up ones and checks the barriers, the placement and
+    // the rejected graphs. Prints what it checks. Needs no device.
+    static bool SelfTest();
+
+private:
+    struct Resource {
+        std::string             name;
+        bool                    isTransient = false;
+        unsigned int            accessBegin = RG_ACCESS_PRESENT;
+        unsigned int            accessEnd = RG_ACCESS_PRESENT;
+        uint64_t                size = 0;
+        uint64_t                alignment = 1;
+        // compiled
+        unsigned int            accessInitial = RG_ACCESS_PRESENT;
+        unsigned int            firstPass = 0;
+        unsigned int            lastPass = 0;
+        uint64_t                offset = 0;
+        bool                    isAliased = false;
+    };
+
+    struct PassUse {
+        unsigned int            resource;
+        unsigned int            access;
+    };
+
+    struct Pass {
+        std::string                         name;
+        std::vector<PassUse>                listUses;
+        std::vector<RenderGraphBarrier>     barriers;     // compiled
+    };
+
+    bool Fail(std::string* err, const std::string& msg) const;
+    void PlaceTransients();
+
+    std::vector<Resource>               m_listResources;
+    std::vector<Pass>                   m_listPasses;
+    std::vector<RenderGraphBarrier>     m_listFinalBarriers;
+    uint64_t                            m_sizeHeap = 0;
+};
@@ -31,7 +31,8 @@ cbuffer FrameCB : register(b1)
 Texture2D<float4> hmTex : register(t0); // heightmap
 Texture2D<float4> dispTex : register(t1); // normal map (RGB) + paint mask (A)
 Texture2D<float> shTex : register(t2);
-Texture2DArray<float4> detTex : register(t3);
+Texture2DArray<float4> detTex : register(t3); //   4-7
+Texture2DArray<float2> detNrm : register(t4); //   0-3, BC5 ( xy)
 
 SamplerState hmSamp : register(s0);
 SamplerComparisonState shSamp : register(s2);
@@ -82,6 +83,20 @@ float3 perturbN(float3 N, float3 V, float2 uv, Texture2D tex, SamplerState smp)
     return normalize(mul(map, TBN));
 }
 
+//   : 0-3   (z ), 4-7  
+//    ,  [branch]  Sample 
+float4 detSample(float2 uv, float idx)
+{
+    float2 dx = ddx(uv), dy = ddy(uv);
+    [branch] if (idx < 3.5f)
+    {
+        float2 xy = detNrm.SampleGrad(dispSamp, float3(uv, idx), dx, dy) * 2.0f - 1.0f;
+        float z = sqrt(saturate(1.0f - dot(xy, xy)));
+        return float4(float3(xy, z) * 0.5f + 0.5f, 1.0f);
+    }
+    return detTex.SampleGrad(dispSamp, float3(uv, idx - 4.0f), dx, dy);
+}
+
 //  
 float4 sampleTri(float3 uvw, float3 N, float idx)
 {
@@ -89,9 +104,9 @@ float4 sampleTri(float3 uvw, float3 N, float idx)
     float3 w = pow(an, 8.0);
     w /= (w.x + w.y + w.z);
 
-    float4 tx = detTex.Sample(dispSamp, float3(uvw.yz, idx));
-    float4 ty = detTex.Sample(dispSamp, float3(uvw.xz, idx));
-    float4 tz = detTex.Sample(dispSamp, float3(uvw.xy, idx));
+    float4 tx = detSample(uvw.yz, idx);
+    float4 ty = detSample(uvw.xz, idx);
+    float4 tz = detSample(uvw.xy, idx);
     return tx * w.x + ty * w.y + tz * w.z;
 }
 
@@ -116,25 +131,25 @@ float4 getTexHeightPlanar(float height, float3 uvw, float low, float med, float
 
     if (height < lowStart)
     {
-        c = detTex.Sample(dispSamp, float3(uvw.xy, low));
+        c = detSample(uvw.xy, low);
     }
     else if (height < transition)
     {
-        float4 c1 = detTex.Sample(dispSamp, float3(uvw.xy, low));
-        float4 c2 = detTex.Sample(dispSamp, float3(uvw.xy, med));
+        float4 c1 = detSample(uvw.xy, low);
+        float4 c2 = detSample(uvw.xy, med);
         float blend = (height - lowStart) / (transition - lowStart);
         c = blendTex(c1, 1 - blend, c2, blend);
     }
     else if (height < highEnd)
     {
-        float4 c1 = detTex.Sample(dispSamp, float3(uvw.xy, med));
-        float4 c2 = detTex.Sample(dispSamp, float3(uvw.xy, high));
+        float4 c1 = detSample(uvw.xy, med);
+        float4 c2 = detSample(uvw.xy, high);
         float blend = (height - transition) / (highEnd - transition);
         c = blendTex(c1, 1 - blend, c2, blend);
     }
     else
     {
-        c = detTex.Sample(dispSamp, float3(uvw.xy, high));
+        c = detSample(uvw.xy, high);
     }
     return c;
 }
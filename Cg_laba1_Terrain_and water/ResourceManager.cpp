@@ -1,13 +1,26 @@
 #include "ResourceManager.h"
+#include "LoadDDS.h"
+#include "StartupReport.h"
+#include "TextureCache.h"
+#include "JobSystem.h"
+#include "Counters.h"
 #include "lodepng.h"
-#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <string>
+#include <thread>
 #include <vector>
 #include <DirectXTex.h>
 
 using namespace DirectX;
 
+//   ,      
+static std::atomic<bool> s_isTrustedAssets{ false };
+
 ResourceManager::ResourceManager(Device* d,
     unsigned int numRTVs, unsigned int numDSVs,
     unsigned int numCBVSRVUAVs, unsigned int numSamplers)
@@ -16,19 +29,15 @@ ResourceManager::ResourceManager(Device* d,
     m_numCBVSRVUAVs(numCBVSRVUAVs), m_numSamplers(numSamplers),
     m_pheapRTV(nullptr), m_pheapDSV(nullptr),
     m_pheapCBVSRVUAV(nullptr), m_pheapSampler(nullptr),
-    m_pCmdAllocator(nullptr), m_pCmdList(nullptr),
-    m_pFence(nullptr), m_pUpload(nullptr),
+    m_pFence(nullptr),
     m_hdlFenceEvent(nullptr),
-    m_valFence(0), m_iUpload(0),
+    m_idOwnerThread(std::this_thread::get_id()),
+    m_valFence(0),
     m_indexFirstFreeSlotRTV(-1), m_indexFirstFreeSlotDSV(-1),
     m_indexFirstFreeSlotCBVSRVUAV(-1), m_indexFirstFreeSlotSampler(-1),
     m_sizeRTVHeapDesc(0), m_sizeDSVHeapDesc(0),
     m_sizeCBVSRVUAVHeapDesc(0), m_sizeSamplerHeapDesc(0)
 {
-    m_pDev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, m_pCmdAllocator);
-    m_pDev->CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE_DIRECT, m_pCmdAllocator, m_pCmdList);
-    m_pCmdList->Close();
-
     m_pDev->CreateFence(m_valFence, D3D12_FENCE_FLAG_NONE, m_pFence);
     m_hdlFenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
     if (!m_hdlFenceEvent) throw GFX_Exception("ResourceManager::ResourceManager: CreateEvent failed.");
@@ -73,40 +82,27 @@ ResourceManager::ResourceManager(Device* d,
     m_sizeCBVSRVUAVHeapDesc = m_pDev->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
     m_sizeSamplerHeapDesc = m_pDev->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER);
 
-    //  upload- (ring)
-    D3D12_RESOURCE_DESC   upDesc = CD3DX12_RESOURCE_DESC::Buffer(DEFAULT_UPLOAD_BUFFER_SIZE);
-    D3D12_HEAP_PROPERTIES upProps = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-
-    m_pDev->CreateCommittedResource(
-        m_pUpload,
-        &upDesc,
-        &upProps,
-        D3D12_HEAP_FLAG_NONE,
-        D3D12_RESOURCE_STATE_GENERIC_READ,
-        nullptr
-    );
-    m_iUpload = 0;
+    //      :      
+    GetUploadContext();
 }
 
 ResourceManager::~ResourceManager() {
-    if (m_pUpload) {
-        WaitForGPU();
-        m_pUpload->Release();
-        m_pUpload = nullptr;
-    }
+    if (!m_listPendingReleases.empty()) FlushReleases();
+    //       
+    m_mapUploadContexts.clear();
+    WaitForGPU();
 
     m_pDev = nullptr;
 
     if (m_hdlFenceEvent) { CloseHandle(m_hdlFenceEvent); m_hdlFenceEvent = nullptr; }
     if (m_pFence) { m_pFence->Release(); m_pFence = nullptr; }
-    if (m_pCmdAllocator) { m_pCmdAllocator->Release(); m_pCmdAllocator = nullptr; }
-    if (m_pCmdList) { m_pCmdList->Release(); m_pCmdList = nullptr; }
 
-    while (!m_listFileData.empty()) {
-        unsigned char* p = m_listFileData.back();
-        if (p) delete[] p;
-        m_listFileData.pop_back();
-    }
+    //     ImageBuffer,    
+    m_mapPendingFiles.clear();
+    m_listUnclaimedFiles.clear();
+    m_listRetiringFiles.clear();
+    m_listFileData.clear();
+
     while (!m_listResources.empty()) {
         ID3D12Resource* r = m_listResources.back();
         if (r) r->Release();
@@ -147,36 +143,66 @@ void ResourceManager::AddDSV(ID3D12Resource* tex, D3D12_DEPTH_STENCIL_VIEW_DESC*
 
 void ResourceManager::AddCBV(D3D12_CONSTANT_BUFFER_VIEW_DESC* desc,
     D3D12_CPU_DESCRIPTOR_HANDLE& handleCPU, D3D12_GPU_DESCRIPTOR_HANDLE& handleGPU) {
-    if (m_indexFirstFreeSlotCBVSRVUAV < 0 || m_indexFirstFreeSlotCBVSRVUAV >= (int)m_numCBVSRVUAVs) {
-        throw GFX_Exception("CBV/SRV/UAV heap is full.");
-    }
-    handleCPU = CD3DX12_CPU_DESCRIPTOR_HANDLE(
-        m_pheapCBVSRVUAV->GetCPUDescriptorHandleForHeapStart(),
-        m_indexFirstFreeSlotCBVSRVUAV, m_sizeCBVSRVUAVHeapDesc
-    );
-    handleGPU = CD3DX12_GPU_DESCRIPTOR_HANDLE(
-        m_pheapCBVSRVUAV->GetGPUDescriptorHandleForHeapStart(),
-        m_indexFirstFreeSlotCBVSRVUAV, m_sizeCBVSRVUAVHeapDesc
-    );
+    AllocateCBVSRVUAVRange(1, handleCPU, handleGPU);
     m_pDev->CreateCBV(desc, handleCPU);
-    ++m_indexFirstFreeSlotCBVSRVUAV;
 }
 
 void ResourceManager::AddSRV(ID3D12Resource* tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc,
     D3D12_CPU_DESCRIPTOR_HANDLE& handleCPU, D3D12_GPU_DESCRIPTOR_HANDLE& handleGPU) {
-    if (m_indexFirstFreeSlotCBVSRVUAV < 0 || m_indexFirstFreeSlotCBVSRVUAV >= (int)m_numCBVSRVUAVs) {
-        throw GFX_Exception("CBV/SRV/UAV heap is full.");
+    AllocateCBVSRVUAVRange(1, handleCPU, handleGPU);
+    m_pDev->CreateSRV(tex, desc, handleCPU);
+}
+
+void ResourceManager::UpdateSRV(ID3D12Resource* tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc,
+    D3D12_CPU_DESCRIPTOR_HANDLE handleCPU) {
+    m_pDev->CreateSRV(tex, desc, handleCPU);
+}
+
+int ResourceManager::TakeFreeCBVSRVUAV(unsigned int count) {
+    //     
+    for (size_t r = 0; r < m_listFreeCBVSRVUAV.size(); ++r) {
+        DescriptorRange& range = m_listFreeCBVSRVUAV[r];
+        if (range.count < count) continue;
+        const int first = (int)range.first;
+        range.first += count;
+        range.count -= count;
+        if (!range.count) m_listFreeCBVSRVUAV.erase(m_listFreeCBVSRVUAV.begin() + r);
+        return first;
+    }
+    return -1;
+}
+
+//   CBV/SRV/UAV,   fence
+static Counter& CounterDescriptors() {
+    static Counter& c = CounterRegistry::Get().Register("descriptors in use", COUNTER_GAUGE);
+    return c;
+}
+
+void ResourceManager::AllocateCBVSRVUAVRange(unsigned int count, D3D12_CPU_DESCRIPTOR_HANDLE& handleCPU,
+    D3D12_GPU_DESCRIPTOR_HANDLE& handleGPU) {
+    int first = TakeFreeCBVSRVUAV(count);
+    if (first < 0 && m_indexFirstFreeSlotCBVSRVUAV >= 0 &&
+        (unsigned int)m_indexFirstFreeSlotCBVSRVUAV + count <= m_numCBVSRVUAVs) {
+        first = m_indexFirstFreeSlotCBVSRVUAV;
+        m_indexFirstFreeSlotCBVSRVUAV += (int)count;
     }
+    if (first < 0 && !m_listPendingReleases.empty()) {
+        //  ,     fence:  GPU,  
+        ++m_numForcedWaits;
+        FlushReleases();
+        first = TakeFreeCBVSRVUAV(count);
+    }
+    if (first < 0) throw GFX_Exception("CBV/SRV/UAV heap is full.");
+    CounterDescriptors().Add(count);
+
     handleCPU = CD3DX12_CPU_DESCRIPTOR_HANDLE(
         m_pheapCBVSRVUAV->GetCPUDescriptorHandleForHeapStart(),
-        m_indexFirstFreeSlotCBVSRVUAV, m_sizeCBVSRVUAVHeapDesc
+        first, m_sizeCBVSRVUAVHeapDesc
     );
     handleGPU = CD3DX12_GPU_DESCRIPTOR_HANDLE(
         m_pheapCBVSRVUAV->GetGPUDescriptorHandleForHeapStart(),
-        m_indexFirstFreeSlotCBVSRVUAV, m_sizeCBVSRVUAVHeapDesc
+        first, m_sizeCBVSRVUAVHeapDesc
     );
-    m_pDev->CreateSRV(tex, desc, handleCPU);
-    ++m_indexFirstFreeSlotCBVSRVUAV;
 }
 
 void ResourceManager::AddSampler(D3D12_SAMPLER_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE& handleCPU) {
@@ -192,6 +218,13 @@ void ResourceManager::AddSampler(D3D12_SAMPLER_DESC* desc, D3D12_CPU_DESCRIPTOR_
 }
 
 unsigned int ResourceManager::AddExistingResource(ID3D12Resource* tex) {
+    std::lock_guard<std::mutex> lock(m_mtxResources);
+    if (!m_listFreeSlots.empty()) {
+        const unsigned int i = m_listFreeSlots.back();
+        m_listFreeSlots.pop_back();
+        m_listResources[i] = tex;
+        return i;
+    }
     m_listResources.push_back(tex);
     return static_cast<unsigned int>(m_listResources.size() - 1);
 }
@@ -199,124 +232,525 @@ unsigned int ResourceManager::AddExistingResource(ID3D12Resource* tex) {
 unsigned int ResourceManager::NewBuffer(ID3D12Resource*& buffer, D3D12_RESOURCE_DESC* descBuffer,
     D3D12_HEAP_PROPERTIES* props, D3D12_HEAP_FLAGS flags,
     D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) {
+    //    ,    
     m_pDev->CreateCommittedResource(buffer, descBuffer, props, flags, state, clear);
-    m_listResources.push_back(buffer);
-    return static_cast<unsigned int>(m_listResources.size() - 1);
+    return AddExistingResource(buffer);
 }
 
 unsigned int ResourceManager::NewBufferAt(unsigned int i, ID3D12Resource*& buffer, D3D12_RESOURCE_DESC* descBuffer,
     D3D12_HEAP_PROPERTIES* props, D3D12_HEAP_FLAGS flags,
     D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear) {
-    if (i >= m_listResources.size()) throw GFX_Exception("ResourceManager::NewBufferAt: index out of bounds.");
+    {
+        std::lock_guard<std::mutex> lock(m_mtxResources);
+        if (i >= m_listResources.size()) throw GFX_Exception("ResourceManager::NewBufferAt: index out of bounds.");
+    }
     m_pDev->CreateCommittedResource(buffer, descBuffer, props, flags, state, clear);
+
+    std::lock_guard<std::mutex> lock(m_mtxResources);
+    //        
+    if (m_listResources[i]) PushRelease(m_listResources[i], 0, 0);
     m_listResources[i] = buffer;
     return i;
 }
 
-void ResourceManager::UploadToBuffer(unsigned int i, unsigned int numSubResources,
-    D3D12_SUBRESOURCE_DATA* data, D3D12_RESOURCE_STATES finalState) {
-    if (i >= m_listResources.size()) throw GFX_Exception("ResourceManager::UploadToBuffer: index out of bounds.");
+void ResourceManager::ReleaseResource(unsigned int i) {
+    std::lock_guard<std::mutex> lock(m_mtxResources);
+    if (i >= m_listResources.size()) throw GFX_Exception("ResourceManager::ReleaseResource: index out of bounds.");
+    if (!m_listResources[i]) return;
+    PushRelease(m_listResources[i], 0, 0);
+    m_listResources[i] = nullptr;
+    m_listFreeSlots.push_back(i);   // GPU   ,    
+}
 
-    // Reset: allocator -> list
-    if (FAILED(m_pCmdAllocator->Reset())) {
-        throw GFX_Exception("UploadToBuffer: CommandAllocator Reset failed.");
-    }
-    if (FAILED(m_pCmdList->Reset(m_pCmdAllocator, nullptr))) {
-        throw GFX_Exception("UploadToBuffer: CommandList Reset failed.");
+void ResourceManager::ReleaseCBVSRVUAVRange(D3D12_CPU_DESCRIPTOR_HANDLE handleCPU, unsigned int count) {
+    const SIZE_T start = m_pheapCBVSRVUAV->GetCPUDescriptorHandleForHeapStart().ptr;
+    if (handleCPU.ptr < start || (handleCPU.ptr - start) / m_sizeCBVSRVUAVHeapDesc + count > m_numCBVSRVUAVs) {
+        throw GFX_Exception("ResourceManager::ReleaseCBVSRVUAVRange: handle out of bounds.");
     }
+    std::lock_guard<std::mutex> lock(m_mtxResources);
+    PushRelease(nullptr, (unsigned int)((handleCPU.ptr - start) / m_sizeCBVSRVUAVHeapDesc), count);
+}
 
-    // Transition to COPY_DEST
-    D3D12_RESOURCE_BARRIER toCopy =
-        CD3DX12_RESOURCE_BARRIER::Transition(m_listResources[i], finalState, D3D12_RESOURCE_STATE_COPY_DEST);
-    m_pCmdList->ResourceBarrier(1, &toCopy);
+void ResourceManager::PushRelease(ID3D12Resource* res, unsigned int firstDescriptor, unsigned int numDescriptors) {
+    //         (  )
+    m_listPendingReleases.push_back({ m_valFence + 1, res, firstDescriptor, numDescriptors });
+    m_numPeakPending = (std::max)(m_numPeakPending, (unsigned int)m_listPendingReleases.size());
+}
+
+unsigned long long ResourceManager::SignalFrame() {
+    std::lock_guard<std::mutex> lock(m_mtxSubmit);
+    const unsigned long long val = ++m_valFence;
+    m_pDev->SetFence(m_pFence, val);
+    return val;
+}
 
-    UINT64 size = GetRequiredIntermediateSize(m_listResources[i], 0, numSubResources);
-    size = (UINT64)std::pow(2.0, std::ceil(std::log((double)size) / std::log(2.0))); //    2
+void ResourceManager::ProcessReleases() {
+    std::lock_guard<std::mutex> lock(m_mtxResources);
+    if (m_listPendingReleases.empty()) return;
+    const unsigned long long valCompleted = m_pFence->GetCompletedValue();
+
+    size_t n = 0;
+    for (; n < m_listPendingReleases.size() && m_listPendingReleases[n].valFence <= valCompleted; ++n) {
+        const PendingRelease& r = m_listPendingReleases[n];
+        if (r.pRes) {
+            r.pRes->Release();
+            ++m_numReleasedResources;
+            continue;
+        }
+
+        //    ,      
+        auto it = std::lower_bound(m_listFreeCBVSRVUAV.begin(), m_listFreeCBVSRVUAV.end(), r.firstDescriptor,
+            [](const DescriptorRange& range, unsigned int first) { return range.first < first; });
+        it = m_listFreeCBVSRVUAV.insert(it, DescriptorRange{ r.firstDescriptor, r.numDescriptors });
+        if (it + 1 != m_listFreeCBVSRVUAV.end() && it->first + it->count == (it + 1)->first) {
+            it->count += (it + 1)->count;
+            m_listFreeCBVSRVUAV.erase(it + 1);
+        }
+        if (it != m_listFreeCBVSRVUAV.begin() && (it - 1)->first + (it - 1)->count == it->first) {
+            (it - 1)->count += it->count;
+            m_listFreeCBVSRVUAV.erase(it);
+        }
+        m_numReleasedDescriptors += r.numDescriptors;
+        CounterDescriptors().Add(-(long long)r.numDescriptors);
+    }
+    m_listPendingReleases.erase(m_listPendingReleases.begin(), m_listPendingReleases.begin() + n);
+}
 
-    if (size > DEFAULT_UPLOAD_BUFFER_SIZE) {
-        //  upload-
-        ID3D12Resource* tmpUpload = nullptr;
-        D3D12_RESOURCE_DESC   tmpDesc = CD3DX12_RESOURCE_DESC::Buffer(size);
-        D3D12_HEAP_PROPERTIES tmpProps = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+void ResourceManager::FlushReleases() {
+    bool needsSignal = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxResources);
+        needsSignal = !m_listPendingReleases.empty() && m_listPendingReleases.back().valFence > m_valFence;
+    }
+    if (needsSignal) SignalFrame();
+    WaitForGPU();
+    ProcessReleases();
+}
 
-        m_pDev->CreateCommittedResource(
-            tmpUpload, &tmpDesc, &tmpProps,
-            D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr);
+ReleaseQueueStats ResourceManager::GetReleaseQueueStats() const {
+    std::lock_guard<std::mutex> lock(m_mtxResources);
+    ReleaseQueueStats stats{};
+    for (const PendingRelease& r : m_listPendingReleases) {
+        if (r.pRes) ++stats.numPendingResources;
+        else stats.numPendingDescriptors += r.numDescriptors;
+    }
+    stats.numPeakPending = m_numPeakPending;
+    stats.numReleasedResources = m_numReleasedResources;
+    stats.numReleasedDescriptors = m_numReleasedDescriptors;
+    stats.numForcedWaits = m_numForcedWaits;
+    return stats;
+}
 
-        UpdateSubresources(m_pCmdList, m_listResources[i], tmpUpload, 0, 0, numSubResources, data);
+void ResourceManager::ReportReleaseQueue() const {
+    const ReleaseQueueStats stats = GetReleaseQueueStats();
+    unsigned int numFree = m_indexFirstFreeSlotCBVSRVUAV >= 0 ? m_numCBVSRVUAVs - m_indexFirstFreeSlotCBVSRVUAV : 0;
+    for (const DescriptorRange& range : m_listFreeCBVSRVUAV) numFree += range.count;
+    StartupReport::Line("Deferred releases: %llu resources and %llu descriptors released, %u resources and %u descriptors "
+        "pending, peak %u entries, %u forced GPU waits; %u of %u CBV/SRV/UAV slots free\n",
+        stats.numReleasedResources, stats.numReleasedDescriptors, stats.numPendingResources,
+        stats.numPendingDescriptors, stats.numPeakPending, stats.numForcedWaits, numFree, m_numCBVSRVUAVs);
+}
 
-        D3D12_RESOURCE_BARRIER toFinal =
-            CD3DX12_RESOURCE_BARRIER::Transition(m_listResources[i], D3D12_RESOURCE_STATE_COPY_DEST, finalState);
-        m_pCmdList->ResourceBarrier(1, &toFinal);
+void ResourceManager::UploadToBuffer(unsigned int i, unsigned int numSubResources,
+    D3D12_SUBRESOURCE_DATA* data, D3D12_RESOURCE_STATES finalState) {
+    UploadToBuffer(i, 0, numSubResources, data, finalState);
+}
 
-        if (FAILED(m_pCmdList->Close())) { tmpUpload->Release(); throw GFX_Exception("UploadToBuffer: CommandList Close failed."); }
+void ResourceManager::UploadToBuffer(unsigned int i, unsigned int firstSubResource, unsigned int numSubResources,
+    D3D12_SUBRESOURCE_DATA* data, D3D12_RESOURCE_STATES finalState) {
+    ID3D12Resource* res = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxResources);
+        if (i >= m_listResources.size()) throw GFX_Exception("ResourceManager::UploadToBuffer: index out of bounds.");
+        res = m_listResources[i];
+    }
 
-        ID3D12CommandList* lists[] = { m_pCmdList };
-        m_pDev->ExecuteCommandLists(lists, _countof(lists));
+    //       ;  ,      
+    UploadContext& ctx = GetUploadContext();
+    ctx.Begin();
+    ctx.Upload(res, firstSubResource, numSubResources, data, finalState);
+    ctx.Submit();
+    SubmitUploads();
+}
 
-        ++m_valFence;
-        m_pDev->SetFence(m_pFence, m_valFence);
+UploadContext& ResourceManager::GetUploadContext() {
+    const std::thread::id id = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(m_mtxUploadContexts);
+    std::unique_ptr<UploadContext>& ctx = m_mapUploadContexts[id];
+    if (!ctx) {
+        ctx.reset(new UploadContext(this, m_pDev,
+            id == m_idOwnerThread ? DEFAULT_UPLOAD_BUFFER_SIZE : WORKER_UPLOAD_BUFFER_SIZE));
+    }
+    return *ctx;
+}
 
-        WaitForGPU();
-        tmpUpload->Release();
+void ResourceManager::ReleaseUploadContext() {
+    std::unique_ptr<UploadContext> ctx;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxUploadContexts);
+        auto it = m_mapUploadContexts.find(std::this_thread::get_id());
+        if (it == m_mapUploadContexts.end()) return;
+        ctx = std::move(it->second);
+        m_mapUploadContexts.erase(it);
     }
-    else {
-        //    ring upload-
-        if (size > DEFAULT_UPLOAD_BUFFER_SIZE - m_iUpload) {
-            if (m_pFence->GetCompletedValue() < m_valFence) {
-                WaitForGPU();
-            }
-            m_iUpload = 0;
-        }
+    //      ,    
+    ctx.reset();
+}
 
-        UpdateSubresources(m_pCmdList, m_listResources[i], m_pUpload, m_iUpload, 0, numSubResources, data);
-        m_iUpload += (UINT)size;
+void ResourceManager::QueueUpload(CommandList* list, std::atomic<unsigned long long>* valFence) {
+    UploadSubmission s;
+    s.pList = list;
+    s.pValFence = valFence;
+    m_queueUploads.Push(s);
+}
 
-        D3D12_RESOURCE_BARRIER toFinal =
-            CD3DX12_RESOURCE_BARRIER::Transition(m_listResources[i], D3D12_RESOURCE_STATE_COPY_DEST, finalState);
-        m_pCmdList->ResourceBarrier(1, &toFinal);
+void ResourceManager::SubmitUploads() {
+    std::lock_guard<std::mutex> lock(m_mtxSubmit);
+    m_listSubmitLists.clear();
+    m_listSubmitFences.clear();
+    UploadSubmission s;
+    while (m_queueUploads.TryPop(s)) {
+        m_listSubmitLists.push_back(s.pList);
+        m_listSubmitFences.push_back(s.pValFence);
+    }
+    if (m_listSubmitLists.empty()) return;
 
-        if (FAILED(m_pCmdList->Close())) {
-            throw GFX_Exception("UploadToBuffer: CommandList Close failed.");
-        }
+    m_pDev->ExecuteCommandLists(m_listSubmitLists.data(), (unsigned int)m_listSubmitLists.size());
+    const unsigned long long val = ++m_valFence;
+    m_pDev->SetFence(m_pFence, val);
+    for (std::atomic<unsigned long long>* f : m_listSubmitFences) f->store(val, std::memory_order_release);
+}
+
+void ResourceManager::UploadMipChain(unsigned int i, unsigned int firstSubResource, const MipChain& mips,
+    D3D12_RESOURCE_STATES finalState) {
+    std::vector<D3D12_SUBRESOURCE_DATA> data(mips.GetLevelCount());
+    for (unsigned int l = 0; l < mips.GetLevelCount(); ++l) {
+        data[l].pData = mips.GetLevel(l);
+        data[l].RowPitch = mips.GetWidth(l) * 4;          // RGBA8
+        data[l].SlicePitch = data[l].RowPitch * mips.GetHeight(l);
+    }
 
-        ID3D12CommandList* lists[] = { m_pCmdList };
-        m_pDev->ExecuteCommandLists(lists, _countof(lists));
+    //  ,      :  4k-  
+    //      
+    ID3D12Resource* res = GetResource(i);
+    UploadContext& ctx = GetUploadContext();
+    ctx.Begin();
+    ctx.Upload(res, firstSubResource, 1, data.data(), finalState);
+    if (data.size() > 1) {
+        ctx.Upload(res, firstSubResource + 1, (unsigned int)data.size() - 1, data.data() + 1, finalState);
+    }
+    ctx.Submit();
+    SubmitUploads();
+}
 
-        ++m_valFence;
-        m_pDev->SetFence(m_pFence, m_valFence);
+void ResourceManager::UploadBCChain(unsigned int i, unsigned int firstSubResource, const BCChain& chain,
+    D3D12_RESOURCE_STATES finalState, unsigned int firstLevel) {
+    if (firstLevel >= chain.GetLevelCount()) throw GFX_Exception("ResourceManager::UploadBCChain: firstLevel out of range.");
+    std::vector<D3D12_SUBRESOURCE_DATA> data(chain.GetLevelCount() - firstLevel);
+    for (unsigned int l = firstLevel; l < chain.GetLevelCount(); ++l) {
+        D3D12_SUBRESOURCE_DATA& sub = data[l - firstLevel];
+        sub.pData = chain.GetLevel(l);
+        sub.RowPitch = chain.GetRowPitch(l);              //   4x4
+        sub.SlicePitch = sub.RowPitch * chain.GetRowCount(l);
     }
+
+    //  BC  4-8   RGBA8     upload-
+    UploadToBuffer(i, firstSubResource, (unsigned int)data.size(), data.data(), finalState);
 }
 
 void ResourceManager::WaitForGPU() {
+    //  ,   ,  
+    SubmitUploads();
     if (FAILED(m_pFence->SetEventOnCompletion(m_valFence, m_hdlFenceEvent))) {
         throw GFX_Exception("ResourceManager::WaitForGPU: SetEventOnCompletion failed.");
     }
     WaitForSingleObject(m_hdlFenceEvent, INFINITE);
 }
 
+void ResourceManager::WaitForFence(unsigned long long val) {
+    if (m_pFence->GetCompletedValue() >= val) return;
+    if (FAILED(m_pFence->SetEventOnCompletion(val, m_hdlFenceEvent))) {
+        throw GFX_Exception("ResourceManager::WaitForFence: SetEventOnCompletion failed.");
+    }
+    WaitForSingleObject(m_hdlFenceEvent, INFINITE);
+}
+
 ID3D12Resource* ResourceManager::GetResource(unsigned int index) {
+    std::lock_guard<std::mutex> lock(m_mtxResources);
     if (index >= m_listResources.size()) throw GFX_Exception("ResourceManager::GetResource: index out of bounds.");
     return m_listResources[index];
 }
 
+ResourceManager::DecodedFile ResourceManager::DecodeFile(const std::string& fn, bool useCache) {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    DecodedFile file;
+
+    TextureCache& cache = TextureCache::Get();
+    uint64_t key = useCache ? cache.MakeKey(fn, "png-rgba8") : 0;
+    TextureCacheEntry entry;
+    if (key && cache.Load(key, entry)) {
+        if (entry.format == DXGI_FORMAT_R8G8B8A8_UNORM && entry.size == (uint64_t)entry.w * entry.h * 4) {
+            file.image = ImageBuffer::FromView(entry.data, entry.view, (size_t)entry.size);
+            file.w = entry.w;
+            file.h = entry.h;
+        }
+        else {
+            TextureCache::ReleaseView(entry.view);
+        }
+    }
+    if (!file.image) {
+        unsigned char* data = nullptr;
+        file.error = DecodePNG(fn, !s_isTrustedAssets.load(std::memory_order_relaxed), &data, &file.w, &file.h);
+        file.image = ImageBuffer::FromMalloc(data, (size_t)file.w * file.h * 4);
+        if (!file.error && key) {
+            cache.Store(key, data, (uint64_t)file.w * file.h * 4, file.w, file.h, DXGI_FORMAT_R8G8B8A8_UNORM, 1);
+        }
+    }
+
+    file.msDecode = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+    return file;
+}
+
+unsigned int ResourceManager::DecodePNG(const std::string& fn, bool verifyChecksums, unsigned char** out,
+    unsigned int* w, unsigned int* h) {
+    unsigned char* png = nullptr;
+    size_t sizePng = 0;
+    *out = nullptr;
+    unsigned int error = lodepng_load_file(&png, &sizePng, fn.c_str());
+    if (!error) {
+        LodePNGState state;
+        lodepng_state_init(&state);
+        state.info_raw.colortype = LCT_RGBA;
+        state.info_raw.bitdepth = 8;
+        state.decoder.ignore_crc = verifyChecksums ? 0 : 1;
+        state.decoder.zlibsettings.ignore_adler32 = verifyChecksums ? 0 : 1;
+        error = lodepng_decode(out, w, h, &state, png, sizePng);
+        lodepng_state_cleanup(&state);
+    }
+    free(png);
+    return error;
+}
+
+void ResourceManager::SetTrustedAssets(bool isTrusted) {
+    s_isTrustedAssets.store(isTrusted, std::memory_order_relaxed);
+}
+
+unsigned int ResourceManager::AddFileData(ImageBuffer&& image) {
+    m_sizeCPUUsage += image.GetSize();
+    m_sizeCPUPeak = (std::max)(m_sizeCPUPeak, m_sizeCPUUsage);
+    m_listFileData.push_back(std::move(image));
+    const unsigned int index = static_cast<unsigned int>(m_listFileData.size() - 1);
+
+    if (m_sizeCPUUsage > m_sizeCPUBudget) {
+        //  ,    GPU;    ,    - 
+        RetireFileData();
+        if (m_sizeCPUUsage > m_sizeCPUBudget && !m_listRetiringFiles.empty()) {
+            WaitForGPU();
+            RetireFileData();
+        }
+        if (m_sizeCPUUsage > m_sizeCPUBudget && !m_isOverBudget) {
+            StartupReport::Line("ResourceManager: CPU image memory %.1f MB is over the %.1f MB budget\n",
+                m_sizeCPUUsage / 1048576.0, m_sizeCPUBudget / 1048576.0);
+        }
+    }
+    m_isOverBudget = m_sizeCPUUsage > m_sizeCPUBudget;
+    return index;
+}
+
+void ResourceManager::FreeFileData(unsigned int i) {
+    m_sizeCPUUsage -= m_listFileData[i].GetSize();
+    m_listFileData[i].Reset();
+}
+
+void ResourceManager::BenchmarkTextureCache(const std::vector<std::string>& files) {
+    using clock = std::chrono::high_resolution_clock;
+    TextureCache& cache = TextureCache::Get();
+
+    //        (),     
+    auto run = [](const std::string& fn, bool useCache, uint64_t& hash) {
+        auto t0 = clock::now();
+        DecodedFile f = DecodeFile(fn, useCache);
+        hash = f.error ? 0 : HashBytes(f.image.Get(), (size_t)f.w * f.h * 4);
+        return std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+    };
+
+    StartupReport::Line("\n=== Texture cache benchmark (%zu files) ===\n", files.size());
+    StartupReport::Line("  %-40s %10s %10s %10s %6s\n", "file", "decode", "cold", "warm", "match");
+
+    double sumDecode = 0.0, sumCold = 0.0, sumWarm = 0.0;
+    for (const std::string& fn : files) {
+        cache.Remove(cache.MakeKey(fn, "png-rgba8"));
+
+        uint64_t hashDecode = 0, hashCold = 0, hashWarm = 0;
+        double msDecode = run(fn, false, hashDecode);
+        double msCold = run(fn, true, hashCold);
+        double msWarm = run(fn, true, hashWarm);
+
+        StartupReport::Line("  %-40s %8.2fms %8.2fms %8.2fms %6s\n", fn.c_str(), msDecode, msCold, msWarm,
+            (hashDecode && hashDecode == hashCold && hashCold == hashWarm) ? "yes" : "NO");
+        sumDecode += msDecode;
+        sumCold += msCold;
+        sumWarm += msWarm;
+    }
+    StartupReport::Line("  total: decode %.2f ms | cold %.2f ms | warm %.2f ms | speedup x%.1f\n",
+        sumDecode, sumCold, sumWarm, sumWarm > 0.0 ? sumDecode / sumWarm : 0.0);
+}
+
+void ResourceManager::BenchmarkPNGDecode(const std::vector<std::string>& files) {
+    using clock = std::chrono::high_resolution_clock;
+    static const int NUM_RUNS = 5;
+
+    //   NUM_RUNS ; MB/s    RGBA8 
+    auto run = [](const std::string& fn, bool verify, uint64_t& hash, uint64_t& bytes) {
+        double best = 0.0;
+        for (int r = 0; r < NUM_RUNS; ++r) {
+            unsigned char* data = nullptr;
+            unsigned int w = 0, h = 0;
+            auto t0 = clock::now();
+            unsigned int error = DecodePNG(fn, verify, &data, &w, &h);
+            double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+            if (r == 0 || ms < best) best = ms;
+            bytes = error ? 0 : (uint64_t)w * h * 4;
+            hash = error ? 0 : HashBytes(data, (size_t)bytes);
+            free(data);
+        }
+        return best;
+    };
+
+    StartupReport::Line("\n=== PNG decode benchmark (%zu files, best of %d) ===\n", files.size(), NUM_RUNS);
+    StartupReport::Line("  %-40s %10s %10s %10s %6s\n", "file", "checked", "trusted", "MB/s", "match");
+
+    double sumChecked = 0.0, sumTrusted = 0.0;
+    uint64_t sumBytes = 0;
+    for (const std::string& fn : files) {
+        uint64_t hashChecked = 0, hashTrusted = 0, bytes = 0;
+        double msChecked = run(fn, true, hashChecked, bytes);
+        double msTrusted = run(fn, false, hashTrusted, bytes);
+
+        StartupReport::Line("  %-40s %8.2fms %8.2fms %10.1f %6s\n", fn.c_str(), msChecked, msTrusted,
+            msChecked > 0.0 ? bytes / (msChecked * 1000.0) : 0.0,
+            (hashChecked && hashChecked == hashTrusted) ? "yes" : "NO");
+        sumChecked += msChecked;
+        sumTrusted += msTrusted;
+        sumBytes += bytes;
+    }
+    StartupReport::Line("  total: checked %.2f ms (%.1f MB/s) | trusted %.2f ms (%.1f MB/s)\n",
+        sumChecked, sumChecked > 0.0 ? sumBytes / (sumChecked * 1000.0) : 0.0,
+        sumTrusted, sumTrusted > 0.0 ? sumBytes / (sumTrusted * 1000.0) : 0.0);
+}
+
+void ResourceManager::PrefetchFiles(const std::vector<std::string>& files) {
+    // biggest files first, so the longest decode starts immediately and bounds the total
+    std::vector<std::pair<uintmax_t, std::string>> bySize;
+    for (const std::string& fn : files) {
+        if (m_mapPendingFiles.count(fn)) continue;
+        std::error_code ec;
+        uintmax_t sz = std::filesystem::file_size(fn, ec);
+        bySize.emplace_back(ec ? 0 : sz, fn);
+    }
+    std::stable_sort(bySize.begin(), bySize.end(),
+        [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    for (const auto& entry : bySize) {
+        const std::string fn = entry.second;
+        m_mapPendingFiles.emplace(fn, JobSystem::Shared().Submit([fn]() { return DecodeFile(fn); }));
+    }
+}
+
 unsigned int ResourceManager::LoadFile(const char* fn, unsigned int& h, unsigned int& w) {
-    unsigned char* data = nullptr;
-    unsigned error = lodepng_decode32_file(&data, &w, &h, fn);
-    if (error) throw GFX_Exception(("ResourceManager::LoadFile: error loading " + std::string(fn)).c_str());
-    m_listFileData.push_back(data);
-    return static_cast<unsigned int>(m_listFileData.size() - 1);
+    auto tWait = std::chrono::high_resolution_clock::now();
+
+    DecodedFile file;
+    auto pending = m_mapPendingFiles.find(fn);
+    if (pending != m_mapPendingFiles.end()) {
+        file = pending->second.get();
+        m_mapPendingFiles.erase(pending);
+    }
+    else {
+        file = DecodeFile(fn);
+    }
+    double msWait = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tWait).count();
+
+    if (file.error) throw GFX_Exception(("ResourceManager::LoadFile: error loading " + std::string(fn)).c_str());
+    StartupReport::Get().AddFileTiming(fn, file.msDecode, msWait, file.w, file.h, file.image.IsMapped());
+
+    w = file.w;
+    h = file.h;
+    return AddFileData(std::move(file.image));
+}
+
+ImageBuffer ResourceManager::DecodeImage(const char* fn, unsigned int& h, unsigned int& w) {
+    const size_t n = std::strlen(fn);
+    if (n >= 4 && _stricmp(fn + n - 4, ".dds") == 0) {
+        int len = MultiByteToWideChar(CP_UTF8, 0, fn, -1, nullptr, 0);
+        std::wstring ws(len, L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, fn, -1, ws.data(), len);
+        return DecodeDDS_RGBA8(ws.c_str(), h, w);
+    }
+
+    DecodedFile file = DecodeFile(fn);
+    if (file.error) throw GFX_Exception(("ResourceManager::DecodeImage: error loading " + std::string(fn)).c_str());
+    w = file.w;
+    h = file.h;
+    return std::move(file.image);
 }
 
 unsigned char* ResourceManager::GetFileData(unsigned int i) {
     if (i >= m_listFileData.size()) throw GFX_Exception("ResourceManager::GetFileData: index out of bounds.");
-    return m_listFileData[i];
+    return m_listFileData[i].Get();
 }
 
 void ResourceManager::UnloadFileData(unsigned int i) {
     if (i >= m_listFileData.size()) throw GFX_Exception("ResourceManager::UnloadFileData: index out of bounds.");
-    delete[] m_listFileData[i];
-    m_listFileData[i] = nullptr;
+    FreeFileData(i);
+}
+
+void ResourceManager::ReleaseFileDataAfterUpload(unsigned int i) {
+    if (i >= m_listFileData.size()) throw GFX_Exception("ResourceManager::ReleaseFileDataAfterUpload: index out of bounds.");
+    //       ,    fence
+    m_listRetiringFiles.push_back({ m_valFence, i });
+    RetireFileData();
+}
+
+void ResourceManager::RetireFileData() {
+    if (!m_listRetiringFiles.empty()) {
+        const unsigned long long valCompleted = m_pFence->GetCompletedValue();
+        auto it = std::remove_if(m_listRetiringFiles.begin(), m_listRetiringFiles.end(),
+            [&](const RetiringFile& f) {
+                if (f.valFence > valCompleted) return false;
+                FreeFileData(f.index);
+                return true;
+            });
+        m_listRetiringFiles.erase(it, m_listRetiringFiles.end());
+    }
+
+    //  :     future, ImageBuffer  
+    auto it = std::remove_if(m_listUnclaimedFiles.begin(), m_listUnclaimedFiles.end(),
+        [](std::future<DecodedFile>& f) { return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready; });
+    m_listUnclaimedFiles.erase(it, m_listUnclaimedFiles.end());
+}
+
+void ResourceManager::DropUnclaimedPrefetches() {
+    //        PNG   ,    
+    for (auto& pending : m_mapPendingFiles) {
+        m_listUnclaimedFiles.push_back(std::move(pending.second));
+    }
+    m_mapPendingFiles.clear();
+    RetireFileData();
+}
+
+void ResourceManager::ReportCPUMemory() const {
+    unsigned long long sizeMapped = 0;
+    unsigned int numResident = 0;
+    for (const ImageBuffer& image : m_listFileData) {
+        if (!image) continue;
+        ++numResident;
+        if (image.IsMapped()) sizeMapped += image.GetSize();
+    }
+    StartupReport::Line("CPU image memory: %u buffers, %.1f MB resident (%.1f MB mapped from the cache), "
+        "peak %.1f MB, budget %.1f MB, %zu waiting for the GPU, %zu unclaimed prefetches\n",
+        numResident, m_sizeCPUUsage / 1048576.0, sizeMapped / 1048576.0, m_sizeCPUPeak / 1048576.0,
+        m_sizeCPUBudget / 1048576.0, m_listRetiringFiles.size(), m_listUnclaimedFiles.size());
 }
 
 // -------- DDS helpers --------
@@ -324,6 +758,19 @@ void ResourceManager::UnloadFileData(unsigned int i) {
 unsigned int ResourceManager::CreateTextureDDS(const wchar_t* path,
     D3D12_CPU_DESCRIPTOR_HANDLE& cpuSrv, D3D12_GPU_DESCRIPTOR_HANDLE& gpuSrv)
 {
+    //  :   ,        upload-.
+    //      8888 (  MipChain)  BC (  ,  )
+    DDSFile dds;
+    if (dds.Open(path)) {
+        const DXGI_FORMAT fmt = dds.GetFormat();
+        const bool is8888 = fmt == DXGI_FORMAT_R8G8B8A8_UNORM || fmt == DXGI_FORMAT_B8G8R8A8_UNORM ||
+            fmt == DXGI_FORMAT_B8G8R8X8_UNORM;
+        const bool isPlain2D = !dds.Is3D() && dds.GetArraySize() == 1;
+        if (dds.GetMipLevels() > 1 || dds.IsCompressed() || (is8888 && isPlain2D)) {
+            return CreateTextureDDS(dds, cpuSrv, gpuSrv);
+        }
+    }
+
     TexMetadata meta{};
     ScratchImage img;
     HRESULT hr = LoadFromDDSFile(path, DDS_FLAGS_NONE, &meta, img);
@@ -396,6 +843,59 @@ unsigned int ResourceManager::CreateTextureDDS(const wchar_t* path,
     return idx;
 }
 
+unsigned int ResourceManager::CreateTextureDDS(DDSFile& dds,
+    D3D12_CPU_DESCRIPTOR_HANDLE& cpuSrv, D3D12_GPU_DESCRIPTOR_HANDLE& gpuSrv)
+{
+    MipChain mips;
+    const bool isGenerateMips = dds.GetMipLevels() == 1 && !dds.IsCompressed();
+    if (isGenerateMips) {
+        mips.Generate(dds.GetPixels(0), dds.GetWidth(), dds.GetHeight(), MIP_FILTER_BOX, MIP_NONE);
+    }
+    const UINT16 mipLevels = (UINT16)(isGenerateMips ? mips.GetLevelCount() : dds.GetMipLevels());
+
+    D3D12_RESOURCE_DESC desc{};
+    if (dds.Is3D()) {
+        desc = CD3DX12_RESOURCE_DESC::Tex3D(dds.GetFormat(), dds.GetWidth(), dds.GetHeight(), (UINT16)dds.GetDepth(), mipLevels);
+    }
+    else {
+        desc = CD3DX12_RESOURCE_DESC::Tex2D(dds.GetFormat(), dds.GetWidth(), dds.GetHeight(), (UINT16)dds.GetArraySize(), mipLevels);
+    }
+
+    ID3D12Resource* tex = nullptr;
+    CD3DX12_HEAP_PROPERTIES heapDefault(D3D12_HEAP_TYPE_DEFAULT);
+    const D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+    unsigned int idx = NewBuffer(tex, &desc, &heapDefault, D3D12_HEAP_FLAG_NONE, state, nullptr);
+
+    //   : UpdateSubresources     
+    if (isGenerateMips) UploadMipChain(idx, 0, mips, state);
+    else UploadToBuffer(idx, dds.GetSubresourceCount(), dds.GetSubresources(), state);
+
+    D3D12_SHADER_RESOURCE_VIEW_DESC srv{};
+    srv.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    srv.Format = dds.GetFormat();
+
+    if (dds.Is3D()) {
+        srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE3D;
+        srv.Texture3D.MipLevels = mipLevels;
+    }
+    else if (dds.IsCube()) {
+        srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURECUBE;
+        srv.TextureCube.MipLevels = mipLevels;
+    }
+    else if (dds.GetArraySize() > 1) {
+        srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+        srv.Texture2DArray.ArraySize = dds.GetArraySize();
+        srv.Texture2DArray.MipLevels = mipLevels;
+    }
+    else {
+        srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+        srv.Texture2D.MipLevels = mipLevels;
+    }
+
+    AddSRV(tex, &srv, cpuSrv, gpuSrv);
+    return idx;
+}
+
 unsigned int ResourceManager::CreateTextureDDSA(const char* pathA,
     D3D12_CPU_DESCRIPTOR_HANDLE& cpuSrv, D3D12_GPU_DESCRIPTOR_HANDLE& gpuSrv)
 {
@@ -408,39 +908,72 @@ unsigned int ResourceManager::CreateTextureDDSA(const char* pathA,
 unsigned int ResourceManager::LoadDDS_CPU_RGBA8(const wchar_t* path,
     unsigned int& outH, unsigned int& outW)
 {
+    return AddFileData(DecodeDDS_RGBA8(path, outH, outW));
+}
+
+ImageBuffer ResourceManager::DecodeDDS_RGBA8(const wchar_t* path, unsigned int& outH, unsigned int& outW)
+{
+    // 0)  : RGBA8   , BGRA   , BC1/3/5 .
+    //       ,         
+    DDSFile dds;
+    if (dds.Open(path)) {
+        void* view = nullptr;
+        unsigned char* data = dds.DetachRGBA8(view);
+        if (data) {
+            outW = dds.GetWidth();
+            outH = dds.GetHeight();
+            AlphaFromRedIfOpaque(data, size_t(outW) * outH); //    255  A = R
+            const size_t sz = size_t(outW) * outH * 4;
+            return view ? ImageBuffer::FromView(data, view, sz) : ImageBuffer::FromNew(data, sz);
+        }
+    }
+
+    // 1)     DirectXTex,  
+    TextureCache& cache = TextureCache::Get();
+    uint64_t key = cache.MakeKey(path, "dds-rgba8-alphaR");
+    TextureCacheEntry entry;
+    if (key && cache.Load(key, entry)) {
+        if (entry.format == DXGI_FORMAT_R8G8B8A8_UNORM && entry.size == (uint64_t)entry.w * entry.h * 4) {
+            outW = entry.w;
+            outH = entry.h;
+            return ImageBuffer::FromView(entry.data, entry.view, (size_t)entry.size);
+        }
+        TextureCache::ReleaseView(entry.view);
+    }
+
     TexMetadata meta{};
     ScratchImage img;
 
-    // 1)  DDS
+    // 2)  DDS
     HRESULT hr = LoadFromDDSFile(path, DDS_FLAGS_NONE | DDS_FLAGS_ALLOW_LARGE_FILES, &meta, img);
-    if (FAILED(hr)) throw GFX_Exception("LoadDDS_CPU_RGBA8: LoadFromDDSFile failed.");
+    if (FAILED(hr)) throw GFX_Exception("DecodeDDS_RGBA8: LoadFromDDSFile failed.");
 
     const ScratchImage* pSrc = &img;
     ScratchImage tmp;
 
-    // 2) planar -> single plane
+    // 3) planar -> single plane
     if (IsPlanar(meta.format)) {
         hr = ConvertToSinglePlane(img.GetImages(), img.GetImageCount(), meta, tmp);
-        if (FAILED(hr)) throw GFX_Exception("LoadDDS_CPU_RGBA8: ConvertToSinglePlane failed.");
+        if (FAILED(hr)) throw GFX_Exception("DecodeDDS_RGBA8: ConvertToSinglePlane failed.");
         pSrc = &tmp;
         meta = tmp.GetMetadata();
     }
 
-    // 3)  BC*
+    // 4)  BC*
     ScratchImage dec;
     if (IsCompressed(meta.format)) {
         hr = Decompress(pSrc->GetImages(), pSrc->GetImageCount(), meta, DXGI_FORMAT_R8G8B8A8_UNORM, dec);
-        if (FAILED(hr)) throw GFX_Exception("LoadDDS_CPU_RGBA8: Decompress failed.");
+        if (FAILED(hr)) throw GFX_Exception("DecodeDDS_RGBA8: Decompress failed.");
         pSrc = &dec;
         meta = dec.GetMetadata();
     }
 
-    // 4)   RGBA8
+    // 5)   RGBA8
     ScratchImage conv;
     if (meta.format != DXGI_FORMAT_R8G8B8A8_UNORM) {
         hr = Convert(pSrc->GetImages(), pSrc->GetImageCount(), meta,
             DXGI_FORMAT_R8G8B8A8_UNORM, TEX_FILTER_DEFAULT, TEX_THRESHOLD_DEFAULT, conv);
-        if (FAILED(hr)) throw GFX_Exception("LoadDDS_CPU_RGBA8: Convert failed.");
+        if (FAILED(hr)) throw GFX_Exception("DecodeDDS_RGBA8: Convert failed.");
         pSrc = &conv;
         meta = conv.GetMetadata();
     }
@@ -453,25 +986,13 @@ unsigned int ResourceManager::LoadDDS_CPU_RGBA8(const wchar_t* path,
     unsigned char* data = new unsigned char[sz];
     std::memcpy(data, im->pixels, sz);
 
-    // 5)    255   R  A
-    bool alphaOpaque = true;
-    for (size_t y = 0; y < im->height && alphaOpaque; ++y) {
-        const unsigned char* row = data + y * im->rowPitch;
-        for (size_t x = 0; x < im->width; ++x) {
-            if (row[x * 4 + 3] != 255) { alphaOpaque = false; break; }
-        }
-    }
-    if (alphaOpaque) {
-        for (size_t y = 0; y < im->height; ++y) {
-            unsigned char* row = data + y * im->rowPitch;
-            for (size_t x = 0; x < im->width; ++x) {
-                row[x * 4 + 3] = row[x * 4 + 0]; // A = R
-            }
-        }
-    }
+    // 6)    255   R  A
+    AlphaFromRedIfOpaque(data, size_t(outW) * outH);
 
-    m_listFileData.push_back(data);
-    return (unsigned)m_listFileData.size() - 1;
+    if (key && im->rowPitch == (size_t)outW * 4) {
+        cache.Store(key, data, sz, outW, outH, DXGI_FORMAT_R8G8B8A8_UNORM, 1);
+    }
+    return ImageBuffer::FromNew(data, sz);
 }
 
 unsigned int ResourceManager::LoadDDS_CPU_RGBA8A(const char* pathA,
@@ -490,6 +1011,31 @@ unsigned int ResourceManager::LoadDDS_RGBA8(const char* fn, unsigned int& h, uns
     std::wstring ws(n, L'\0');
     MultiByteToWideChar(CP_UTF8, 0, fn, -1, ws.data(), n);
 
+    //  ,      RGBA8 (BGR -> RGB   FORCE_RGB)
+    DDSFile dds;
+    if (dds.Open(ws.c_str())) {
+        void* view = nullptr;
+        unsigned char* data = dds.DetachRGBA8(view);
+        if (data) {
+            w = dds.GetWidth();
+            h = dds.GetHeight();
+            const size_t sz = size_t(w) * h * 4;
+            return AddFileData(view ? ImageBuffer::FromView(data, view, sz) : ImageBuffer::FromNew(data, sz));
+        }
+    }
+
+    TextureCache& cache = TextureCache::Get();
+    uint64_t key = cache.MakeKey(ws.c_str(), "dds-rgba8-forcergb");
+    TextureCacheEntry entry;
+    if (key && cache.Load(key, entry)) {
+        if (entry.format == DXGI_FORMAT_R8G8B8A8_UNORM && entry.size == (uint64_t)entry.w * entry.h * 4) {
+            w = entry.w;
+            h = entry.h;
+            return AddFileData(ImageBuffer::FromView(entry.data, entry.view, (size_t)entry.size));
+        }
+        TextureCache::ReleaseView(entry.view);
+    }
+
     //  DDS
     DirectX::TexMetadata meta{};
     DirectX::ScratchImage src;
@@ -510,6 +1056,8 @@ unsigned int ResourceManager::LoadDDS_RGBA8(const char* fn, unsigned int& h, uns
     unsigned char* data = new unsigned char[sz];
     std::memcpy(data, im->pixels, sz);
 
-    m_listFileData.push_back(data);
-    return (unsigned)m_listFileData.size() - 1;
+    if (key && im->rowPitch == (size_t)w * 4) {
+        cache.Store(key, data, sz, w, h, DXGI_FORMAT_R8G8B8A8_UNORM, 1);
+    }
+    return AddFileData(ImageBuffer::FromNew(data, sz));
 }
@@ -1,18 +1,49 @@
 #pragma once
 #include "Graphics.h"
+#include "BlockCompress.h"
+#include "ImageBuffer.h"
+#include "MPSCQueue.h"
+#include "UploadContext.h"
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 using namespace graphics;
 
-static const unsigned long long DEFAULT_UPLOAD_BUFFER_SIZE = 100000000; // 100 MB
+class DDSFile;
 
+static const unsigned long long DEFAULT_UPLOAD_BUFFER_SIZE = 100000000; // 100 MB, ring of the owning thread
+static const unsigned long long WORKER_UPLOAD_BUFFER_SIZE = 16ull << 20; // ring of every other thread
+static const unsigned long long DEFAULT_CPU_MEMORY_BUDGET = 512ull << 20;  // decoded images kept in RAM
+
+// What the deferred release queue holds now and has done so far.
+struct ReleaseQueueStats {
+    unsigned int        numPendingResources;
+    unsigned int        numPendingDescriptors;
+    unsigned int        numPeakPending;         // entries waiting at once
+    unsigned long long  numReleasedResources;
+    unsigned long long  numReleasedDescriptors;
+    unsigned int        numForcedWaits;         // the heap ran out and the GPU had to be waited for
+};
+
+// Resource creation (NewBuffer, NewBufferAt, ReleaseResource, GetResource) and the upload calls may come
+// from any thread; each thread records into its own UploadContext. Descriptors, decoded files and the
+// per-frame calls belong to one thread at a time: the thread that created the manager until the scene
+// starts its render thread, the render thread after that.
 class ResourceManager {
+    friend class UploadContext;
 public:
     ResourceManager(Device* d, unsigned int numRTVs, unsigned int numDSVs,
         unsigned int numCBVSRVUAVs, unsigned int numSamplers);
     ~ResourceManager();
 
     ID3D12DescriptorHeap* GetCBVSRVUAVHeap() { return m_pheapCBVSRVUAV; }
+    unsigned int GetCBVSRVUAVDescriptorSize() const { return m_sizeCBVSRVUAVHeapDesc; }
 
     void AddRTV(ID3D12Resource* tex, D3D12_RENDER_TARGET_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE& handleCPU);
     void AddDSV(ID3D12Resource* tex, D3D12_DEPTH_STENCIL_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE& handleCPU);
@@ -21,27 +52,101 @@ public:
     void AddSRV(ID3D12Resource* tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE& handleCPU,
         D3D12_GPU_DESCRIPTOR_HANDLE& handleGPU);
     void AddSampler(D3D12_SAMPLER_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE& handleCPU);
+    // Rewrites a slot handed out by AddSRV; the caller makes sure no frame in flight still reads it.
+    void UpdateSRV(ID3D12Resource* tex, D3D12_SHADER_RESOURCE_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handleCPU);
+    // count adjacent CBV/SRV/UAV slots for one descriptor table, filled with UpdateSRV. Released ranges are
+    // reused first; a full heap waits for the GPU if that frees something.
+    void AllocateCBVSRVUAVRange(unsigned int count, D3D12_CPU_DESCRIPTOR_HANDLE& handleCPU,
+        D3D12_GPU_DESCRIPTOR_HANDLE& handleGPU);
 
     unsigned int AddExistingResource(ID3D12Resource* tex);
 
     unsigned int NewBuffer(ID3D12Resource*& buffer, D3D12_RESOURCE_DESC* descBuffer, D3D12_HEAP_PROPERTIES* props,
         D3D12_HEAP_FLAGS flags, D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear);
 
+    // Replaces the resource in slot i; the previous one goes through ReleaseResource.
     unsigned int NewBufferAt(unsigned int i, ID3D12Resource*& buffer, D3D12_RESOURCE_DESC* descBuffer,
         D3D12_HEAP_PROPERTIES* props, D3D12_HEAP_FLAGS flags,
         D3D12_RESOURCE_STATES state, D3D12_CLEAR_VALUE* clear);
 
+    // Deferred release. Call once the last command list using the resource or descriptors has been
+    // submitted: they are destroyed when the queue fence passes the next signal, so frames in flight
+    // keep reading valid memory and nobody waits for the GPU.
+    void ReleaseResource(unsigned int i);
+    void ReleaseCBVSRVUAVRange(D3D12_CPU_DESCRIPTOR_HANDLE handleCPU, unsigned int count);
+    // Signals the queue fence behind the command lists of a frame; call after Present.
+    unsigned long long SignalFrame();
+    // Destroys what the GPU is done with. Cheap, call per frame.
+    void ProcessReleases();
+    ReleaseQueueStats GetReleaseQueueStats() const;
+    void ReportReleaseQueue() const;
+
     void UploadToBuffer(unsigned int i, unsigned int numSubResources, D3D12_SUBRESOURCE_DATA* data,
         D3D12_RESOURCE_STATES finalState);
+    void UploadToBuffer(unsigned int i, unsigned int firstSubResource, unsigned int numSubResources,
+        D3D12_SUBRESOURCE_DATA* data, D3D12_RESOURCE_STATES finalState);
+    // All levels of an RGBA8 chain into subresources firstSubResource .. firstSubResource + levels - 1.
+    void UploadMipChain(unsigned int i, unsigned int firstSubResource, const MipChain& mips,
+        D3D12_RESOURCE_STATES finalState);
+    // Same for a block-compressed chain; the pitch is counted in rows of 4x4 blocks.
+    // firstLevel skips the finer levels of the chain (the texture holds firstLevel..N-1).
+    void UploadBCChain(unsigned int i, unsigned int firstSubResource, const BCChain& chain,
+        D3D12_RESOURCE_STATES finalState, unsigned int firstLevel = 0);
+    // Fence value signalled after the last upload, and how far the GPU has got.
+    unsigned long long GetUploadFence() const { return m_valFence; }
+    unsigned long long GetCompletedUploadFence() const { return m_pFence->GetCompletedValue(); }
+    // The calling thread's upload context, created on first use and kept until the manager goes away.
+    // The Upload* calls above are Begin/Upload/Submit on it followed by SubmitUploads.
+    UploadContext& GetUploadContext();
+    // Waits for the calling thread's batches and drops its context. For threads that end before the
+    // manager does, so their rings are not kept forever.
+    void ReleaseUploadContext();
+    // Executes every batch the contexts have queued in one ExecuteCommandLists and signals the fence behind
+    // them. Any thread; whoever calls it does the submission for everybody.
+    void SubmitUploads();
 
     ID3D12Resource* GetResource(unsigned int index);
 
     // PNG loader (CPU RGBA8)
+    // PrefetchFiles starts decoding on the worker pool; a later LoadFile of the same name
+    // only waits for that one file instead of decoding it on the calling thread.
+    void PrefetchFiles(const std::vector<std::string>& files);
     unsigned int LoadFile(const char* fn, unsigned int& h, unsigned int& w);
+    // PNG or DDS to RGBA8 on the calling thread, any thread; throws on error. Nothing is registered:
+    // the image belongs to the caller until it is handed over with AddFileData.
+    static ImageBuffer DecodeImage(const char* fn, unsigned int& h, unsigned int& w);
+    // Takes over an image decoded elsewhere; counted against the CPU budget like a LoadFile result.
+    unsigned int AddFileData(ImageBuffer&& image);
     unsigned char* GetFileData(unsigned int i);
     void UnloadFileData(unsigned int i);
+    // For data that only feeds uploads: freed by RetireFileData once the GPU has passed
+    // every upload submitted so far.
+    void ReleaseFileDataAfterUpload(unsigned int i);
+    // Frees the entries whose fence has completed and the prefetched files nobody claimed. Cheap, call per frame.
+    void RetireFileData();
+    // Prefetched files still pending are no longer waited for by LoadFile; they are freed as they finish.
+    void DropUnclaimedPrefetches();
+
+    // Bytes held by decoded images (file mappings included). Going over the budget first retires
+    // finished uploads, then waits for the GPU if that frees something, and warns otherwise.
+    void SetCPUMemoryBudget(unsigned long long bytes) { m_sizeCPUBudget = bytes; }
+    unsigned long long GetCPUMemoryBudget() const { return m_sizeCPUBudget; }
+    unsigned long long GetCPUMemoryUsage() const { return m_sizeCPUUsage; }
+    unsigned long long GetCPUMemoryPeak() const { return m_sizeCPUPeak; }
+    void ReportCPUMemory() const;
+
+    // Decodes every file with the cache bypassed, then cold (decode + store) and warm (mapped hit),
+    // and prints the three timings side by side. Needs no device.
+    static void BenchmarkTextureCache(const std::vector<std::string>& files);
+    // Times the bundled PNG decoder alone (cache bypassed) with and without CRC/Adler32 checks and reports MB/s.
+    static void BenchmarkPNGDecode(const std::vector<std::string>& files);
+    // Assets that ship with the build skip the PNG chunk CRCs and zlib Adler32 on decode.
+    // Set before the first LoadFile/PrefetchFiles; decoding runs on the worker threads.
+    static void SetTrustedAssets(bool isTrusted);
 
     void WaitForGPU();
+    // Blocks until the queue fence reaches val (a SignalFrame result, say). Owner thread.
+    void WaitForFence(unsigned long long val);
 
     // --- DDS helpers ---
     unsigned int CreateTextureDDS(const wchar_t* path, D3D12_CPU_DESCRIPTOR_HANDLE& cpuSrv, D3D12_GPU_DESCRIPTOR_HANDLE& gpuSrv);
@@ -51,9 +156,46 @@ public:
     unsigned int LoadDDS_RGBA8(const char* fn, unsigned int& h, unsigned int& w);
 
 private:
+    struct DecodedFile {
+        ImageBuffer    image;               // malloc from lodepng or a TextureCache mapping
+        unsigned int   w = 0;
+        unsigned int   h = 0;
+        unsigned int   error = 0;
+        double         msDecode = 0.0;
+    };
+    struct RetiringFile {
+        unsigned long long  valFence;
+        unsigned int        index;
+    };
+    struct PendingRelease {
+        unsigned long long  valFence;
+        ID3D12Resource*     pRes;               // nullptr for a descriptor range
+        unsigned int        firstDescriptor;
+        unsigned int        numDescriptors;
+    };
+    struct DescriptorRange {
+        unsigned int        first;
+        unsigned int        count;
+    };
+    static DecodedFile DecodeFile(const std::string& fn, bool useCache = true);
+    static unsigned int DecodePNG(const std::string& fn, bool verifyChecksums, unsigned char** out,
+        unsigned int* w, unsigned int* h);
+    static ImageBuffer DecodeDDS_RGBA8(const wchar_t* path, unsigned int& h, unsigned int& w);
+    unsigned int CreateTextureDDS(DDSFile& dds, D3D12_CPU_DESCRIPTOR_HANDLE& cpuSrv, D3D12_GPU_DESCRIPTOR_HANDLE& gpuSrv);
+    void FreeFileData(unsigned int i);
+    struct UploadSubmission {
+        CommandList*                        pList = nullptr;
+        std::atomic<unsigned long long>*    pValFence = nullptr;   // gets the fence value once executed
+    };
+    // Lock-free hand-over from the contexts; executed by the next SubmitUploads.
+    void QueueUpload(CommandList* list, std::atomic<unsigned long long>* valFence);
+    // Caller holds m_mtxResources.
+    void PushRelease(ID3D12Resource* res, unsigned int firstDescriptor, unsigned int numDescriptors);
+    // Signals if a pending release waits for a value not signalled yet, waits for the GPU and releases everything.
+    void FlushReleases();
+    int TakeFreeCBVSRVUAV(unsigned int count);
+
     Device* m_pDev{};
-    ID3D12CommandAllocator* m_pCmdAllocator{};
-    ID3D12GraphicsCommandList* m_pCmdList{};
     ID3D12Fence* m_pFence{};
     HANDLE                        m_hdlFenceEvent{};
 
@@ -63,11 +205,32 @@ private:
     ID3D12DescriptorHeap* m_pheapSampler{};
 
     std::vector<ID3D12Resource*>  m_listResources;
-    std::vector<unsigned char*>   m_listFileData;
-
-    ID3D12Resource* m_pUpload{};
-    unsigned long long            m_iUpload{};
-    unsigned long long            m_valFence{};
+    std::vector<unsigned int>     m_listFreeSlots;          //   m_listResources
+    std::vector<PendingRelease>   m_listPendingReleases;    //   fence
+    mutable std::mutex            m_mtxResources;           //   
+    std::vector<DescriptorRange>  m_listFreeCBVSRVUAV;      //   first,  
+    unsigned long long            m_numReleasedResources = 0;
+    unsigned long long            m_numReleasedDescriptors = 0;
+    unsigned int                  m_numPeakPending = 0;
+    unsigned int                  m_numForcedWaits = 0;
+    std::vector<ImageBuffer>      m_listFileData;
+    std::vector<RetiringFile>     m_listRetiringFiles;  //   fence,  
+    std::unordered_map<std::string, std::future<DecodedFile>> m_mapPendingFiles;
+    std::vector<std::future<DecodedFile>> m_listUnclaimedFiles;
+
+    unsigned long long            m_sizeCPUBudget = DEFAULT_CPU_MEMORY_BUDGET;
+    unsigned long long            m_sizeCPUUsage = 0;
+    unsigned long long            m_sizeCPUPeak = 0;
+    bool                          m_isOverBudget = false;
+
+    std::thread::id               m_idOwnerThread;
+    std::unordered_map<std::thread::id, std::unique_ptr<UploadContext>> m_mapUploadContexts;
+    std::mutex                    m_mtxUploadContexts;
+    MPSCQueue<UploadSubmission>   m_queueUploads;
+    std::mutex                    m_mtxSubmit;              //      fence
+    std::vector<CommandList*> m_listSubmitLists;
+    std::vector<std::atomic<unsigned long long>*> m_listSubmitFences;
+    std::atomic<unsigned long long> m_valFence{};
 
     unsigned int                  m_numRTVs{};
     unsigned int                  m_numDSVs{};
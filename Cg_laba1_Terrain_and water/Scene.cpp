@@ -1,5 +1,11 @@
 // Scene.cpp
 #include "Scene.h"
+#include "PNGExport.h"
+#include "StartupReport.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Counters.h"
+#include "Benchmark.h"
 #include <stdlib.h>
 #include <math.h>
 #include <DirectXTex.h>
@@ -25,9 +31,23 @@ static bool __AABBOutsideFrustum(const XMFLOAT4 planes[6], const XMFLOAT3& c, co
     return false;
 }
 
+//  ,     ( H),      
+static const char* TERRAIN_HEIGHT_MAPS[] = { "hm6.png", "heightmap4.png", "heightmap6.png" };
+static const char* TERRAIN_DISPLACEMENT_MAP = "disp_4k.png";
+
+//     ( +       256   )
+static const unsigned long long FRAME_CONSTANTS_PAGE_SIZE = 256 * 1024;
+
+//     GPU 
+static const char* GPU_SCOPES_SHADOW[4] = { "shadow cascade 0", "shadow cascade 1", "shadow cascade 2", "shadow cascade 3" };
+
 // : , , , 
-Scene::Scene(int height, int width, Device* DEV) :
-    m_ResMgr(DEV, FRAME_BUFFER_COUNT, 6, 23, 0), m_Cam(height, width), m_DNC(6000, 1024) {
+// CBV/SRV:    ,     
+Scene::Scene(int height, int width, Device* DEV, unsigned int numFramesInFlight) :
+    m_ResMgr(DEV, FRAME_BUFFER_COUNT, 6, 32, 0), m_Scheduler(DEV, &m_ResMgr, FRAME_BUFFER_COUNT, numFramesInFlight),
+    m_GPUProfiler(DEV, &m_ResMgr, FRAME_BUFFER_COUNT, Profiler::Get()),
+    m_PoolTransient(DEV), m_Constants(&m_ResMgr, FRAME_BUFFER_COUNT, FRAME_CONSTANTS_PAGE_SIZE),
+    m_Pipelines(DEV, "shadercache"), m_Cam(height, width), m_DNC(6000, 1024) {
     m_pDev = DEV;
     m_pT = nullptr;
 
@@ -37,9 +57,34 @@ Scene::Scene(int height, int width, Device* DEV) :
     m_prevTime = steady_clock::now();
     m_WaterTime = 0.0f;
 
-    //   (frame resources)
-    for (int i = 0; i < FRAME_BUFFER_COUNT; ++i) {
-        m_pFrames[i] = new Frame(i, m_pDev, &m_ResMgr, height, width, 4096);
+    // ,     GPU
+    for (unsigned int i = 0; i < 4; ++i) m_gpuShadow[i] = m_GPUProfiler.AddScope(GPU_SCOPES_SHADOW[i]);
+    m_gpuTerrain = m_GPUProfiler.AddScope("terrain");
+    m_gpuWater = m_GPUProfiler.AddScope("water");
+
+    //  PNG      ,      
+    const char* fnNormals[4] = { "coast_sand_rocks_02_nor_dx_1k.png", "snow_02_nor_dx_1k.png",
+        "dirt_nor_dx_1k.png", "rock_surface_nor_dx_1k.png" };
+    const char* fnDiffuse[4] = { "coast_sand_rocks_02_diff_1k.png", "snow_02_diff_1k.png",
+        "dirt_diff_1k.png", "rock_surface_diff_1k.png" };
+    const char* fnHeightMap = TERRAIN_HEIGHT_MAPS[0];
+    const char* fnDisplacementMap = TERRAIN_DISPLACEMENT_MAP;
+    m_ResMgr.PrefetchFiles({ fnNormals[0], fnNormals[1], fnNormals[2], fnNormals[3],
+        fnDiffuse[0], fnDiffuse[1], fnDiffuse[2], fnDiffuse[3], fnHeightMap, fnDisplacementMap });
+    //  :  (   shadercache)  , InitPipeline*   
+    PrefetchShader(L"RenderTerrainTessVS.hlsl", VERTEX_SHADER);
+    PrefetchShader(L"RenderTerrainTessHS.hlsl", HULL_SHADER);
+    PrefetchShader(L"RenderTerrainTessDS.hlsl", DOMAIN_SHADER);
+    PrefetchShader(L"RenderTerrainTessPS.hlsl", PIXEL_SHADER);
+    PrefetchShader(L"RenderShadowMapHS.hlsl", HULL_SHADER);
+    PrefetchShader(L"RenderShadowMapDS.hlsl", DOMAIN_SHADER);
+    PrefetchShader(L"WaterVS.hlsl", VERTEX_SHADER);
+    PrefetchShader(L"WaterPS.hlsl", PIXEL_SHADER);
+
+    //     (frame resources)
+    {
+        StartupPhase phase("frame resources");
+        InitRenderGraph(height, width);
     }
 
     //    (///)
@@ -50,22 +95,38 @@ Scene::Scene(int height, int width, Device* DEV) :
         XMFLOAT4(0.40f, 0.42f, 0.47f, 0.0f)
     };
     //   +  + 
-    m_pT = new Terrain(
-        &m_ResMgr,
-        new TerrainMaterial(&m_ResMgr,
-            "coast_sand_rocks_02_nor_dx_1k.png", "snow_02_nor_dx_1k.png",
-            "dirt_nor_dx_1k.png", "rock_surface_nor_dx_1k.png",
-            "coast_sand_rocks_02_diff_1k.png", "snow_02_diff_1k.png",
-            "dirt_diff_1k.png", "rock_surface_diff_1k.png",
-            colors),
-        "hm6.png",
-        "disp_4k.png"
-    );
-
-    m_ResMgr.WaitForGPU(); //   
-
-    //   
-    m_pDev->CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE_DIRECT, m_pFrames[0]->GetAllocator(), m_pCmdList);
+    {
+        StartupPhase phase("material (decode wait + upload)");
+        m_pMat = new TerrainMaterial(&m_ResMgr,
+            fnNormals[0], fnNormals[1], fnNormals[2], fnNormals[3],
+            fnDiffuse[0], fnDiffuse[1], fnDiffuse[2], fnDiffuse[3],
+            colors);
+    }
+    {
+        StartupPhase phase("terrain (decode wait + mesh + upload)");
+        m_pT = new Terrain(&m_ResMgr, m_pMat, fnHeightMap, fnDisplacementMap);
+    }
+    m_pTRender = m_pT;
+    m_pTRendered.store(m_pT);
+
+    //   -  
+    m_hdlPacketRequest = CreateEvent(nullptr, FALSE, TRUE, nullptr);
+    m_hdlPacketReady = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (!m_hdlPacketRequest || !m_hdlPacketReady) throw GFX_Exception("Scene::Scene: CreateEvent failed.");
+
+    {
+        StartupPhase phase("GPU upload wait");
+        m_ResMgr.WaitForGPU(); //   
+    }
+    //  RAM   ,    (   )
+    m_ResMgr.DropUnclaimedPrefetches();
+    m_ResMgr.RetireFileData();
+    m_ResMgr.ReportCPUMemory();
+
+    //   :         
+    for (unsigned int i = 0; i < FRAME_PASS_COUNT; ++i) {
+        m_pDev->CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE_DIRECT, m_pFrames[0]->GetAllocator(i), m_pCmdLists[i]);
+    }
     CloseCommandLists();
 
     //  /
@@ -81,7 +142,9 @@ Scene::Scene(int height, int width, Device* DEV) :
     m_srMain.right = width;
     m_srMain.bottom = height;
 
-    //  : 3D , , , -
+    // : 3D , , , -.     PSO   ,
+    //    ,   
+    StartupPhase phase("pipelines (requests)");
     //InitPipelineTerrain2D();
     InitPipelineTerrain3D();
     InitPipelineShadowMap();
@@ -90,27 +153,54 @@ Scene::Scene(int height, int width, Device* DEV) :
 }
 
 Scene::~Scene() {
-    //   root 
-    while (!m_listRootSigs.empty()) {
-        ID3D12RootSignature* sigRoot = m_listRootSigs.back();
-        if (sigRoot) sigRoot->Release();
-        m_listRootSigs.pop_back();
-    }
-    //   PSO
-    while (!m_listPSOs.empty()) {
-        ID3D12PipelineState* pso = m_listPSOs.back();
-        if (pso) pso->Release();
-        m_listPSOs.pop_back();
+    // - :     ,  
+    m_isStopping.store(true);
+    if (m_hdlPacketReady) SetEvent(m_hdlPacketReady);
+    if (m_thrRender.joinable()) m_thrRender.join();
+
+    //      PSO,     
+    m_ResMgr.WaitForGPU();
+    m_Scheduler.Report();
+    if (!m_Scheduler.WriteCSV("frametimes.csv")) StartupReport::Line("  cannot write frametimes.csv\n");
+    if (!m_fnBenchmark.empty()) WriteBenchmark();
+    GetShaderCache().Report();
+    m_Pipelines.Report();
+    m_Pipelines.Save(); //  PSO   ,     
+    Profiler::Get().Report();
+    CounterRegistry::Get().Report();
+    Profiler::Get().EndStream(); //    :  -trace  
+    StartupReport::Line("  constants: peak %.1f KB of a %.0f KB page per frame\n", m_Constants.GetPeakUsage() / 1024.0,
+        m_Constants.GetPageSize() / 1024.0);
+    if (m_numInputFrames) {
+        StartupReport::Line("  input to Present %.2f ms (max %.2f) over %llu frames with input\n",
+            m_msInputSum / m_numInputFrames, m_msInputMax, m_numInputFrames);
     }
+    JobSystem::Shared().Report();
+    //   :      
+    if (m_futTerrain.valid()) {
+        try { delete m_futTerrain.get(); }
+        catch (const std::exception&) {}
+    }
+    //      ,     
+    if (m_pTRender && m_pTRender != m_pT) { m_pTRender->Release(); delete m_pTRender; }
     if (m_pT) { delete m_pT; } //  
+    delete m_pMat;             //   ,    
+    m_ResMgr.ReportReleaseQueue();
+    for (unsigned int i = 0; i < FRAME_PASS_COUNT; ++i) {
+        if (m_pCmdLists[i]) { m_pCmdLists[i]->Release(); m_pCmdLists[i] = nullptr; }
+    }
     for (int i = 0; i < FRAME_BUFFER_COUNT; ++i) { delete m_pFrames[i]; } //  
+    if (m_hdlPacketRequest) { CloseHandle(m_hdlPacketRequest); m_hdlPacketRequest = nullptr; }
+    if (m_hdlPacketReady) { CloseHandle(m_hdlPacketReady); m_hdlPacketReady = nullptr; }
     m_pDev = nullptr;
 }
 
 //   ,     
 void Scene::CloseCommandLists() {
-    if (FAILED(m_pCmdList->Close())) {
-        throw GFX_Exception("Scene::CloseCommandLists failed.");
+    for (unsigned int i = 0; i < FRAME_PASS_COUNT; ++i) {
+        if (FAILED(m_pCmdLists[i]->Close())) {
+            throw GFX_Exception("Scene::CloseCommandLists failed.");
+        }
     }
 }
 
@@ -178,11 +268,10 @@ void Scene::InitPipelineTerrain3D() {
     paramsRoot[1].InitAsDescriptorTable(1, &rangesRoot[1]);
     rangesRoot[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0);
     paramsRoot[2].InitAsDescriptorTable(1, &rangesRoot[2]);
-    rangesRoot[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 1);
-    paramsRoot[3].InitAsDescriptorTable(1, &rangesRoot[3]);
+    paramsRoot[3].InitAsConstantBufferView(1);  // b1:   ConstantAllocator,  
     rangesRoot[4].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 2);
     paramsRoot[4].InitAsDescriptorTable(1, &rangesRoot[4]);
-    rangesRoot[5].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 3);
+    rangesRoot[5].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 3); //  t3 +  t4
     paramsRoot[5].InitAsDescriptorTable(1, &rangesRoot[5], D3D12_SHADER_VISIBILITY_PIXEL);
 
     // : ,  DS,   ,   
@@ -207,19 +296,7 @@ void Scene::InitPipelineTerrain3D() {
     descRoot.Init(_countof(paramsRoot), paramsRoot, 4, descSamplers,
         D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS |
         D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
-    ID3D12RootSignature* sigRoot;
-    m_pDev->CreateRootSig(&descRoot, sigRoot);
-    m_listRootSigs.push_back(sigRoot);
-
-    //  
-    D3D12_SHADER_BYTECODE bcPS = {};
-    D3D12_SHADER_BYTECODE bcVS = {};
-    D3D12_SHADER_BYTECODE bcHS = {};
-    D3D12_SHADER_BYTECODE bcDS = {};
-    CompileShader(L"RenderTerrainTessVS.hlsl", VERTEX_SHADER, bcVS);
-    CompileShader(L"RenderTerrainTessPS.hlsl", PIXEL_SHADER, bcPS);
-    CompileShader(L"RenderTerrainTessHS.hlsl", HULL_SHADER, bcHS);
-    CompileShader(L"RenderTerrainTessDS.hlsl", DOMAIN_SHADER, bcDS);
+    m_hdlRootTerrain = m_Pipelines.AddRootSignature(descRoot);
 
     DXGI_SAMPLE_DESC descSample = {};
     descSample.Count = 1;
@@ -237,12 +314,7 @@ void Scene::InitPipelineTerrain3D() {
 
     // PSO   
     D3D12_GRAPHICS_PIPELINE_STATE_DESC descPSO = {};
-    descPSO.pRootSignature = sigRoot;
     descPSO.InputLayout = descInputLayout;
-    descPSO.VS = bcVS;
-    descPSO.PS = bcPS;
-    descPSO.HS = bcHS;
-    descPSO.DS = bcDS;
     descPSO.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_PATCH;
     descPSO.NumRenderTargets = 1;
     descPSO.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -255,25 +327,28 @@ void Scene::InitPipelineTerrain3D() {
     descPSO.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
     descPSO.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
 
-    ID3D12PipelineState* pso;
-    m_pDev->CreatePSO(&descPSO, pso);
-    m_listPSOs.push_back(pso);
+    //  ; PSO   ,     
+    PipelineShaders shaders;
+    shaders.vs = L"RenderTerrainTessVS.hlsl";
+    shaders.hs = L"RenderTerrainTessHS.hlsl";
+    shaders.ds = L"RenderTerrainTessDS.hlsl";
+    shaders.ps = L"RenderTerrainTessPS.hlsl";
+    m_hdlPSOTerrain = m_Pipelines.Request("terrain", m_hdlRootTerrain, descPSO, shaders);
 }
 
 // RS+PSO  - (  RTV,  depth)
 void Scene::InitPipelineShadowMap() {
     CD3DX12_ROOT_PARAMETER paramsRoot[4];
-    CD3DX12_DESCRIPTOR_RANGE rangesRoot[4];
+    CD3DX12_DESCRIPTOR_RANGE rangesRoot[3];
 
-    // height, displacement, per-terrain CB, per-shadow-pass CB
+    // height, displacement, per-terrain CB, per-shadow-pass CB (root CBV)
     rangesRoot[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
     paramsRoot[0].InitAsDescriptorTable(1, &rangesRoot[0]);
     rangesRoot[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 1);
     paramsRoot[1].InitAsDescriptorTable(1, &rangesRoot[1]);
     rangesRoot[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0);
     paramsRoot[2].InitAsDescriptorTable(1, &rangesRoot[2]);
-    rangesRoot[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 1);
-    paramsRoot[3].InitAsDescriptorTable(1, &rangesRoot[3]);
+    paramsRoot[3].InitAsConstantBufferView(1);
 
     CD3DX12_STATIC_SAMPLER_DESC descSamplers[2];
     descSamplers[0].Init(0, D3D12_FILTER_MIN_MAG_MIP_LINEAR);
@@ -287,17 +362,7 @@ void Scene::InitPipelineShadowMap() {
     descRoot.Init(_countof(paramsRoot), paramsRoot, 2, descSamplers,
         D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT |
         D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS);
-    ID3D12RootSignature* sigRoot;
-    m_pDev->CreateRootSig(&descRoot, sigRoot);
-    m_listRootSigs.push_back(sigRoot);
-
-    //   VS,  HS/DS   
-    D3D12_SHADER_BYTECODE bcVS = {};
-    D3D12_SHADER_BYTECODE bcHS = {};
-    D3D12_SHADER_BYTECODE bcDS = {};
-    CompileShader(L"RenderTerrainTessVS.hlsl", VERTEX_SHADER, bcVS);
-    CompileShader(L"RenderShadowMapHS.hlsl", HULL_SHADER, bcHS);
-    CompileShader(L"RenderShadowMapDS.hlsl", DOMAIN_SHADER, bcDS);
+    const unsigned int rootShadow = m_Pipelines.AddRootSignature(descRoot);
 
     DXGI_SAMPLE_DESC descSample = {};
     descSample.Count = 1;
@@ -315,11 +380,7 @@ void Scene::InitPipelineShadowMap() {
 
     // PSO:  depth ( RTV),      
     D3D12_GRAPHICS_PIPELINE_STATE_DESC descPSO = {};
-    descPSO.pRootSignature = sigRoot;
     descPSO.InputLayout = descInputLayout;
-    descPSO.VS = bcVS;
-    descPSO.HS = bcHS;
-    descPSO.DS = bcDS;
     descPSO.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_PATCH;
     descPSO.RTVFormats[0] = DXGI_FORMAT_UNKNOWN;
     descPSO.NumRenderTargets = 0;
@@ -335,9 +396,12 @@ void Scene::InitPipelineShadowMap() {
     descPSO.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
     descPSO.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
 
-    ID3D12PipelineState* pso;
-    m_pDev->CreatePSO(&descPSO, pso);
-    m_listPSOs.push_back(pso);
+    //   VS,  HS/DS   
+    PipelineShaders shaders;
+    shaders.vs = L"RenderTerrainTessVS.hlsl";
+    shaders.hs = L"RenderShadowMapHS.hlsl";
+    shaders.ds = L"RenderShadowMapDS.hlsl";
+    m_hdlPSOShadow = m_Pipelines.Request("shadow map", rootShadow, descPSO, shaders);
 }
 
 // RS+PSO   (,  )
@@ -352,21 +416,12 @@ void Scene::InitPipelineWater() {
         D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
         D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS |
         D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS);
-    ID3D12RootSignature* sigRoot;
-    m_pDev->CreateRootSig(&descRoot, sigRoot);
-    m_listRootSigs.push_back(sigRoot);
-
-    //  
-    D3D12_SHADER_BYTECODE bcVS = {}, bcPS = {};
-    CompileShader(L"WaterVS.hlsl", VERTEX_SHADER, bcVS);
-    CompileShader(L"WaterPS.hlsl", PIXEL_SHADER, bcPS);
+    const unsigned int rootWater = m_Pipelines.AddRootSignature(descRoot);
 
     DXGI_SAMPLE_DESC descSample = {}; descSample.Count = 1;
 
     // PSO : TRIANGLE, 1 RTV, depth read-only (Zero write)
     D3D12_GRAPHICS_PIPELINE_STATE_DESC descPSO = {};
-    descPSO.pRootSignature = sigRoot;
-    descPSO.VS = bcVS; descPSO.PS = bcPS;
     descPSO.InputLayout = { nullptr, 0 };
     descPSO.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
     descPSO.NumRenderTargets = 1; descPSO.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -388,125 +443,306 @@ void Scene::InitPipelineWater() {
     descPSO.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;       //   
     descPSO.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_LESS_EQUAL;
 
-    ID3D12PipelineState* pso;
-    m_pDev->CreatePSO(&descPSO, pso);
-    m_listPSOs.push_back(pso);
+    //  
+    PipelineShaders shaders;
+    shaders.vs = L"WaterVS.hlsl";
+    shaders.ps = L"WaterPS.hlsl";
+    m_hdlPSOWater = m_Pipelines.Request("water", rootWater, descPSO, shaders);
 }
 
 //  /
-void Scene::SetViewport(ID3D12GraphicsCommandList* cmdList) {
+//  :     ,         -.
+//                  
+void Scene::InitRenderGraph(int height, int width) {
+    const unsigned int dimShadowAtlas = 4096;
+
+    // typeless 24/8: depth view  , SRV   
+    D3D12_RESOURCE_DESC descAtlas = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R24G8_TYPELESS, dimShadowAtlas, dimShadowAtlas,
+        1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+    D3D12_CLEAR_VALUE clearAtlas = {};
+    clearAtlas.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+    clearAtlas.DepthStencil.Depth = 1.0f;
+
+    D3D12_RESOURCE_DESC descDepth = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, width, height,
+        1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+    D3D12_CLEAR_VALUE clearDepth = {};
+    clearDepth.Format = DXGI_FORMAT_D32_FLOAT;
+    clearDepth.DepthStencil.Depth = 1.0f;
+
+    m_idBackBuffer = m_Graph.ImportResource("back buffer", RG_ACCESS_PRESENT, RG_ACCESS_PRESENT);
+    const unsigned int idAtlas = m_PoolTransient.AddTarget(m_Graph, "Shadow Atlas", descAtlas, clearAtlas);
+    const unsigned int idDepth = m_PoolTransient.AddTarget(m_Graph, "Depth/Stencil Buffer", descDepth, clearDepth);
+
+    //       ,     
+    for (unsigned int i = 0; i < FRAME_PASS_MAIN; ++i) {
+        const unsigned int idPass = m_Graph.AddPass(("shadow cascade " + std::to_string(i)).c_str());
+        m_Graph.Use(idPass, idAtlas, RG_ACCESS_DEPTH_WRITE);
+    }
+    const unsigned int idMain = m_Graph.AddPass("main");
+    m_Graph.Use(idMain, idAtlas, RG_ACCESS_SHADER_READ);
+    m_Graph.Use(idMain, idDepth, RG_ACCESS_DEPTH_WRITE);
+    m_Graph.Use(idMain, m_idBackBuffer, RG_ACCESS_RENDER_TARGET);
+
+    std::string err;
+    if (!m_Graph.Compile(&err)) throw GFX_Exception(("Scene::InitRenderGraph: " + err).c_str());
+    m_PoolTransient.Allocate(m_Graph);
+
+    ID3D12Resource* pAtlas = m_PoolTransient.GetResource(idAtlas);
+    ID3D12Resource* pDepth = m_PoolTransient.GetResource(idDepth);
+    for (int i = 0; i < FRAME_BUFFER_COUNT; ++i) {
+        m_pFrames[i] = new Frame(i, m_pDev, &m_ResMgr, height, width, pDepth, pAtlas, dimShadowAtlas);
+        m_listGraphResources[i].assign(m_Graph.GetResourceCount(), nullptr);
+        m_listGraphResources[i][m_idBackBuffer] = m_pFrames[i]->GetBackBuffer();
+        m_listGraphResources[i][idAtlas] = pAtlas;
+        m_listGraphResources[i][idDepth] = pDepth;
+    }
+
+    StartupReport::Line("render graph: %u passes, transients %.1f MB in one heap for %d frames (%.1f MB as per-frame targets)\n",
+        m_Graph.GetPassCount(), m_PoolTransient.GetHeapSize() / 1048576.0, FRAME_BUFFER_COUNT,
+        FRAME_BUFFER_COUNT * m_Graph.GetTransientBytes() / 1048576.0);
+}
+
+void Scene::SetViewport(CommandList* cmdList) {
     cmdList->RSSetViewports(1, &m_vpMain);
     cmdList->RSSetScissorRects(1, &m_srMain);
 }
 
-//    (4 )
-void Scene::DrawShadowMap(ID3D12GraphicsCommandList* cmdList) {
-    m_pFrames[m_iFrame]->BeginShadowPass(cmdList);
+//   i   (4    );       ,
+//    :   ;     
+void Scene::DrawShadowCascade(CommandList* cmdList, unsigned int i) {
+    PROFILE_SCOPE("Scene::DrawShadowCascade");
+    GPUProfileScope scopeGPU(m_GPUProfiler, cmdList, m_gpuShadow[i]);
+    if (i == 0) m_pFrames[m_iFrame]->BeginShadowPass(cmdList);
+    else m_pFrames[m_iFrame]->ResumeShadowPass(cmdList);
 
-    cmdList->SetPipelineState(m_listPSOs[1]);
-    cmdList->SetGraphicsRootSignature(m_listRootSigs[1]);
+    //           ;
+    //  PSO  ,    ( )
+    if (!m_Pipelines.SetPipeline(cmdList, m_hdlPSOShadow)) return;
 
     ID3D12DescriptorHeap* heaps[] = { m_ResMgr.GetCBVSRVUAVHeap() };
     cmdList->SetDescriptorHeaps(_countof(heaps), heaps);
 
-    m_pT->AttachTerrainResources(cmdList, 0, 1, 2); // height/disp/CBV 
-
-    for (int i = 0; i < 4; ++i) {
-        ShadowMapShaderConstants constants;
-        constants.shadowViewProj = m_DNC.GetShadowViewProjMatrix(i);  //  
-        constants.eye = m_Cam.GetEyePosition();                       //  
-        m_DNC.GetShadowFrustum(i, constants.frustum);                 //   
-        m_pFrames[m_iFrame]->SetShadowConstants(constants, i);
-        m_pFrames[m_iFrame]->AttachShadowPassResources(i, cmdList, 3);
-        m_pT->Draw(cmdList, true); //    depth
-    }
+    m_pTRender->AttachTerrainResources(cmdList, 0, 1, 2); // height/disp/CBV 
 
-    m_pFrames[m_iFrame]->EndShadowPass(cmdList);
+    m_pFrames[m_iFrame]->AttachShadowPassResources(i, cmdList, 3, m_Constants.Push(m_pPacket->shadowConstants[i]));
+    m_pTRender->Draw(cmdList, true); //    depth
 }
 
 //   :  (+),    
-void Scene::DrawTerrain(ID3D12GraphicsCommandList* cmdList) {
+void Scene::DrawTerrain(CommandList* cmdList) {
+    PROFILE_SCOPE("Scene::DrawTerrain");
     const float clearColor[] = { 0.2f, 0.6f, 1.0f, 1.0f };
     m_pFrames[m_iFrame]->BeginRenderPass(cmdList, clearColor);
+    SetViewport(cmdList);
 
-    if (m_drawMode == 4) {
-
-        cmdList->SetPipelineState(m_listPSOs[3]);
-        cmdList->SetGraphicsRootSignature(m_listRootSigs[0]);
+    // PSO      :   (  )
+    const unsigned int psoTerrain = (m_pPacket->drawMode == 4) ? m_hdlPSOWireframe : m_hdlPSOTerrain;
+    m_GPUProfiler.BeginScope(cmdList, m_gpuTerrain); //   ,  
+    if (m_Pipelines.SetPipeline(cmdList, psoTerrain)) {
+        ID3D12DescriptorHeap* heaps[] = { m_ResMgr.GetCBVSRVUAVHeap() };
+        cmdList->SetDescriptorHeaps(_countof(heaps), heaps);
+
+        m_pTRender->AttachTerrainResources(cmdList, 0, 1, 2); // SRV height/disp + CBV 
+
+        if (m_pPacket->drawMode) {
+            //   (, , , ,  )  
+            m_pFrames[m_iFrame]->AttachFrameResources(cmdList, 4, 3, m_Constants.Push(m_pPacket->frameConstants)); //  + CBV 
+            m_pTRender->AttachMaterialResources(cmdList, 5);          //  
+
+            // 3D:    - (LOD)
+            const XMFLOAT4& eye4 = m_pPacket->frameConstants.eye;
+            XMFLOAT3 eye3(eye4.x, eye4.y, eye4.z);
+            PROFILE_SCOPE("Terrain::DrawLOD");
+            m_pTRender->DrawLOD(cmdList, eye3);
+        }
     }
-    else {
+    m_GPUProfiler.EndScope(cmdList, m_gpuTerrain);
 
-        cmdList->SetPipelineState(m_listPSOs[0]);
-        cmdList->SetGraphicsRootSignature(m_listRootSigs[0]);
+    if (m_pPacket->drawMode == 1) {
+        DrawWater(cmdList); //    ( 3D )
     }
+}
 
-    SetViewport(cmdList);
-
-    ID3D12DescriptorHeap* heaps[] = { m_ResMgr.GetCBVSRVUAVHeap() };
-    cmdList->SetDescriptorHeaps(_countof(heaps), heaps);
-
-    m_pT->AttachTerrainResources(cmdList, 0, 1, 2); // SRV height/disp + CBV 
-
-    if (m_drawMode) {
-        //    (, , , ,  )
-        XMFLOAT4 frustum[6];
-        m_Cam.GetViewFrustum(frustum);
-
-        PerFrameConstantBuffer constants;
-        constants.viewproj = m_Cam.GetViewProjectionMatrixTransposed();
-        for (int i = 0; i < 4; ++i) constants.shadowtexmatrices[i] = m_DNC.GetShadowViewProjTexMatrix(i);
-        constants.eye = m_Cam.GetEyePosition();
-        constants.frustum[0] = frustum[0];
-        constants.frustum[1] = frustum[1];
-        constants.frustum[2] = frustum[2];
-        constants.frustum[3] = frustum[3];
-        constants.frustum[4] = frustum[4];
-        constants.frustum[5] = frustum[5];
-        constants.light = m_DNC.GetLight();
-        constants.useTextures = m_UseTextures;
-
-        m_pFrames[m_iFrame]->SetFrameConstants(constants);
-        m_pFrames[m_iFrame]->AttachFrameResources(cmdList, 4, 3); // CBV  + 
-        m_pT->AttachMaterialResources(cmdList, 5);                //  
+//       :  iPass   ;    
+//        .         
+void Scene::RecordPass(unsigned int iPass) {
+    PROFILE_SCOPE("Scene::RecordPass");
+    CommandList* cmdList = m_pCmdLists[iPass];
+    ID3D12Resource* const* resources = m_listGraphResources[m_iFrame].data();
+    m_pFrames[m_iFrame]->AttachCommandList(cmdList, iPass);
+    if (iPass == 0) m_Scheduler.RecordBegin(cmdList);
+    TransientPool::RecordBarriers(cmdList, m_Graph.GetBarriers(iPass), resources);
+
+    if (iPass == FRAME_PASS_MAIN) {
+        DrawTerrain(cmdList);
+        TransientPool::RecordBarriers(cmdList, m_Graph.GetFinalBarriers(), resources); // -   PRESENT
+        m_Scheduler.RecordEnd(cmdList);
     }
-
-    if (m_drawMode) {
-        // 3D:    - (LOD)
-        XMFLOAT4 eye4 = m_Cam.GetEyePosition();
-        XMFLOAT3 eye3(eye4.x, eye4.y, eye4.z);
-        m_pT->DrawLOD(cmdList, eye3);
+    else {
+        DrawShadowCascade(cmdList, iPass);
     }
 
+    if (FAILED(cmdList->Close())) {
+        throw GFX_Exception("Scene::RecordPass: CommandList Close failed.");
+    }
+}
 
+//    ,     ,    ,
+//     ;     
+void Scene::RecordFrame(bool isParallel) {
+    if (isParallel) {
+        JobSystem::Shared().ParallelFor(0, FRAME_PASS_COUNT, 1, [this](unsigned int first, unsigned int last) {
+            for (unsigned int i = first; i < last; ++i) RecordPass(i);
+        });
+    }
+    else {
+        for (unsigned int i = 0; i < FRAME_PASS_COUNT; ++i) RecordPass(i);
+    }
+}
 
-    if (m_drawMode == 1) {
-        DrawWater(cmdList); //    ( 3D )
+//  :     . Main    RecordingDevice,  
+//  ,    ,      CPU      ;
+//         
+void Scene::BenchmarkRecording(unsigned int numFrames) {
+    if (!numFrames) return;
+    m_ResMgr.WaitForGPU(); //   ,    
+    m_Pipelines.WaitAll(); //   PSO    
+    m_Pipelines.ThrowIfFailed();
+
+    //       ; -   
+    FramePacket pkt;
+    BuildPacket(pkt);
+    m_pPacket = &pkt;
+
+    double msTotal[2] = {};
+    double msBest[2] = { 1e30, 1e30 };
+    for (int mode = 0; mode < 2; ++mode) {
+        const bool isParallel = (mode == 1);
+        m_pFrames[m_iFrame]->Reset();
+        m_Constants.BeginFrame(m_iFrame);
+        RecordFrame(isParallel); // :     
+        for (unsigned int n = 0; n < numFrames; ++n) {
+            auto t0 = steady_clock::now();
+            m_pFrames[m_iFrame]->Reset();
+            m_Constants.BeginFrame(m_iFrame);
+            RecordFrame(isParallel);
+            const double ms = duration<double, std::milli>(steady_clock::now() - t0).count();
+            msTotal[mode] += ms;
+            if (ms < msBest[mode]) msBest[mode] = ms;
+        }
     }
 
-    m_pFrames[m_iFrame]->EndRenderPass(cmdList);
+    const double msSerial = msTotal[0] / numFrames;
+    const double msParallel = msTotal[1] / numFrames;
+    StartupReport::Line("\n=== Command list recording (%u passes, %u frames, %u workers + caller) ===\n",
+        FRAME_PASS_COUNT, numFrames, JobSystem::Shared().GetWorkerCount());
+    StartupReport::Line("  serial   %.3f ms (best %.3f)\n", msSerial, msBest[0]);
+    StartupReport::Line("  parallel %.3f ms (best %.3f) | x%.2f\n", msParallel, msBest[1],
+        msParallel > 0.0 ? msSerial / msParallel : 0.0);
+    m_pPacket = nullptr;
 }
 
-//   :  ?  ?  ? 
+//    m_pPacket:  ?  +   ?  ExecuteCommandLists ? 
 void Scene::Draw() {
+    PROFILE_SCOPE("Scene::Draw");
     m_pFrames[m_iFrame]->Reset();
-    m_pFrames[m_iFrame]->AttachCommandList(m_pCmdList);
-
-    DrawShadowMap(m_pCmdList);
-    DrawTerrain(m_pCmdList);
+    {
+        PROFILE_SCOPE("Scene::RecordFrame");
+        RecordFrame(m_isParallelRecording);
+    }
 
-    CloseCommandLists();
-    ID3D12CommandList* lCmds[] = { m_pCmdList };
-    m_pDev->ExecuteCommandLists(lCmds, __crt_countof(lCmds));
+    PROFILE_SCOPE("submit + Present");
+    CommandList* lCmds[FRAME_PASS_COUNT];
+    for (unsigned int i = 0; i < FRAME_PASS_COUNT; ++i) lCmds[i] = m_pCmdLists[i];
+    m_pDev->ExecuteCommandLists(lCmds, FRAME_PASS_COUNT);
     m_pDev->Present();
+    //    fence  ,   ;      
+    m_Scheduler.EndFrame(m_ResMgr.SignalFrame());
+}
+
+void Scene::StartBenchmark(const CameraPath& path, const std::string& namePath, float dt, const std::filesystem::path& fnReport) {
+    m_pathPlay = path;
+    if (m_pathPlay.IsEmpty()) {
+        const BoundingSphere bs = m_pT->GetBoundingSphere();
+        const XMFLOAT3 c = bs.GetCenter();
+        m_pathPlay = CameraPath::Flythrough(c.x, c.y, c.z, bs.GetRadius());
+    }
+    m_namePath = namePath;
+    m_dtFixed = dt;
+    m_timePath = 0.0f;
+    m_numPathFrames = 0;
+    m_isPlayingPath = true;
+    m_fnBenchmark = fnReport;
+    m_readerBenchmark = CounterRegistry::Get().AddReader();
+    //       :          
+    CounterRegistry::Get().ResetTotals();
+    m_tBenchmark = steady_clock::now();
+    StartupReport::Line("benchmark: %s, %.1f s at %.4f s a frame\n", m_namePath.empty() ? "flythrough" : m_namePath.c_str(),
+        m_pathPlay.GetDuration(), m_dtFixed);
 }
 
-//  // +  Draw()
+// -  :        
+void Scene::WriteBenchmark() {
+    BenchmarkRun run;
+    run.path = m_namePath;
+    run.numFrames = m_numPathFrames;
+    run.dt = m_dtFixed;
+    run.sWall = duration<double>(steady_clock::now() - m_tBenchmark).count();
+    run.frames = m_Scheduler.GetTotal();
+    const CounterSnapshot* snap = nullptr;
+    if (CounterRegistry::Get().Acquire(m_readerBenchmark, snap)) run.pCounters = snap;
+    if (WriteBenchmarkJSON(m_fnBenchmark, run)) StartupReport::Line("benchmark: %llu frames, report in %s\n", run.numFrames, m_fnBenchmark.string().c_str());
+    else StartupReport::Line("benchmark: cannot write %s\n", m_fnBenchmark.string().c_str());
+}
+
+void Scene::ToggleCameraRecording() {
+    if (!m_isRecordingPath) {
+        m_pathRecord.Clear();
+        m_timeRecord = 0.0f;
+        m_isRecordingPath = true;
+        StartupReport::Line("camera path: recording\n");
+        return;
+    }
+    m_isRecordingPath = false;
+    if (m_pathRecord.Save("camera.path")) {
+        StartupReport::Line("camera path: %zu keys, %.1f s, saved to camera.path\n", m_pathRecord.GetKeyCount(), m_pathRecord.GetDuration());
+    }
+    else StartupReport::Line("camera path: cannot write camera.path\n");
+}
+
+//     :          
 void Scene::Update() {
+    PROFILE_SCOPE("Scene::Update");
+    if (m_hasRenderFailed.load()) std::rethrow_exception(m_errRender);
+
+    BuildPacket(m_bufPackets.GetWriteBuffer());
+    m_bufPackets.Publish();
+    SetEvent(m_hdlPacketReady);
+}
+
+// ///  + ,       
+void Scene::BuildPacket(FramePacket& pkt) {
+    PROFILE_SCOPE("Scene::BuildPacket");
     auto now = steady_clock::now();
     float dt = static_cast<float>(std::chrono::duration_cast<std::chrono::duration<double>>(now - m_prevTime).count());
     m_prevTime = now;
+    if (m_dtFixed > 0.0f) dt = m_dtFixed; // :          
     if (dt < 0.25f) m_WaterTime += dt; //   
 
+    if (m_isPlayingPath) {
+        const CameraKey key = m_pathPlay.Sample(m_timePath);
+        m_Cam.SetPose(XMFLOAT4(key.x, key.y, key.z, 1.0f), key.yaw, key.pitch);
+        m_timePath += dt;
+        ++m_numPathFrames;
+    }
+    else if (m_isRecordingPath) {
+        const XMFLOAT4 eye = m_Cam.GetEyePosition();
+        m_pathRecord.AddKey({ m_timeRecord, eye.x, eye.y, eye.z, m_Cam.GetYaw(), m_Cam.GetPitch() });
+        m_timeRecord += dt;
+    }
+
+    SwapTerrainIfReady(); //  :    ,    
+
     if (m_LockToTerrain) {
         //      + 
         XMFLOAT4 eye = m_Cam.GetEyePosition();
@@ -514,15 +750,156 @@ void Scene::Update() {
         m_Cam.LockPosition(XMFLOAT4(eye.x, eye.y, h, 1.0f));
     }
 
+    //    ,      :    
     BoundingSphere bs = m_pT->GetBoundingSphere();   // lvalue
-    m_DNC.Update(bs, &m_Cam);
+    JobCounter cntCascades;
+    JobSystem::Shared().Run([this, &bs]() {
+        PROFILE_SCOPE("DayNightCycle::Update");
+        m_DNC.Update(bs, &m_Cam);
+    }, &cntCascades);
+
+    //         -
+    XMFLOAT4 frustum[6];
+    m_Cam.GetViewFrustum(frustum);
+    {
+        PROFILE_SCOPE("Terrain::SelectVisiblePatches");
+        m_pT->SelectVisiblePatches(frustum, pkt.listVisiblePatches);
+        const XMFLOAT4 eye = m_Cam.GetEyePosition();
+        static Counter& s_triangles = CounterRegistry::Get().Register("triangles (estimate)", COUNTER_PER_FRAME);
+        s_triangles.Add((long long)Terrain::EstimateTriangles(XMFLOAT3(eye.x, eye.y, eye.z), pkt.listVisiblePatches));
+    }
+    {
+        PROFILE_SCOPE("wait for cascades");
+        JobSystem::Shared().Wait(cntCascades);
+    }
+
+    pkt.seq = ++m_seqPacket;
+    pkt.pTerrain = m_pT;
+
+    //   (, , , ,  )
+    PerFrameConstantBuffer& constants = pkt.frameConstants;
+    constants.viewproj = m_Cam.GetViewProjectionMatrixTransposed();
+    for (int i = 0; i < 4; ++i) constants.shadowtexmatrices[i] = m_DNC.GetShadowViewProjTexMatrix(i);
+    constants.eye = m_Cam.GetEyePosition();
+    for (int i = 0; i < 6; ++i) constants.frustum[i] = frustum[i];
+    constants.light = m_DNC.GetLight();
+    constants.useTextures = m_UseTextures;
+
+    //   
+    for (unsigned int i = 0; i < 4; ++i) {
+        pkt.shadowConstants[i].shadowViewProj = m_DNC.GetShadowViewProjMatrix(i);  //  
+        pkt.shadowConstants[i].eye = constants.eye;                                 //  
+        m_DNC.GetShadowFrustum(i, pkt.shadowConstants[i].frustum);                  //   
+    }
+
+    pkt.pixelAngle = m_Cam.GetPixelAngle();
+    pkt.drawMode = m_drawMode;
+    pkt.waterLevel = m_WaterLevel;
+    pkt.waterTime = m_WaterTime;
+    pkt.waterGrid = m_WaterGrid;
+    pkt.waveAmp = m_WaveAmp;
+    pkt.waveLen = m_WaveLen;
+    pkt.waveSpeed = m_WaveSpeed;
+
+    // ,    ,   
+    pkt.hasInput = m_hasPendingInput;
+    pkt.tInput = m_tFirstInput;
+    m_hasPendingInput = false;
+}
+
+void Scene::StartRenderThread() {
+    m_thrRender = std::thread(&Scene::RenderLoop, this);
+}
+
+//  -:    swap chain ?    ? ;
+//   ,  Update     
+void Scene::RenderLoop() {
+    Profiler::Get().SetThreadName("render");
+    try {
+        while (!m_isStopping.load()) {
+            // ,  swap chain    ,   ,    
+            {
+                PROFILE_SCOPE("wait for swap chain");
+                m_Scheduler.BeginFrame();
+            }
+            {
+                PROFILE_SCOPE("wait for packet");
+                while (!m_bufPackets.Acquire()) {
+                    WaitForSingleObject(m_hdlPacketReady, INFINITE);
+                    if (m_isStopping.load()) return;
+                }
+            }
+            //    ,   
+            SetEvent(m_hdlPacketRequest);
+            RenderPacket(m_bufPackets.GetReadBuffer());
+            //   :       ,      
+            Profiler::Get().Collect();
+            CounterRegistry::Get().Snapshot(); //    HUD,   
+        }
+    }
+    catch (...) {
+        m_errRender = std::current_exception();
+        m_hasRenderFailed.store(true);
+        SetEvent(m_hdlPacketRequest); //  ,    
+    }
+}
+
+void Scene::RenderPacket(const FramePacket& pkt) {
+    PROFILE_SCOPE("Scene::RenderPacket");
+    if (pkt.pTerrain != m_pTRender) SwapRenderTerrain(pkt.pTerrain); //  :  ,   
+
+    //      ;   ,      SRV
+    {
+        PROFILE_SCOPE("TerrainMaterial::Stream");
+        const XMFLOAT4& eye4 = pkt.frameConstants.eye;
+        m_pTRender->GetMaterial()->Stream(XMFLOAT3(eye4.x, eye4.y, eye4.z), pkt.listVisiblePatches, pkt.pixelAngle,
+            pkt.frameConstants.useTextures != FALSE);
+    }
 
-    m_iFrame = m_pDev->GetCurrentBackBuffer(); //  - 
+    m_Pipelines.ThrowIfFailed();               // PSO,   ,    ,    
+    {
+        PROFILE_SCOPE("wait for slot");
+        m_iFrame = m_Scheduler.AcquireSlot();  //  - ;  GPU,     
+    }
+    m_GPUProfiler.BeginFrame(m_iFrame);        //       
+    m_Constants.BeginFrame(m_iFrame);          //   : GPU   
+    m_ResMgr.RetireFileData();                 // CPU-,   GPU  
+    m_ResMgr.ProcessReleases();                //   ,       
+    m_ResMgr.SubmitUploads();                  //       
+    m_pPacket = &pkt;
     Draw();
+    m_pPacket = nullptr;
+
+    if (pkt.hasInput) {
+        //      Present ,   
+        m_msInputLast = duration<double, std::milli>(steady_clock::now() - pkt.tInput).count();
+        m_msInputSum += m_msInputLast;
+        if (m_msInputLast > m_msInputMax) m_msInputMax = m_msInputLast;
+        ++m_numInputFrames;
+    }
+
+    FrameStats& stats = m_bufStats.GetWriteBuffer();
+    stats.timing = m_Scheduler.GetLastTiming();
+    stats.window = m_Scheduler.GetLastWindow();
+    stats.msInputToPresent = m_msInputLast;
+    m_bufStats.Publish();
+}
+
+FrameStats Scene::GetFrameStats() {
+    if (m_bufStats.Acquire()) m_statsLast = m_bufStats.GetReadBuffer();
+    return m_statsLast;
+}
+
+//             Present
+void Scene::NoteInput() {
+    if (m_hasPendingInput) return;
+    m_hasPendingInput = true;
+    m_tFirstInput = steady_clock::now();
 }
 
 //   : , , ,  ,  
 void Scene::HandleKeyboardInput(UINT key) {
+    NoteInput();
     switch (key) {
     case _W: if (m_drawMode > 0) m_Cam.Translate(XMFLOAT3(MOVE_STEP, 0.0f, 0.0f)); break;
     case _S: if (m_drawMode > 0) m_Cam.Translate(XMFLOAT3(-MOVE_STEP, 0.0f, 0.0f)); break;
@@ -535,6 +912,20 @@ void Scene::HandleKeyboardInput(UINT key) {
     case VK_SPACE: m_DNC.TogglePause(); break;          //   /
     case VK_OEM_PLUS: m_WaterLevel += 1.0f; break;      //  
     case VK_OEM_MINUS: m_WaterLevel -= 1.0f; break;     //  
+    case _P: ExportTerrain(); break;                    //      PNG
+    case _C: ToggleCameraRecording(); break;            //    -benchmark   camera.path
+    case _R:                                            //      profile.json
+        JobSystem::Shared().RunBackground([]() {
+            if (Profiler::Get().WriteTrace("profile.json")) StartupReport::Line("profiler: trace written to profile.json\n");
+            else StartupReport::Line("profiler: cannot write profile.json\n");
+        });
+        break;
+    case _H: {                                          //   ,   
+        const int n = (int)(sizeof(TERRAIN_HEIGHT_MAPS) / sizeof(TERRAIN_HEIGHT_MAPS[0]));
+        if (!m_futTerrain.valid()) m_idxTerrainFile = (m_idxTerrainFile + 1) % n;
+        RequestTerrain(TERRAIN_HEIGHT_MAPS[m_idxTerrainFile], TERRAIN_DISPLACEMENT_MAP);
+        break;
+    }
     case _1: m_drawMode = 4; break;                     //  2D/
     case _2: m_drawMode = 1; break;                     //  3D
     case _3: m_drawMode = 1; break;                     //   3D
@@ -543,6 +934,7 @@ void Scene::HandleKeyboardInput(UINT key) {
 
 // :   (pitch/yaw)
 void Scene::HandleMouseInput(int x, int y) {
+    NoteInput();
     if (m_drawMode > 0) {
         m_Cam.Pitch(ROT_ANGLE * y);
         m_Cam.Yaw(-ROT_ANGLE * x);
@@ -550,7 +942,9 @@ void Scene::HandleMouseInput(int x, int y) {
 }
 void Scene::HandleMouseClick(int mouseX, int mouseY, int screenWidth, int screenHeight)
 {
-    if (!m_pT) return;
+    NoteInput();
+    //   ,      (Finalize   )
+    if (!m_pT || m_pTRendered.load() != m_pT) return;
 
     // 1.  viewProj    
     XMFLOAT4X4 vpT = m_Cam.GetViewProjectionMatrixTransposed();
@@ -614,53 +1008,133 @@ void Scene::ResetBrushStroke()
     m_hasLastBrushPoint = false;
 }
 
+void Scene::ExportTerrain()
+{
+    if (!m_pT) return;
+    if (m_futExport.valid() && m_futExport.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        StartupReport::Line("export: previous export is still running\n");
+        return;
+    }
+
+    //     ;    ,   
+    auto t0 = steady_clock::now();
+    auto snap = std::make_shared<TerrainSnapshot>();
+    m_pT->Snapshot(*snap);
+    double msSnapshot = duration<double, std::milli>(steady_clock::now() - t0).count();
+
+    //  : EncodePNG16     ,  ,   
+    m_futExport = JobSystem::Shared().Submit([snap, msSnapshot]() {
+        auto save = [](const char* fn, const std::vector<uint16_t>& data, unsigned int w, unsigned int h) {
+            if (data.empty()) return;
+            PNGExportStats stats;
+            auto t = steady_clock::now();
+            bool isOk = SavePNG16(fn, data.data(), w, h, &stats);
+            double ms = duration<double, std::milli>(steady_clock::now() - t).count();
+            if (!isOk) {
+                StartupReport::Line("export: failed to write %s\n", fn);
+                return;
+            }
+            StartupReport::Line("export: %s %ux%u, %u pieces, %.1f MB -> %.1f MB, filter %.1f ms, deflate %.1f ms, total %.1f ms\n",
+                fn, w, h, stats.numPieces, stats.bytesRaw / 1048576.0, stats.bytesPNG / 1048576.0,
+                stats.msFilter, stats.msDeflate, ms);
+        };
+        StartupReport::Line("export: snapshot %.2f ms on the frame thread\n", msSnapshot);
+        save("terrain_height.png", snap->height, snap->wHeight, snap->hHeight);
+        save("terrain_mask.png", snap->mask, snap->wMask, snap->hMask);
+    });
+}
+
+
+void Scene::RequestTerrain(const char* fnHeightMap, const char* fnDisplacementMap)
+{
+    if (m_futTerrain.valid()) {
+        StartupReport::Line("terrain: previous request is still loading\n");
+        return;
+    }
+
+    ResourceManager* rm = &m_ResMgr;
+    TerrainMaterial* mat = m_pMat;
+    std::string fnH = fnHeightMap, fnD = fnDisplacementMap;
+    //  :   BC-        ,  ;
+    //     ,      
+    m_futTerrain = JobSystem::Shared().Submit([rm, mat, fnH, fnD]() {
+        auto t0 = steady_clock::now();
+        Terrain* t = Terrain::Build(rm, mat, fnH.c_str(), fnD.c_str());
+        StartupReport::Line("terrain: %s built in the background in %.1f ms\n", fnH.c_str(),
+            duration<double, std::milli>(steady_clock::now() - t0).count());
+        return t;
+    });
+}
+
+// :     ; GPU- (Finalize)      
+void Scene::SwapTerrainIfReady()
+{
+    if (!m_futTerrain.valid() || m_futTerrain.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+    if (m_pTRendered.load() != m_pT) return; //      
+
+    Terrain* t = nullptr;
+    try {
+        t = m_futTerrain.get();
+    }
+    catch (const std::exception& e) {
+        //   
+        StartupReport::Line("terrain: background load failed, keeping the current one: %s\n", e.what());
+        return;
+    }
+
+    m_pT = t;
+    m_hasLastBrushPoint = false;
+}
+
+// :     .       GPU  ,  
+// ;     ,     . 
+// Finalize         ,    -
+void Scene::SwapRenderTerrain(Terrain* t) {
+    t->Finalize();
+    Terrain* old = m_pTRender;
+    m_pTRender = t;
+    old->Release();
+    delete old;
+    m_pTRendered.store(t);
+    StartupReport::Line("terrain: swapped in\n");
+}
 
 //   ( AABB-     , )
-void Scene::DrawWater(ID3D12GraphicsCommandList* cmdList) {
-    BoundingSphere bs = m_pT->GetBoundingSphere();
+void Scene::DrawWater(CommandList* cmdList) {
+    PROFILE_SCOPE("Scene::DrawWater");
+    GPUProfileScope scopeGPU(m_GPUProfiler, cmdList, m_gpuWater);
+    BoundingSphere bs = m_pTRender->GetBoundingSphere();
     XMFLOAT3 c = bs.GetCenter();
     float half = bs.GetRadius();
 
-    XMFLOAT4 frustum[6];
-    m_Cam.GetViewFrustum(frustum);
+    const XMFLOAT4* frustum = m_pPacket->frameConstants.frustum;
 
-    XMFLOAT3 aabbCenter(c.x, c.y, m_WaterLevel);
+    XMFLOAT3 aabbCenter(c.x, c.y, m_pPacket->waterLevel);
     XMFLOAT3 aabbExtent(half, half, 20.0f);
     if (__AABBOutsideFrustum(frustum, aabbCenter, aabbExtent)) return; //  
 
-    ID3D12PipelineState* pso = m_listPSOs[2];
-    ID3D12RootSignature* rs = m_listRootSigs[2];
-
-    cmdList->SetPipelineState(pso);
-    cmdList->SetGraphicsRootSignature(rs);
+    if (!m_Pipelines.SetPipeline(cmdList, m_hdlPSOWater)) return;
     cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
     //  VP
-    XMFLOAT4X4 vp = m_Cam.GetViewProjectionMatrixTransposed();
+    const XMFLOAT4X4& vp = m_pPacket->frameConstants.viewproj;
     cmdList->SetGraphicsRoot32BitConstants(0, 16, &vp, 0);
 
     //   (, , , )
+    const FramePacket& pkt = *m_pPacket;
     struct WaterParams { float centerX, centerY, halfSize, level; float time, grid, amp, waveLen, waveSpeed; } wp;
-    wp.centerX = c.x; wp.centerY = c.y; wp.halfSize = half; wp.level = m_WaterLevel;
-    wp.time = m_WaterTime; wp.grid = (float)m_WaterGrid; wp.amp = m_WaveAmp; wp.waveLen = m_WaveLen; wp.waveSpeed = m_WaveSpeed;
+    wp.centerX = c.x; wp.centerY = c.y; wp.halfSize = half; wp.level = pkt.waterLevel;
+    wp.time = pkt.waterTime; wp.grid = (float)pkt.waterGrid; wp.amp = pkt.waveAmp; wp.waveLen = pkt.waveLen; wp.waveSpeed = pkt.waveSpeed;
 
     cmdList->SetGraphicsRoot32BitConstants(1, 9, &wp, 0);
 
     //    ( )
-    UINT vertexCount = (UINT)m_WaterGrid * (UINT)m_WaterGrid * 6u;
+    UINT vertexCount = (UINT)pkt.waterGrid * (UINT)pkt.waterGrid * 6u;
     cmdList->DrawInstanced(vertexCount, 1, 0, 0);
 }
 
 // -PSO  : ,   RS/
 void Scene::InitPipelineTerrain3D_Debug() {
-    ID3D12RootSignature* sigRoot = m_listRootSigs[0];
-
-    D3D12_SHADER_BYTECODE bcVS = {}, bcPS = {}, bcHS = {}, bcDS = {};
-    CompileShader(L"RenderTerrainTessVS.hlsl", VERTEX_SHADER, bcVS);
-    CompileShader(L"RenderTerrainTessPS.hlsl", PIXEL_SHADER, bcPS);
-    CompileShader(L"RenderTerrainTessHS.hlsl", HULL_SHADER, bcHS);
-    CompileShader(L"RenderTerrainTessDS.hlsl", DOMAIN_SHADER, bcDS);
-
     DXGI_SAMPLE_DESC samp = {}; samp.Count = 1;
 
     D3D12_INPUT_ELEMENT_DESC layout[] = {
@@ -673,9 +1147,7 @@ void Scene::InitPipelineTerrain3D_Debug() {
 
     //   ,  FillMode = WIREFRAME
     D3D12_GRAPHICS_PIPELINE_STATE_DESC p = {};
-    p.pRootSignature = sigRoot;
     p.InputLayout = ild;
-    p.VS = bcVS; p.PS = bcPS; p.HS = bcHS; p.DS = bcDS;
     p.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_PATCH;
     p.NumRenderTargets = 1; p.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
     p.DSVFormat = DXGI_FORMAT_D32_FLOAT;
@@ -686,7 +1158,12 @@ void Scene::InitPipelineTerrain3D_Debug() {
     p.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
     p.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
 
-    ID3D12PipelineState* psoDbg = nullptr;
-    m_pDev->CreatePSO(&p, psoDbg);
-    m_listPSOs.push_back(psoDbg);
+    //   ,   :      .   ,
+    //  _1   
+    PipelineShaders shaders;
+    shaders.vs = L"RenderTerrainTessVS.hlsl";
+    shaders.hs = L"RenderTerrainTessHS.hlsl";
+    shaders.ds = L"RenderTerrainTessDS.hlsl";
+    shaders.ps = L"RenderTerrainTessPS.hlsl";
+    m_hdlPSOWireframe = m_Pipelines.Request("terrain wireframe", m_hdlRootTerrain, p, shaders, m_hdlPSOTerrain);
 }
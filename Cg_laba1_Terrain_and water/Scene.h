@@ -1,10 +1,25 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <exception>
+#include <filesystem>
+#include <future>
+#include <string>
+#include <thread>
 #include "Frame.h"
+#include "FrameScheduler.h"
+#include "GPUProfiler.h"
+#include "ConstantAllocator.h"
+#include "PipelineRegistry.h"
+#include "RenderGraph.h"
+#include "TransientPool.h"
+#include "TripleBuffer.h"
 #include "ResourceManager.h"
 #include "Terrain.h"
 #include "Camera.h"
+#include "CameraPath.h"
+#include "Counters.h"
 #include "DayNightCycle.h"
 
 using namespace graphics;
@@ -15,11 +30,51 @@ enum InputKeys { _0 = 0x30, _1, _2, _3, _4, _5, _6, _7, _8, _9, _A = 0x41, _B, _
 
 static const int FRAME_BUFFER_COUNT = 3; // triple buffering.
 
+// ,  -      ;  Publish  
+struct FramePacket {
+    unsigned long long          seq = 0;
+    Terrain*                    pTerrain = nullptr;     //  ; ,   ,   
+    PerFrameConstantBuffer      frameConstants{};       // ,  , , ,  
+    ShadowMapShaderConstants    shadowConstants[4]{};
+    std::vector<PatchBounds>    listVisiblePatches;     //     
+    float                       pixelAngle = 0.0f;
+    int                         drawMode = 1;
+    float                       waterLevel = 0.0f;
+    float                       waterTime = 0.0f;
+    int                         waterGrid = 0;
+    float                       waveAmp = 0.0f;
+    float                       waveLen = 0.0f;
+    float                       waveSpeed = 0.0f;
+    bool                        hasInput = false;       // tInput     ,   
+    std::chrono::steady_clock::time_point tInput;
+};
+
+//  -     
+struct FrameStats {
+    FrameTiming                 timing;
+    FrameWindow                 window;                 //     (~1 )
+    double                      msInputToPresent = 0.0; //  ,    
+};
+
+//  .     : , , , ,  ; Update 
+//    . -          
+//  ,     GPU: , , Finalize/Release ,   Present.
+//    ,    ,     N+1 ,   N.
 class Scene {
 public:
-    Scene(int height, int width, Device* DEV);
+    // numFramesInFlight:        GPU (1..FRAME_BUFFER_COUNT)
+    Scene(int height, int width, Device* DEV, unsigned int numFramesInFlight = 2);
     ~Scene();
 
+    //      -;     ( )
+    void StartRenderThread();
+    // ,  -   :   ,   
+    HANDLE GetPacketRequestEvent() const { return m_hdlPacketRequest; }
+    //          ;   
+    FrameStats GetFrameStats();
+    unsigned int GetFramesInFlight() const { return m_Scheduler.GetFramesInFlight(); }
+
+    //     ;   -,   
     void Update();
     void Draw();
 
@@ -30,11 +85,39 @@ public:
 
     bool RaycastTerrain(int mouseX, int mouseY, int screenWidth, int screenHeight, XMFLOAT3& outHit);
     void ResetBrushStroke();
+
+    //       16- PNG;   ,      
+    void ExportTerrain();
+    //         ;  ,  Update   
+    //   .    ,  
+    void RequestTerrain(const char* fnHeightMap, const char* fnDisplacementMap);
+
+    //             ( )  
+    void SetParallelRecording(bool isParallel) { m_isParallelRecording = isParallel; }
+    // numFrames      ,    GPU,   
+    void BenchmarkRecording(unsigned int numFrames);
+    // :    path (   ),    dt,  ;  
+    // -.  fnReport  ,     
+    void StartBenchmark(const CameraPath& path, const std::string& namePath, float dt, const std::filesystem::path& fnReport);
+    bool IsBenchmarkDone() const { return m_isPlayingPath && m_timePath > m_pathPlay.GetDuration(); }
+    //     ;      camera.path
+    void ToggleCameraRecording();
 private:
+    void BuildPacket(FramePacket& pkt);
+    void NoteInput();
+    void RenderLoop();
+    void RenderPacket(const FramePacket& pkt);
+    void SwapRenderTerrain(Terrain* t);
+    void RecordFrame(bool isParallel);
+    void RecordPass(unsigned int iPass);
+
+    void SwapTerrainIfReady();
+    void WriteBenchmark();
 
     void CloseCommandLists();
+    void InitRenderGraph(int height, int width);
 
-    void SetViewport(ID3D12GraphicsCommandList* cmdList);
+    void SetViewport(CommandList* cmdList);
 
     void InitPipelineTerrain2D();
 
@@ -44,27 +127,45 @@ private:
 
     // --- Water ---
     void InitPipelineWater();
-    void DrawWater(ID3D12GraphicsCommandList* cmdList);
+    void DrawWater(CommandList* cmdList);
 
 
-    void DrawTerrain(ID3D12GraphicsCommandList* cmdList);
+    void DrawTerrain(CommandList* cmdList);
 
-    void DrawShadowMap(ID3D12GraphicsCommandList* cmdList);
+    void DrawShadowCascade(CommandList* cmdList, unsigned int i);
     void InitPipelineTerrain3D_Debug();
 
 
     Device* m_pDev = nullptr;
     ResourceManager                     m_ResMgr;
+    FrameScheduler                      m_Scheduler;
+    GPUProfiler                         m_GPUProfiler;          //       GPU 
+    unsigned int                        m_gpuShadow[4] = {};
+    unsigned int                        m_gpuTerrain = 0;
+    unsigned int                        m_gpuWater = 0;
+    RenderGraph                         m_Graph;                //   ->  
+    TransientPool                       m_PoolTransient;        //    ,    
+    unsigned int                        m_idBackBuffer = 0;
+    ConstantAllocator                   m_Constants;            //      root CBV
+    PipelineRegistry                    m_Pipelines;            // root-  PSO,   
+    unsigned int                        m_hdlRootTerrain = PIPELINE_NONE;
+    unsigned int                        m_hdlPSOTerrain = PIPELINE_NONE;
+    unsigned int                        m_hdlPSOShadow = PIPELINE_NONE;
+    unsigned int                        m_hdlPSOWater = PIPELINE_NONE;
+    unsigned int                        m_hdlPSOWireframe = PIPELINE_NONE;
+    std::vector<ID3D12Resource*>        m_listGraphResources[::FRAME_BUFFER_COUNT]; //    ,     -
     Frame* m_pFrames[::FRAME_BUFFER_COUNT]{};
-    ID3D12GraphicsCommandList* m_pCmdList = nullptr;
-    Terrain* m_pT = nullptr;
+    CommandList* m_pCmdLists[FRAME_PASS_COUNT]{};    //     
+    bool m_isParallelRecording = true;
+    Terrain* m_pT = nullptr;                            //  
+    Terrain* m_pTRender = nullptr;                      //  -,   m_pT  
+    std::atomic<Terrain*> m_pTRendered{ nullptr };      //     
+    TerrainMaterial* m_pMat = nullptr;
     Camera                              m_Cam;
     DayNightCycle                       m_DNC;
     D3D12_VIEWPORT                      m_vpMain{};
     D3D12_RECT                          m_srMain{};
     int                                 m_drawMode = 1;
-    std::vector<ID3D12RootSignature*>   m_listRootSigs;
-    std::vector<ID3D12PipelineState*>   m_listPSOs;
     int                                 m_iFrame = 0;
     bool                                m_UseTextures = false;
     bool                                m_LockToTerrain = false;
@@ -76,6 +177,40 @@ private:
     float                               m_WaveLen = 50.0f;
     float                               m_WaveSpeed = 0.8f;
     std::chrono::steady_clock::time_point m_prevTime;
+    float                               m_dtFixed = 0.0f;       // > 0:     
+    CameraPath                          m_pathPlay;
+    bool                                m_isPlayingPath = false;
+    float                               m_timePath = 0.0f;
+    unsigned long long                  m_numPathFrames = 0;
+    std::string                         m_namePath;
+    std::filesystem::path               m_fnBenchmark;
+    unsigned int                        m_readerBenchmark = CounterRegistry::MAX_READERS;
+    std::chrono::steady_clock::time_point m_tBenchmark;
+    CameraPath                          m_pathRecord;
+    bool                                m_isRecordingPath = false;
+    float                               m_timeRecord = 0.0f;
     bool     m_hasLastBrushPoint = false;
     XMFLOAT3 m_lastBrushPoint = XMFLOAT3(0, 0, 0);
+    std::future<void> m_futExport;   //   ,  
+    std::future<Terrain*> m_futTerrain;  //    ,  
+    int m_idxTerrainFile = 0;            //        
+
+    // ---    - ---
+    TripleBuffer<FramePacket>   m_bufPackets;
+    TripleBuffer<FrameStats>    m_bufStats;
+    const FramePacket*          m_pPacket = nullptr;    // ,   
+    unsigned long long          m_seqPacket = 0;
+    HANDLE                      m_hdlPacketRequest = nullptr;
+    HANDLE                      m_hdlPacketReady = nullptr;
+    std::thread                 m_thrRender;
+    std::atomic<bool>           m_isStopping{ false };
+    std::atomic<bool>           m_hasRenderFailed{ false };
+    std::exception_ptr          m_errRender;
+    bool                        m_hasPendingInput = false;
+    std::chrono::steady_clock::time_point m_tFirstInput;
+    FrameStats                  m_statsLast;            // : ,   
+    double                      m_msInputLast = 0.0;    //   -
+    double                      m_msInputSum = 0.0;
+    double                      m_msInputMax = 0.0;
+    unsigned long long          m_numInputFrames = 0;
 };
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+#include "StartupReport.h"
+
+// The checks of one SelfTest: expect(cond, "what") prints the line with ok or FAILED (quiet: failures
+// only), Finish prints the verdict under the test's name and returns it.
+class SelfTestExpect {
+public:
+    explicit SelfTestExpect(bool isQuiet = false) : m_isQuiet(isQuiet) {}
+
+    bool operator()(bool cond, const char* what) {
+        if (!cond) m_isOk = false;
+        if (!m_isQuiet) StartupReport::Line("  %-64s %s\n", what, cond ? "ok" : "FAILED");
+        else if (!cond) StartupReport::Line("  FAILED: %s\n", what);
+        return cond;
+    }
+
+    bool IsOk() const { return m_isOk; }
+    bool Finish(const char* name) const {
+        StartupReport::Line("\n%s self test: %s\n", name, m_isOk ? "passed" : "FAILED");
+        return m_isOk;
+    }
+
+private:
+    bool    m_isQuiet;
+    bool    m_isOk = true;
+};
@@ -0,0 +1,442 @@
+#include "ShaderCache.h"
+#include "JobSystem.h"
+#include "SelfTest.h"
+#include "StartupReport.h"
+#include "TextureCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+using std::chrono::steady_clock;
+
+static const uint32_t SHADER_CACHE_MAGIC = 0x31434853; // "SHC1"
+static const uint32_t SHADER_CACHE_VERSION = 1;
+static const uint64_t SHADER_MAX_BYTECODE = 16ull << 20;
+
+struct ShaderCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t size;
+};
+
+static bool ReadSource(const std::filesystem::path& fn, std::string& text) {
+    std::ifstream in(fn, std::ios::binary);
+    if (!in) return false;
+    text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static std::shared_future<void> ReadyFuture() {
+    std::promise<void> done;
+    done.set_value();
+    return done.get_future().share();
+}
+
+static uint64_t HashString(const std::string& s, uint64_t h) {
+    return HashBytes(s.data(), s.size(), h);
+}
+
+ShaderCache::ShaderCache(ShaderCompileFn compile, JobSystem* jobs, const std::filesystem::path& dir, ShaderReadFn read)
+    : m_fnCompile(std::move(compile)), m_fnRead(read ? std::move(read) : ShaderReadFn(ReadSource)), m_pJobs(jobs), m_dir(dir) {
+}
+
+ShaderCache::~ShaderCache() {
+    std::vector<std::shared_future<void>> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        for (const std::unique_ptr<Entry>& e : m_listEntries) pending.push_back(e->fut);
+    }
+    for (std::shared_future<void>& fut : pending) fut.wait();
+}
+
+uint64_t ShaderCache::MakeKey(const ShaderDesc& desc) const {
+    std::string text;
+    if (!m_fnRead(desc.file, text)) return 0;
+
+    uint64_t h = HashString(desc.file, SHADER_CACHE_VERSION);
+    h = HashString(text, h);
+    std::vector<std::string> visited(1, std::filesystem::path(desc.file).lexically_normal().generic_string());
+    HashIncludes(desc.file, text, visited, h);
+
+    h = HashString(desc.entry, h);
+    h = HashString(desc.target, h);
+    for (const auto& def : desc.defines) {
+        h = HashString(def.first, h);
+        h = HashString(def.second, h);
+    }
+    h = HashBytes(&desc.flags, sizeof(desc.flags), h);
+    return h ? h : 1;
+}
+
+// #include "x" and #include <x>, relative to the including file. A commented-out include counts too,
+// which costs no more than a recompile when it changes.
+void ShaderCache::HashIncludes(const std::filesystem::path& fn, const std::string& text,
+    std::vector<std::string>& visited, uint64_t& h) const {
+    size_t pos = 0;
+    while ((pos = text.find("#include", pos)) != std::string::npos) {
+        pos += 8;
+        const size_t open = text.find_first_of("\"<\n", pos);
+        if (open == std::string::npos || text[open] == '\n') continue;
+        const char close = text[open] == '"' ? '"' : '>';
+        const size_t end = text.find_first_of(std::string(1, close) + "\n", open + 1);
+        if (end == std::string::npos || text[end] != close) continue;
+
+        const std::filesystem::path inc = fn.parent_path() / text.substr(open + 1, end - open - 1);
+        const std::string name = inc.lexically_normal().generic_string();
+        if (std::find(visited.begin(), visited.end(), name) != visited.end()) continue;
+        visited.push_back(name);
+
+        h = HashString(name, h);
+        std::string textInc;
+        if (!m_fnRead(inc, textInc)) continue; // the compiler will say so
+        h = HashString(textInc, h);
+        HashIncludes(inc, textInc, visited, h);
+    }
+}
+
+unsigned int ShaderCache::Request(const ShaderDesc& desc) {
+    ++m_numRequests;
+    const uint64_t key = MakeKey(desc);
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (key) {
+        auto it = m_mapKeys.find(key);
+        if (it != m_mapKeys.end()) {
+            ++m_numShared;
+            return it->second;
+        }
+    }
+
+    const unsigned int handle = static_cast<unsigned int>(m_listEntries.size());
+    m_listEntries.push_back(std::make_unique<Entry>());
+    Entry* e = m_listEntries.back().get();
+    e->key = key;
+    e->desc = desc;
+    if (!key) {
+        e->err = "ShaderCache: cannot read " + desc.file;
+        ++m_numFailed;
+        e->fut = ReadyFuture();
+        return handle;
+    }
+    m_mapKeys[key] = handle;
+
+    if (m_pJobs) {
+        e->fut = m_pJobs->Submit([this, e]() { Build(*e); }).share();
+    }
+    else {
+        Build(*e);
+        e->fut = ReadyFuture();
+    }
+    return handle;
+}
+
+void ShaderCache::Build(Entry& e) {
+    if (Load(e.key, e.bytecode)) {
+        ++m_numDiskHits;
+        e.isOk = true;
+        return;
+    }
+
+    auto t0 = steady_clock::now();
+    std::string err;
+    try {
+        e.isOk = m_fnCompile(e.desc, e.bytecode, err);
+    }
+    catch (const std::exception& ex) {
+        e.isOk = false;
+        err = ex.what();
+    }
+    m_usCompile += static_cast<unsigned long long>(
+        std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - t0).count());
+
+    if (!e.isOk || e.bytecode.empty()) {
+        e.isOk = false;
+        e.bytecode.clear();
+        e.err = e.desc.file + " (" + e.desc.entry + ", " + e.desc.target + "): " + (err.empty() ? "no bytecode" : err);
+        ++m_numFailed;
+        return;
+    }
+    ++m_numCompiled;
+    Store(e.key, e.bytecode);
+}
+
+bool ShaderCache::Wait(unsigned int handle, std::string* err) {
+    Entry* e = nullptr;
+    std::shared_future<void> fut;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        e = m_listEntries[handle].get();
+        fut = e->fut;
+    }
+    fut.wait();
+    if (!e->isOk && err) *err = e->err;
+    return e->isOk;
+}
+
+const std::vector<unsigned char>& ShaderCache::GetBytecode(unsigned int handle) const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_listEntries[handle]->bytecode;
+}
+
+uint64_t ShaderCache::GetKey(unsigned int handle) const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_listEntries[handle]->key;
+}
+
+std::filesystem::path ShaderCache::GetEntryPath(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.cso", static_cast<unsigned long long>(key));
+    return m_dir / name;
+}
+
+bool ShaderCache::Load(uint64_t key, std::vector<unsigned char>& bytecode) const {
+    if (m_dir.empty()) return false;
+    std::ifstream in(GetEntryPath(key), std::ios::binary);
+    if (!in) return false;
+
+    ShaderCacheHeader hdr = {};
+    in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr));
+    if (!in || hdr.magic != SHADER_CACHE_MAGIC || hdr.version != SHADER_CACHE_VERSION || hdr.key != key ||
+        hdr.size == 0 || hdr.size > SHADER_MAX_BYTECODE) {
+        return false;
+    }
+    bytecode.resize(static_cast<size_t>(hdr.size));
+    in.read(reinterpret_cast<char*>(bytecode.data()), static_cast<std::streamsize>(hdr.size));
+    if (in.gcount() != static_cast<std::streamsize>(hdr.size)) {
+        bytecode.clear();
+        return false;
+    }
+    return true;
+}
+
+void ShaderCache::Store(uint64_t key, const std::vector<unsigned char>& bytecode) const {
+    if (m_dir.empty()) return;
+    std::error_code ec;
+    std::filesystem::create_directories(m_dir, ec);
+
+    ShaderCacheHeader hdr = {};
+    hdr.magic = SHADER_CACHE_MAGIC;
+    hdr.version = SHADER_CACHE_VERSION;
+    hdr.key = key;
+    hdr.size = bytecode.size();
+
+    // temp name, then rename, as in TextureCache: another process may be loading the same key
+    std::filesystem::path p = GetEntryPath(key);
+    std::filesystem::path tmp = p;
+    tmp += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream outFile(tmp, std::ios::binary | std::ios::trunc);
+        if (!outFile) return;
+        outFile.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        outFile.write(reinterpret_cast<const char*>(bytecode.data()), static_cast<std::streamsize>(bytecode.size()));
+        if (!outFile) {
+            outFile.close();
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(tmp, p, ec);
+    if (ec) std::filesystem::remove(tmp, ec);
+}
+
+void ShaderCache::Report() const {
+    StartupReport::Line("  shaders: %u requested, %u shared, %u from disk, %u compiled (%.1f ms over all threads), %u failed\n",
+        m_numRequests.load(), m_numShared.load(), m_numDiskHits.load(), m_numCompiled.load(),
+        m_usCompile.load() / 1000.0, m_numFailed.load());
+}
+
+bool ShaderCache::SelfTest() {
+    SelfTestExpect expect(true);
+
+    // sources in memory; the stub "compiles" a source to its target, defines and text, and fails on "error"
+    std::mutex mtxSources;
+    std::unordered_map<std::string, std::string> sources;
+    auto setSource = [&](const std::string& fn, const std::string& text) {
+        std::lock_guard<std::mutex> lock(mtxSources);
+        sources[fn] = text;
+    };
+    ShaderReadFn read = [&](const std::filesystem::path& fn, std::string& text) {
+        std::lock_guard<std::mutex> lock(mtxSources);
+        auto it = sources.find(fn.lexically_normal().generic_string());
+        if (it == sources.end()) return false;
+        text = it->second;
+        return true;
+    };
+    std::atomic<unsigned int> numCalls{ 0 };
+    ShaderCompileFn compile = [&](const ShaderDesc& desc, std::vector<unsigned char>& bytecode, std::string& err) {
+        ++numCalls;
+        std::string text;
+        if (!read(desc.file, text)) {
+            err = "cannot open file";
+            return false;
+        }
+        if (text.find("error") != std::string::npos) {
+            err = "X3000: syntax error";
+            return false;
+        }
+        std::string out = desc.target;
+        for (const auto& def : desc.defines) out += " " + def.first + "=" + def.second;
+        out += " | " + text;
+        bytecode.assign(out.begin(), out.end());
+        return true;
+    };
+    auto bytecodeText = [](ShaderCache& cache, unsigned int h) {
+        const std::vector<unsigned char>& bc = cache.GetBytecode(h);
+        return std::string(bc.begin(), bc.end());
+    };
+    auto makeDesc = [](const char* file, const char* target) {
+        ShaderDesc desc;
+        desc.file = file;
+        desc.target = target;
+        return desc;
+    };
+
+    setSource("shaders/common.hlsli", "float3 g_light;");
+    setSource("shaders/terrain_vs.hlsl", "#include \"common.hlsli\"\nvoid main() {}");
+    setSource("shaders/terrain_ps.hlsl", "#include \"common.hlsli\"\nfloat4 main() : SV_Target { return 1; }");
+    setSource("shaders/broken_ps.hlsl", "float4 main() { error }");
+
+    // identical requests share one compilation
+    {
+        StartupReport::Line("\n=== Shader cache: sharing ===\n");
+        ShaderCache cache(compile, nullptr, "", read);
+        numCalls = 0;
+        const unsigned int vs = cache.Request(makeDesc("shaders/terrain_vs.hlsl", "vs_5_0"));
+        const unsigned int vsAgain = cache.Request(makeDesc("shaders/terrain_vs.hlsl", "vs_5_0"));
+        ShaderDesc descDefine = makeDesc("shaders/terrain_vs.hlsl", "vs_5_0");
+        descDefine.defines.push_back({ "SHADOW", "1" });
+        const unsigned int vsShadow = cache.Request(descDefine);
+        ShaderDesc descFlags = makeDesc("shaders/terrain_vs.hlsl", "vs_5_0");
+        descFlags.flags = 1;
+        const unsigned int vsFlags = cache.Request(descFlags);
+
+        StartupReport::Line("  handles %u %u %u %u, %u compiler calls\n", vs, vsAgain, vsShadow, vsFlags, numCalls.load());
+        expect(vs == vsAgain, "the same request gets the same handle");
+        expect(vsShadow != vs && vsFlags != vs && vsFlags != vsShadow, "defines and flags are part of the key");
+        expect(numCalls == 3, "three distinct compilations call the compiler three times");
+        expect(cache.Wait(vs) && bytecodeText(cache, vs).find("vs_5_0 |") == 0, "the bytecode is what the compiler made");
+        expect(cache.Wait(vsShadow) && bytecodeText(cache, vsShadow).find("SHADOW=1") != std::string::npos,
+            "the define reached the compiler");
+    }
+
+    // the key follows the included files
+    {
+        StartupReport::Line("\n=== Shader cache: includes ===\n");
+        ShaderCache cache(compile, nullptr, "", read);
+        const uint64_t keyVS = cache.MakeKey(makeDesc("shaders/terrain_vs.hlsl", "vs_5_0"));
+        const uint64_t keyPS = cache.MakeKey(makeDesc("shaders/terrain_ps.hlsl", "ps_5_0"));
+        setSource("shaders/common.hlsli", "float3 g_light; float g_time;");
+        const uint64_t keyVSEdited = cache.MakeKey(makeDesc("shaders/terrain_vs.hlsl", "vs_5_0"));
+        const uint64_t keyPSEdited = cache.MakeKey(makeDesc("shaders/terrain_ps.hlsl", "ps_5_0"));
+        setSource("shaders/common.hlsli", "float3 g_light;");
+
+        StartupReport::Line("  vs %016llx -> %016llx after editing the header\n",
+            static_cast<unsigned long long>(keyVS), static_cast<unsigned long long>(keyVSEdited));
+        expect(keyVS != 0 && keyPS != 0, "readable sources get a key");
+        expect(keyVS != keyVSEdited && keyPS != keyPSEdited, "editing an included header changes the key");
+        expect(cache.MakeKey(makeDesc("shaders/terrain_vs.hlsl", "vs_5_0")) == keyVS, "undoing the edit restores the key");
+
+        setSource("shaders/a.hlsli", "#include \"b.hlsli\"");
+        setSource("shaders/b.hlsli", "#include \"a.hlsli\"");
+        setSource("shaders/cycle.hlsl", "#include \"a.hlsli\"\nvoid main() {}");
+        expect(cache.MakeKey(makeDesc("shaders/cycle.hlsl", "vs_5_0")) != 0, "an include cycle still gets a key");
+        expect(cache.MakeKey(makeDesc("shaders/missing.hlsl", "vs_5_0")) == 0, "a missing source gets no key");
+    }
+
+    // failures reach Wait with the compiler's message
+    {
+        StartupReport::Line("\n=== Shader cache: failures ===\n");
+        ShaderCache cache(compile, nullptr, "", read);
+        std::string err;
+        const bool isBroken = cache.Wait(cache.Request(makeDesc("shaders/broken_ps.hlsl", "ps_5_0")), &err);
+        StartupReport::Line("  broken: %s\n", err.c_str());
+        expect(!isBroken && err.find("X3000") != std::string::npos, "a failed compile reports the compiler's error");
+        err.clear();
+        const bool isMissing = cache.Wait(cache.Request(makeDesc("shaders/missing.hlsl", "ps_5_0")), &err);
+        StartupReport::Line("  missing: %s\n", err.c_str());
+        expect(!isMissing && !err.empty(), "a missing source fails without calling the compiler");
+    }
+
+    // a second cache over the same directory loads instead of compiling
+    {
+        StartupReport::Line("\n=== Shader cache: disk ===\n");
+        std::error_code ec;
+        const std::filesystem::path dir = std::filesystem::temp_directory_path(ec) / "shadercache_selftest";
+        std::filesystem::remove_all(dir, ec);
+
+        std::string bcFirst;
+        {
+            ShaderCache cache(compile, nullptr, dir, read);
+            numCalls = 0;
+            const unsigned int vs = cache.Request(makeDesc("shaders/terrain_vs.hlsl", "vs_5_0"));
+            cache.Request(makeDesc("shaders/terrain_ps.hlsl", "ps_5_0"));
+            cache.Request(makeDesc("shaders/broken_ps.hlsl", "ps_5_0"));
+            cache.Wait(vs);
+            bcFirst = bytecodeText(cache, vs);
+            expect(numCalls == 3 && cache.GetDiskHits() == 0, "the first run compiles everything");
+        }
+        {
+            ShaderCache cache(compile, nullptr, dir, read);
+            numCalls = 0;
+            const unsigned int vs = cache.Request(makeDesc("shaders/terrain_vs.hlsl", "vs_5_0"));
+            cache.Request(makeDesc("shaders/terrain_ps.hlsl", "ps_5_0"));
+            const unsigned int broken = cache.Request(makeDesc("shaders/broken_ps.hlsl", "ps_5_0"));
+            StartupReport::Line("  second run: %u from disk, %u compiler calls\n", cache.GetDiskHits(), numCalls.load());
+            expect(cache.GetDiskHits() == 2, "the second run loads both good shaders");
+            expect(numCalls == 1 && !cache.Wait(broken), "a failure is not cached");
+            expect(cache.Wait(vs) && bytecodeText(cache, vs) == bcFirst, "the loaded bytecode is the compiled one");
+        }
+        {
+            // a truncated entry is compiled again
+            ShaderCache cache(compile, nullptr, dir, read);
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.cso",
+                static_cast<unsigned long long>(cache.MakeKey(makeDesc("shaders/terrain_vs.hlsl", "vs_5_0"))));
+            std::filesystem::resize_file(dir / name, sizeof(ShaderCacheHeader) + 2, ec);
+            numCalls = 0;
+            const unsigned int vs = cache.Request(makeDesc("shaders/terrain_vs.hlsl", "vs_5_0"));
+            expect(!ec && numCalls == 1 && cache.Wait(vs) && bytecodeText(cache, vs) == bcFirst,
+                "a truncated entry is compiled again");
+        }
+        std::filesystem::remove_all(dir, ec);
+    }
+
+    // many threads requesting overlapping shaders on a job system
+    {
+        StartupReport::Line("\n=== Shader cache: parallel ===\n");
+        JobSystem jobs(3);
+        ShaderCache cache(compile, &jobs, "", read);
+        numCalls = 0;
+        const unsigned int NUM_VARIANTS = 24;
+        std::vector<unsigned int> handles[4];
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t]() {
+                for (unsigned int i = 0; i < NUM_VARIANTS; ++i) {
+                    ShaderDesc desc = makeDesc("shaders/terrain_ps.hlsl", "ps_5_0");
+                    desc.defines.push_back({ "VARIANT", std::to_string(i) });
+                    handles[t].push_back(cache.Request(desc));
+                }
+            });
+        }
+        for (std::thread& t : threads) t.join();
+
+        bool isSame = true, isRight = true;
+        for (unsigned int i = 0; i < NUM_VARIANTS; ++i) {
+            for (unsigned int t = 1; t < 4; ++t) isSame = isSame && handles[t][i] == handles[0][i];
+            const std::string want = "VARIANT=" + std::to_string(i) + " |";
+            isRight = isRight && cache.Wait(handles[0][i]) && bytecodeText(cache, handles[0][i]).find(want) != std::string::npos;
+        }
+        StartupReport::Line("  %u requests, %u compiler calls, %u shared\n", 4 * NUM_VARIANTS, numCalls.load(),
+            cache.GetSharedCount());
+        expect(isSame, "every thread got the same handle for the same variant");
+        expect(numCalls == NUM_VARIANTS, "each variant was compiled once");
+        expect(isRight, "each handle holds its own variant");
+    }
+
+    return expect.Finish("shader cache");
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class JobSystem;
+
+// One compilation: source file, entry point, target profile ("vs_5_0"), defines and compiler flags.
+struct ShaderDesc {
+    std::string                                         file;
+    std::string                                         entry = "main";
+    std::string                                         target;
+    std::vector<std::pair<std::string, std::string>>    defines;
+    unsigned int                                        flags = 0;
+};
+
+// Turns desc into bytecode or fills err. Runs on job threads, several at once.
+typedef std::function<bool(const ShaderDesc& desc, std::vector<unsigned char>& bytecode, std::string& err)> ShaderCompileFn;
+// Reads a source file whole; false when it cannot be read.
+typedef std::function<bool(const std::filesystem::path& fn, std::string& text)> ShaderReadFn;
+
+// Compiled shader bytecode, keyed by a hash of the source, of every file it includes, the entry point,
+// target, defines and flags. Request starts a compilation on the job system and returns a handle; an
+// identical request returns the same handle instead of compiling again. A finished compilation is
+// stored on disk under its key, so the next start loads it instead of calling the compiler; an edit to
+// the shader or any header it includes changes the key.
+//
+// The compiler and the file reader are passed in, so the cache runs under SelfTest with a stub compiler
+// and sources kept in memory.
+class ShaderCache {
+public:
+    // dir empty: no disk cache. jobs null: Request compiles on the calling thread. read null: from disk.
+    ShaderCache(ShaderCompileFn compile, JobSystem* jobs, const std::filesystem::path& dir, ShaderReadFn read = nullptr);
+    // Waits for the compilations still running.
+    ~ShaderCache();
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache& operator=(const ShaderCache&) = delete;
+
+    // Safe from any thread.
+    unsigned int Request(const ShaderDesc& desc);
+    // Blocks until handle is done; false with err filled when it failed.
+    bool Wait(unsigned int handle, std::string* err = nullptr);
+    // After a successful Wait. Lives as long as the cache.
+    const std::vector<unsigned char>& GetBytecode(unsigned int handle) const;
+    // MakeKey of the request behind handle.
+    uint64_t GetKey(unsigned int handle) const;
+
+    // 0 when the source cannot be read.
+    uint64_t MakeKey(const ShaderDesc& desc) const;
+
+    unsigned int GetCompiledCount() const { return m_numCompiled; }
+    unsigned int GetDiskHits() const { return m_numDiskHits; }
+    unsigned int GetSharedCount() const { return m_numShared; }
+    void Report() const;
+
+    // Runs the cache against a stub compiler: sharing, keys that follow includes, failures, the disk
+    // cache and parallel requests. Prints what it checks. Needs no device.
+    static bool SelfTest();
+
+private:
+    struct Entry {
+        uint64_t                    key = 0;
+        ShaderDesc                  desc;
+        std::vector<unsigned char>  bytecode;
+        std::string                 err;
+        bool                        isOk = false;
+        std::shared_future<void>    fut;
+    };
+
+    // Disk, else the compiler. Job thread.
+    void Build(Entry& e);
+    void HashIncludes(const std::filesystem::path& fn, const std::string& text, std::vector<std::string>& visited,
+        uint64_t& h) const;
+    std::filesystem::path GetEntryPath(uint64_t key) const;
+    bool Load(uint64_t key, std::vector<unsigned char>& bytecode) const;
+    void Store(uint64_t key, const std::vector<unsigned char>& bytecode) const;
+
+    ShaderCompileFn                             m_fnCompile;
+    ShaderReadFn                                m_fnRead;
+    JobSystem*                                  m_pJobs;
+    std::filesystem::path                       m_dir;
+    mutable std::mutex                          m_mtx;
+    std::vector<std::unique_ptr<Entry>>         m_listEntries;
+    std::unordered_map<uint64_t, unsigned int>  m_mapKeys;         // key -> handle
+    std::atomic<unsigned int>                   m_numRequests{ 0 };
+    std::atomic<unsigned int>                   m_numShared{ 0 };
+    std::atomic<unsigned int>                   m_numDiskHits{ 0 };
+    std::atomic<unsigned int>                   m_numCompiled{ 0 };
+    std::atomic<unsigned int>                   m_numFailed{ 0 };
+    std::atomic<unsigned long long>             m_usCompile{ 0 };   // summed over threads
+};
@@ -0,0 +1,86 @@
+#include "StartupReport.h"
+#include <Windows.h>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+void StartupReport::Line(const char* fmt, ...) {
+    char buf[512];
+    va_list args; va_start(args, fmt);
+    _vsnprintf_s(buf, _TRUNCATE, fmt, args);
+    va_end(args);
+    OutputDebugStringA(buf);
+    std::printf("%s", buf);
+}
+
+StartupReport& StartupReport::Get() {
+    static StartupReport report;
+    return report;
+}
+
+void StartupReport::BeginPhase(const char* name) {
+    Phase p;
+    p.name = name;
+    p.depth = static_cast<int>(m_stackOpen.size());
+    p.tBegin = clock::now();
+    p.ms = -1.0;
+    m_stackOpen.push_back(m_listPhases.size());
+    m_listPhases.push_back(p);
+}
+
+void StartupReport::EndPhase() {
+    if (m_stackOpen.empty()) return;
+    Phase& p = m_listPhases[m_stackOpen.back()];
+    m_stackOpen.pop_back();
+    p.ms = std::chrono::duration<double, std::milli>(clock::now() - p.tBegin).count();
+}
+
+void StartupReport::AddFileTiming(const std::string& fn, double msDecode, double msWait,
+    unsigned int w, unsigned int h, bool isCached) {
+    std::lock_guard<std::mutex> lock(m_mtxFiles);
+    m_listFiles.push_back({ fn, msDecode, msWait, w, h, isCached });
+}
+
+void StartupReport::AddTextureQuality(const std::string& name, const char* format, float psnr,
+    unsigned long long bytesRaw, unsigned long long bytesCompressed, bool isCached) {
+    std::lock_guard<std::mutex> lock(m_mtxFiles);
+    m_listTextures.push_back({ name, format, psnr, bytesRaw, bytesCompressed, isCached });
+}
+
+void StartupReport::Print() {
+    const double msTotal = std::chrono::duration<double, std::milli>(clock::now() - m_tStart).count();
+
+    Line("\n=== Startup report (%.1f ms since launch) ===\n", msTotal);
+    for (const Phase& p : m_listPhases) {
+        Line("  %*s%-32s %9.2f ms\n", p.depth * 2, "", p.name.c_str(), p.ms);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mtxFiles);
+    if (!m_listTextures.empty()) {
+        unsigned long long sumRaw = 0, sumCompressed = 0;
+        Line("  %-40s %6s %8s %9s %9s %6s\n", "texture", "format", "PSNR", "RGBA8", "GPU", "cache");
+        for (const TextureQuality& t : m_listTextures) {
+            Line("  %-40s %6s %6.2fdB %7.2fMB %7.2fMB %6s\n", t.name.c_str(), t.format, t.psnr,
+                t.bytesRaw / 1048576.0, t.bytesCompressed / 1048576.0, t.isCached ? "hit" : "miss");
+            sumRaw += t.bytesRaw;
+            sumCompressed += t.bytesCompressed;
+        }
+        Line("  block compression: %.2f MB -> %.2f MB of VRAM (%.1fx)\n", sumRaw / 1048576.0,
+            sumCompressed / 1048576.0, sumCompressed ? double(sumRaw) / sumCompressed : 0.0);
+    }
+    if (m_listFiles.empty()) return;
+
+    double sumDecode = 0.0, maxDecode = 0.0, sumWait = 0.0;
+    size_t numCached = 0;
+    Line("  %-40s %11s %9s %9s %6s\n", "file", "size", "decode", "wait", "cache");
+    for (const FileTiming& f : m_listFiles) {
+        Line("  %-40s %5ux%-5u %7.2fms %7.2fms %6s\n", f.fn.c_str(), f.w, f.h, f.msDecode, f.msWait,
+            f.isCached ? "hit" : "miss");
+        sumDecode += f.msDecode;
+        sumWait += f.msWait;
+        maxDecode = (std::max)(maxDecode, f.msDecode);
+        if (f.isCached) ++numCached;
+    }
+    Line("  decode sum %.2f ms | largest %.2f ms | main thread blocked %.2f ms | cache hits %zu/%zu\n",
+        sumDecode, maxDecode, sumWait, numCached, m_listFiles.size());
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Wall-clock timings of startup phases and of every decoded file.
+// Phases are opened/closed on the main thread; file timings may come from worker threads.
+class StartupReport {
+public:
+    static StartupReport& Get();
+
+    void BeginPhase(const char* name);
+    void EndPhase();
+
+    // msDecode: time spent on the worker, msWait: time the caller blocked waiting for the result,
+    // isCached: the texels came from the TextureCache instead of the decoder.
+    void AddFileTiming(const std::string& fn, double msDecode, double msWait, unsigned int w, unsigned int h,
+        bool isCached = false);
+
+    // One block-compressed texture: PSNR of level 0 against the source, full chain size before/after.
+    void AddTextureQuality(const std::string& name, const char* format, float psnr,
+        unsigned long long bytesRaw, unsigned long long bytesCompressed, bool isCached);
+
+    void Print();
+
+    // printf-style line to both the debug output and the console.
+    static void Line(const char* fmt, ...);
+
+private:
+    using clock = std::chrono::high_resolution_clock;
+
+    struct Phase {
+        std::string         name;
+        int                 depth;
+        clock::time_point   tBegin;
+        double              ms;
+    };
+    struct FileTiming {
+        std::string     fn;
+        double          msDecode;
+        double          msWait;
+        unsigned int    w;
+        unsigned int    h;
+        bool            isCached;
+    };
+    struct TextureQuality {
+        std::string         name;
+        const char*         format;
+        float               psnr;
+        unsigned long long  bytesRaw;
+        unsigned long long  bytesCompressed;
+        bool                isCached;
+    };
+
+    StartupReport() : m_tStart(clock::now()) {}
+
+    clock::time_point           m_tStart;
+    std::vector<Phase>          m_listPhases;
+    std::vector<size_t>         m_stackOpen;
+    std::vector<FileTiming>     m_listFiles;
+    std::vector<TextureQuality> m_listTextures;
+    std::mutex                  m_mtxFiles;
+};
+
+// Opens a phase for the lifetime of the object.
+class StartupPhase {
+public:
+    explicit StartupPhase(const char* name) { StartupReport::Get().BeginPhase(name); }
+    ~StartupPhase() { StartupReport::Get().EndPhase(); }
+};
@@ -2,23 +2,19 @@
 #include "lodepng.h"
 #include "Terrain.h"
 #include "Common.h"
+#include "StartupReport.h"
+#include "TextureCache.h"
+#include "Counters.h"
 #include <algorithm>
 #include <functional>
 #include <vector>
 #include <float.h>
 #include <cstring>
 #include <cctype>
-#include <cstdarg>
 #include <cstdio>
 
 //   helpers  
 
-//    (  )
-static int& G_TerrainTess()
-{
-    static int g_tess = 64;
-    return g_tess;
-}
 namespace
 {
     inline int clampi(int v, int lo, int hi)
@@ -62,10 +58,24 @@ static bool HasExtNoCase(const char* fileName, const char* ext)
 
 static inline float clamp01(float v) { return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v); }
 
+//  r    [x0,x1) x [y0,y1);  r (right <= left)  
+static void GrowRect(RECT& r, int x0, int y0, int x1, int y1)
+{
+    if (r.right <= r.left || r.bottom <= r.top) {
+        r = { x0, y0, x1, y1 };
+        return;
+    }
+    r.left = (std::min)(r.left, (LONG)x0);
+    r.top = (std::min)(r.top, (LONG)y0);
+    r.right = (std::max)(r.right, (LONG)x1);
+    r.bottom = (std::max)(r.bottom, (LONG)y1);
+}
+
 //   Terrain  
 
-Terrain::Terrain(ResourceManager* rm, TerrainMaterial* mat,
-    const char* fnHeightmap, const char* fnDisplacementMap)
+static void DestroyQT(__QTNode* n);
+
+Terrain::Terrain(ResourceManager* rm, TerrainMaterial* mat)
     : m_pMat(mat), m_pResMgr(rm)
 {
     // 
@@ -75,7 +85,12 @@ Terrain::Terrain(ResourceManager* rm, TerrainMaterial* mat,
     m_dataIndices = nullptr;
     m_pConstants = nullptr;
     m_idxDisplacementGPU = (unsigned int)-1;
+}
 
+Terrain::Terrain(ResourceManager* rm, TerrainMaterial* mat,
+    const char* fnHeightmap, const char* fnDisplacementMap)
+    : Terrain(rm, mat)
+{
     //  
     LoadHeightMap(fnHeightmap);
     LoadDisplacementMap(fnDisplacementMap);
@@ -83,25 +98,126 @@ Terrain::Terrain(ResourceManager* rm, TerrainMaterial* mat,
     // 
     CreateMesh3D();
     BuildQT();
+    Finalize();
+}
+
+Terrain* Terrain::Build(ResourceManager* rm, TerrainMaterial* mat,
+    const char* fnHeightmap, const char* fnDisplacementMap)
+{
+    Terrain* t = new Terrain(rm, mat);
+    t->m_isBackground = true;
+    try {
+        t->LoadHeightMap(fnHeightmap);
+        t->LoadDisplacementMap(fnDisplacementMap);
+        t->CreateMesh3D();
+        t->BuildQT();
+    }
+    catch (...) {
+        //   ,        
+        t->Release();
+        delete t;
+        throw;
+    }
+    return t;
+}
+
+void Terrain::Finalize()
+{
+    // CPU-  ,    ;       
+    if (m_imgHeightMap) m_idxHeightCPU = m_pResMgr->AddFileData(std::move(m_imgHeightMap));
+    if (m_imgDisplacementMap) m_idxDisplacementCPU = m_pResMgr->AddFileData(std::move(m_imgDisplacementMap));
+
+    //     SRV    
+    auto addSRV = [&](unsigned int idx, D3D12_CPU_DESCRIPTOR_HANDLE& hdlCPU, D3D12_GPU_DESCRIPTOR_HANDLE& hdlGPU) {
+        ID3D12Resource* tex = m_pResMgr->GetResource(idx);
+        D3D12_RESOURCE_DESC descTex = tex->GetDesc();
+
+        D3D12_SHADER_RESOURCE_VIEW_DESC descSRV = {};
+        descSRV.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+        descSRV.Format = descTex.Format;
+        descSRV.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+        descSRV.Texture2D.MipLevels = descTex.MipLevels;
+
+        m_pResMgr->AddSRV(tex, &descSRV, hdlCPU, hdlGPU);
+    };
+    addSRV(m_idxHeightGPU, m_hdlHeightMapSRV_CPU, m_hdlHeightMapSRV_GPU);
+    addSRV(m_idxDisplacementGPU, m_hdlDisplacementMapSRV_CPU, m_hdlDisplacementMapSRV_GPU);
+
+    D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
+    cbvDesc.BufferLocation = m_pResMgr->GetResource(m_idxConstantsGPU)->GetGPUVirtualAddress();
+    cbvDesc.SizeInBytes = (sizeof(TerrainShaderConstants) + 255) & ~255;
+
+    m_pResMgr->AddCBV(&cbvDesc, m_hdlConstantsCBV_CPU, m_hdlConstantsCBV_GPU);
+    m_hasDescriptors = true;
 }
 
+void Terrain::Release()
+{
+    if (m_hasDescriptors) {
+        m_pResMgr->ReleaseCBVSRVUAVRange(m_hdlHeightMapSRV_CPU, 1);
+        m_pResMgr->ReleaseCBVSRVUAVRange(m_hdlDisplacementMapSRV_CPU, 1);
+        m_pResMgr->ReleaseCBVSRVUAVRange(m_hdlConstantsCBV_CPU, 1);
+        m_hasDescriptors = false;
+    }
+
+    unsigned int* slots[] = { &m_idxHeightGPU, &m_idxDisplacementGPU, &m_idxVertexGPU, &m_idxIndexGPU, &m_idxConstantsGPU };
+    for (unsigned int* idx : slots) {
+        if (*idx == (unsigned int)-1) continue;
+        m_pResMgr->ReleaseResource(*idx);
+        *idx = (unsigned int)-1;
+    }
+
+    // CPU-    , GPU    
+    if (m_idxHeightCPU != (unsigned int)-1) { m_pResMgr->UnloadFileData(m_idxHeightCPU); m_idxHeightCPU = (unsigned int)-1; }
+    if (m_idxDisplacementCPU != (unsigned int)-1) { m_pResMgr->UnloadFileData(m_idxDisplacementCPU); m_idxDisplacementCPU = (unsigned int)-1; }
+    m_imgHeightMap.Reset();
+    m_imgDisplacementMap.Reset();
+    m_dataHeightMap = nullptr;
+    m_dataDisplacementMap = nullptr;
+}
 
 Terrain::~Terrain()
 {
-    //   CPU-
+    //   CPU-; GPU-   Release    
     m_dataHeightMap = nullptr;
     m_dataDisplacementMap = nullptr;
     DeleteVertexAndIndexArrays();
+    DestroyQT(m_pQTRoot);
+    m_pQTRoot = nullptr;
     m_pResMgr = nullptr;
-    delete m_pMat;
 }
 
-void Terrain::Draw(ID3D12GraphicsCommandList* cmdList, bool draw3D)
+//  :    ,     
+static Counter& CounterPatchesSubmitted() {
+    static Counter& c = CounterRegistry::Get().Register("patches submitted", COUNTER_PER_FRAME);
+    return c;
+}
+static Counter& CounterPatchesVisible() {
+    static Counter& c = CounterRegistry::Get().Register("patches visible", COUNTER_PER_FRAME);
+    return c;
+}
+static Counter& CounterPatchesCulled() {
+    static Counter& c = CounterRegistry::Get().Register("patches culled", COUNTER_PER_FRAME);
+    return c;
+}
+static Counter& CounterBrushStamps() {
+    static Counter& c = CounterRegistry::Get().Register("brush stamps", COUNTER_PER_FRAME);
+    return c;
+}
+
+//     ;    
+void Terrain::CountSubmittedPatches() const
+{
+    CounterPatchesSubmitted().Add(m_numIndices / 4);
+}
+
+void Terrain::Draw(CommandList* cmdList, bool draw3D)
 {
     if (draw3D) {
         cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_4_CONTROL_POINT_PATCHLIST);
         cmdList->IASetVertexBuffers(0, 1, &m_viewVertexBuffer);
         cmdList->IASetIndexBuffer(&m_viewIndexBuffer);
+        CountSubmittedPatches();
         cmdList->DrawIndexedInstanced(m_numIndices, 1, 0, 0, 0);
     }
     else {
@@ -124,7 +240,7 @@ void Terrain::CreateMesh3D()
     float mountainsScale = 1.0f;
     m_scaleHeightMap = (float)m_wHeightMap / 16.0f * mountainsScale;
 
-    const int tess = G_TerrainTess();
+    const int tess = m_tessStep;
     const int patchCountX = m_wHeightMap / tess;
     const int patchCountY = m_hHeightMap / tess;
 
@@ -304,18 +420,18 @@ void Terrain::CreateVertexBuffer()
     D3D12_RESOURCE_DESC vbDesc = CD3DX12_RESOURCE_DESC::Buffer(m_numVertices * sizeof(Vertex));
     CD3DX12_HEAP_PROPERTIES defHeap(D3D12_HEAP_TYPE_DEFAULT);
 
-    auto vbIndex = m_pResMgr->NewBuffer(vbRes, &vbDesc, &defHeap,
+    m_idxVertexGPU = m_pResMgr->NewBuffer(vbRes, &vbDesc, &defHeap,
         D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, nullptr);
     vbRes->SetName(L"Terrain Vertex Buffer");
 
-    auto vbSize = GetRequiredIntermediateSize(vbRes, 0, 1);
+    auto vbSize = vbDesc.Width; //   staging    
 
     D3D12_SUBRESOURCE_DATA vbData = {};
     vbData.pData = m_dataVertices;
     vbData.RowPitch = vbSize;
     vbData.SlicePitch = vbSize;
 
-    m_pResMgr->UploadToBuffer(vbIndex, 1, &vbData, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+    m_pResMgr->UploadToBuffer(m_idxVertexGPU, 1, &vbData, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
 
     m_viewVertexBuffer = {};
     m_viewVertexBuffer.BufferLocation = vbRes->GetGPUVirtualAddress();
@@ -330,18 +446,18 @@ void Terrain::CreateIndexBuffer()
     D3D12_RESOURCE_DESC ibDesc = CD3DX12_RESOURCE_DESC::Buffer(m_numIndices * sizeof(UINT));
     CD3DX12_HEAP_PROPERTIES defHeap(D3D12_HEAP_TYPE_DEFAULT);
 
-    auto ibIndex = m_pResMgr->NewBuffer(ibRes, &ibDesc, &defHeap,
+    m_idxIndexGPU = m_pResMgr->NewBuffer(ibRes, &ibDesc, &defHeap,
         D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_INDEX_BUFFER, nullptr);
     ibRes->SetName(L"Terrain Index Buffer");
 
-    auto ibSize = GetRequiredIntermediateSize(ibRes, 0, 1);
+    auto ibSize = ibDesc.Width;
 
     D3D12_SUBRESOURCE_DATA ibData = {};
     ibData.pData = m_dataIndices;
     ibData.RowPitch = ibSize;
     ibData.SlicePitch = ibSize;
 
-    m_pResMgr->UploadToBuffer(ibIndex, 1, &ibData, D3D12_RESOURCE_STATE_INDEX_BUFFER);
+    m_pResMgr->UploadToBuffer(m_idxIndexGPU, 1, &ibData, D3D12_RESOURCE_STATE_INDEX_BUFFER);
 
     m_viewIndexBuffer = {};
     m_viewIndexBuffer.BufferLocation = ibRes->GetGPUVirtualAddress();
@@ -356,11 +472,11 @@ void Terrain::CreateConstantBuffer()
     D3D12_RESOURCE_DESC cbDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeof(TerrainShaderConstants));
     CD3DX12_HEAP_PROPERTIES defHeap(D3D12_HEAP_TYPE_DEFAULT);
 
-    auto cbIndex = m_pResMgr->NewBuffer(cbRes, &cbDesc, &defHeap,
+    m_idxConstantsGPU = m_pResMgr->NewBuffer(cbRes, &cbDesc, &defHeap,
         D3D12_HEAP_FLAG_NONE, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, nullptr);
     cbRes->SetName(L"Terrain Shader Constants Buffer");
 
-    auto cbSize = GetRequiredIntermediateSize(cbRes, 0, 1);
+    auto cbSize = cbDesc.Width;
 
     m_pConstants = new TerrainShaderConstants(m_scaleHeightMap, (float)m_wHeightMap, (float)m_hHeightMap, m_hBase);
 
@@ -369,13 +485,8 @@ void Terrain::CreateConstantBuffer()
     cbData.RowPitch = cbSize;
     cbData.SlicePitch = cbSize;
 
-    m_pResMgr->UploadToBuffer(cbIndex, 1, &cbData, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
-
-    D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
-    cbvDesc.BufferLocation = cbRes->GetGPUVirtualAddress();
-    cbvDesc.SizeInBytes = (sizeof(TerrainShaderConstants) + 255) & ~255;
-
-    m_pResMgr->AddCBV(&cbvDesc, m_hdlConstantsCBV_CPU, m_hdlConstantsCBV_GPU);
+    m_pResMgr->UploadToBuffer(m_idxConstantsGPU, 1, &cbData, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+    // CBV  Finalize
 }
 
 //    / ====
@@ -400,59 +511,52 @@ XMFLOAT2 Terrain::CalcZBounds(Vertex bl, Vertex tr)
     return XMFLOAT2(zmin, zmax);
 }
 
-void Terrain::LoadHeightMap(const char* fnHeightMap)
+unsigned char* Terrain::LoadMap(const char* fn, ImageBuffer& img, unsigned int& idxCPU,
+    unsigned int& h, unsigned int& w)
 {
-    if (HasExtNoCase(fnHeightMap, ".dds")) {
-        // DDS-  :    
-        unsigned int h = 0, w = 0;
-        unsigned int idxCpu = m_pResMgr->LoadDDS_CPU_RGBA8A(fnHeightMap, h, w);
-        m_dataHeightMap = m_pResMgr->GetFileData(idxCpu);
-        m_wHeightMap = w;
-        m_hHeightMap = h;
-
-        m_pResMgr->CreateTextureDDSA(fnHeightMap, m_hdlHeightMapSRV_CPU, m_hdlHeightMapSRV_GPU);
+    if (m_isBackground) {
+        //        ,      Finalize
+        img = ResourceManager::DecodeImage(fn, h, w);
+        return img.Get();
     }
-    else {
-        unsigned int index = m_pResMgr->LoadFile(fnHeightMap, m_hHeightMap, m_wHeightMap);
-        m_dataHeightMap = m_pResMgr->GetFileData(index);
-
-        D3D12_RESOURCE_DESC descTex = {};
-        descTex.MipLevels = 1;
-        descTex.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-        descTex.Width = m_wHeightMap;
-        descTex.Height = m_hHeightMap;
-        descTex.Flags = D3D12_RESOURCE_FLAG_NONE;
-        descTex.DepthOrArraySize = 1;
-        descTex.SampleDesc.Count = 1;
-        descTex.SampleDesc.Quality = 0;
-        descTex.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-
-        ID3D12Resource* hm = nullptr;
-        CD3DX12_HEAP_PROPERTIES defHeap(D3D12_HEAP_TYPE_DEFAULT);
-
-        //     m_idxHeightGPU
-        m_idxHeightGPU = m_pResMgr->NewBuffer(
-            hm, &descTex, &defHeap, D3D12_HEAP_FLAG_NONE,
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, nullptr);
-        hm->SetName(L"Height Map");
-
-        D3D12_SUBRESOURCE_DATA dataTex = {};
-        dataTex.pData = m_dataHeightMap;
-        dataTex.RowPitch = m_wHeightMap * 4;
-        dataTex.SlicePitch = m_hHeightMap * m_wHeightMap * 4;
-
-        m_pResMgr->UploadToBuffer(
-            m_idxHeightGPU, 1, &dataTex,
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+    idxCPU = HasExtNoCase(fn, ".dds")
+        ? m_pResMgr->LoadDDS_CPU_RGBA8A(fn, h, w)
+        : m_pResMgr->LoadFile(fn, h, w);
+    return m_pResMgr->GetFileData(idxCPU);
+}
 
-        D3D12_SHADER_RESOURCE_VIEW_DESC descSRV = {};
-        descSRV.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        descSRV.Format = descTex.Format;
-        descSRV.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-        descSRV.Texture2D.MipLevels = 1;
+void Terrain::LoadHeightMap(const char* fnHeightMap)
+{
+    // DDS  PNG : RGBA8  CPU,  ,   
+    m_dataHeightMap = LoadMap(fnHeightMap, m_imgHeightMap, m_idxHeightCPU, m_hHeightMap, m_wHeightMap);
+
+    //   :  Kaiser  ,       
+    m_mipsHeightMap.Generate(m_dataHeightMap, m_wHeightMap, m_hHeightMap, MIP_FILTER_BOX, MIP_NONE);
+
+    D3D12_RESOURCE_DESC descTex = {};
+    descTex.MipLevels = (UINT16)m_mipsHeightMap.GetLevelCount();
+    descTex.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    descTex.Width = m_wHeightMap;
+    descTex.Height = m_hHeightMap;
+    descTex.Flags = D3D12_RESOURCE_FLAG_NONE;
+    descTex.DepthOrArraySize = 1;
+    descTex.SampleDesc.Count = 1;
+    descTex.SampleDesc.Quality = 0;
+    descTex.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+
+    ID3D12Resource* hm = nullptr;
+    CD3DX12_HEAP_PROPERTIES defHeap(D3D12_HEAP_TYPE_DEFAULT);
 
-        m_pResMgr->AddSRV(hm, &descSRV, m_hdlHeightMapSRV_CPU, m_hdlHeightMapSRV_GPU);
-    }
+    //     m_idxHeightGPU
+    m_idxHeightGPU = m_pResMgr->NewBuffer(
+        hm, &descTex, &defHeap, D3D12_HEAP_FLAG_NONE,
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, nullptr);
+    hm->SetName(L"Height Map");
+
+    m_pResMgr->UploadMipChain(
+        m_idxHeightGPU, 0, m_mipsHeightMap,
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+    // SRV  Finalize
 }
 
 
@@ -463,15 +567,17 @@ void Terrain::ReuploadHeightMap()
     if (m_idxHeightGPU == (unsigned int)-1 || !m_dataHeightMap)
         return;
 
-    D3D12_SUBRESOURCE_DATA dataTex = {};
-    dataTex.pData = m_dataHeightMap;
-    dataTex.RowPitch = m_wHeightMap * 4;
-    dataTex.SlicePitch = m_hHeightMap * m_wHeightMap * 4;
+    //     
+    const RECT& r = m_rectDirtyHeightMap;
+    if (r.right <= r.left || r.bottom <= r.top)
+        return;
+    m_mipsHeightMap.Update(r.left, r.top, r.right, r.bottom);
+    m_rectDirtyHeightMap = {};
 
-    m_pResMgr->UploadToBuffer(
+    m_pResMgr->UploadMipChain(
         m_idxHeightGPU,
-        1,
-        &dataTex,
+        0,
+        m_mipsHeightMap,
         D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 }
 
@@ -480,113 +586,76 @@ void Terrain::ReuploadHeightMap()
 
 void Terrain::LoadDisplacementMap(const char* fnMap)
 {
-    if (HasExtNoCase(fnMap, ".dds")) {
-        unsigned int h = 0, w = 0;
-        unsigned int idxCpu = m_pResMgr->LoadDDS_CPU_RGBA8A(fnMap, h, w);
-        m_dataDisplacementMap = m_pResMgr->GetFileData(idxCpu);
-        m_wDisplacementMap = w;
-        m_hDisplacementMap = h;
-
-        // ---     ---
-        if (m_dataDisplacementMap) {
-            const size_t pxCount = size_t(m_wDisplacementMap) * size_t(m_hDisplacementMap);
-            for (size_t i = 0; i < pxCount; ++i) {
-                m_dataDisplacementMap[i * 4 + 3] = 0; // A = 0
-            }
+    const bool isDDS = HasExtNoCase(fnMap, ".dds");
+    m_dataDisplacementMap = LoadMap(fnMap, m_imgDisplacementMap, m_idxDisplacementCPU,
+        m_hDisplacementMap, m_wDisplacementMap);
+
+    // ---     ---
+    if (m_dataDisplacementMap) {
+        const size_t pxCount = size_t(m_wDisplacementMap) * size_t(m_hDisplacementMap);
+        for (size_t i = 0; i < pxCount; ++i) {
+            m_dataDisplacementMap[i * 4 + 3] = 0; // A = 0
         }
+    }
 
-        D3D12_RESOURCE_DESC descTex = {};
-        descTex.MipLevels = 1;
-        descTex.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-        descTex.Width = m_wDisplacementMap;
-        descTex.Height = m_hDisplacementMap;
-        descTex.Flags = D3D12_RESOURCE_FLAG_NONE;
-        descTex.DepthOrArraySize = 1;
-        descTex.SampleDesc.Count = 1;
-        descTex.SampleDesc.Quality = 0;
-        descTex.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-
-        ID3D12Resource* dm = nullptr;
-        CD3DX12_HEAP_PROPERTIES defHeap(D3D12_HEAP_TYPE_DEFAULT);
-
-        m_idxDisplacementGPU = m_pResMgr->NewBuffer(
-            dm, &descTex, &defHeap,
-            D3D12_HEAP_FLAG_NONE,
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
-            nullptr);
-        dm->SetName(L"Displacement Map (DDS?RGBA8)");
-
-        D3D12_SUBRESOURCE_DATA dataTex = {};
-        dataTex.pData = m_dataDisplacementMap;
-        dataTex.RowPitch = m_wDisplacementMap * 4;
-        dataTex.SlicePitch = m_hDisplacementMap * m_wDisplacementMap * 4;
-
-        m_pResMgr->UploadToBuffer(
-            m_idxDisplacementGPU,
-            1,
-            &dataTex,
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+    // RGB   (), A    (max,     )
+    m_mipsDisplacementMap.Generate(m_dataDisplacementMap, m_wDisplacementMap, m_hDisplacementMap,
+        MIP_FILTER_KAISER, MIP_NORMAL_MAP | MIP_ALPHA_MAX);
+
+    //  GPU  BC3:   RGB,   A. BC5           .
+    // RGBA8-   CPU:   ,  BC3    
+    m_isDisplacementBC = m_wDisplacementMap % 4 == 0 && m_hDisplacementMap % 4 == 0;
+    if (m_isDisplacementBC) {
+        const uint64_t key = TextureCache::Get().MakeKey(fnMap, "disp-bc3-kaiser-nrm-amax-zeroA");
+        if (!m_bcDisplacementMap.Load(key) || m_bcDisplacementMap.GetFormat() != BC_FORMAT_BC3 ||
+            m_bcDisplacementMap.GetWidth(0) != m_wDisplacementMap || m_bcDisplacementMap.GetHeight(0) != m_hDisplacementMap) {
+            m_bcDisplacementMap.Encode(m_mipsDisplacementMap, BC_FORMAT_BC3, key);
+        }
 
-        D3D12_SHADER_RESOURCE_VIEW_DESC descSRV = {};
-        descSRV.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        descSRV.Format = descTex.Format;
-        descSRV.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-        descSRV.Texture2D.MipLevels = 1;
+        unsigned long long bytesRaw = 0;
+        for (unsigned int l = 0; l < m_mipsDisplacementMap.GetLevelCount(); ++l) {
+            bytesRaw += 4ull * m_mipsDisplacementMap.GetWidth(l) * m_mipsDisplacementMap.GetHeight(l);
+        }
+        StartupReport::Get().AddTextureQuality(fnMap, "BC3", m_bcDisplacementMap.GetPSNR(), bytesRaw,
+            m_bcDisplacementMap.GetSize(), m_bcDisplacementMap.IsCached());
+    }
+
+    D3D12_RESOURCE_DESC descTex = {};
+    descTex.MipLevels = (UINT16)m_mipsDisplacementMap.GetLevelCount();
+    descTex.Format = m_isDisplacementBC ? DXGI_FORMAT_BC3_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+    descTex.Width = m_wDisplacementMap;
+    descTex.Height = m_hDisplacementMap;
+    descTex.Flags = D3D12_RESOURCE_FLAG_NONE;
+    descTex.DepthOrArraySize = 1;
+    descTex.SampleDesc.Count = 1;
+    descTex.SampleDesc.Quality = 0;
+    descTex.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+
+    ID3D12Resource* dm = nullptr;
+    CD3DX12_HEAP_PROPERTIES defHeap(D3D12_HEAP_TYPE_DEFAULT);
 
-        m_pResMgr->AddSRV(dm, &descSRV, m_hdlDisplacementMapSRV_CPU, m_hdlDisplacementMapSRV_GPU);
+    m_idxDisplacementGPU = m_pResMgr->NewBuffer(
+        dm, &descTex, &defHeap,
+        D3D12_HEAP_FLAG_NONE,
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+        nullptr);
+    dm->SetName(isDDS ? L"Displacement Map (DDS?RGBA8)" : L"Displacement Map");
+
+    if (m_isDisplacementBC) {
+        m_pResMgr->UploadBCChain(
+            m_idxDisplacementGPU,
+            0,
+            m_bcDisplacementMap,
+            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
     }
     else {
-        unsigned int idxCpu = m_pResMgr->LoadFile(fnMap, m_hDisplacementMap, m_wDisplacementMap);
-        m_dataDisplacementMap = m_pResMgr->GetFileData(idxCpu);
-
-        // ---     ---
-        if (m_dataDisplacementMap) {
-            const size_t pxCount = size_t(m_wDisplacementMap) * size_t(m_hDisplacementMap);
-            for (size_t i = 0; i < pxCount; ++i) {
-                m_dataDisplacementMap[i * 4 + 3] = 0; // A = 0
-            }
-        }
-
-        D3D12_RESOURCE_DESC descTex = {};
-        descTex.MipLevels = 1;
-        descTex.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-        descTex.Width = m_wDisplacementMap;
-        descTex.Height = m_hDisplacementMap;
-        descTex.Flags = D3D12_RESOURCE_FLAG_NONE;
-        descTex.DepthOrArraySize = 1;
-        descTex.SampleDesc.Count = 1;
-        descTex.SampleDesc.Quality = 0;
-        descTex.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-
-        ID3D12Resource* dm = nullptr;
-        CD3DX12_HEAP_PROPERTIES defHeap(D3D12_HEAP_TYPE_DEFAULT);
-
-        m_idxDisplacementGPU = m_pResMgr->NewBuffer(
-            dm, &descTex, &defHeap,
-            D3D12_HEAP_FLAG_NONE,
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
-            nullptr);
-        dm->SetName(L"Displacement Map");
-
-        D3D12_SUBRESOURCE_DATA dataTex = {};
-        dataTex.pData = m_dataDisplacementMap;
-        dataTex.RowPitch = m_wDisplacementMap * 4;
-        dataTex.SlicePitch = m_hDisplacementMap * m_wDisplacementMap * 4;
-
-        m_pResMgr->UploadToBuffer(
+        m_pResMgr->UploadMipChain(
             m_idxDisplacementGPU,
-            1,
-            &dataTex,
+            0,
+            m_mipsDisplacementMap,
             D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-
-        D3D12_SHADER_RESOURCE_VIEW_DESC descSRV = {};
-        descSRV.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        descSRV.Format = descTex.Format;
-        descSRV.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-        descSRV.Texture2D.MipLevels = 1;
-
-        m_pResMgr->AddSRV(dm, &descSRV, m_hdlDisplacementMapSRV_CPU, m_hdlDisplacementMapSRV_GPU);
     }
+    // SRV  Finalize
 }
 
 
@@ -596,15 +665,27 @@ void Terrain::ReuploadDisplacementMap()
     if (m_idxDisplacementGPU == (unsigned int)-1 || !m_dataDisplacementMap)
         return;
 
-    D3D12_SUBRESOURCE_DATA dataTex = {};
-    dataTex.pData = m_dataDisplacementMap;
-    dataTex.RowPitch = m_wDisplacementMap * 4;
-    dataTex.SlicePitch = m_hDisplacementMap * m_wDisplacementMap * 4;
-
-    m_pResMgr->UploadToBuffer(
+    const RECT& r = m_rectDirtyDisplacementMap;
+    if (r.right <= r.left || r.bottom <= r.top)
+        return;
+    std::vector<MipRect> dirty;
+    m_mipsDisplacementMap.Update(r.left, r.top, r.right, r.bottom, &dirty);
+    m_rectDirtyDisplacementMap = {};
+
+    if (m_isDisplacementBC) {
+        //    4x4     
+        m_bcDisplacementMap.Update(m_mipsDisplacementMap, dirty);
+        m_pResMgr->UploadBCChain(
+            m_idxDisplacementGPU,
+            0,
+            m_bcDisplacementMap,
+            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+        return;
+    }
+    m_pResMgr->UploadMipChain(
         m_idxDisplacementGPU,
-        1,
-        &dataTex,
+        0,
+        m_mipsDisplacementMap,
         D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 }
 void Terrain::PaintBrushAt(float worldX, float worldY, float radiusWorld)
@@ -675,6 +756,31 @@ void Terrain::PaintBrushAt(float worldX, float worldY, float radiusWorld)
             }
         }
     }
+
+    //   : Reupload*    
+    const int dMinX = clampi(minX * (int)m_wDisplacementMap / (int)m_wHeightMap, 0, (int)m_wDisplacementMap - 1);
+    const int dMaxX = clampi(maxX * (int)m_wDisplacementMap / (int)m_wHeightMap, 0, (int)m_wDisplacementMap - 1);
+    const int dMinY = clampi(minY * (int)m_hDisplacementMap / (int)m_hHeightMap, 0, (int)m_hDisplacementMap - 1);
+    const int dMaxY = clampi(maxY * (int)m_hDisplacementMap / (int)m_hHeightMap, 0, (int)m_hDisplacementMap - 1);
+    GrowRect(m_rectDirtyHeightMap, minX, minY, maxX + 1, maxY + 1);
+    GrowRect(m_rectDirtyDisplacementMap, dMinX, dMinY, dMaxX + 1, dMaxY + 1);
+    CounterBrushStamps().Add();
+}
+
+void Terrain::Snapshot(TerrainSnapshot& out) const
+{
+    // 8  -> 16    257: 0  255   0  65535
+    out.wHeight = m_dataHeightMap ? m_wHeightMap : 0;
+    out.hHeight = m_dataHeightMap ? m_hHeightMap : 0;
+    out.height.resize((size_t)out.wHeight * out.hHeight);
+    for (size_t i = 0; i < out.height.size(); ++i)
+        out.height[i] = (uint16_t)(m_dataHeightMap[i * 4 + 0] * 257);
+
+    out.wMask = m_dataDisplacementMap ? m_wDisplacementMap : 0;
+    out.hMask = m_dataDisplacementMap ? m_hDisplacementMap : 0;
+    out.mask.resize((size_t)out.wMask * out.hMask);
+    for (size_t i = 0; i < out.mask.size(); ++i)
+        out.mask[i] = (uint16_t)(m_dataDisplacementMap[i * 4 + 3] * 257);
 }
 
 
@@ -691,7 +797,7 @@ void Terrain::PaintBrushAt(float worldX, float worldY, float radiusWorld)
 
 //     
 
-void Terrain::AttachTerrainResources(ID3D12GraphicsCommandList* cmdList,
+void Terrain::AttachTerrainResources(CommandList* cmdList,
     unsigned int slotHM, unsigned int slotDM, unsigned int slotCBV)
 {
     cmdList->SetGraphicsRootDescriptorTable(slotHM, m_hdlHeightMapSRV_GPU);
@@ -699,7 +805,7 @@ void Terrain::AttachTerrainResources(ID3D12GraphicsCommandList* cmdList,
     cmdList->SetGraphicsRootDescriptorTable(slotCBV, m_hdlConstantsCBV_GPU);
 }
 
-void Terrain::AttachMaterialResources(ID3D12GraphicsCommandList* cmdList, unsigned int srvTableIndex)
+void Terrain::AttachMaterialResources(CommandList* cmdList, unsigned int srvTableIndex)
 {
     m_pMat->Attach(cmdList, srvTableIndex);
 }
@@ -812,24 +918,19 @@ struct __QTNode {
     __QTNode() : x0(0), y0(0), x1(0), y1(0), level(0) { c[0] = c[1] = c[2] = c[3] = nullptr; }
 };
 
-static __QTNode* s_qtRoot = nullptr;
-static int  s_patchW = 0, s_patchH = 0;
-static int  s_tessStep = 8;
-
 static void DestroyQT(__QTNode* n) { if (!n) return; for (int i = 0; i < 4; i++) DestroyQT(n->c[i]); delete n; }
 
 void Terrain::BuildQT()
 {
-    DestroyQT(s_qtRoot); s_qtRoot = nullptr;
+    DestroyQT(m_pQTRoot); m_pQTRoot = nullptr;
 
-    s_tessStep = G_TerrainTess();
-    s_patchW = max(1, (int)(m_wHeightMap / s_tessStep));
-    s_patchH = max(1, (int)(m_hHeightMap / s_tessStep));
+    m_scalePatchX = max(1, (int)(m_wHeightMap / m_tessStep));
+    m_scalePatchY = max(1, (int)(m_hHeightMap / m_tessStep));
 
     auto calcZ = [&](int x0, int y0, int x1, int y1)->XMFLOAT2 {
-        int px0 = x0 * s_tessStep, py0 = y0 * s_tessStep;
-        int px1 = min(m_wHeightMap - 1, x1 * s_tessStep - 1);
-        int py1 = min(m_hHeightMap - 1, y1 * s_tessStep - 1);
+        int px0 = x0 * m_tessStep, py0 = y0 * m_tessStep;
+        int px1 = min(m_wHeightMap - 1, x1 * m_tessStep - 1);
+        int py1 = min(m_hHeightMap - 1, y1 * m_tessStep - 1);
 
         float zmin = +FLT_MAX, zmax = -FLT_MAX;
         for (int y = py0; y <= py1; ++y)
@@ -847,8 +948,8 @@ void Terrain::BuildQT()
             __QTNode* n = new __QTNode(); n->x0 = x0; n->y0 = y0; n->x1 = x1; n->y1 = y1; n->level = lvl;
 
             XMFLOAT2 bz = calcZ(x0, y0, x1, y1);
-            n->aabbMin = XMFLOAT3((float)(x0 * s_tessStep), (float)(y0 * s_tessStep), bz.x);
-            n->aabbMax = XMFLOAT3((float)(x1 * s_tessStep), (float)(y1 * s_tessStep), bz.y);
+            n->aabbMin = XMFLOAT3((float)(x0 * m_tessStep), (float)(y0 * m_tessStep), bz.x);
+            n->aabbMax = XMFLOAT3((float)(x1 * m_tessStep), (float)(y1 * m_tessStep), bz.y);
 
             if ((x1 - x0) <= 1 && (y1 - y0) <= 1) return n;
 
@@ -872,7 +973,7 @@ void Terrain::BuildQT()
             return n;
         };
 
-    s_qtRoot = build(0, 0, s_patchW, s_patchH, 0);
+    m_pQTRoot = build(0, 0, m_scalePatchX, m_scalePatchY, 0);
 }
 
 static inline float dist2(const XMFLOAT3& a, const XMFLOAT3& b)
@@ -884,7 +985,7 @@ static inline float dist2(const XMFLOAT3& a, const XMFLOAT3& b)
 void Terrain::SelectQT(const DirectX::XMFLOAT3& eye, std::vector<DirectX::XMFLOAT4>& outBoxes) const
 {
     outBoxes.clear();
-    if (!s_qtRoot) return;
+    if (!m_pQTRoot) return;
 
     auto shouldSplit = [&](const __QTNode* n) -> bool {
         float cx = 0.5f * (n->aabbMin.x + n->aabbMax.x);
@@ -897,7 +998,7 @@ void Terrain::SelectQT(const DirectX::XMFLOAT3& eye, std::vector<DirectX::XMFLOA
         float dist = sqrtf(dx * dx + dy * dy) + 1e-3f;
 
         const float k = 2.0f;
-        const float minSize = 4.0f * s_tessStep;
+        const float minSize = 4.0f * m_tessStep;
         return (R > minSize) && (dist < k * R);
         };
 
@@ -914,90 +1015,72 @@ void Terrain::SelectQT(const DirectX::XMFLOAT3& eye, std::vector<DirectX::XMFLOA
             );
         };
 
-    walk(s_qtRoot);
+    walk(m_pQTRoot);
 }
 
-#define LOD_DEBUG 1
-#define LOD_DEBUG_EVERY_N_FRAMES 60
-
-void Terrain::DrawLOD(ID3D12GraphicsCommandList* cmdList, const DirectX::XMFLOAT3& eye)
+void Terrain::SelectVisiblePatches(const DirectX::XMFLOAT4 frustum[6], std::vector<PatchBounds>& outPatches) const
 {
-    cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_4_CONTROL_POINT_PATCHLIST);
-    cmdList->IASetVertexBuffers(0, 1, &m_viewVertexBuffer);
-    cmdList->IASetIndexBuffer(&m_viewIndexBuffer);
-
-#if LOD_DEBUG
-    static int s_frame = 0;
-    const bool doLog = ((++s_frame % LOD_DEBUG_EVERY_N_FRAMES) == 0);
-
-    auto LOGF = [](const char* fmt, ...) {
-        char buf[512];
-        va_list args; va_start(args, fmt);
-        _vsnprintf_s(buf, _TRUNCATE, fmt, args);
-        va_end(args);
-        OutputDebugStringA(buf);
-        std::printf("%s", buf);
+    outPatches.clear();
+    if (!m_pQTRoot) return;
+
+    // AABB ,        
+    auto isOutside = [&](const __QTNode* n) -> bool {
+        for (int i = 0; i < 6; ++i) {
+            const XMFLOAT4& p = frustum[i];
+            float x = p.x > 0.0f ? n->aabbMax.x : n->aabbMin.x;
+            float y = p.y > 0.0f ? n->aabbMax.y : n->aabbMin.y;
+            float z = p.z > 0.0f ? n->aabbMax.z : n->aabbMin.z;
+            if (p.x * x + p.y * y + p.z * z + p.w < 0.0f) return true;
+        }
+        return false;
         };
-#endif
-
-    std::vector<DirectX::XMFLOAT4> boxes;
-    SelectQT(eye, boxes);
-
-#if LOD_DEBUG
-    if (doLog)
-    {
-        const int cellsX = max(0, s_patchW - 1);
-        const int cellsY = max(0, s_patchH - 1);
-        const int totalPatches = cellsX * cellsY;
-
-        auto clampi = [](int v, int lo, int hi) { return v < lo ? lo : (v > hi ? hi : v); };
-        auto imax = [](int a, int b) { return (a > b) ? a : b; };
-        auto imin = [](int a, int b) { return (a < b) ? a : b; };
 
-        long long estPatches = 0;
-        int minW = 0x7fffffff, minH = 0x7fffffff;
-        int maxW = 0, maxH = 0;
-
-        LOGF(
-            "\n[LOD] frame=%d | eye=(%.1f, %.1f, %.1f) | tessStep=%d | grid=%dx%d patches=%d | boxes=%zu\n",
-            s_frame, eye.x, eye.y, eye.z, s_tessStep, cellsX, cellsY, totalPatches, boxes.size()
-        );
-
-        const int PREVIEW = 5;
-        for (size_t i = 0; i < boxes.size(); ++i)
+    std::function<void(const __QTNode*)> walk = [&](const __QTNode* n)
         {
-            const auto& b = boxes[i];
-            int vx0 = (int)floorf(b.x / (float)s_tessStep);
-            int vy0 = (int)floorf(b.y / (float)s_tessStep);
-            int vx1 = (int)ceilf(b.z / (float)s_tessStep);
-            int vy1 = (int)ceilf(b.w / (float)s_tessStep);
-
-            int x0 = clampi(vx0, 0, cellsX);
-            int y0 = clampi(vy0, 0, cellsY);
-            int x1 = clampi(vx1, 0, cellsX);
-            int y1 = clampi(vy1, 0, cellsY);
-
-            const int bw = imax(0, x1 - x0);
-            const int bh = imax(0, y1 - y0);
-            const int area = bw * bh;
-
-            estPatches += area;
-            minW = imin(minW, bw);  minH = imin(minH, bh);
-            maxW = imax(maxW, bw);  maxH = imax(maxH, bh);
-
-            if ((int)i < PREVIEW)
-                LOGF("  box[%02zu] world=[%.0f %.0f .. %.0f %.0f] -> patches=[%d..%d)x[%d..%d) size=%dx%d area=%d\n",
-                    i, b.x, b.y, b.z, b.w, x0, x1, y0, y1, bw, bh, area);
-        }
+            if (isOutside(n)) return;
+            const bool hasChildren = (n->c[0] || n->c[1] || n->c[2] || n->c[3]);
+            if (hasChildren) {
+                for (int i = 0; i < 4; ++i) if (n->c[i]) walk(n->c[i]);
+                return;
+            }
+            outPatches.push_back({ n->aabbMin.x, n->aabbMin.y, n->aabbMin.z, n->aabbMax.x, n->aabbMax.y, n->aabbMax.z });
+        };
 
-        const double coverage = (totalPatches > 0)
-            ? (100.0 * (double)estPatches / (double)totalPatches) : 0.0;
+    walk(m_pQTRoot);
 
-        LOGF("  summary: estPatches=%lld (%.1f%% of %d) | boxSize[min=%dx%d max=%dx%d]\n",
-            (long long)estPatches, coverage, totalPatches,
-            (minW == 0x7fffffff ? 0 : minW), (minH == 0x7fffffff ? 0 : minH), maxW, maxH);
+    //     , ,     ,  
+    const long long numLeaves = (long long)m_scalePatchX * m_scalePatchY;
+    CounterPatchesVisible().Add((long long)outPatches.size());
+    CounterPatchesCulled().Add(numLeaves - (long long)outPatches.size());
+}
+
+//  CalcTessFactor  RenderTerrainTessHS.hlsl   : quad-   t   2*t*t
+// .       ,  
+unsigned long long Terrain::EstimateTriangles(const DirectX::XMFLOAT3& eye, const std::vector<PatchBounds>& patches)
+{
+    const float LOD_NEAR = 32.0f, LOD_FAR = 400.0f, HARD_CUTOFF = 2000.0f;
+    double sum = 0.0;
+    for (const PatchBounds& p : patches) {
+        const float dx = 0.5f * (p.x0 + p.x1) - eye.x;
+        const float dy = 0.5f * (p.y0 + p.y1) - eye.y;
+        const float dz = 0.5f * (p.z0 + p.z1) - eye.z;
+        const float d = sqrtf(dx * dx + dy * dy + dz * dz);
+        if (d > HARD_CUTOFF) continue;
+        float s = saturatef((d - LOD_NEAR) / (LOD_FAR - LOD_NEAR));
+        s = powf(s, 1.5f);
+        float t = powf(2.0f, 6.0f + (1.0f - 6.0f) * s);
+        t = t < 1.0f ? 1.0f : (t > 64.0f ? 64.0f : t);
+        sum += 2.0 * t * t;
     }
-#endif
+    return (unsigned long long)sum;
+}
 
+//    :   LOD  hull-
+void Terrain::DrawLOD(CommandList* cmdList, const DirectX::XMFLOAT3& eye)
+{
+    cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_4_CONTROL_POINT_PATCHLIST);
+    cmdList->IASetVertexBuffers(0, 1, &m_viewVertexBuffer);
+    cmdList->IASetIndexBuffer(&m_viewIndexBuffer);
+    CountSubmittedPatches();
     cmdList->DrawIndexedInstanced(m_numIndices, 1, 0, 0, 0);
 }
@@ -4,10 +4,14 @@
 #include "Graphics.h"
 #include "Material.h"
 #include "BoundingVolume.h"
+#include "ImageBuffer.h"
+#include <cstdint>
 #include <vector>
 
 using namespace graphics;
 
+struct __QTNode;
+
 struct Vertex {
     XMFLOAT3 position;
     XMFLOAT3 aabbmin;
@@ -15,6 +19,17 @@ struct Vertex {
     UINT skirt;
 };
 
+//     , 16   :
+//   R- heightmap,    A-  
+struct TerrainSnapshot {
+    std::vector<uint16_t> height;
+    unsigned int          wHeight = 0;
+    unsigned int          hHeight = 0;
+    std::vector<uint16_t> mask;
+    unsigned int          wMask = 0;
+    unsigned int          hMask = 0;
+};
+
 struct TerrainShaderConstants {
     float scale;
     float width;
@@ -23,26 +38,52 @@ struct TerrainShaderConstants {
     TerrainShaderConstants(float s, float w, float d, float b) : scale(s), width(w), depth(d), base(b) {}
 };
 
+//    :     ,     
 class Terrain {
 public:
+    // ,   : , ,   
     Terrain(ResourceManager* rm, TerrainMaterial* mat, const char* fnHeightmap, const char* fnDisplacementMap);
     ~Terrain();
 
-    void Draw(ID3D12GraphicsCommandList* cmdList, bool Draw3D = true);
-    void DrawLOD(ID3D12GraphicsCommandList* cmdList, const DirectX::XMFLOAT3& eye);
+    //    : , ,      ,    
+    //  JobSystem (Scene::RequestTerrain  Build  ;   BC- 
+    //     ,  ).      Build  : 
+    //      upload-  ,  SRV/CBV  CPU- 
+    //   Finalize     .  GFX_Exception,     
+    static Terrain* Build(ResourceManager* rm, TerrainMaterial* mat, const char* fnHeightmap, const char* fnDisplacementMap);
+    //  : SRV/CBV   CPU- ;     
+    void Finalize();
+    //  ,       :    
+    //    , CPU-  
+    void Release();
+
+    void Draw(CommandList* cmdList, bool Draw3D = true);
+    void DrawLOD(CommandList* cmdList, const DirectX::XMFLOAT3& eye);
     void SelectQT(const DirectX::XMFLOAT3& eye, std::vector<DirectX::XMFLOAT4>& outBoxes) const;
+    //     (  )      
+    void SelectVisiblePatches(const DirectX::XMFLOAT4 frustum[6], std::vector<PatchBounds>& outPatches) const;
+    //       (  ,   hull-)
+    static unsigned long long EstimateTriangles(const DirectX::XMFLOAT3& eye, const std::vector<PatchBounds>& patches);
+    TerrainMaterial* GetMaterial() { return m_pMat; }
 
-    void AttachTerrainResources(ID3D12GraphicsCommandList* cmdList, unsigned int srvDescTableIndexHeightMap,
+    void AttachTerrainResources(CommandList* cmdList, unsigned int srvDescTableIndexHeightMap,
         unsigned int srvDescTableIndexDisplacementMap, unsigned int cbvDescTableIndex);
-    void AttachMaterialResources(ID3D12GraphicsCommandList* cmdList, unsigned int srvDescTableIndex);
+    void AttachMaterialResources(CommandList* cmdList, unsigned int srvDescTableIndex);
 
     BoundingSphere GetBoundingSphere() { return m_BoundingSphere; }
     float GetHeightAtPoint(float x, float y);
-    void DrawLOD(ID3D12GraphicsCommandList* cmdList, const DirectX::XMFLOAT4& eye);
+    void DrawLOD(CommandList* cmdList, const DirectX::XMFLOAT4& eye);
     void PaintBrushAt(float worldX, float worldY, float radiusWorld);
     void ReuploadDisplacementMap();
     void ReuploadHeightMap();
+    //    :  ,     
+    void Snapshot(TerrainSnapshot& out) const;
 private:
+    Terrain(ResourceManager* rm, TerrainMaterial* mat);
+    void CountSubmittedPatches() const;
+
+    // CPU-:       img,     
+    unsigned char* LoadMap(const char* fn, ImageBuffer& img, unsigned int& idxCPU, unsigned int& h, unsigned int& w);
     void CreateMesh3D();
     void CreateVertexBuffer();
     void CreateIndexBuffer();
@@ -86,6 +127,25 @@ private:
     int m_scalePatchX = 0;  //    X (  )
     int m_scalePatchY = 0;  //    Y (  )
     int m_tessStep = 64;  //   heightmap    
+    __QTNode* m_pQTRoot = nullptr;
     unsigned int m_idxDisplacementGPU = (unsigned int)-1;
     unsigned int m_idxHeightGPU = (unsigned int)-1;
+    unsigned int m_idxVertexGPU = (unsigned int)-1;
+    unsigned int m_idxIndexGPU = (unsigned int)-1;
+    unsigned int m_idxConstantsGPU = (unsigned int)-1;
+    // CPU-:   ,  Finalize     
+    unsigned int m_idxHeightCPU = (unsigned int)-1;
+    unsigned int m_idxDisplacementCPU = (unsigned int)-1;
+    ImageBuffer  m_imgHeightMap;
+    ImageBuffer  m_imgDisplacementMap;
+    bool         m_isBackground = false;
+    bool         m_hasDescriptors = false;
+    //  CPU-   ,     Reupload*
+    MipChain m_mipsHeightMap;
+    MipChain m_mipsDisplacementMap;
+    RECT     m_rectDirtyHeightMap = {};
+    RECT     m_rectDirtyDisplacementMap = {};
+    //    GPU  BC3; false     4,   RGBA8
+    BCChain  m_bcDisplacementMap;
+    bool     m_isDisplacementBC = false;
 };
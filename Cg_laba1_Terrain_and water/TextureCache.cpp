@@ -0,0 +1,253 @@
+#include "TextureCache.h"
+#include <Windows.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+static const uint32_t CACHE_MAGIC = 0x31435854; // "TXC1"
+static const uint32_t CACHE_VERSION = 2;
+static const size_t   CACHE_HASH_CHUNK = 1 << 20;
+
+// 64 bytes so the texels after it stay 16-byte aligned for SIMD readers.
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t size;
+    uint32_t w;
+    uint32_t h;
+    uint32_t format;
+    uint32_t mips;
+    float    psnr;
+    uint8_t  reserved[20];
+};
+static_assert(sizeof(CacheHeader) == 64, "CacheHeader must stay 64 bytes");
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+
+struct CacheFile {
+    std::filesystem::file_time_type time;
+    uintmax_t                       size;
+    std::filesystem::path           path;
+};
+
+// Total size of the entries in dir; lists them into files when given.
+static uint64_t ScanEntries(const std::filesystem::path& dir, std::vector<CacheFile>* files) {
+    uint64_t total = 0;
+    std::error_code ec;
+    for (auto it = std::filesystem::directory_iterator(dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        if (it->path().extension() != ".tex") continue;
+        CacheFile file{ it->last_write_time(ec), it->file_size(ec), it->path() };
+        if (ec) continue;
+        total += file.size;
+        if (files) files->push_back(file);
+    }
+    return total;
+}
+
+static inline uint64_t RotL(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+static inline uint64_t Round(uint64_t acc, uint64_t v) { return RotL(acc + v * PRIME2, 31) * PRIME1; }
+static inline uint64_t Read64(const unsigned char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+
+    // four independent lanes over 32-byte stripes, then fold
+    uint64_t lane[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+    while (end - p >= 32) {
+        lane[0] = Round(lane[0], Read64(p));
+        lane[1] = Round(lane[1], Read64(p + 8));
+        lane[2] = Round(lane[2], Read64(p + 16));
+        lane[3] = Round(lane[3], Read64(p + 24));
+        p += 32;
+    }
+    uint64_t h = RotL(lane[0], 1) + RotL(lane[1], 7) + RotL(lane[2], 12) + RotL(lane[3], 18);
+    h += static_cast<uint64_t>(size);
+
+    while (end - p >= 8) { h = RotL(h ^ Round(0, Read64(p)), 27) * PRIME1 + PRIME3; p += 8; }
+    while (p < end) { h = RotL(h ^ (*p * PRIME3), 11) * PRIME1; ++p; }
+
+    h ^= h >> 33; h *= PRIME2;
+    h ^= h >> 29; h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+TextureCache& TextureCache::Get() {
+    static TextureCache cache;
+    return cache;
+}
+
+TextureCache::TextureCache()
+    : m_dir("texcache"), m_sizeBudget(DEFAULT_TEXTURE_CACHE_BUDGET), m_sizeUsed(0), m_isScanned(false),
+    m_numHits(0), m_numMisses(0) {
+}
+
+void TextureCache::SetDirectory(const std::filesystem::path& dir) {
+    std::lock_guard<std::mutex> lock(m_mtxEvict);
+    m_dir = dir;
+    m_isScanned = false;
+}
+
+std::filesystem::path TextureCache::GetEntryPath(uint64_t key) const {
+    char name[32];
+    sprintf_s(name, "%016llx.tex", static_cast<unsigned long long>(key));
+    return m_dir / name;
+}
+
+uint64_t TextureCache::MakeKey(const std::filesystem::path& source, const char* params) const {
+    std::ifstream in(source, std::ios::binary);
+    if (!in) return 0;
+
+    std::vector<char> chunk(CACHE_HASH_CHUNK);
+    uint64_t h = CACHE_VERSION;
+    while (in) {
+        in.read(chunk.data(), chunk.size());
+        std::streamsize got = in.gcount();
+        if (got <= 0) break;
+        h = HashBytes(chunk.data(), static_cast<size_t>(got), h);
+    }
+    h = HashBytes(params, std::strlen(params), h);
+    return h ? h : 1;
+}
+
+bool TextureCache::Load(uint64_t key, TextureCacheEntry& out) {
+    if (!key) return false;
+
+    std::filesystem::path p = GetEntryPath(key);
+    HANDLE file = CreateFileW(p.c_str(), GENERIC_READ | FILE_WRITE_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        ++m_numMisses;
+        return false;
+    }
+
+    LARGE_INTEGER sizeFile{};
+    if (!GetFileSizeEx(file, &sizeFile) || sizeFile.QuadPart < (LONGLONG)sizeof(CacheHeader)) {
+        CloseHandle(file);
+        ++m_numMisses;
+        return false;
+    }
+
+    // last write time doubles as the LRU stamp for eviction
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(file, nullptr, nullptr, &now);
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) {
+        ++m_numMisses;
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) {
+        ++m_numMisses;
+        return false;
+    }
+
+    const CacheHeader* hdr = static_cast<const CacheHeader*>(view);
+    if (hdr->magic != CACHE_MAGIC || hdr->version != CACHE_VERSION || hdr->key != key ||
+        hdr->size + sizeof(CacheHeader) > (uint64_t)sizeFile.QuadPart) {
+        UnmapViewOfFile(view);
+        Remove(key);
+        ++m_numMisses;
+        return false;
+    }
+
+    out.view = view;
+    out.data = static_cast<unsigned char*>(view) + sizeof(CacheHeader);
+    out.size = hdr->size;
+    out.w = hdr->w;
+    out.h = hdr->h;
+    out.format = hdr->format;
+    out.mips = hdr->mips;
+    out.psnr = hdr->psnr;
+    ++m_numHits;
+    return true;
+}
+
+void TextureCache::Store(uint64_t key, const void* data, uint64_t size, unsigned int w, unsigned int h,
+    unsigned int format, unsigned int mips, float psnr) {
+    if (!key || !data) return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(m_dir, ec);
+
+    CacheHeader hdr = {};
+    hdr.magic = CACHE_MAGIC;
+    hdr.version = CACHE_VERSION;
+    hdr.key = key;
+    hdr.size = size;
+    hdr.w = w;
+    hdr.h = h;
+    hdr.format = format;
+    hdr.mips = mips;
+    hdr.psnr = psnr;
+
+    // write under a per-thread temp name, then rename, so readers never see half an entry
+    std::filesystem::path p = GetEntryPath(key);
+    std::filesystem::path tmp = p;
+    tmp += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream outFile(tmp, std::ios::binary | std::ios::trunc);
+        if (!outFile) return;
+        outFile.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        outFile.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!outFile) {
+            outFile.close();
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mtxEvict);
+        uintmax_t sizeOld = std::filesystem::file_size(p, ec);
+        if (ec) sizeOld = 0;
+        std::filesystem::rename(tmp, p, ec);
+        if (ec) std::filesystem::remove(tmp, ec);
+        else if (m_isScanned) m_sizeUsed += sizeof(hdr) + size - sizeOld;
+    }
+
+    Evict();
+}
+
+void TextureCache::Remove(uint64_t key) {
+    std::lock_guard<std::mutex> lock(m_mtxEvict);
+    const std::filesystem::path p = GetEntryPath(key);
+    std::error_code ec;
+    const uintmax_t size = std::filesystem::file_size(p, ec);
+    if (std::filesystem::remove(p, ec) && m_isScanned) m_sizeUsed -= (std::min)(m_sizeUsed, static_cast<uint64_t>(size));
+}
+
+void TextureCache::ReleaseView(void* view) {
+    if (view) UnmapViewOfFile(view);
+}
+
+void TextureCache::Evict() {
+    std::lock_guard<std::mutex> lock(m_mtxEvict);
+    if (!m_isScanned) {
+        m_sizeUsed = ScanEntries(m_dir, nullptr);
+        m_isScanned = true;
+    }
+    if (m_sizeUsed <= m_sizeBudget) return;
+
+    // over the budget: the directory is listed for the LRU order, which also corrects the tracked size
+    std::vector<CacheFile> files;
+    uint64_t total = ScanEntries(m_dir, &files);
+    std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.time < b.time; });
+    std::error_code ec;
+    for (const CacheFile& file : files) {
+        if (total <= m_sizeBudget) break;
+        // an entry still mapped by this process cannot be deleted; skip it and keep going
+        if (std::filesystem::remove(file.path, ec)) total -= file.size;
+    }
+    m_sizeUsed = total;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+
+// Content-addressed disk cache of decoded, GPU-ready texel data.
+// An entry is keyed by a hash of the source file bytes plus the conversion parameters,
+// stored raw behind a small header and mapped copy-on-write on a hit, so a hit skips decoding
+// and callers may still edit the texels in place without touching the file.
+static const uint64_t DEFAULT_TEXTURE_CACHE_BUDGET = 1ull << 30; // 1 GiB
+
+struct TextureCacheEntry {
+    unsigned char*  data = nullptr;     // first texel
+    void*           view = nullptr;     // mapped view, give back with TextureCache::ReleaseView
+    uint64_t        size = 0;           // bytes of texel data
+    unsigned int    w = 0;
+    unsigned int    h = 0;
+    unsigned int    format = 0;         // DXGI_FORMAT of the texels
+    unsigned int    mips = 0;
+    float           psnr = 0.0f;        // quality of a lossy encode against its source, 0 if not lossy
+};
+
+class TextureCache {
+public:
+    static TextureCache& Get();
+
+    void SetDirectory(const std::filesystem::path& dir);
+    void SetBudget(uint64_t bytes) { m_sizeBudget = bytes; }
+
+    // 0 when the source cannot be read (the caller then just decodes without caching).
+    uint64_t MakeKey(const std::filesystem::path& source, const char* params) const;
+
+    bool Load(uint64_t key, TextureCacheEntry& out);
+    void Store(uint64_t key, const void* data, uint64_t size, unsigned int w, unsigned int h,
+        unsigned int format, unsigned int mips, float psnr = 0.0f);
+    void Remove(uint64_t key);
+    static void ReleaseView(void* view);
+
+    // Deletes least recently used entries until the directory fits in the budget. The size on disk is
+    // tracked in memory from one scan of the directory; it is listed again only when over the budget.
+    void Evict();
+
+    uint64_t GetHits() const { return m_numHits; }
+    uint64_t GetMisses() const { return m_numMisses; }
+
+private:
+    TextureCache();
+    std::filesystem::path GetEntryPath(uint64_t key) const;
+
+    std::filesystem::path   m_dir;
+    uint64_t                m_sizeBudget;
+    std::mutex              m_mtxEvict;     // also guards m_sizeUsed and m_isScanned
+    uint64_t                m_sizeUsed;     // bytes of entries on disk, valid once m_isScanned
+    bool                    m_isScanned;
+    std::atomic<uint64_t>   m_numHits;
+    std::atomic<uint64_t>   m_numMisses;
+};
+
+// 64-bit hash used for cache keys; not cryptographic.
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
@@ -0,0 +1,78 @@
+#include "TransientPool.h"
+#include <string>
+
+TransientPool::~TransientPool() {
+    // placed resources before the heap under them
+    for (Target& t : m_listTargets) {
+        if (t.pResource) { t.pResource->Release(); t.pResource = nullptr; }
+    }
+    if (m_pHeap) { m_pHeap->Release(); m_pHeap = nullptr; }
+    m_pDev = nullptr;
+}
+
+unsigned int TransientPool::AddTarget(RenderGraph& graph, const char* name, const D3D12_RESOURCE_DESC& desc,
+    const D3D12_CLEAR_VALUE& clear) {
+    const D3D12_RESOURCE_ALLOCATION_INFO info = m_pDev->GetResourceAllocationInfo(&desc);
+    const unsigned int resource = graph.CreateTransient(name, info.SizeInBytes, info.Alignment);
+    m_listTargets.push_back({ resource, desc, clear, nullptr });
+    return resource;
+}
+
+void TransientPool::Allocate(const RenderGraph& graph) {
+    if (m_pHeap) throw GFX_Exception("TransientPool::Allocate: already allocated.");
+
+    // render and depth targets only, so resource heap tier 1 is enough
+    D3D12_HEAP_DESC descHeap = {};
+    descHeap.SizeInBytes = (graph.GetHeapSize() + D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT - 1)
+        & ~static_cast<unsigned long long>(D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT - 1);
+    descHeap.Properties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+    descHeap.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+    descHeap.Flags = D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES;
+    m_pDev->CreateHeap(&descHeap, m_pHeap);
+    m_pHeap->SetName(L"Render Graph Transients");
+    m_sizeHeap = descHeap.SizeInBytes;
+
+    for (Target& t : m_listTargets) {
+        m_pDev->CreatePlacedResource(t.pResource, m_pHeap, graph.GetTransientOffset(t.resource), &t.desc,
+            ToState(graph.GetInitialAccess(t.resource)), &t.clear);
+        const std::string name = graph.GetResourceName(t.resource);
+        t.pResource->SetName(std::wstring(name.begin(), name.end()).c_str());
+    }
+}
+
+ID3D12Resource* TransientPool::GetResource(unsigned int resource) const {
+    for (const Target& t : m_listTargets) {
+        if (t.resource == resource) return t.pResource;
+    }
+    return nullptr;
+}
+
+D3D12_RESOURCE_STATES TransientPool::ToState(unsigned int access) {
+    D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_PRESENT;
+    if (access & RG_ACCESS_RENDER_TARGET) state |= D3D12_RESOURCE_STATE_RENDER_TARGET;
+    if (access & RG_ACCESS_DEPTH_WRITE) state |= D3D12_RESOURCE_STATE_DEPTH_WRITE;
+    if (access & RG_ACCESS_COPY_DEST) state |= D3D12_RESOURCE_STATE_COPY_DEST;
+    if (access & RG_ACCESS_DEPTH_READ) state |= D3D12_RESOURCE_STATE_DEPTH_READ;
+    if (access & RG_ACCESS_SHADER_READ) state |= D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+    if (access & RG_ACCESS_COPY_SOURCE) state |= D3D12_RESOURCE_STATE_COPY_SOURCE;
+    return state;
+}
+
+void TransientPool::RecordBarriers(CommandList* cmdList, const std::vector<RenderGraphBarrier>& barriers,
+    ID3D12Resource* const* resources) {
+    D3D12_RESOURCE_BARRIER batch[16];
+    unsigned int num = 0;
+    for (const RenderGraphBarrier& b : barriers) {
+        if (b.type == RG_BARRIER_ALIASING) {
+            batch[num++] = CD3DX12_RESOURCE_BARRIER::Aliasing(nullptr, resources[b.resource]);
+        }
+        else {
+            batch[num++] = CD3DX12_RESOURCE_BARRIER::Transition(resources[b.resource], ToState(b.before), ToState(b.after));
+        }
+        if (num == _countof(batch)) {
+            cmdList->ResourceBarrier(num, batch);
+            num = 0;
+        }
+    }
+    if (num) cmdList->ResourceBarrier(num, batch);
+}
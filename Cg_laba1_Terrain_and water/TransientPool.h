@@ -0,0 +1,46 @@
+#pragma once
+#include "RenderGraph.h"
+#include "Graphics.h"
+#include <vector>
+
+using namespace graphics;
+
+// Device side of a RenderGraph: one heap for the graph's transient targets, placed resources at the
+// offsets Compile chose, and the compiled barriers turned into ResourceBarrier calls. The targets are
+// created once and serve every frame (see RenderGraph on why that is safe on one queue).
+class TransientPool {
+public:
+    explicit TransientPool(Device* dev) : m_pDev(dev) {}
+    // The caller has waited for the GPU.
+    ~TransientPool();
+    TransientPool(const TransientPool&) = delete;
+    TransientPool& operator=(const TransientPool&) = delete;
+
+    // Declares a render or depth target in graph, sized by the device. Returns the graph's resource index.
+    unsigned int AddTarget(RenderGraph& graph, const char* name, const D3D12_RESOURCE_DESC& desc,
+        const D3D12_CLEAR_VALUE& clear);
+    // After graph.Compile: the heap and every target in the state the graph starts the frame with.
+    void Allocate(const RenderGraph& graph);
+
+    ID3D12Resource* GetResource(unsigned int resource) const;
+    unsigned long long GetHeapSize() const { return m_sizeHeap; }
+
+    // The barriers in ResourceBarrier calls of up to 16; resources maps graph indices to this frame's
+    // resources.
+    static void RecordBarriers(CommandList* cmdList, const std::vector<RenderGraphBarrier>& barriers,
+        ID3D12Resource* const* resources);
+    static D3D12_RESOURCE_STATES ToState(unsigned int access);
+
+private:
+    struct Target {
+        unsigned int            resource;
+        D3D12_RESOURCE_DESC     desc;
+        D3D12_CLEAR_VALUE       clear;
+        ID3D12Resource*         pResource;
+    };
+
+    Device*                 m_pDev;
+    ID3D12Heap*             m_pHeap = nullptr;
+    std::vector<Target>     m_listTargets;
+    unsigned long long      m_sizeHeap = 0;
+};
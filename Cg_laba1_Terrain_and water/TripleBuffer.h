@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+
+// Lock-free single-producer single-consumer triple buffer. The writer fills the back slot and
+// publishes it; the reader takes the newest published slot. Neither side ever waits for the other,
+// and a slot the reader has not taken yet is replaced by a newer one. T is reused slot by slot, so
+// containers inside it keep their capacity.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Writer: the slot to fill; it holds whatever was published three times ago.
+    T& GetWriteBuffer() { return m_slots[m_iBack]; }
+    // Writer: makes the write buffer the newest one.
+    void Publish() {
+        m_iBack = m_state.exchange(m_iBack | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Reader: takes the newest slot if one was published since the last call.
+    bool Acquire() {
+        if (!(m_state.load(std::memory_order_relaxed) & FRESH)) return false;
+        m_iFront = m_state.exchange(m_iFront, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+    // Reader: the slot taken by the last successful Acquire.
+    const T& GetReadBuffer() const { return m_slots[m_iFront]; }
+
+private:
+    static const unsigned int INDEX_MASK = 3;
+    static const unsigned int FRESH = 4;
+
+    T                           m_slots[3];
+    unsigned int                m_iBack = 0;        // writer only
+    std::atomic<unsigned int>   m_state{ 1 };       // middle slot, FRESH once published and not yet taken
+    unsigned int                m_iFront = 2;       // reader only
+};
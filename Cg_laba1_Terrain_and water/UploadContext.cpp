@@ -0,0 +1,155 @@
+#include "UploadContext.h"
+#include "ResourceManager.h"
+#include "Counters.h"
+
+// A batch that is being recorded or waits in the submission queue has no fence value yet.
+static const unsigned long long UPLOAD_FENCE_PENDING = ~0ull;
+// More batches than this in flight means the GPU is far behind; the oldest is waited for instead.
+static const size_t UPLOAD_CONTEXT_MAX_BATCHES = 4;
+
+UploadContext::UploadContext(ResourceManager* rm, Device* dev, unsigned long long sizeRing)
+    : m_pResMgr(rm), m_pDev(dev), m_sizeRing(sizeRing)
+{
+    D3D12_RESOURCE_DESC   descRing = CD3DX12_RESOURCE_DESC::Buffer(m_sizeRing);
+    D3D12_HEAP_PROPERTIES propsRing = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+    m_pDev->CreateCommittedResource(m_pRing, &descRing, &propsRing, D3D12_HEAP_FLAG_NONE,
+        D3D12_RESOURCE_STATE_GENERIC_READ, nullptr);
+    m_pRing->SetName(L"Upload Context Ring");
+
+    m_hdlFenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (!m_hdlFenceEvent) throw GFX_Exception("UploadContext::UploadContext: CreateEvent failed.");
+}
+
+UploadContext::~UploadContext() {
+    if (m_pCurrent) Submit();
+    WaitIdle();
+
+    for (std::unique_ptr<Batch>& b : m_listBatches) {
+        for (ID3D12Resource* tmp : b->listTemp) tmp->Release();
+        if (b->pList) b->pList->Release();
+        if (b->pAllocator) b->pAllocator->Release();
+    }
+    m_listBatches.clear();
+
+    if (m_pRing) { m_pRing->Release(); m_pRing = nullptr; }
+    if (m_hdlFenceEvent) { CloseHandle(m_hdlFenceEvent); m_hdlFenceEvent = nullptr; }
+    m_pDev = nullptr;
+    m_pResMgr = nullptr;
+}
+
+UploadContext::Batch* UploadContext::AcquireBatch() {
+    const unsigned long long valCompleted = m_pResMgr->GetCompletedUploadFence();
+    for (std::unique_ptr<Batch>& b : m_listBatches) {
+        const unsigned long long val = b->valFence.load(std::memory_order_acquire);
+        if (val != UPLOAD_FENCE_PENDING && val <= valCompleted) return b.get();
+    }
+
+    if (m_listBatches.size() < UPLOAD_CONTEXT_MAX_BATCHES) {
+        std::unique_ptr<Batch> b(new Batch());
+        m_pDev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, b->pAllocator);
+        m_pDev->CreateGraphicsCommandList(D3D12_COMMAND_LIST_TYPE_DIRECT, b->pAllocator, b->pList);
+        b->pList->Close();
+        m_listBatches.push_back(std::move(b));
+        return m_listBatches.back().get();
+    }
+
+    // all in flight: submit the queue and wait for the oldest
+    m_pResMgr->SubmitUploads();
+    Batch* oldest = nullptr;
+    for (std::unique_ptr<Batch>& b : m_listBatches) {
+        if (!oldest || b->valFence.load(std::memory_order_acquire) < oldest->valFence.load(std::memory_order_acquire)) {
+            oldest = b.get();
+        }
+    }
+    WaitForFence(oldest->valFence.load(std::memory_order_acquire));
+    return oldest;
+}
+
+void UploadContext::Begin() {
+    if (m_pCurrent) return;
+
+    Batch* b = AcquireBatch();
+    for (ID3D12Resource* tmp : b->listTemp) tmp->Release();
+    b->listTemp.clear();
+    if (FAILED(b->pAllocator->Reset())) throw GFX_Exception("UploadContext::Begin: CommandAllocator Reset failed.");
+    if (FAILED(b->pList->Reset(b->pAllocator, nullptr))) throw GFX_Exception("UploadContext::Begin: CommandList Reset failed.");
+    b->valFence.store(UPLOAD_FENCE_PENDING, std::memory_order_relaxed);
+    b->hasCommands = false;
+    m_pCurrent = b;
+}
+
+void UploadContext::Upload(ID3D12Resource* dst, unsigned int firstSubResource, unsigned int numSubResources,
+    D3D12_SUBRESOURCE_DATA* data, D3D12_RESOURCE_STATES state) {
+    if (!m_pCurrent) throw GFX_Exception("UploadContext::Upload: Begin was not called.");
+
+    const UINT64 size = m_pDev->GetRequiredIntermediateSize(dst, firstSubResource, numSubResources);
+    static Counter& s_bytes = CounterRegistry::Get().Register("upload bytes", COUNTER_PER_FRAME, "B");
+    s_bytes.Add((long long)size);
+    ID3D12Resource* staging = m_pRing;
+    UINT64 offset = 0;
+    if (size > m_sizeRing) {
+        // a temporary upload resource lives until the GPU is done with the batch
+        D3D12_RESOURCE_DESC   descTmp = CD3DX12_RESOURCE_DESC::Buffer(size);
+        D3D12_HEAP_PROPERTIES propsTmp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+        m_pDev->CreateCommittedResource(staging, &descTmp, &propsTmp, D3D12_HEAP_FLAG_NONE,
+            D3D12_RESOURCE_STATE_GENERIC_READ, nullptr);
+        m_pCurrent->listTemp.push_back(staging);
+    }
+    else {
+        offset = (m_iRing + D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1) & ~(UINT64)(D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1);
+        if (offset + size > m_sizeRing) {
+            // earlier batches and this one may still read the start of the ring: submit it and wait for all
+            if (m_pCurrent->hasCommands) {
+                Submit();
+                WaitIdle();
+                Begin();
+            }
+            else {
+                WaitIdle();
+            }
+            offset = 0;
+        }
+        m_iRing = offset + size;
+    }
+
+    CommandList* list = m_pCurrent->pList;
+    D3D12_RESOURCE_BARRIER toCopy = CD3DX12_RESOURCE_BARRIER::Transition(dst, state, D3D12_RESOURCE_STATE_COPY_DEST);
+    list->ResourceBarrier(1, &toCopy);
+    list->UpdateSubresources(dst, staging, offset, firstSubResource, numSubResources, data);
+    D3D12_RESOURCE_BARRIER toFinal = CD3DX12_RESOURCE_BARRIER::Transition(dst, D3D12_RESOURCE_STATE_COPY_DEST, state);
+    list->ResourceBarrier(1, &toFinal);
+    m_pCurrent->hasCommands = true;
+}
+
+void UploadContext::Submit() {
+    if (!m_pCurrent) return;
+
+    Batch* b = m_pCurrent;
+    m_pCurrent = nullptr;
+    if (FAILED(b->pList->Close())) throw GFX_Exception("UploadContext::Submit: CommandList Close failed.");
+    if (!b->hasCommands) {
+        b->valFence.store(0, std::memory_order_release);   // an empty batch is free at once
+        return;
+    }
+    m_pResMgr->QueueUpload(b->pList, &b->valFence);
+}
+
+void UploadContext::WaitIdle() {
+    // after SubmitUploads every submitted batch has a fence value
+    m_pResMgr->SubmitUploads();
+    unsigned long long valLast = 0;
+    for (std::unique_ptr<Batch>& b : m_listBatches) {
+        if (b.get() == m_pCurrent) continue;
+        const unsigned long long val = b->valFence.load(std::memory_order_acquire);
+        if (val != UPLOAD_FENCE_PENDING && val > valLast) valLast = val;
+    }
+    WaitForFence(valLast);
+}
+
+void UploadContext::WaitForFence(unsigned long long val) {
+    if (m_pResMgr->GetCompletedUploadFence() >= val) return;
+    if (FAILED(m_pResMgr->m_pFence->SetEventOnCompletion(val, m_hdlFenceEvent))) {
+        throw GFX_Exception("UploadContext::WaitForFence: SetEventOnCompletion failed.");
+    }
+    WaitForSingleObject(m_hdlFenceEvent, INFINITE);
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "Graphics.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class ResourceManager;
+
+// One thread's upload recording: command lists with their own allocators and a staging ring in an
+// upload heap of its own, so several threads can record copies at once without sharing anything.
+// Submit closes the batch and hands it to the ResourceManager's submission queue; whichever thread
+// drains that queue executes it and tells the batch its fence value. Not shared between threads:
+// get the calling thread's context from ResourceManager::GetUploadContext.
+class UploadContext {
+public:
+    UploadContext(ResourceManager* rm, graphics::Device* dev, unsigned long long sizeRing);
+    ~UploadContext();
+    UploadContext(const UploadContext&) = delete;
+    UploadContext& operator=(const UploadContext&) = delete;
+
+    // Starts a batch. Reuses an allocator the GPU is done with; waits only when all of them are busy.
+    void Begin();
+    // Copies data into subresources of dst, which sits in state between uploads.
+    void Upload(ID3D12Resource* dst, unsigned int firstSubResource, unsigned int numSubResources,
+        D3D12_SUBRESOURCE_DATA* data, D3D12_RESOURCE_STATES state);
+    // Closes the batch and queues it; it reaches the GPU with the next ResourceManager::SubmitUploads.
+    void Submit();
+    // Submits what is queued and waits until the GPU has run every batch of this context.
+    void WaitIdle();
+
+private:
+    struct Batch {
+        ID3D12CommandAllocator*             pAllocator = nullptr;
+        graphics::CommandList*              pList = nullptr;
+        std::atomic<unsigned long long>     valFence{ 0 };  // UPLOAD_FENCE_PENDING while recorded or queued
+        std::vector<ID3D12Resource*>        listTemp;       // staging that did not fit into the ring
+        bool                                hasCommands = false;
+    };
+
+    Batch* AcquireBatch();
+    void WaitForFence(unsigned long long val);
+
+    ResourceManager*                    m_pResMgr;
+    graphics::Device*                   m_pDev;
+    ID3D12Resource*                     m_pRing = nullptr;
+    unsigned long long                  m_sizeRing;
+    unsigned long long                  m_iRing = 0;
+    std::vector<std::unique_ptr<Batch>> m_listBatches;
+    Batch*                              m_pCurrent = nullptr;
+    HANDLE                              m_hdlFenceEvent = nullptr;
+};
@@ -56,7 +56,7 @@ Water::~Water()
     if (m_pRootSig) { m_pRootSig->Release(); m_pRootSig = nullptr; }
 }
 
-void Water::Draw(ID3D12GraphicsCommandList* cmdList, const WaterConstants& constants)
+void Water::Draw(CommandList* cmdList, const WaterConstants& constants)
 {
     cmdList->SetPipelineState(m_pPSO);
     cmdList->SetGraphicsRootSignature(m_pRootSig);
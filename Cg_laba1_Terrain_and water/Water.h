@@ -28,7 +28,7 @@ public:
     Water(Device* dev, float waterHeight, float halfSize);
     ~Water();
 
-    void Draw(ID3D12GraphicsCommandList* cmdList, const WaterConstants& constants);
+    void Draw(CommandList* cmdList, const WaterConstants& constants);
 
 private:
     Device* m_pDev;
@@ -5,6 +5,13 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*SSE2 is part of every x64 target, so the kernels below only need a runtime fallback on old x86 builds*/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LODEPNG_SSE2
+#include <emmintrin.h>
+#endif
 
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
@@ -444,6 +451,10 @@ typedef struct HuffmanTree
     unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
     unsigned maxbitlen; /*maximum number of bits a single code can get*/
     unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+    /*decoder lookup tables, see HuffmanTree_makeTable*/
+    unsigned char* table_len; /*bits used by the entry, or the max code length of a second level table*/
+    unsigned short* table_value; /*symbol, or the start of a second level table*/
+    unsigned short* table_pair; /*second literal decoded by the same root entry: literal | (total bits << 8), 0 if none*/
 } HuffmanTree;
 
 
@@ -452,6 +463,9 @@ static void HuffmanTree_init(HuffmanTree* tree)
     tree->tree2d = 0;
     tree->tree1d = 0;
     tree->lengths = 0;
+    tree->table_len = 0;
+    tree->table_value = 0;
+    tree->table_pair = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
@@ -459,6 +473,9 @@ static void HuffmanTree_cleanup(HuffmanTree* tree)
     lodepng_free(tree->tree2d);
     lodepng_free(tree->tree1d);
     lodepng_free(tree->lengths);
+    lodepng_free(tree->table_len);
+    lodepng_free(tree->table_value);
+    lodepng_free(tree->table_pair);
 }
 
 /*the tree representation used by the decoder. return value is error*/
@@ -873,6 +890,166 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
         if (treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
     }
 }
+
+/*
+Table driven decoding for the literal/length and distance trees.
+The first HUFFMAN_FIRSTBITS bits of the stream index a root table. Codes that fit in it are decoded with a
+single lookup; longer codes point to a second level table indexed by the remaining bits. For the
+literal/length tree, a root entry whose code is a literal and whose leftover bits hold a complete second
+literal also stores that one in table_pair, so runs of short literals come out two per lookup.
+*/
+#define HUFFMAN_FIRSTBITS 10u
+#define HUFFMAN_INVALIDSYMBOL 65535u
+
+static unsigned reverseBits(unsigned bits, unsigned num)
+{
+    unsigned i, result = 0;
+    for (i = 0; i < num; ++i) result |= ((bits >> (num - i - 1u)) & 1u) << i;
+    return result;
+}
+
+/*returns the 32 bits starting at bit pointer bp, in stream order (first bit in the lsb); zero past the end*/
+static unsigned peekBits(const unsigned char* in, size_t bp, size_t inlength)
+{
+    size_t p = bp >> 3;
+    unsigned long long v = 0;
+    if (p + 8 <= inlength)
+    {
+        v = (unsigned long long)in[p] | ((unsigned long long)in[p + 1] << 8)
+            | ((unsigned long long)in[p + 2] << 16) | ((unsigned long long)in[p + 3] << 24)
+            | ((unsigned long long)in[p + 4] << 32) | ((unsigned long long)in[p + 5] << 40)
+            | ((unsigned long long)in[p + 6] << 48) | ((unsigned long long)in[p + 7] << 56);
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; p + i < inlength && i < 8; ++i) v |= (unsigned long long)in[p + i] << (8 * i);
+    }
+    return (unsigned)(v >> (bp & 7));
+}
+
+/*builds the lookup tables from tree1d and lengths, the 2D tree must already have validated the code. return value is error*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree, unsigned pairs)
+{
+    static const unsigned headsize = 1u << HUFFMAN_FIRSTBITS;
+    static const unsigned mask = (1u << HUFFMAN_FIRSTBITS) - 1u;
+    unsigned maxlens[1u << HUFFMAN_FIRSTBITS];
+    size_t i, size, pointer;
+
+    /*longest code behind each root entry decides the size of its second level table*/
+    for (i = 0; i < headsize; ++i) maxlens[i] = 0;
+    for (i = 0; i < tree->numcodes; ++i)
+    {
+        unsigned l = tree->lengths[i];
+        unsigned index;
+        if (l <= HUFFMAN_FIRSTBITS) continue;
+        index = reverseBits(tree->tree1d[i] >> (l - HUFFMAN_FIRSTBITS), HUFFMAN_FIRSTBITS);
+        if (maxlens[index] < l) maxlens[index] = l;
+    }
+    size = headsize;
+    for (i = 0; i < headsize; ++i)
+    {
+        if (maxlens[i] > HUFFMAN_FIRSTBITS) size += (size_t)1u << (maxlens[i] - HUFFMAN_FIRSTBITS);
+    }
+
+    tree->table_len = (unsigned char*)lodepng_malloc(size * sizeof(*tree->table_len));
+    tree->table_value = (unsigned short*)lodepng_malloc(size * sizeof(*tree->table_value));
+    if (!tree->table_len || !tree->table_value) return 83; /*alloc fail*/
+    for (i = 0; i < size; ++i)
+    {
+        tree->table_len[i] = 16; /*longer than any code, together with the invalid symbol marks an unused entry*/
+        tree->table_value[i] = HUFFMAN_INVALIDSYMBOL;
+    }
+
+    pointer = headsize;
+    for (i = 0; i < headsize; ++i)
+    {
+        if (maxlens[i] <= HUFFMAN_FIRSTBITS) continue;
+        tree->table_len[i] = (unsigned char)maxlens[i];
+        tree->table_value[i] = (unsigned short)pointer;
+        pointer += (size_t)1u << (maxlens[i] - HUFFMAN_FIRSTBITS);
+    }
+
+    for (i = 0; i < tree->numcodes; ++i)
+    {
+        unsigned l = tree->lengths[i];
+        unsigned reverse, j, num;
+        if (l == 0) continue;
+        reverse = reverseBits(tree->tree1d[i], l);
+        if (l <= HUFFMAN_FIRSTBITS)
+        {
+            /*every root index whose low l bits are this code*/
+            num = 1u << (HUFFMAN_FIRSTBITS - l);
+            for (j = 0; j < num; ++j)
+            {
+                unsigned index = reverse | (j << l);
+                if (tree->table_value[index] != HUFFMAN_INVALIDSYMBOL) return 55; /*oversubscribed*/
+                tree->table_len[index] = (unsigned char)l;
+                tree->table_value[index] = (unsigned short)i;
+            }
+        }
+        else
+        {
+            unsigned index = reverse & mask;
+            unsigned maxlen = tree->table_len[index];
+            unsigned start = tree->table_value[index];
+            unsigned reverse2 = reverse >> HUFFMAN_FIRSTBITS;
+            num = 1u << (maxlen - l);
+            for (j = 0; j < num; ++j)
+            {
+                unsigned index2 = start + (reverse2 | (j << (l - HUFFMAN_FIRSTBITS)));
+                tree->table_len[index2] = (unsigned char)l;
+                tree->table_value[index2] = (unsigned short)i;
+            }
+        }
+    }
+
+    if (pairs)
+    {
+        tree->table_pair = (unsigned short*)lodepng_malloc(headsize * sizeof(*tree->table_pair));
+        if (!tree->table_pair) return 83; /*alloc fail*/
+        for (i = 0; i < headsize; ++i)
+        {
+            unsigned l1 = tree->table_len[i];
+            unsigned index2, l2;
+            tree->table_pair[i] = 0;
+            if (l1 > HUFFMAN_FIRSTBITS || tree->table_value[i] > 255) continue;
+            /*the bits after the first code; entries agree on all indices sharing the low l2 bits*/
+            index2 = (unsigned)i >> l1;
+            l2 = tree->table_len[index2];
+            if (l2 > HUFFMAN_FIRSTBITS - l1 || tree->table_value[index2] > 255) continue;
+            tree->table_pair[i] = (unsigned short)(tree->table_value[index2] | ((l1 + l2) << 8));
+        }
+    }
+
+    return 0;
+}
+
+/*
+Decodes one symbol from the bits returned by peekBits and advances bp. Returns (unsigned)(-1) for a code
+that is not in the tree, or if the code runs past the end of the input.
+*/
+static unsigned huffmanDecodeSymbolTable(unsigned bits, size_t* bp, const HuffmanTree* codetree, size_t inbitlength)
+{
+    unsigned index = bits & ((1u << HUFFMAN_FIRSTBITS) - 1u);
+    unsigned l = codetree->table_len[index];
+    unsigned value = codetree->table_value[index];
+    if (l > HUFFMAN_FIRSTBITS)
+    {
+        if (value == HUFFMAN_INVALIDSYMBOL) return (unsigned)(-1);
+        index = value + ((bits >> HUFFMAN_FIRSTBITS) & ((1u << (l - HUFFMAN_FIRSTBITS)) - 1u));
+        l = codetree->table_len[index];
+        value = codetree->table_value[index];
+        if (value == HUFFMAN_INVALIDSYMBOL) return (unsigned)(-1);
+    }
+    if (*bp + l > inbitlength)
+    {
+        *bp = inbitlength + 1; /*reports error 10, end of input reached without end code*/
+        return (unsigned)(-1);
+    }
+    *bp += l;
+    return value;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_DECODER
@@ -1052,14 +1229,35 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     if (btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
     else if (btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
 
+    if (!error) error = HuffmanTree_makeTable(&tree_ll, 1);
+    if (!error) error = HuffmanTree_makeTable(&tree_d, 0);
+
+    /*
+    the output is written up to out->allocsize and out->size is only set at the end of the block,
+    the PNG decoder reserves the predicted size so this normally never reallocates
+    */
     while (!error) /*decode all symbols until end reached, breaks at end code*/
     {
+        unsigned bits, code_ll, pair;
+
+        if ((*pos) + 2 > out->allocsize && !ucvector_reserve(out, (*pos) + 2)) ERROR_BREAK(83 /*alloc fail*/);
+
+        bits = peekBits(in, *bp, inlength);
+        pair = tree_ll.table_pair[bits & ((1u << HUFFMAN_FIRSTBITS) - 1u)];
+        if (pair && (*bp) + (pair >> 8) <= inbitlength)
+        {
+            /*two literals from one lookup*/
+            out->data[(*pos)] = (unsigned char)tree_ll.table_value[bits & ((1u << HUFFMAN_FIRSTBITS) - 1u)];
+            out->data[(*pos) + 1] = (unsigned char)pair;
+            (*pos) += 2;
+            (*bp) += pair >> 8;
+            continue;
+        }
+
         /*code_ll is literal, length or end code*/
-        unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+        code_ll = huffmanDecodeSymbolTable(bits, bp, &tree_ll, inbitlength);
         if (code_ll <= 255) /*literal symbol*/
         {
-            /*ucvector_push_back would do the same, but for some reason the two lines below run 10% faster*/
-            if (!ucvector_resize(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
             out->data[*pos] = (unsigned char)code_ll;
             ++(*pos);
         }
@@ -1067,7 +1265,7 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
         {
             unsigned code_d, distance;
             unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-            size_t start, forward, backward, length;
+            size_t start, backward, length;
 
             /*part 1: get length base*/
             length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
@@ -1075,15 +1273,17 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
             /*part 2: get extra bits and add the value of that to length*/
             numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
             if ((*bp + numextrabits_l) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-            length += readBitsFromStream(bp, in, numextrabits_l);
+            bits = peekBits(in, *bp, inlength);
+            length += bits & ((1u << numextrabits_l) - 1u);
+            (*bp) += numextrabits_l;
 
             /*part 3: get distance code*/
-            code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+            code_d = huffmanDecodeSymbolTable(bits >> numextrabits_l, bp, &tree_d, inbitlength);
             if (code_d > 29)
             {
-                if (code_ll == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+                if (code_d == (unsigned)(-1)) /*huffmanDecodeSymbolTable returns (unsigned)(-1) in case of error*/
                 {
-                    /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
+                    /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbolTable
                     (10=no endcode, 11=wrong jump outside of tree)*/
                     error = (*bp) > inlength * 8 ? 10 : 11;
                 }
@@ -1095,37 +1295,53 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
             /*part 4: get extra bits from distance*/
             numextrabits_d = DISTANCEEXTRA[code_d];
             if ((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-            distance += readBitsFromStream(bp, in, numextrabits_d);
+            distance += peekBits(in, *bp, inlength) & ((1u << numextrabits_d) - 1u);
+            (*bp) += numextrabits_d;
 
             /*part 5: fill in all the out[n] values based on the length and dist*/
             start = (*pos);
             if (distance > start) ERROR_BREAK(52); /*too long backward distance*/
             backward = start - distance;
 
-            if (!ucvector_resize(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
-            if (distance < length) {
-                for (forward = 0; forward < length; ++forward)
+            if ((*pos) + length > out->allocsize && !ucvector_reserve(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
+            if (distance == 1)
+            {
+                memset(out->data + *pos, out->data[backward], length);
+            }
+            else if (distance < length)
+            {
+                /*overlapping copy: the source repeats with period distance, so it goes in chunks that never overlap*/
+                unsigned char* dst = out->data + *pos;
+                const unsigned char* src = out->data + backward;
+                size_t remaining = length;
+                while (remaining > 0)
                 {
-                    out->data[(*pos)++] = out->data[backward++];
+                    size_t n = remaining < distance ? remaining : distance;
+                    memcpy(dst, src, n);
+                    dst += n;
+                    src += n;
+                    remaining -= n;
                 }
             }
-            else {
+            else
+            {
                 memcpy(out->data + *pos, out->data + backward, length);
-                *pos += length;
             }
+            *pos += length;
         }
         else if (code_ll == 256)
         {
             break; /*end code, break the loop*/
         }
-        else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+        else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbolTable returns (unsigned)(-1) in case of error*/
         {
-            /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
+            /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbolTable
             (10=no endcode, 11=wrong jump outside of tree)*/
             error = ((*bp) > inlength * 8) ? 10 : 11;
             break;
         }
     }
+    out->size = *pos;
 
     HuffmanTree_cleanup(&tree_ll);
     HuffmanTree_cleanup(&tree_d);
@@ -1204,20 +1420,6 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
     return error;
 }
 
-static unsigned inflate(unsigned char** out, size_t* outsize,
-    const unsigned char* in, size_t insize,
-    const LodePNGDecompressSettings* settings)
-{
-    if (settings->custom_inflate)
-    {
-        return settings->custom_inflate(out, outsize, in, insize, settings);
-    }
-    else
-    {
-        return lodepng_inflate(out, outsize, in, insize, settings);
-    }
-}
-
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -1562,7 +1764,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, unsigned final)
 {
     /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
     2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
@@ -1574,7 +1776,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
         unsigned BFINAL, BTYPE, LEN, NLEN;
         unsigned char firstbyte;
 
-        BFINAL = (i == numdeflateblocks - 1);
+        BFINAL = final && (i == numdeflateblocks - 1);
         BTYPE = 0;
 
         firstbyte = (unsigned char)(BFINAL + ((BTYPE & 1) << 1) + ((BTYPE & 2) << 1));
@@ -1926,16 +2128,22 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
     return error;
 }
 
-static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-    const LodePNGCompressSettings* settings)
+/*
+deflates in[start..end-1]; in[dictstart..start-1] only primes the LZ77 hash, so matches may reach back into it.
+If final is 0, the last block is not marked final and the output ends with an empty stored block (a sync flush),
+so the result is byte aligned and can be followed by the next piece of the same stream
+*/
+static unsigned lodepng_deflatev_piece(ucvector* out, const unsigned char* in, size_t dictstart,
+    size_t start, size_t end, const LodePNGCompressSettings* settings, unsigned final)
 {
     unsigned error = 0;
     size_t i, blocksize, numdeflateblocks;
+    size_t insize = end - start;
     size_t bp = 0; /*the bit pointer*/
     Hash hash;
 
     if (settings->btype > 2) return 61;
-    else if (settings->btype == 0) return deflateNoCompression(out, in, insize);
+    else if (settings->btype == 0) return deflateNoCompression(out, in + start, insize, final);
     else if (settings->btype == 1) blocksize = insize;
     else /*if(settings->btype == 2)*/
     {
@@ -1951,15 +2159,36 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     error = hash_init(&hash, settings->windowsize);
     if (error) return error;
 
+    if (settings->use_lz77 && dictstart < start)
+    {
+        /*only the hash chains are wanted, the symbols for the dictionary are thrown away*/
+        uivector dict_encoded;
+        uivector_init(&dict_encoded);
+        if (start - dictstart > settings->windowsize) dictstart = start - settings->windowsize;
+        error = encodeLZ77(&dict_encoded, &hash, in, dictstart, start, settings->windowsize,
+            settings->minmatch, settings->nicematch, settings->lazymatching);
+        uivector_cleanup(&dict_encoded);
+    }
+
     for (i = 0; i != numdeflateblocks && !error; ++i)
     {
-        unsigned final = (i == numdeflateblocks - 1);
-        size_t start = i * blocksize;
-        size_t end = start + blocksize;
-        if (end > insize) end = insize;
+        unsigned blockfinal = final && (i == numdeflateblocks - 1);
+        size_t blockstart = start + i * blocksize;
+        size_t blockend = blockstart + blocksize;
+        if (blockend > end) blockend = end;
+
+        if (settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, blockstart, blockend, settings, blockfinal);
+        else if (settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, blockstart, blockend, settings, blockfinal);
+    }
 
-        if (settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final);
-        else if (settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
+    if (!error && !final)
+    {
+        /*sync flush: BFINAL 0, BTYPE 00, pad to the byte boundary, LEN 0, NLEN 65535*/
+        addBitToStream(&bp, out, 0);
+        addBitToStream(&bp, out, 0);
+        addBitToStream(&bp, out, 0);
+        if (!ucvector_push_back(out, 0) || !ucvector_push_back(out, 0)
+            || !ucvector_push_back(out, 255) || !ucvector_push_back(out, 255)) error = 83; /*alloc fail*/
     }
 
     hash_cleanup(&hash);
@@ -1967,6 +2196,12 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     return error;
 }
 
+static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
+    const LodePNGCompressSettings* settings)
+{
+    return lodepng_deflatev_piece(out, in, 0, 0, insize, settings, 1);
+}
+
 unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
     const unsigned char* in, size_t insize,
     const LodePNGCompressSettings* settings)
@@ -1980,6 +2215,19 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
     return error;
 }
 
+unsigned lodepng_deflate_piece(unsigned char** out, size_t* outsize,
+    const unsigned char* in, size_t dictsize, size_t insize,
+    const LodePNGCompressSettings* settings, unsigned final)
+{
+    unsigned error;
+    ucvector v;
+    ucvector_init_buffer(&v, *out, *outsize);
+    error = lodepng_deflatev_piece(&v, in - dictsize, 0, dictsize, dictsize + insize, settings, final);
+    *out = v.data;
+    *outsize = v.size;
+    return error;
+}
+
 static unsigned deflate(unsigned char** out, size_t* outsize,
     const unsigned char* in, size_t insize,
     const LodePNGCompressSettings* settings)
@@ -2005,6 +2253,42 @@ static unsigned update_adler32(unsigned adler, const unsigned char* data, unsign
     unsigned s1 = adler & 0xffff;
     unsigned s2 = (adler >> 16) & 0xffff;
 
+#ifdef LODEPNG_SSE2
+    /*
+    16 bytes per step: s1 grows by their sum and s2 by 16 * s1 plus the sum weighted 16..1.
+    5552 bytes (347 steps) is the most that keeps s2 below 2^32 before the modulo, as in zlib
+    */
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i weights_hi = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+        const __m128i weights_lo = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+        while (len >= 16)
+        {
+            unsigned blocks = len / 16 > 347 ? 347 : len / 16;
+            __m128i vs1 = _mm_cvtsi32_si128((int)s1);
+            __m128i vs2 = _mm_cvtsi32_si128((int)s2);
+            __m128i vps = zero; /*sum of s1 before each step*/
+            unsigned lanes[4];
+            len -= blocks * 16;
+            while (blocks > 0)
+            {
+                __m128i bytes = _mm_loadu_si128((const __m128i*)data);
+                vps = _mm_add_epi32(vps, vs1);
+                vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes, zero));
+                vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weights_hi));
+                vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weights_lo));
+                data += 16;
+                --blocks;
+            }
+            vs2 = _mm_add_epi32(vs2, _mm_slli_epi32(vps, 4));
+            _mm_storeu_si128((__m128i*)lanes, vs1);
+            s1 = (lanes[0] + lanes[1] + lanes[2] + lanes[3]) % 65521;
+            _mm_storeu_si128((__m128i*)lanes, vs2);
+            s2 = (lanes[0] + lanes[1] + lanes[2] + lanes[3]) % 65521;
+        }
+    }
+#endif /*LODEPNG_SSE2*/
+
     while (len > 0)
     {
         /*at least 5550 sums can be done before the sums overflow, saving a lot of module divisions*/
@@ -2035,7 +2319,8 @@ static unsigned adler32(const unsigned char* data, unsigned len)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+/*like lodepng_zlib_decompress, but keeps the capacity already reserved in out*/
+static unsigned lodepng_zlib_decompressv(ucvector* out, const unsigned char* in,
     size_t insize, const LodePNGDecompressSettings* settings)
 {
     unsigned error = 0;
@@ -2067,19 +2352,32 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
         return 26;
     }
 
-    error = inflate(out, outsize, in + 2, insize - 2, settings);
+    if (settings->custom_inflate) error = settings->custom_inflate(&out->data, &out->size, in + 2, insize - 2, settings);
+    else error = lodepng_inflatev(out, in + 2, insize - 2, settings);
     if (error) return error;
 
     if (!settings->ignore_adler32)
     {
         unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
-        unsigned checksum = adler32(*out, (unsigned)(*outsize));
+        unsigned checksum = adler32(out->data, (unsigned)(out->size));
         if (checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
     }
 
     return 0; /*no error*/
 }
 
+unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+    size_t insize, const LodePNGDecompressSettings* settings)
+{
+    unsigned error;
+    ucvector v;
+    ucvector_init_buffer(&v, *out, *outsize);
+    error = lodepng_zlib_decompressv(&v, in, insize, settings);
+    *out = v.data;
+    *outsize = v.size;
+    return error;
+}
+
 static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
     size_t insize, const LodePNGDecompressSettings* settings)
 {
@@ -2093,6 +2391,19 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
     }
 }
 
+static unsigned zlib_decompressv(ucvector* out, const unsigned char* in,
+    size_t insize, const LodePNGDecompressSettings* settings)
+{
+    if (settings->custom_zlib)
+    {
+        return settings->custom_zlib(&out->data, &out->size, in, insize, settings);
+    }
+    else
+    {
+        return lodepng_zlib_decompressv(out, in, insize, settings);
+    }
+}
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -2163,6 +2474,12 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
     if (!settings->custom_zlib) return 87; /*no custom zlib function provided */
     return settings->custom_zlib(out, outsize, in, insize, settings);
 }
+
+static unsigned zlib_decompressv(ucvector* out, const unsigned char* in,
+    size_t insize, const LodePNGDecompressSettings* settings)
+{
+    return zlib_decompress(&out->data, &out->size, in, insize, settings);
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 #ifdef LODEPNG_COMPILE_ENCODER
 static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
@@ -2267,12 +2584,45 @@ static unsigned lodepng_crc32_table[256] = {
   3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
 };
 
+/*
+Slicing-by-8 tables: table k gives the CRC of a byte followed by k zero bytes, so 8 input bytes fold
+into the register with 8 independent lookups. Built once from lodepng_crc32_table; the function local
+static makes the first use safe from the decoder worker threads.
+Note: the SSE4.2 crc32 instruction uses the Castagnoli polynomial (CRC32C), not the one PNG needs.
+*/
+struct LodePNGCRC32Slices
+{
+    unsigned table[8][256];
+
+    LodePNGCRC32Slices()
+    {
+        unsigned i, k;
+        for (i = 0; i != 256; ++i) table[0][i] = lodepng_crc32_table[i];
+        for (k = 1; k != 8; ++k)
+        {
+            for (i = 0; i != 256; ++i)
+            {
+                table[k][i] = (table[k - 1][i] >> 8) ^ lodepng_crc32_table[table[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
 /*Return the CRC of the bytes buf[0..len-1].*/
 unsigned lodepng_crc32(const unsigned char* data, size_t length)
 {
+    static const LodePNGCRC32Slices slices;
+    const unsigned (*t)[256] = slices.table;
     unsigned r = 0xffffffffu;
-    size_t i;
-    for (i = 0; i < length; ++i)
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        unsigned lo = r ^ (data[i] | ((unsigned)data[i + 1] << 8) | ((unsigned)data[i + 2] << 16) | ((unsigned)data[i + 3] << 24));
+        unsigned hi = data[i + 4] | ((unsigned)data[i + 5] << 8) | ((unsigned)data[i + 6] << 16) | ((unsigned)data[i + 7] << 24);
+        r = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+          ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    for (; i < length; ++i)
     {
         r = lodepng_crc32_table[(r ^ data[i]) & 0xff] ^ (r >> 8);
     }
@@ -3872,6 +4222,100 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
     return state->error;
 }
 
+#ifdef LODEPNG_SSE2
+/*3 or 4 byte pixels move through the low bytes of an SSE register; the loads never touch the byte after the pixel*/
+static __m128i loadPixel(const unsigned char* p, size_t bytewidth)
+{
+    int v = 0;
+    memcpy(&v, p, bytewidth);
+    return _mm_cvtsi32_si128(v);
+}
+
+static void storePixel(unsigned char* p, __m128i v, size_t bytewidth)
+{
+    int x = _mm_cvtsi128_si32(v);
+    memcpy(p, &x, bytewidth);
+}
+
+/*
+Sub, Average and Paeth for 3 and 4 byte pixels, and Up for any pixel size. These carry a dependency from
+pixel to pixel, so the gain comes from handling all channels of a pixel at once. Same results as the scalar
+code below, byte for byte. Returns 0 if the filter/pixel size combination is left to the scalar code.
+*/
+static unsigned unfilterScanlineSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+    size_t bytewidth, unsigned char filterType, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i;
+
+    if (filterType == 2 && precon)
+    {
+        for (i = 0; i + 16 <= length; i += 16)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+            _mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+        }
+        for (; i != length; ++i) recon[i] = scanline[i] + precon[i];
+        return 1;
+    }
+    if (bytewidth != 3 && bytewidth != 4) return 0;
+    if (length % bytewidth != 0) return 0;
+
+    if (filterType == 1)
+    {
+        __m128i a = zero;
+        for (i = 0; i != length; i += bytewidth)
+        {
+            a = _mm_add_epi8(loadPixel(scanline + i, bytewidth), a);
+            storePixel(recon + i, a, bytewidth);
+        }
+        return 1;
+    }
+    if (filterType == 3 && precon)
+    {
+        const __m128i one = _mm_set1_epi8(1);
+        __m128i a = zero;
+        for (i = 0; i != length; i += bytewidth)
+        {
+            __m128i b = loadPixel(precon + i, bytewidth);
+            /*_mm_avg_epu8 rounds up, PNG rounds down*/
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_add_epi8(loadPixel(scanline + i, bytewidth), avg);
+            storePixel(recon + i, a, bytewidth);
+        }
+        return 1;
+    }
+    if (filterType == 4 && precon)
+    {
+        /*channels widened to 16 bits, so p = a + b - c and the distances don't wrap*/
+        __m128i a = zero, c = zero;
+        for (i = 0; i != length; i += bytewidth)
+        {
+            __m128i b = _mm_unpacklo_epi8(loadPixel(precon + i, bytewidth), zero);
+            __m128i pa = _mm_sub_epi16(b, c);
+            __m128i pb = _mm_sub_epi16(a, c);
+            __m128i pc = _mm_add_epi16(pa, pb);
+            __m128i useC, useB, pred;
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            /*same tie breaking as paethPredictor: c if strictly closest, else b if closer than a, else a*/
+            useC = _mm_and_si128(_mm_cmplt_epi16(pc, pa), _mm_cmplt_epi16(pc, pb));
+            useB = _mm_andnot_si128(useC, _mm_cmplt_epi16(pb, pa));
+            pred = _mm_or_si128(_mm_and_si128(useC, c),
+                _mm_or_si128(_mm_and_si128(useB, b), _mm_andnot_si128(_mm_or_si128(useC, useB), a)));
+            a = _mm_add_epi8(loadPixel(scanline + i, bytewidth), _mm_packus_epi16(pred, zero));
+            storePixel(recon + i, a, bytewidth);
+            a = _mm_unpacklo_epi8(a, zero);
+            c = b;
+        }
+        return 1;
+    }
+    return 0;
+}
+#endif /*LODEPNG_SSE2*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
     size_t bytewidth, unsigned char filterType, size_t length)
 {
@@ -3885,6 +4329,9 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
     */
 
     size_t i;
+#ifdef LODEPNG_SSE2
+    if (unfilterScanlineSSE2(recon, scanline, precon, bytewidth, filterType, length)) return 0;
+#endif /*LODEPNG_SSE2*/
     switch (filterType)
     {
     case 0:
@@ -4606,8 +5053,7 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     if (!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
     if (!state->error)
     {
-        state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-            idat.size, &state->decoder.zlibsettings);
+        state->error = zlib_decompressv(&scanlines, idat.data, idat.size, &state->decoder.zlibsettings);
         if (!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
     }
     ucvector_cleanup(&idat);
@@ -754,6 +754,16 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
     const unsigned char* in, size_t insize,
     const LodePNGCompressSettings* settings);
 
+/*
+Compress one piece of a larger deflate stream, so pieces can be compressed in parallel and concatenated.
+The dictsize bytes before in (in[-dictsize..-1]) are the end of the previous piece: they are not output, but
+matches may refer to them. Unless final is 1, the piece ends with an empty stored block (a sync flush) instead
+of a final block, which leaves it byte aligned. Out buffer must be freed after use.
+*/
+unsigned lodepng_deflate_piece(unsigned char** out, size_t* outsize,
+    const unsigned char* in, size_t dictsize, size_t insize,
+    const LodePNGCompressSettings* settings, unsigned final);
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_ZLIB*/
 